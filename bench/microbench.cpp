@@ -0,0 +1,879 @@
+//热点路径的微基准：请求解析、响应构建、路由查找、线程池和任务队列、locker.h中的同步原语、向量化扫描
+//http_conn通过socketpair驱动，不经过真实网络；解析和构建响应的私有函数通过测试钩子http_conn_test_hook直接调用
+//每个结果输出一行JSON，便于脚本比较不同提交的数字，其他输出(线程池创建线程的提示等)被丢弃
+//编译：g++ -std=c++20 -O2 -o microbench bench/microbench.cpp http_conn.cpp reactor.cpp uring_reactor.cpp coro_reactor.cpp filecache.cpp gzipcache.cpp timerwheel.cpp simdscan.cpp bufpool.cpp response.cpp log.cpp stats.cpp router.cpp proxy.cpp respcache.cpp docindex.cpp -lpthread -lz
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+#include<fcntl.h>
+#include<time.h>
+#include<sched.h>
+#include<getopt.h>
+#include<pthread.h>
+#include<sys/socket.h>
+#include<sys/epoll.h>
+#include<sys/stat.h>
+#include<atomic>
+#include<list>
+#include<string>
+#include<vector>
+#include"../http_conn.h"
+#include"../threadpool.h"
+#include"../ringqueue.h"
+#include"../locker.h"
+#include"../simdscan.h"
+#include"../router.h"
+#include"../respcache.h"
+
+//网站根目录，定义在http_conn.cpp中
+extern const char* doc_root;
+
+static FILE* g_out = NULL;          //结果输出，标准输出的副本
+static const char* g_filter = NULL; //只运行名字中包含该字符串的基准
+static double g_scale = 1.0;        //迭代次数的倍数
+
+static uint64_t now_ns(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static long iterations(long base){
+    long n = (long)(base * g_scale);
+    return n > 0 ? n : 1;
+}
+
+static bool selected(const char* bench){
+    return !g_filter || strstr(bench,g_filter);
+}
+
+//一行结果：ns是ops次操作的总耗时，bytes不为0时再给出吞吐
+static void report(const char* bench,const char* name,int threads,long ops,uint64_t ns,double bytes = 0){
+    fprintf(g_out,"{\"bench\":\"%s\",\"case\":\"%s\",\"threads\":%d,\"ops\":%ld,\"ns\":%lu,\"ns_per_op\":%.2f,\"mops\":%.3f",
+            bench,name,threads,ops,(unsigned long)ns,(double)ns / ops,ops * 1e3 / (ns ? ns : 1));
+    if(bytes > 0){
+        fprintf(g_out,",\"mb_per_s\":%.1f",bytes * 1e9 / (ns ? ns : 1) / (1 << 20));
+    }
+    fprintf(g_out,"}\n");
+    fflush(g_out);
+}
+
+//测试钩子：http_conn的友元，直接调用解析和构建响应的私有函数
+class http_conn_test_hook{
+public:
+    //把一个请求放进连接的读缓冲区，效果和read从socket读入相同
+    static void load(http_conn& c,const char* req,long len){
+        c.free_read_buf();
+        c.init_request();
+        c.append_read_buf(req,len);
+    }
+    //只用从状态机把请求头切成行，返回行数
+    static int split_lines(http_conn& c){
+        int lines = 0;
+        while(c.parse_line() == http_conn::LINE_OK){
+            c.m_start_line = c.m_checked_idx;
+            ++lines;
+        }
+        return lines;
+    }
+    static http_conn::HTTP_CODE process_read(http_conn& c){
+        return c.process_read();
+    }
+    static bool process_write(http_conn& c,http_conn::HTTP_CODE ret){
+        return c.process_write(ret);
+    }
+    static void reset_write(http_conn& c){
+        c.reset_write();
+    }
+    //200响应的状态行和首部
+    static bool build_headers(http_conn& c,long content_length){
+        c.m_write_idx = 0;
+        c.m_linger = true;
+        return c.add_status_line(200) && c.add_headers(content_length);
+    }
+    //整个错误响应
+    static bool build_error(http_conn& c,int status){
+        c.m_write_idx = 0;
+        return c.add_error(status);
+    }
+};
+typedef http_conn_test_hook hook;
+
+//请求语料
+struct request_case{
+    const char* name;
+    std::string text;
+};
+
+static std::vector<request_case> request_corpus(){
+    std::vector<request_case> corpus;
+    request_case minimal = {"minimal","GET /index.html HTTP/1.1\r\nHost: bench\r\nConnection: keep-alive\r\n\r\n"};
+    corpus.push_back(minimal);
+    request_case browser = {"browser",
+        "GET /index.html HTTP/1.1\r\n"
+        "Host: 127.0.0.1:9006\r\n"
+        "Connection: keep-alive\r\n"
+        "Cache-Control: max-age=0\r\n"
+        "sec-ch-ua: \"Chromium\";v=\"118\", \"Google Chrome\";v=\"118\", \"Not=A?Brand\";v=\"99\"\r\n"
+        "sec-ch-ua-mobile: ?0\r\n"
+        "sec-ch-ua-platform: \"Linux\"\r\n"
+        "Upgrade-Insecure-Requests: 1\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/118.0.0.0 Safari/537.36\r\n"
+        "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,image/apng,*/*;q=0.8\r\n"
+        "Sec-Fetch-Site: none\r\n"
+        "Sec-Fetch-Mode: navigate\r\n"
+        "Sec-Fetch-User: ?1\r\n"
+        "Sec-Fetch-Dest: document\r\n"
+        "Accept-Encoding: gzip, deflate, br\r\n"
+        "Accept-Language: en-US,en;q=0.9\r\n"
+        "\r\n"};
+    corpus.push_back(browser);
+    //带一个2KB的Cookie首部
+    request_case cookie = {"cookie","GET /index.html HTTP/1.1\r\nHost: bench\r\nConnection: keep-alive\r\nCookie: "};
+    for(int i = 0;i < 64;++i){
+        char kv[40];
+        snprintf(kv,sizeof(kv),"session_%02d=%020d; ",i,i * 7919);
+        cookie.text += kv;
+    }
+    cookie.text += "\r\n\r\n";
+    corpus.push_back(cookie);
+    request_case missing = {"404","GET /missing.html HTTP/1.1\r\nHost: bench\r\nConnection: keep-alive\r\n\r\n"};
+    corpus.push_back(missing);
+    //爬虫和命令行工具的请求：首部少、行短，每个字节上的扫描开销和浏览器请求不同
+    request_case googlebot = {"googlebot",
+        "GET /index.html HTTP/1.1\r\n"
+        "Host: bench.example.com\r\n"
+        "Connection: keep-alive\r\n"
+        "Accept: text/html,application/xhtml+xml,application/signed-exchange;v=b3,application/xml;q=0.9,*/*;q=0.8\r\n"
+        "From: googlebot(at)googlebot.com\r\n"
+        "User-Agent: Mozilla/5.0 (compatible; Googlebot/2.1; +http://www.google.com/bot.html)\r\n"
+        "Accept-Encoding: gzip, deflate, br\r\n"
+        "If-Modified-Since: Tue, 10 Oct 2023 08:12:31 GMT\r\n"
+        "\r\n"};
+    corpus.push_back(googlebot);
+    request_case bingbot = {"bingbot",
+        "GET /index.html HTTP/1.1\r\n"
+        "Cache-Control: no-cache\r\n"
+        "Connection: keep-alive\r\n"
+        "Pragma: no-cache\r\n"
+        "Accept: */*\r\n"
+        "Accept-Encoding: gzip, deflate\r\n"
+        "From: bingbot(at)microsoft.com\r\n"
+        "Host: bench.example.com\r\n"
+        "User-Agent: Mozilla/5.0 (compatible; bingbot/2.0; +http://www.bing.com/bingbot.htm)\r\n"
+        "\r\n"};
+    corpus.push_back(bingbot);
+    request_case curl = {"curl","GET /index.html HTTP/1.1\r\nHost: 127.0.0.1:9006\r\nUser-Agent: curl/8.4.0\r\nAccept: */*\r\n\r\n"};
+    corpus.push_back(curl);
+    //负载均衡/容器编排的健康检查，每个探测一个短连接
+    request_case probe = {"probe","GET /__health HTTP/1.1\r\nHost: 10.0.0.5:9006\r\nUser-Agent: kube-probe/1.28\r\nAccept: */*\r\nConnection: close\r\n\r\n"};
+    corpus.push_back(probe);
+    //路由处理函数生成的主体，不经过文件
+    request_case route = {"route","GET /__health HTTP/1.1\r\nHost: bench\r\nConnection: keep-alive\r\n\r\n"};
+    corpus.push_back(route);
+    return corpus;
+}
+
+//连接的运行环境：socketpair的一端交给http_conn，另一端是客户端
+struct conn_env{
+    int sv[2];
+    int epollfd;
+    timerwheel timers;
+    http_conn conn;
+};
+
+static void env_init(conn_env* env){
+    if(socketpair(AF_UNIX,SOCK_STREAM,0,env -> sv) < 0){
+        perror("socketpair");
+        exit(1);
+    }
+    //和accept4得到的连接一样，交给http_conn的一端是非阻塞的
+    fcntl(env -> sv[0],F_SETFL,fcntl(env -> sv[0],F_GETFL) | O_NONBLOCK);
+    env -> epollfd = epoll_create1(0);
+    sockaddr_in addr;
+    memset(&addr,0,sizeof(addr));
+    addr.sin_family = AF_INET;
+    env -> conn.init(env -> sv[0],addr,env -> epollfd,&env -> timers);
+}
+
+static void env_destroy(conn_env* env){
+    env -> conn.close_conn();
+    close(env -> sv[1]);
+    close(env -> epollfd);
+}
+
+static void bench_clock(){
+    if(!selected("clock")){
+        return;
+    }
+    long n = iterations(2000000);
+    uint64_t sink = 0;
+    uint64_t start = now_ns();
+    for(long i = 0;i < n;++i){
+        sink += now_ns();
+    }
+    report("clock","monotonic",1,n,now_ns() - start);
+    if(sink == 1){
+        fprintf(g_out,"\n");
+    }
+}
+
+//parse_line：只切行；process_read：切行、解析请求行和首部、do_request(查文件缓存)
+//每次迭代都要把请求重新拷贝进读缓冲区(解析会改写'\r\n')，拷贝的耗时单独作为load给出
+static void bench_parser(conn_env* env){
+    std::vector<request_case> corpus = request_corpus();
+    http_conn& c = env -> conn;
+    for(size_t i = 0;i < corpus.size();++i){
+        const char* req = corpus[i].text.data();
+        long len = corpus[i].text.size();
+        long n = iterations(200000);
+        if(selected("load")){
+            uint64_t start = now_ns();
+            for(long k = 0;k < n;++k){
+                hook::load(c,req,len);
+            }
+            report("load",corpus[i].name,1,n,now_ns() - start,(double)len * n);
+        }
+        if(selected("parse_line")){
+            int lines = 0;
+            uint64_t start = now_ns();
+            for(long k = 0;k < n;++k){
+                hook::load(c,req,len);
+                lines += hook::split_lines(c);
+            }
+            report("parse_line",corpus[i].name,1,n,now_ns() - start,(double)len * n);
+            if(lines == 0){
+                fprintf(stderr,"parse_line found no lines in %s\n",corpus[i].name);
+            }
+        }
+        //process_read逐次计时，之后不计时地构建并丢弃响应，释放do_request持有的文件
+        if(selected("process_read")){
+            uint64_t total = 0;
+            for(long k = 0;k < n;++k){
+                hook::load(c,req,len);
+                uint64_t start = now_ns();
+                http_conn::HTTP_CODE ret = hook::process_read(c);
+                total += now_ns() - start;
+                hook::process_write(c,ret);
+                hook::reset_write(c);
+            }
+            report("process_read",corpus[i].name,1,n,total,(double)len * n);
+        }
+        if(selected("process_write")){
+            uint64_t total = 0;
+            for(long k = 0;k < n;++k){
+                hook::load(c,req,len);
+                http_conn::HTTP_CODE ret = hook::process_read(c);
+                uint64_t start = now_ns();
+                hook::process_write(c,ret);
+                total += now_ns() - start;
+                hook::reset_write(c);
+            }
+            report("process_write",corpus[i].name,1,n,total);
+        }
+    }
+    if(selected("add_headers")){
+        long n = iterations(2000000);
+        uint64_t start = now_ns();
+        for(long k = 0;k < n;++k){
+            hook::build_headers(c,k);
+        }
+        report("add_headers","200",1,n,now_ns() - start);
+    }
+    if(selected("add_error")){
+        long n = iterations(2000000);
+        uint64_t start = now_ns();
+        for(long k = 0;k < n;++k){
+            hook::build_error(c,404);
+        }
+        report("add_error","404",1,n,now_ns() - start);
+    }
+    hook::reset_write(c);
+}
+
+static bool route_ok(const route_request&,route_reply& reply,void*){
+    return reply.append("ok\n",3);
+}
+
+//注册一张64条路由的表：健康检查、统计、60个/api/v1/下的精确路由和一个前缀路由，路径有较长的公共前缀
+static void route_table(){
+    router* r = router::instance();
+    r -> add(http_conn::GET,"/__health",route_ok,NULL);
+    r -> add(http_conn::GET,"/__stats",route_ok,NULL);
+    r -> add(http_conn::GET,"/__stats.json",route_ok,NULL);
+    for(int i = 0;i < 60;++i){
+        char path[64];
+        snprintf(path,sizeof(path),"/api/v1/items/%d",i);
+        r -> add(i % 4 == 3 ? http_conn::POST : http_conn::GET,path,route_ok,NULL);
+    }
+    r -> add(http_conn::GET,"/api/v2/*",route_ok,NULL);
+}
+
+//路由查找和原来直接映射到文件的代价对比：每个文件请求现在都先查一次路由表(miss)，
+//再stat(文件缓存关闭时)或者查文件缓存
+static void bench_route(){
+    if(!selected("route")){
+        return;
+    }
+    router* r = router::instance();
+    struct lookup_case{
+        const char* name;
+        const char* url;
+    };
+    static const lookup_case cases[] = {
+        {"hit_short","/__health"},
+        {"hit_deep","/api/v1/items/42"},
+        {"hit_query","/__stats?format=json"},
+        {"hit_prefix","/api/v2/users/17/orders"},
+        {"miss_file","/index.html"},
+        {"miss_deep","/api/v1/items/999"},
+    };
+    long n = iterations(5000000);
+    for(size_t i = 0;i < sizeof(cases) / sizeof(cases[0]);++i){
+        long found = 0;
+        uint64_t start = now_ns();
+        for(long k = 0;k < n;++k){
+            found += r -> find(http_conn::GET,cases[i].url) != NULL;
+        }
+        report("route",cases[i].name,1,n,now_ns() - start);
+        if(found != 0 && found != n){
+            fprintf(stderr,"route %s matched only sometimes\n",cases[i].name);
+        }
+    }
+    std::string path = std::string(doc_root) + "/index.html";
+    n = iterations(1000000);
+    struct stat st;
+    uint64_t start = now_ns();
+    for(long k = 0;k < n;++k){
+        stat(path.c_str(),&st);
+    }
+    report("route","stat",1,n,now_ns() - start);
+    start = now_ns();
+    for(long k = 0;k < n;++k){
+        filecache::entry* e = filecache::instance() -> acquire(path.c_str());
+        if(e){
+            filecache::instance() -> release(e);
+        }
+    }
+    report("route","filecache",1,n,now_ns() - start);
+}
+
+//完整的一轮：客户端写请求，read从socketpair读入，process解析并构建响应，write发出，客户端读完响应
+static void bench_roundtrip(const char* name,int pipeline){
+    if(!selected("roundtrip")){
+        return;
+    }
+    conn_env* env = new conn_env;
+    env_init(env);
+    std::string req;
+    for(int i = 0;i < pipeline;++i){
+        req += "GET /index.html HTTP/1.1\r\nHost: bench\r\nConnection: keep-alive\r\n\r\n";
+    }
+    static char buf[256 * 1024];
+    long expected = -1;   //一轮响应的总字节数，第一轮时得到
+    long n = iterations(50000 / pipeline);
+    uint64_t start = now_ns();
+    for(long k = 0;k < n;++k){
+        if(send(env -> sv[1],req.data(),req.size(),0) != (ssize_t)req.size()){
+            perror("send");
+            exit(1);
+        }
+        env -> conn.read();
+        env -> conn.mark_busy();
+        env -> conn.process();
+        env -> conn.write();
+        long got = 0;
+        while(expected < 0 || got < expected){
+            ssize_t r = recv(env -> sv[1],buf,sizeof(buf),expected < 0 ? MSG_DONTWAIT : 0);
+            if(r <= 0){
+                break;
+            }
+            got += r;
+        }
+        if(expected < 0){
+            expected = got;
+        }
+    }
+    report("roundtrip",name,1,n * pipeline,now_ns() - start,(double)expected * n);
+    env_destroy(env);
+    delete env;
+}
+
+//线程池的任务：什么也不做，只计数
+struct noop_task{
+    std::atomic<long> done;
+    //固定线程数的线程池不调整线程数，排队时间用不到
+    uint64_t enqueue_ns() const{
+        return 0;
+    }
+    void process(){
+        done.fetch_add(1,std::memory_order_relaxed);
+    }
+};
+
+//对照组：原来的线程池实现，std::list请求队列加互斥锁，信号量通知工作线程
+template<typename T>
+class list_pool{
+public:
+    list_pool(int thread_number,int max_requests):m_thread_number(thread_number),m_max_requests(max_requests),m_stop(false){
+        m_threads = new pthread_t[thread_number];
+        for(int i = 0;i < thread_number;++i){
+            if(pthread_create(&m_threads[i],NULL,worker,this) != 0){
+                throw std::exception();
+            }
+        }
+    }
+    ~list_pool(){
+        m_stop = true;
+        for(int i = 0;i < m_thread_number;++i){
+            m_queuestat.post();
+        }
+        for(int i = 0;i < m_thread_number;++i){
+            pthread_join(m_threads[i],NULL);
+        }
+        delete [] m_threads;
+    }
+    //第二个参数只是为了和threadpool::append的参数一致
+    bool append(T* request,int = -1){
+        m_queuelocker.lock();
+        if((int)m_workqueue.size() >= m_max_requests){
+            m_queuelocker.unlock();
+            return false;
+        }
+        m_workqueue.push_back(request);
+        m_queuelocker.unlock();
+        m_queuestat.post();
+        return true;
+    }
+private:
+    static void* worker(void* arg){
+        list_pool* pool = (list_pool*)arg;
+        while(true){
+            pool -> m_queuestat.wait();
+            if(pool -> m_stop){
+                break;
+            }
+            pool -> m_queuelocker.lock();
+            if(pool -> m_workqueue.empty()){
+                pool -> m_queuelocker.unlock();
+                continue;
+            }
+            T* request = pool -> m_workqueue.front();
+            pool -> m_workqueue.pop_front();
+            pool -> m_queuelocker.unlock();
+            request -> process();
+        }
+        return NULL;
+    }
+private:
+    int m_thread_number;
+    int m_max_requests;
+    pthread_t* m_threads;
+    std::list<T*> m_workqueue;
+    locker m_queuelocker;
+    sem m_queuestat;
+    std::atomic<bool> m_stop;
+};
+
+//一个生产者(主线程，相当于反应堆)连续append，直到所有任务都被工作线程执行完
+template<typename POOL>
+static uint64_t drain_pool(POOL* pool,noop_task* task,long n,bool keyed){
+    task -> done.store(0);
+    uint64_t start = now_ns();
+    for(long i = 0;i < n;++i){
+        while(!pool -> append(task,keyed ? (int)i : -1)){
+            sched_yield();
+        }
+    }
+    while(task -> done.load(std::memory_order_relaxed) < n){
+        sched_yield();
+    }
+    return now_ns() - start;
+}
+
+static const int THREAD_COUNTS[] = {1,2,4,8,16,32};
+static const int THREAD_COUNT_NUM = sizeof(THREAD_COUNTS) / sizeof(THREAD_COUNTS[0]);
+
+static void bench_threadpool(){
+    if(!selected("threadpool")){
+        return;
+    }
+    noop_task task;
+    for(int t = 0;t < THREAD_COUNT_NUM;++t){
+        int threads = THREAD_COUNTS[t];
+        long n = iterations(200000);
+        {
+            list_pool<noop_task> pool(threads,10000);
+            report("threadpool","list_mutex",threads,n,drain_pool(&pool,&task,n,false));
+        }
+        {
+            threadpool<noop_task> fifo(threads,10000,threadpool<noop_task>::FIFO);
+            report("threadpool","fifo",threads,n,drain_pool(&fifo,&task,n,false));
+        }
+        {
+            threadpool<noop_task> steal(threads,10000,threadpool<noop_task>::WORK_STEALING);
+            report("threadpool","steal",threads,n,drain_pool(&steal,&task,n,true));
+        }
+    }
+}
+
+//任务队列本身：一半线程入队一半线程出队(1个线程时同一个线程交替入队出队)
+struct list_queue{
+    std::list<long*> items;
+    locker lock;
+    bool push(long* v){
+        lock.lock();
+        items.push_back(v);
+        lock.unlock();
+        return true;
+    }
+    bool pop(long*& v){
+        lock.lock();
+        if(items.empty()){
+            lock.unlock();
+            return false;
+        }
+        v = items.front();
+        items.pop_front();
+        lock.unlock();
+        return true;
+    }
+};
+
+struct ring_queue{
+    ringqueue<long*> items;
+    ring_queue():items(4096){}
+    bool push(long* v){return items.push(v);}
+    bool pop(long*& v){return items.pop(v);}
+};
+
+template<typename Q>
+struct queue_run{
+    Q* queue;
+    long per_producer;
+    long total;
+    std::atomic<long> popped;
+    std::atomic<int> ready;
+    std::atomic<bool> go;
+};
+
+template<typename Q>
+static void* queue_producer(void* arg){
+    queue_run<Q>* run = (queue_run<Q>*)arg;
+    long value = 0;
+    run -> ready.fetch_add(1);
+    while(!run -> go.load()){
+        sched_yield();
+    }
+    for(long i = 0;i < run -> per_producer;++i){
+        while(!run -> queue -> push(&value)){
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+template<typename Q>
+static void* queue_consumer(void* arg){
+    queue_run<Q>* run = (queue_run<Q>*)arg;
+    long* v;
+    run -> ready.fetch_add(1);
+    while(!run -> go.load()){
+        sched_yield();
+    }
+    while(run -> popped.load(std::memory_order_relaxed) < run -> total){
+        if(run -> queue -> pop(v)){
+            run -> popped.fetch_add(1,std::memory_order_relaxed);
+        }
+        else{
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+template<typename Q>
+static void bench_queue_one(const char* name,int threads){
+    Q* queue = new Q;
+    long n = iterations(1000000);
+    if(threads == 1){
+        long value = 0;
+        long* v;
+        uint64_t start = now_ns();
+        for(long i = 0;i < n;++i){
+            queue -> push(&value);
+            queue -> pop(v);
+        }
+        report("queue",name,1,n,now_ns() - start);
+        delete queue;
+        return;
+    }
+    int producers = threads / 2;
+    queue_run<Q> run;
+    run.queue = queue;
+    run.per_producer = n / producers;
+    run.total = run.per_producer * producers;
+    run.popped = 0;
+    run.ready = 0;
+    run.go = false;
+    std::vector<pthread_t> tids(threads);
+    for(int i = 0;i < threads;++i){
+        pthread_create(&tids[i],NULL,i < producers ? queue_producer<Q> : queue_consumer<Q>,&run);
+    }
+    while(run.ready.load() < threads){
+        sched_yield();
+    }
+    uint64_t start = now_ns();
+    run.go = true;
+    for(int i = 0;i < threads;++i){
+        pthread_join(tids[i],NULL);
+    }
+    report("queue",name,threads,run.total,now_ns() - start);
+    delete queue;
+}
+
+static void bench_queue(){
+    if(!selected("queue")){
+        return;
+    }
+    for(int t = 0;t < THREAD_COUNT_NUM;++t){
+        bench_queue_one<list_queue>("list_mutex",THREAD_COUNTS[t]);
+        bench_queue_one<ring_queue>("ringqueue",THREAD_COUNTS[t]);
+    }
+}
+
+//locker.h中的原语
+struct contend_arg{
+    locker* lock;
+    long n;
+    long* counter;
+};
+
+static void* contend_worker(void* arg){
+    contend_arg* a = (contend_arg*)arg;
+    for(long i = 0;i < a -> n;++i){
+        a -> lock -> lock();
+        ++*a -> counter;
+        a -> lock -> unlock();
+    }
+    return NULL;
+}
+
+//两个线程轮流唤醒对方，测一次交接的往返时间
+struct pingpong{
+    sem ping;
+    sem pong;
+    locker lock;
+    cond to_b;
+    cond to_a;
+    int turn;
+    long n;
+};
+
+static void* sem_pong(void* arg){
+    pingpong* p = (pingpong*)arg;
+    for(long i = 0;i < p -> n;++i){
+        p -> ping.wait();
+        p -> pong.post();
+    }
+    return NULL;
+}
+
+static void* cond_pong(void* arg){
+    pingpong* p = (pingpong*)arg;
+    for(long i = 0;i < p -> n;++i){
+        p -> lock.lock();
+        while(p -> turn != 1){
+            p -> to_b.wait(p -> lock.get());
+        }
+        p -> turn = 0;
+        p -> to_a.signal();
+        p -> lock.unlock();
+    }
+    return NULL;
+}
+
+static void bench_locker(){
+    long n = iterations(2000000);
+    if(selected("locker")){
+        locker lock;
+        uint64_t start = now_ns();
+        for(long i = 0;i < n;++i){
+            lock.lock();
+            lock.unlock();
+        }
+        report("locker","uncontended",1,n,now_ns() - start);
+        for(int threads = 2;threads <= 8;threads *= 2){
+            long counter = 0;
+            std::vector<pthread_t> tids(threads);
+            std::vector<contend_arg> args(threads);
+            start = now_ns();
+            for(int i = 0;i < threads;++i){
+                args[i].lock = &lock;
+                args[i].n = n / threads;
+                args[i].counter = &counter;
+                pthread_create(&tids[i],NULL,contend_worker,&args[i]);
+            }
+            for(int i = 0;i < threads;++i){
+                pthread_join(tids[i],NULL);
+            }
+            report("locker","contended",threads,counter,now_ns() - start);
+        }
+    }
+    if(selected("sem")){
+        sem s;
+        uint64_t start = now_ns();
+        for(long i = 0;i < n;++i){
+            s.post();
+            s.wait();
+        }
+        report("sem","post_wait",1,n,now_ns() - start);
+        pingpong* p = new pingpong;
+        p -> n = iterations(100000);
+        pthread_t tid;
+        pthread_create(&tid,NULL,sem_pong,p);
+        start = now_ns();
+        for(long i = 0;i < p -> n;++i){
+            p -> ping.post();
+            p -> pong.wait();
+        }
+        report("sem","pingpong",2,p -> n,now_ns() - start);
+        pthread_join(tid,NULL);
+        delete p;
+    }
+    if(selected("cond")){
+        cond c;
+        uint64_t start = now_ns();
+        for(long i = 0;i < n;++i){
+            c.signal();
+        }
+        report("cond","signal_no_waiter",1,n,now_ns() - start);
+        pingpong* p = new pingpong;
+        p -> n = iterations(100000);
+        p -> turn = 0;
+        pthread_t tid;
+        pthread_create(&tid,NULL,cond_pong,p);
+        start = now_ns();
+        for(long i = 0;i < p -> n;++i){
+            p -> lock.lock();
+            p -> turn = 1;
+            p -> to_b.signal();
+            while(p -> turn != 0){
+                p -> to_a.wait(p -> lock.get());
+            }
+            p -> lock.unlock();
+        }
+        report("cond","pingpong",2,p -> n,now_ns() - start);
+        pthread_join(tid,NULL);
+        delete p;
+    }
+    if(selected("eventcount")){
+        eventcount ec;
+        uint64_t start = now_ns();
+        for(long i = 0;i < n;++i){
+            ec.notify_one();
+        }
+        report("eventcount","notify_no_waiter",1,n,now_ns() - start);
+    }
+}
+
+//scan_any2的三种实现在请求头语料上找'\r'/'\n'
+static void bench_scan(){
+    if(!selected("scan")){
+        return;
+    }
+    std::string corpus;
+    std::vector<request_case> requests = request_corpus();
+    while(corpus.size() < 64 * 1024){
+        for(size_t i = 0;i < requests.size();++i){
+            corpus += requests[i].text;
+        }
+    }
+    const char* begin = corpus.data();
+    const char* end = begin + corpus.size();
+    const char* impls[] = {"scalar","sse4.2","avx2"};
+    for(int i = 0;i < 3;++i){
+        scan_init(impls[i]);
+        if(strcmp(scan_impl_name(),impls[i]) != 0){
+            continue;   //CPU不支持
+        }
+        long rounds = iterations(2000);
+        long hits = 0;
+        uint64_t start = now_ns();
+        for(long r = 0;r < rounds;++r){
+            for(const char* p = begin;p < end;++p){
+                p = scan_any2(p,end,'\r','\n');
+                ++hits;
+            }
+        }
+        report("scan",impls[i],1,hits,now_ns() - start,(double)corpus.size() * rounds);
+    }
+    scan_init();
+}
+
+static void usage(const char* prog){
+    printf("usage: %s [-f filter] [-n scale]\n",prog);
+}
+
+int main(int argc,char* argv[]){
+    int opt;
+    while((opt = getopt(argc,argv,"f:n:")) != -1){
+        switch(opt){
+            case 'f': g_filter = optarg; break;
+            case 'n': g_scale = atof(optarg); break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    //结果写到标准输出的副本，标准输出本身重定向到/dev/null，丢掉线程池等打印的提示
+    g_out = fdopen(dup(STDOUT_FILENO),"w");
+    int devnull = open("/dev/null",O_WRONLY);
+    dup2(devnull,STDOUT_FILENO);
+    close(devnull);
+
+    //生成临时的网站根目录，一个1KB的index.html
+    char root[] = "/tmp/tiny_web_microbench.XXXXXX";
+    if(!mkdtemp(root)){
+        perror("mkdtemp");
+        return 1;
+    }
+    std::string index = std::string(root) + "/index.html";
+    FILE* fp = fopen(index.c_str(),"w");
+    for(int i = 0;i < 1024;++i){
+        fputc('a' + i % 26,fp);
+    }
+    fclose(fp);
+    doc_root = root;
+
+    scan_init();
+    response_init();
+    if(!filecache::instance() -> init(doc_root,64 << 20,256 << 10)){
+        fprintf(stderr,"filecache init failure\n");
+        return 1;
+    }
+    fprintf(g_out,"{\"bench\":\"meta\",\"cpus\":%ld,\"scan\":\"%s\",\"scale\":%g}\n",sysconf(_SC_NPROCESSORS_ONLN),scan_impl_name(),g_scale);
+
+    route_table();
+    bench_clock();
+    bench_route();
+    conn_env* env = new conn_env;
+    env_init(env);
+    bench_parser(env);
+    env_destroy(env);
+    delete env;
+    bench_roundtrip("keepalive",1);
+    bench_roundtrip("pipeline8",8);
+    //同样的请求从小文件响应缓存发送，不再stat/mmap和格式化首部
+    if(respcache::instance() -> init(2 << 20)){
+        bench_roundtrip("keepalive_arena",1);
+        bench_roundtrip("pipeline8_arena",8);
+    }
+    bench_scan();
+    bench_locker();
+    bench_queue();
+    bench_threadpool();
+
+    unlink(index.c_str());
+    rmdir(root);
+    return 0;
+}
@@ -0,0 +1,158 @@
+#!/bin/sh
+# 在回环地址上用生成的doc_root跑一组固定的压测场景，每个场景输出一行JSON
+# 用法：bench/run_bench.sh [每个场景的秒数]，BENCH_1G=1 时加入1GB文件的场景，BENCH_ENGINE=uring 时服务器用io_uring反应堆，BENCH_MODE=coro 时用协程模式
+# 冷启动场景：BENCH_COLD_SECONDS 是重启后立即压测的秒数(默认同上，60即第一分钟)，BENCH_DROP_CACHES=1 并且有权限时每次启动前清空页缓存
+set -e
+cd "$(dirname "$0")/.."
+SECONDS_PER_RUN=${1:-5}
+PORT=${BENCH_PORT:-9107}
+OUT=${BENCH_OUT:-_bench}
+ENGINE=${BENCH_ENGINE:-epoll}
+MODE=${BENCH_MODE:-split}
+COLD_SECONDS=${BENCH_COLD_SECONDS:-$SECONDS_PER_RUN}
+
+mkdir -p "$OUT"
+g++ -std=c++20 -O2 -o "$OUT/tiny_web" main.cpp http_conn.cpp reactor.cpp uring_reactor.cpp coro_reactor.cpp filecache.cpp gzipcache.cpp timerwheel.cpp simdscan.cpp bufpool.cpp response.cpp log.cpp stats.cpp router.cpp proxy.cpp respcache.cpp docindex.cpp -lpthread -lz
+g++ -O2 -o "$OUT/tiny_web_bench" bench/tiny_web_bench.cpp -lpthread
+g++ -std=c++20 -O2 -o "$OUT/stub_backend" bench/stub_backend.cpp
+
+ROOT="$OUT/doc_root"
+mkdir -p "$ROOT"
+head -c 1024 /dev/urandom > "$ROOT/1k.bin"
+head -c 1048576 /dev/urandom > "$ROOT/1m.bin"
+# 可压缩的文本资源，比较原样发送和gzip协商
+awk 'BEGIN{for(i=0;i<2000;i++) printf ".c%d{margin:%dpx;color:#%06x}\n",i,i%32,i*2654435761%16777216}' > "$ROOT/app.css"
+if [ "${BENCH_1G:-0}" = "1" ]; then
+    truncate -s 1G "$ROOT/1g.bin"
+fi
+# 冷启动场景用的2000个1~32KB的文件，分在20个目录中
+COLD_URLS=
+for d in $(seq 0 19); do
+    mkdir -p "$ROOT/cold/$d"
+    for f in $(seq 0 99); do
+        if [ ! -f "$ROOT/cold/$d/$f.bin" ]; then
+            head -c $(( (d * 100 + f) * 7919 % 32768 + 1024 )) /dev/urandom > "$ROOT/cold/$d/$f.bin"
+        fi
+        COLD_URLS="$COLD_URLS/cold/$d/$f.bin,"
+    done
+done
+
+SERVER_PID=
+BACKEND_PID=
+stop_server(){
+    if [ -n "$SERVER_PID" ]; then
+        kill "$SERVER_PID" 2>/dev/null || true
+        wait "$SERVER_PID" 2>/dev/null || true
+        SERVER_PID=
+    fi
+}
+stop_backend(){
+    if [ -n "$BACKEND_PID" ]; then
+        kill $BACKEND_PID 2>/dev/null || true
+        wait $BACKEND_PID 2>/dev/null || true
+        BACKEND_PID=
+    fi
+}
+trap 'stop_server; stop_backend' EXIT
+
+# $1 额外的服务器参数
+start_server(){
+    stop_server
+    "$OUT/tiny_web" 127.0.0.1 "$PORT" -d "$ROOT" -e "$ENGINE" -m "$MODE" -L off $1 &
+    SERVER_PID=$!
+    sleep 0.5
+}
+
+# 冷启动：$1 额外的服务器参数，日志中出现startup(开始接受连接)后返回
+start_cold(){
+    stop_server
+    if [ "${BENCH_DROP_CACHES:-0}" = "1" ] && [ -w /proc/sys/vm/drop_caches ]; then
+        sync
+        echo 3 > /proc/sys/vm/drop_caches
+    fi
+    : > "$OUT/cold.log"
+    "$OUT/tiny_web" 127.0.0.1 "$PORT" -d "$ROOT" -e "$ENGINE" -m "$MODE" -L info -o "$OUT/cold.log" $1 &
+    SERVER_PID=$!
+    for i in $(seq 200); do
+        if grep -q "startup in" "$OUT/cold.log"; then
+            break
+        fi
+        sleep 0.05
+    done
+}
+
+# $1 场景名 $2 额外的服务器参数 其余参数传给压测工具；重启后立即压测，输出启动耗时
+cold_run(){
+    name=$1
+    start_cold "$2"
+    shift 2
+    startup_ms=$(sed -n 's/.*startup in \([0-9]*\) ms.*/\1/p' "$OUT/cold.log")
+    printf '{"scenario":"%s","startup_ms":%s,"result":' "$name" "${startup_ms:-null}"
+    "$OUT/tiny_web_bench" -p "$PORT" -d "$COLD_SECONDS" -j "$@" | tr -d '\n'
+    echo '}'
+}
+
+# $1 场景名 其余参数传给压测工具
+run(){
+    name=$1
+    shift
+    printf '{"scenario":"%s","result":' "$name"
+    "$OUT/tiny_web_bench" -p "$PORT" -d "$SECONDS_PER_RUN" -j "$@" | tr -d '\n'
+    echo '}'
+}
+
+start_server ""
+run 1k-closed-c16        -c 16 -u /1k.bin
+run 1k-closed-c16-p8     -c 16 -P 8 -u /1k.bin
+run 1k-closed-close      -c 16 -k 0 -u /1k.bin
+run 1k-open-5000rps      -c 16 -r 5000 -u /1k.bin
+run mix-closed-c16       -c 16 -u /1k.bin:9,/1m.bin:1
+run css-identity-c16     -c 16 -u /app.css
+run css-gzip-c16         -c 16 -g -u /app.css
+
+# 短连接突发：每秒新建的连接数和connect延迟，全连接队列5(原来的listen参数)、默认队列、加TCP_DEFER_ACCEPT对比
+run accept-close-c256    -c 256 -k 0 -u /1k.bin
+start_server "-b 5"
+run accept-close-c256-b5 -c 256 -k 0 -u /1k.bin
+start_server "-a 1"
+run accept-close-c256-defer -c 256 -k 0 -u /1k.bin
+start_server ""
+
+# 1MB文件：sendfile(默认阈值256KB)和mmap+writev对比
+run 1m-sendfile-c4       -c 4 -u /1m.bin
+# 断点续传/拖动进度条：只发送请求的64KB
+run 1m-range-64k-c4      -c 4 -R bytes=65536-131071 -u /1m.bin
+start_server "-s 4096"
+run 1m-writev-c4         -c 4 -u /1m.bin
+
+if [ "${BENCH_1G:-0}" = "1" ]; then
+    start_server ""
+    run 1g-sendfile-c1   -c 1 -u /1g.bin
+    start_server "-s 2097152 -c 2048"
+    run 1g-writev-c1     -c 1 -u /1g.bin
+fi
+
+# 冷启动的延迟：不预热、预热时遍历doc_root(没有快照)、预热时载入上一次保存的快照
+rm -f "$OUT/index.snap"
+cold_run cold-nowarm-c16        ""                   -c 16 -u "$COLD_URLS"
+cold_run cold-warm-walk-c16     "-W $OUT/index.snap" -c 16 -u "$COLD_URLS"
+cold_run cold-warm-snapshot-c16 "-W $OUT/index.snap" -c 16 -u "$COLD_URLS"
+stop_server
+
+# 反向代理：经过连接池和splice转发给stub_backend，和直接发送文件对比；代理只支持epoll的split模式
+if [ "$ENGINE" = "epoll" ] && [ "$MODE" = "split" ]; then
+    BACKEND_PORT=$((PORT + 1))
+    "$OUT/stub_backend" "$BACKEND_PORT" &
+    BACKEND_PID=$!
+    "$OUT/stub_backend" "unix:$OUT/stub.sock" &
+    BACKEND_PID="$BACKEND_PID $!"
+    sleep 0.3
+    start_server "-p /api/=127.0.0.1:$BACKEND_PORT,/uds/=unix:$OUT/stub.sock"
+    run proxy-1k-c16         -c 16 -u /api/len/1024
+    run proxy-1k-c16-p8      -c 16 -P 8 -u /api/len/1024
+    run proxy-1k-close-c16   -c 16 -k 0 -u /api/len/1024
+    run proxy-1m-c4          -c 4 -u /api/len/1048576
+    run proxy-uds-1k-c16     -c 16 -u /uds/len/1024
+    stop_server
+    stop_backend
+fi
@@ -0,0 +1,222 @@
+//反向代理(-p)压测和测试用的后端：单线程epoll，HTTP/1.1长连接，支持流水线
+//按URL中的关键字回答，URL前面的代理前缀不影响匹配：
+//  .../len/N      Content-Length的N字节主体
+//  .../chunked/N  chunked编码的N字节主体，每块最多4KB
+//  .../close/N    没有Content-Length，N字节主体之后关闭连接
+//  .../hang       不回答，测试代理的超时
+//  其他GET/HEAD   "ok\n"；带请求体的请求原样回送请求体
+//编译：g++ -std=c++20 -O2 -o stub_backend bench/stub_backend.cpp
+//用法：stub_backend port 或者 stub_backend unix:路径
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<strings.h>
+#include<unistd.h>
+#include<fcntl.h>
+#include<signal.h>
+#include<sys/socket.h>
+#include<sys/un.h>
+#include<sys/epoll.h>
+#include<netinet/in.h>
+#include<netinet/tcp.h>
+#include<string>
+
+struct conn{
+    std::string in;
+    std::string out;
+    size_t out_pos = 0;
+    bool close_after = false;   //发完out之后关闭
+    bool hang = false;          //之后的请求都不回答
+};
+
+static conn* g_conns[65536];
+
+static std::string body_of(size_t n){
+    std::string body(n,'x');
+    for(size_t i = 0;i < n;i += 64){
+        body[i] = '\n';
+    }
+    return body;
+}
+
+//解析in中完整的请求，响应追加到out；请求不完整时返回false
+static bool handle_one(conn* c){
+    size_t head_end = c -> in.find("\r\n\r\n");
+    if(head_end == std::string::npos){
+        return false;
+    }
+    const char* head = c -> in.c_str();
+    long length = 0;
+    const char* cl = strcasestr(head,"\r\nContent-Length:");
+    if(cl && cl < head + head_end){
+        length = atol(cl + 17);
+    }
+    size_t total = head_end + 4 + length;
+    if(c -> in.size() < total){
+        return false;
+    }
+    std::string line = c -> in.substr(0,c -> in.find("\r\n"));
+    bool is_head = line.compare(0,5,"HEAD ") == 0;
+    std::string path = line.substr(line.find(' ') + 1);
+    path = path.substr(0,path.find(' '));
+    std::string& out = c -> out;
+    char buf[256];
+    size_t pos;
+    if(path.find("/hang") != std::string::npos){
+        c -> hang = true;
+    }
+    else if((pos = path.find("/chunked/")) != std::string::npos){
+        size_t n = atol(path.c_str() + pos + 9);
+        out += "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nTransfer-Encoding: chunked\r\n\r\n";
+        if(!is_head){
+            std::string body = body_of(n);
+            for(size_t off = 0;off < n;off += 4096){
+                size_t len = n - off < 4096 ? n - off : 4096;
+                snprintf(buf,sizeof(buf),"%zx;ext=1\r\n",len);
+                out += buf;
+                out.append(body,off,len);
+                out += "\r\n";
+            }
+            out += "0\r\nX-Trailer: done\r\n\r\n";
+        }
+    }
+    else if((pos = path.find("/close/")) != std::string::npos){
+        out += "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nConnection: close\r\n\r\n";
+        if(!is_head){
+            out += body_of(atol(path.c_str() + pos + 7));
+        }
+        c -> close_after = true;
+    }
+    else{
+        std::string body;
+        if((pos = path.find("/len/")) != std::string::npos){
+            body = body_of(atol(path.c_str() + pos + 5));
+        }
+        else if(length > 0){
+            body = c -> in.substr(head_end + 4,length);
+        }
+        else{
+            body = "ok\n";
+        }
+        snprintf(buf,sizeof(buf),"HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: %zu\r\nKeep-Alive: timeout=60\r\n\r\n",body.size());
+        out += buf;
+        if(!is_head){
+            out += body;
+        }
+    }
+    c -> in.erase(0,total);
+    return true;
+}
+
+static void close_conn(int epollfd,int fd){
+    epoll_ctl(epollfd,EPOLL_CTL_DEL,fd,NULL);
+    close(fd);
+    delete g_conns[fd];
+    g_conns[fd] = NULL;
+}
+
+//尽量发送out，发完且要关闭时返回false
+static bool flush(int epollfd,int fd,conn* c){
+    while(c -> out_pos < c -> out.size()){
+        ssize_t n = send(fd,c -> out.data() + c -> out_pos,c -> out.size() - c -> out_pos,MSG_NOSIGNAL);
+        if(n < 0){
+            break;
+        }
+        c -> out_pos += n;
+    }
+    bool pending = c -> out_pos < c -> out.size();
+    if(!pending){
+        c -> out.clear();
+        c -> out_pos = 0;
+        if(c -> close_after){
+            return false;
+        }
+    }
+    epoll_event event;
+    event.data.fd = fd;
+    event.events = EPOLLIN | (pending ? (uint32_t)EPOLLOUT : 0);
+    epoll_ctl(epollfd,EPOLL_CTL_MOD,fd,&event);
+    return true;
+}
+
+int main(int argc,char* argv[]){
+    if(argc < 2){
+        printf("usage: %s port|unix:path\n",argv[0]);
+        return 1;
+    }
+    signal(SIGPIPE,SIG_IGN);
+    int listenfd;
+    if(strncmp(argv[1],"unix:",5) == 0){
+        sockaddr_un addr;
+        memset(&addr,0,sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path,argv[1] + 5,sizeof(addr.sun_path) - 1);
+        unlink(addr.sun_path);
+        listenfd = socket(AF_UNIX,SOCK_STREAM,0);
+        if(bind(listenfd,(sockaddr*)&addr,sizeof(addr)) < 0){
+            perror("bind");
+            return 1;
+        }
+    }
+    else{
+        sockaddr_in addr;
+        memset(&addr,0,sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(atoi(argv[1]));
+        listenfd = socket(AF_INET,SOCK_STREAM,0);
+        int on = 1;
+        setsockopt(listenfd,SOL_SOCKET,SO_REUSEADDR,&on,sizeof(on));
+        if(bind(listenfd,(sockaddr*)&addr,sizeof(addr)) < 0){
+            perror("bind");
+            return 1;
+        }
+    }
+    listen(listenfd,1024);
+    int epollfd = epoll_create1(0);
+    epoll_event event;
+    event.data.fd = listenfd;
+    event.events = EPOLLIN;
+    epoll_ctl(epollfd,EPOLL_CTL_ADD,listenfd,&event);
+    epoll_event events[256];
+    char buf[65536];
+    while(true){
+        int number = epoll_wait(epollfd,events,256,-1);
+        for(int i = 0;i < number;++i){
+            int fd = events[i].data.fd;
+            if(fd == listenfd){
+                int connfd = accept4(listenfd,NULL,NULL,SOCK_NONBLOCK);
+                if(connfd < 0 || connfd >= 65536){
+                    if(connfd >= 0){
+                        close(connfd);
+                    }
+                    continue;
+                }
+                int on = 1;
+                setsockopt(connfd,IPPROTO_TCP,TCP_NODELAY,&on,sizeof(on));
+                g_conns[connfd] = new conn;
+                event.data.fd = connfd;
+                event.events = EPOLLIN;
+                epoll_ctl(epollfd,EPOLL_CTL_ADD,connfd,&event);
+                continue;
+            }
+            conn* c = g_conns[fd];
+            if(!c){
+                continue;
+            }
+            if(events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)){
+                ssize_t n = recv(fd,buf,sizeof(buf),0);
+                if(n <= 0){
+                    close_conn(epollfd,fd);
+                    continue;
+                }
+                c -> in.append(buf,n);
+                while(!c -> hang && !c -> close_after && handle_one(c)){
+                }
+            }
+            if(!flush(epollfd,fd,c)){
+                close_conn(epollfd,fd);
+            }
+        }
+    }
+}
@@ -0,0 +1,585 @@
+//tiny_web的HTTP压测工具，和服务器一样基于epoll
+//闭环模式：每个连接发出请求(流水线时一次发出多个)，收到响应后立刻发下一个，测的是最大吞吐
+//开环模式：按固定的总速率(RPS)安排请求的发送时间，延迟从安排的时间算起而不是实际发出的时间，
+//         服务器变慢时排队的时间也计入延迟，避免协调遗漏(coordinated omission)低估尾延迟
+//短连接(-k 0)：每个请求一个新连接，另外输出每秒建立的连接数和connect的延迟，测的是服务器的accept路径
+//编译：g++ -O2 -o tiny_web_bench bench/tiny_web_bench.cpp -lpthread
+#include<sys/socket.h>
+#include<sys/epoll.h>
+#include<netinet/in.h>
+#include<netinet/tcp.h>
+#include<arpa/inet.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+#include<fcntl.h>
+#include<errno.h>
+#include<time.h>
+#include<getopt.h>
+#include<pthread.h>
+#include<stdint.h>
+#include<vector>
+#include<string>
+
+static const int MAX_PIPELINE = 64;
+static const int HEADER_MAX = 8192;
+
+//和服务器统计相同的对数-线性直方图，单位纳秒
+static const int SUB_BITS = 4;
+static const int SUB = 1 << SUB_BITS;
+static const int MAX_BITS = 40;
+static const int HIST_BUCKETS = (MAX_BITS - SUB_BITS + 2) * SUB;
+
+struct histogram{
+    uint64_t count;
+    uint64_t max;
+    uint64_t buckets[HIST_BUCKETS];
+};
+
+static int bucket_index(uint64_t v){
+    if(v < (uint64_t)SUB){
+        return v;
+    }
+    int msb = 63 - __builtin_clzll(v);
+    if(msb > MAX_BITS){
+        return HIST_BUCKETS - 1;
+    }
+    int shift = msb - SUB_BITS;
+    return (shift + 1) * SUB + ((v >> shift) & (SUB - 1));
+}
+
+static uint64_t bucket_upper(int idx){
+    if(idx < SUB){
+        return idx;
+    }
+    int shift = idx / SUB - 1;
+    uint64_t sub = idx % SUB;
+    return ((SUB + sub + 1) << shift) - 1;
+}
+
+static void hist_record(histogram* h,uint64_t v){
+    ++h -> count;
+    if(v > h -> max){
+        h -> max = v;
+    }
+    ++h -> buckets[bucket_index(v)];
+}
+
+static uint64_t hist_quantile(const histogram* h,double q){
+    if(h -> count == 0){
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(q * h -> count);
+    if(rank >= h -> count){
+        rank = h -> count - 1;
+    }
+    uint64_t seen = 0;
+    for(int i = 0;i < HIST_BUCKETS;++i){
+        seen += h -> buckets[i];
+        if(seen > rank){
+            uint64_t v = bucket_upper(i);
+            return v < h -> max ? v : h -> max;
+        }
+    }
+    return h -> max;
+}
+
+static void hist_merge(histogram* to,const histogram* from){
+    to -> count += from -> count;
+    if(from -> max > to -> max){
+        to -> max = from -> max;
+    }
+    for(int b = 0;b < HIST_BUCKETS;++b){
+        to -> buckets[b] += from -> buckets[b];
+    }
+}
+
+static uint64_t now_ns(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+//命令行参数，所有线程共用
+struct options{
+    const char* host;
+    int port;
+    int connections;
+    int threads;
+    double duration;      //秒
+    double rps;           //大于0时是开环模式，总的请求速率
+    bool keepalive;
+    bool gzip;            //请求带Accept-Encoding: gzip
+    const char* range;    //不为NULL时请求带Range首部，例如"bytes=0-65535"
+    int pipeline;         //每个连接同时在途的请求数
+    bool json;
+    std::vector<std::string> urls;   //按权重展开后的URL列表，均匀随机选取
+};
+
+static options g_opt;
+static sockaddr_in g_addr;
+
+//一个压测连接
+struct bench_conn{
+    int fd;
+    bool connecting;
+    uint64_t connect_start;   //调用connect的时间
+    std::string out;          //待发送的请求
+    size_t out_off;
+    uint64_t start[MAX_PIPELINE];   //在途请求的开始时间(开环模式是安排的时间)，先进先出
+    int head;
+    int inflight;
+    //响应解析
+    char header[HEADER_MAX];
+    int header_len;
+    bool in_body;
+    long body_left;
+    int status;
+    bool done;                //短连接的响应已经收完，需要换一个新连接
+    //开环模式下已经到期但还没发出的请求的安排时间
+    std::vector<uint64_t> pending;
+    uint64_t next_due;        //开环模式下一个请求的安排时间
+};
+
+//每个线程的结果
+struct thread_result{
+    histogram hist;
+    histogram connect_hist;   //connect到连接可写的时间；全连接队列溢出时SYN重传会让它变成秒级
+    uint64_t connects;
+    uint64_t responses;
+    uint64_t bytes;
+    uint64_t errors;
+    uint64_t status_2xx;
+    uint64_t status_other;
+};
+
+struct worker_arg{
+    int index;
+    int connections;
+    double rps;
+    thread_result result;
+};
+
+static int open_conn(bench_conn* c,int epollfd){
+    c -> fd = socket(AF_INET,SOCK_STREAM,0);
+    if(c -> fd < 0){
+        return -1;
+    }
+    int flags = fcntl(c -> fd,F_GETFL);
+    fcntl(c -> fd,F_SETFL,flags | O_NONBLOCK);
+    int one = 1;
+    setsockopt(c -> fd,IPPROTO_TCP,TCP_NODELAY,&one,sizeof(one));
+    c -> connect_start = now_ns();
+    int ret = connect(c -> fd,(sockaddr*)&g_addr,sizeof(g_addr));
+    if(ret < 0 && errno != EINPROGRESS){
+        close(c -> fd);
+        c -> fd = -1;
+        return -1;
+    }
+    //立即连上的也等EPOLLOUT再算建立，统一记录connect的延迟
+    c -> connecting = true;
+    c -> out.clear();
+    c -> out_off = 0;
+    c -> head = 0;
+    c -> inflight = 0;
+    c -> header_len = 0;
+    c -> in_body = false;
+    c -> done = false;
+    epoll_event ev;
+    ev.data.ptr = c;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    epoll_ctl(epollfd,EPOLL_CTL_ADD,c -> fd,&ev);
+    return 0;
+}
+
+static void close_conn(bench_conn* c,int epollfd){
+    if(c -> fd >= 0){
+        epoll_ctl(epollfd,EPOLL_CTL_DEL,c -> fd,NULL);
+        close(c -> fd);
+        c -> fd = -1;
+    }
+}
+
+static void append_request(bench_conn* c,uint64_t start){
+    const std::string& url = g_opt.urls[rand() % g_opt.urls.size()];
+    c -> out += "GET ";
+    c -> out += url;
+    c -> out += " HTTP/1.1\r\nHost: bench\r\nConnection: ";
+    c -> out += g_opt.keepalive ? "keep-alive" : "close";
+    if(g_opt.gzip){
+        c -> out += "\r\nAccept-Encoding: gzip";
+    }
+    if(g_opt.range){
+        c -> out += "\r\nRange: ";
+        c -> out += g_opt.range;
+    }
+    c -> out += "\r\n\r\n";
+    c -> start[(c -> head + c -> inflight) % MAX_PIPELINE] = start;
+    ++c -> inflight;
+}
+
+//在途请求没满时补充请求：闭环模式总是补满，开环模式只发已经到期的
+static void fill_requests(bench_conn* c,bool open_loop){
+    int depth = g_opt.keepalive ? g_opt.pipeline : 1;
+    if(!g_opt.keepalive && c -> inflight > 0){
+        return;
+    }
+    while(c -> inflight < depth){
+        if(open_loop){
+            if(c -> pending.empty()){
+                break;
+            }
+            append_request(c,c -> pending.front());
+            c -> pending.erase(c -> pending.begin());
+        }
+        else{
+            append_request(c,now_ns());
+        }
+        if(!g_opt.keepalive){
+            break;
+        }
+    }
+}
+
+//发送缓冲区中的请求，返回false表示连接出错
+static bool flush_out(bench_conn* c){
+    while(c -> out_off < c -> out.size()){
+        ssize_t n = send(c -> fd,c -> out.data() + c -> out_off,c -> out.size() - c -> out_off,MSG_NOSIGNAL);
+        if(n < 0){
+            if(errno == EAGAIN){
+                return true;
+            }
+            return false;
+        }
+        c -> out_off += n;
+    }
+    c -> out.clear();
+    c -> out_off = 0;
+    return true;
+}
+
+//一个响应完整收到
+static void finish_response(bench_conn* c,thread_result* r){
+    uint64_t start = c -> start[c -> head];
+    c -> head = (c -> head + 1) % MAX_PIPELINE;
+    --c -> inflight;
+    hist_record(&r -> hist,now_ns() - start);
+    ++r -> responses;
+    if(c -> status >= 200 && c -> status < 300){
+        ++r -> status_2xx;
+    }
+    else{
+        ++r -> status_other;
+    }
+    c -> in_body = false;
+    c -> header_len = 0;
+    if(!g_opt.keepalive){
+        c -> done = true;
+    }
+}
+
+//解析收到的数据，可能包含多个流水线响应；返回false表示响应格式错误
+static bool consume(bench_conn* c,const char* data,size_t len,thread_result* r){
+    while(len > 0){
+        if(c -> in_body){
+            size_t n = (size_t)c -> body_left < len ? c -> body_left : len;
+            c -> body_left -= n;
+            data += n;
+            len -= n;
+            if(c -> body_left == 0){
+                finish_response(c,r);
+            }
+            continue;
+        }
+        //首部：逐块追加，在新追加的部分(往前多看3个字节)中找空行
+        int old = c -> header_len;
+        size_t n = len < (size_t)(HEADER_MAX - old) ? len : HEADER_MAX - old;
+        if(n == 0){
+            return false;
+        }
+        memcpy(c -> header + old,data,n);
+        c -> header_len += n;
+        int from = old > 3 ? old - 3 : 0;
+        char* end = (char*)memmem(c -> header + from,c -> header_len - from,"\r\n\r\n",4);
+        if(!end){
+            data += n;
+            len -= n;
+            continue;
+        }
+        int header_bytes = end + 4 - c -> header;
+        int used = header_bytes - old;   //本次数据中属于首部的字节数
+        data += used;
+        len -= used;
+        c -> header[header_bytes - 1] = '\0';
+        c -> status = atoi(c -> header + 9);
+        char* cl = strcasestr(c -> header,"\r\nContent-Length:");
+        c -> body_left = cl ? atol(cl + 17) : 0;
+        c -> in_body = true;
+        if(c -> body_left == 0){
+            finish_response(c,r);
+        }
+    }
+    return true;
+}
+
+static void* worker(void* arg){
+    worker_arg* w = (worker_arg*)arg;
+    thread_result* r = &w -> result;
+    bool open_loop = w -> rps > 0;
+    int epollfd = epoll_create1(0);
+    std::vector<bench_conn> conns(w -> connections);
+    //开环模式：每个连接平分本线程的速率，起始时间错开，避免所有连接同时发送
+    uint64_t interval = open_loop ? (uint64_t)(1e9 * w -> connections / w -> rps) : 0;
+    uint64_t begin = now_ns();
+    uint64_t stop = begin + (uint64_t)(g_opt.duration * 1e9);
+    for(int i = 0;i < w -> connections;++i){
+        bench_conn* c = &conns[i];
+        c -> fd = -1;
+        c -> next_due = begin + (open_loop ? interval * i / w -> connections : 0);
+        if(open_conn(c,epollfd) < 0){
+            ++r -> errors;
+        }
+    }
+    static char buf[256 * 1024];
+    epoll_event events[1024];
+    while(true){
+        uint64_t now = now_ns();
+        if(now >= stop){
+            break;
+        }
+        int timeout = 10;
+        if(open_loop){
+            //到期的请求放进连接的待发队列；连接忙(在途已满)时请求在这里排队，等待时间计入延迟
+            uint64_t next = stop;
+            for(size_t i = 0;i < conns.size();++i){
+                bench_conn* c = &conns[i];
+                while(c -> next_due <= now){
+                    c -> pending.push_back(c -> next_due);
+                    c -> next_due += interval;
+                }
+                if(c -> next_due < next){
+                    next = c -> next_due;
+                }
+                if(c -> fd >= 0 && !c -> connecting){
+                    fill_requests(c,true);
+                    if(!flush_out(c)){
+                        ++r -> errors;
+                        close_conn(c,epollfd);
+                    }
+                }
+                else if(c -> fd < 0 && open_conn(c,epollfd) < 0){
+                    ++r -> errors;
+                }
+            }
+            timeout = next > now ? (int)((next - now) / 1000000) : 0;
+        }
+        int n = epoll_wait(epollfd,events,1024,timeout);
+        for(int i = 0;i < n;++i){
+            bench_conn* c = (bench_conn*)events[i].data.ptr;
+            if(c -> fd < 0){
+                continue;
+            }
+            if(c -> connecting){
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(c -> fd,SOL_SOCKET,SO_ERROR,&err,&len);
+                if(err){
+                    ++r -> errors;
+                    close_conn(c,epollfd);
+                    open_conn(c,epollfd);
+                    continue;
+                }
+                c -> connecting = false;
+                ++r -> connects;
+                hist_record(&r -> connect_hist,now_ns() - c -> connect_start);
+            }
+            bool broken = false;
+            if(events[i].events & EPOLLIN){
+                while(true){
+                    ssize_t got = recv(c -> fd,buf,sizeof(buf),0);
+                    if(got > 0){
+                        r -> bytes += got;
+                        if(!consume(c,buf,got,r)){
+                            broken = true;
+                            break;
+                        }
+                        continue;
+                    }
+                    if(got < 0 && errno == EAGAIN){
+                        break;
+                    }
+                    //对端关闭：在途的请求没有收到响应，算错误
+                    if(c -> inflight > 0){
+                        ++r -> errors;
+                    }
+                    broken = true;
+                    break;
+                }
+            }
+            if(c -> done){
+                broken = true;   //短连接：一个响应一个连接
+            }
+            if(broken){
+                close_conn(c,epollfd);
+                if(open_conn(c,epollfd) < 0){
+                    ++r -> errors;
+                }
+                continue;
+            }
+            fill_requests(c,open_loop);
+            if(!flush_out(c)){
+                ++r -> errors;
+                close_conn(c,epollfd);
+                open_conn(c,epollfd);
+            }
+        }
+    }
+    for(size_t i = 0;i < conns.size();++i){
+        close_conn(&conns[i],epollfd);
+    }
+    close(epollfd);
+    return NULL;
+}
+
+//URL列表："/a.html:9,/big.bin:1"，权重省略时为1
+static bool parse_urls(const char* spec){
+    std::string s(spec);
+    size_t pos = 0;
+    while(pos <= s.size()){
+        size_t comma = s.find(',',pos);
+        if(comma == std::string::npos){
+            comma = s.size();
+        }
+        std::string item = s.substr(pos,comma - pos);
+        pos = comma + 1;
+        if(item.empty()){
+            continue;
+        }
+        int weight = 1;
+        size_t colon = item.rfind(':');
+        if(colon != std::string::npos){
+            weight = atoi(item.c_str() + colon + 1);
+            item = item.substr(0,colon);
+        }
+        if(item[0] != '/' || weight <= 0){
+            return false;
+        }
+        for(int i = 0;i < weight;++i){
+            g_opt.urls.push_back(item);
+        }
+    }
+    return !g_opt.urls.empty();
+}
+
+static void usage(const char* prog){
+    printf("usage: %s [-H host] [-p port] [-c connections] [-t threads] [-d seconds] [-r rps] [-k 0|1] [-P pipeline] [-u url[:weight],...] [-g] [-R range] [-j]\n",prog);
+}
+
+int main(int argc,char* argv[]){
+    g_opt.host = "127.0.0.1";
+    g_opt.port = 9006;
+    g_opt.connections = 16;
+    g_opt.threads = 1;
+    g_opt.duration = 10;
+    g_opt.rps = 0;
+    g_opt.keepalive = true;
+    g_opt.pipeline = 1;
+    g_opt.json = false;
+    g_opt.gzip = false;
+    g_opt.range = NULL;
+    int opt;
+    while((opt = getopt(argc,argv,"H:p:c:t:d:r:k:P:u:gR:j")) != -1){
+        switch(opt){
+            case 'H': g_opt.host = optarg; break;
+            case 'p': g_opt.port = atoi(optarg); break;
+            case 'c': g_opt.connections = atoi(optarg); break;
+            case 't': g_opt.threads = atoi(optarg); break;
+            case 'd': g_opt.duration = atof(optarg); break;
+            case 'r': g_opt.rps = atof(optarg); break;
+            case 'k': g_opt.keepalive = atoi(optarg) != 0; break;
+            case 'P': g_opt.pipeline = atoi(optarg); break;
+            case 'u':{
+                if(!parse_urls(optarg)){
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            }
+            case 'g': g_opt.gzip = true; break;
+            case 'R': g_opt.range = optarg; break;
+            case 'j': g_opt.json = true; break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if(g_opt.urls.empty()){
+        g_opt.urls.push_back("/index.html");
+    }
+    if(g_opt.threads <= 0 || g_opt.connections < g_opt.threads || g_opt.pipeline <= 0 || g_opt.pipeline > MAX_PIPELINE){
+        usage(argv[0]);
+        return 1;
+    }
+    memset(&g_addr,0,sizeof(g_addr));
+    g_addr.sin_family = AF_INET;
+    g_addr.sin_port = htons(g_opt.port);
+    if(inet_pton(AF_INET,g_opt.host,&g_addr.sin_addr) != 1){
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::vector<worker_arg> args(g_opt.threads);
+    std::vector<pthread_t> tids(g_opt.threads);
+    uint64_t begin = now_ns();
+    for(int i = 0;i < g_opt.threads;++i){
+        memset(&args[i].result,0,sizeof(args[i].result));
+        args[i].index = i;
+        args[i].connections = g_opt.connections / g_opt.threads + (i < g_opt.connections % g_opt.threads ? 1 : 0);
+        args[i].rps = g_opt.rps * args[i].connections / g_opt.connections;
+        pthread_create(&tids[i],NULL,worker,&args[i]);
+    }
+    thread_result total;
+    memset(&total,0,sizeof(total));
+    for(int i = 0;i < g_opt.threads;++i){
+        pthread_join(tids[i],NULL);
+        thread_result& r = args[i].result;
+        total.responses += r.responses;
+        total.bytes += r.bytes;
+        total.errors += r.errors;
+        total.status_2xx += r.status_2xx;
+        total.status_other += r.status_other;
+        total.connects += r.connects;
+        hist_merge(&total.hist,&r.hist);
+        hist_merge(&total.connect_hist,&r.connect_hist);
+    }
+    double elapsed = (now_ns() - begin) / 1e9;
+    double rps = total.responses / elapsed;
+    double mbps = total.bytes / elapsed / (1 << 20);
+    double p50 = hist_quantile(&total.hist,0.5) / 1e3;
+    double p99 = hist_quantile(&total.hist,0.99) / 1e3;
+    double p999 = hist_quantile(&total.hist,0.999) / 1e3;
+    double max = total.hist.max / 1e3;
+    double cps = total.connects / elapsed;
+    double c50 = hist_quantile(&total.connect_hist,0.5) / 1e3;
+    double c99 = hist_quantile(&total.connect_hist,0.99) / 1e3;
+    double cmax = total.connect_hist.max / 1e3;
+    if(g_opt.json){
+        printf("{\"mode\":\"%s\",\"connections\":%d,\"threads\":%d,\"keepalive\":%s,\"pipeline\":%d,\"target_rps\":%.0f,"
+               "\"seconds\":%.3f,\"responses\":%lu,\"rps\":%.1f,\"mb_per_s\":%.2f,\"errors\":%lu,\"non_2xx\":%lu,"
+               "\"p50_us\":%.1f,\"p99_us\":%.1f,\"p999_us\":%.1f,\"max_us\":%.1f,"
+               "\"connects\":%lu,\"conn_per_s\":%.1f,\"connect_p50_us\":%.1f,\"connect_p99_us\":%.1f,\"connect_max_us\":%.1f}\n",
+               g_opt.rps > 0 ? "open" : "closed",g_opt.connections,g_opt.threads,g_opt.keepalive ? "true" : "false",
+               g_opt.pipeline,g_opt.rps,elapsed,(unsigned long)total.responses,rps,mbps,(unsigned long)total.errors,
+               (unsigned long)total.status_other,p50,p99,p999,max,(unsigned long)total.connects,cps,c50,c99,cmax);
+    }
+    else{
+        printf("%s loop, %d connections, %d threads, keep-alive %s, pipeline %d%s\n",g_opt.rps > 0 ? "open" : "closed",
+               g_opt.connections,g_opt.threads,g_opt.keepalive ? "on" : "off",g_opt.pipeline,
+               g_opt.rps > 0 ? " (latency measured from intended send time)" : "");
+        printf("  %lu responses in %.2fs: %.1f req/s, %.2f MB/s, %lu errors, %lu non-2xx\n",(unsigned long)total.responses,
+               elapsed,rps,mbps,(unsigned long)total.errors,(unsigned long)total.status_other);
+        printf("  latency p50 %.1fus  p99 %.1fus  p999 %.1fus  max %.1fus\n",p50,p99,p999,max);
+        printf("  %lu connects: %.1f conn/s, connect p50 %.1fus  p99 %.1fus  max %.1fus\n",(unsigned long)total.connects,
+               cps,c50,c99,cmax);
+    }
+    return 0;
+}
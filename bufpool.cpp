@@ -0,0 +1,111 @@
+#include<stdlib.h>
+#include<pthread.h>
+#include<new>
+#include"bufpool.h"
+
+//每个线程一条空闲链表，分配和归还都不加锁
+//分段可能在一个线程中分配、在另一个线程中归还(流水线请求由工作线程整理剩余数据)，
+//所以线程的空闲链表超过MAX_CACHED段时把一批还给全局的仓库，线程的空闲链表为空时先从仓库取一批，仓库也空了才申请新的slab
+static thread_local buf_segment* t_free_list = NULL;
+static thread_local int t_free_count = 0;
+
+static pthread_mutex_t g_depot_lock = PTHREAD_MUTEX_INITIALIZER;
+static buf_segment* g_depot = NULL;
+static int g_depot_count = 0;
+
+buf_segment* bufpool::alloc(){
+    if(!t_free_list){
+        pthread_mutex_lock(&g_depot_lock);
+        while(g_depot && t_free_count < BATCH){
+            buf_segment* seg = g_depot;
+            g_depot = seg -> next;
+            --g_depot_count;
+            seg -> next = t_free_list;
+            t_free_list = seg;
+            ++t_free_count;
+        }
+        pthread_mutex_unlock(&g_depot_lock);
+    }
+    if(!t_free_list){
+        //池空了，一次申请一个slab，切成SLAB_SEGMENTS段放入空闲链表；slab不归还给系统，池的大小就是历史峰值
+        buf_segment* slab = (buf_segment*)malloc(sizeof(buf_segment) * SLAB_SEGMENTS);
+        if(!slab){
+            throw std::bad_alloc();
+        }
+        for(int i = 0;i < SLAB_SEGMENTS;++i){
+            slab[i].next = t_free_list;
+            t_free_list = &slab[i];
+        }
+        t_free_count += SLAB_SEGMENTS;
+    }
+    buf_segment* seg = t_free_list;
+    t_free_list = seg -> next;
+    --t_free_count;
+    seg -> next = NULL;
+    seg -> len = 0;
+    seg -> cap = buf_segment::SIZE;
+    return seg;
+}
+
+buf_segment* bufpool::alloc_large(int cap){
+    if(cap <= buf_segment::SIZE){
+        return alloc();
+    }
+    buf_segment* seg = (buf_segment*)malloc(sizeof(buf_segment) - buf_segment::SIZE + cap);
+    if(!seg){
+        throw std::bad_alloc();
+    }
+    seg -> next = NULL;
+    seg -> len = 0;
+    seg -> cap = cap;
+    return seg;
+}
+
+void bufpool::free_chain(buf_segment* head){
+    while(head){
+        buf_segment* next = head -> next;
+        if(head -> cap != buf_segment::SIZE){
+            free(head);
+            head = next;
+            continue;
+        }
+        head -> next = t_free_list;
+        t_free_list = head;
+        ++t_free_count;
+        head = next;
+    }
+    if(t_free_count > MAX_CACHED){
+        //留下BATCH段，其余的还给仓库
+        buf_segment* first = t_free_list;
+        buf_segment* last = NULL;
+        int moved = 0;
+        while(t_free_count > BATCH){
+            last = t_free_list;
+            t_free_list = t_free_list -> next;
+            --t_free_count;
+            ++moved;
+        }
+        pthread_mutex_lock(&g_depot_lock);
+        last -> next = g_depot;
+        g_depot = first;
+        g_depot_count += moved;
+        pthread_mutex_unlock(&g_depot_lock);
+    }
+}
+
+void bufpool::flush_cache(){
+    if(!t_free_list){
+        return;
+    }
+    buf_segment* last = t_free_list;
+    while(last -> next){
+        last = last -> next;
+    }
+    pthread_mutex_lock(&g_depot_lock);
+    last -> next = g_depot;
+    g_depot = t_free_list;
+    g_depot_count += t_free_count;
+    pthread_mutex_unlock(&g_depot_lock);
+    t_free_list = NULL;
+    t_free_count = 0;
+}
@@ -0,0 +1,31 @@
+#ifndef BUFPOOL_H
+#define BUFPOOL_H
+
+//读缓冲区的分段和每线程的分段池
+//连接的读缓冲区是由固定大小的分段组成的链表，需要时从当前线程的池中取一段，请求处理完后归还
+//池中的分段以slab为单位(一次malloc若干段)向系统申请，归还的分段放在线程自己的空闲链表上，分配和归还都不加锁；
+//线程缓存的分段过多时成批还给全局仓库，其他线程缺分段时先从仓库取
+struct buf_segment{
+    static const int SIZE = 8192 - 16;   //每段可存放的数据字节数，加上头部正好8KB
+    buf_segment* next;
+    int len;          //已经写入的字节数
+    int cap;          //data的容量，池中的分段是SIZE，alloc_large单独申请的分段更大
+    char data[SIZE];
+};
+
+class bufpool{
+public:
+    static const int SLAB_SEGMENTS = 16;   //每次向系统申请的段数
+    static const int BATCH = 32;           //线程和全局仓库之间一次移动的段数
+    static const int MAX_CACHED = 64;      //线程空闲链表最多缓存的段数
+    //从当前线程的池中取一段，next和len已经清零
+    static buf_segment* alloc();
+    //单独malloc一个容量为cap(不小于SIZE)的分段，用于装下超过一个分段的请求头，free_chain时直接free
+    static buf_segment* alloc_large(int cap);
+    //归还一整条链表到当前线程的池中
+    static void free_chain(buf_segment* head);
+    //把当前线程缓存的分段全部还给全局仓库，线程长时间不处理请求(线程池退休的线程停放)前调用
+    static void flush_cache();
+};
+
+#endif
@@ -0,0 +1,154 @@
+#include<sys/socket.h>
+#include<netinet/in.h>
+#include<arpa/inet.h>
+#include<stdio.h>
+#include<unistd.h>
+#include<errno.h>
+#include<string.h>
+
+#include"./coro_reactor.h"
+
+//添加文件描述符到内核事件集
+extern void addfd(int epollfd,int fd,bool one_shot);
+
+coro_reactor::coro_reactor():
+    m_listenfd(-1),m_epollfd(-1),m_users(NULL),m_slots(NULL)
+{
+}
+
+coro_reactor::~coro_reactor(){
+    if(m_epollfd != -1){
+        close(m_epollfd);
+    }
+    if(m_listenfd != -1){
+        close(m_listenfd);
+    }
+}
+
+bool coro_reactor::init(const char* ip,int port,http_conn* users,coro_slot* slots){
+    m_users = users;
+    m_slots = slots;
+
+    m_listenfd = reactor::open_listener(ip,port);
+    if(m_listenfd < 0){
+        return false;
+    }
+    m_epollfd = epoll_create(5);
+    if(m_epollfd == -1){
+        return false;
+    }
+    addfd(m_epollfd,m_listenfd,false);
+    return true;
+}
+
+bool coro_reactor::start(){
+    if(pthread_create(&m_thread,NULL,worker,this) != 0){
+        return false;
+    }
+    return pthread_detach(m_thread) == 0;
+}
+
+void* coro_reactor::worker(void* arg){
+    coro_reactor* r = (coro_reactor*)arg;
+    r -> run();
+    return r;
+}
+
+void coro_reactor::accept_all(){
+    while(true){
+        struct sockaddr_in client_address;
+        socklen_t client_addrlength = sizeof(client_address);
+        int connfd = accept4(m_listenfd,(struct sockaddr*)& client_address,&client_addrlength,SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(connfd < 0){
+            if(errno == EAGAIN || errno == EWOULDBLOCK){
+                break;
+            }
+            if(errno == ECONNABORTED || errno == EINTR){
+                continue;
+            }
+            LOG_WARN("accept failure, errno is: %d",errno);
+            break;
+        }
+        stats_add(STAT_ACCEPTS,1);
+        if(connfd >= MAX_FD || http_conn::m_user_count >= MAX_FD){
+            reactor::show_error(connfd,"Internal server busy");
+            continue;
+        }
+        coro_slot* slot = m_slots + connfd;
+        slot -> reset();
+        m_users[connfd].init(connfd,client_address,m_epollfd,&m_timers,NULL,slot);
+        //可读和可写都注册，边缘触发只在状态变化时报告一次，之后不再epoll_ctl
+        epoll_event event;
+        event.data.fd = connfd;
+        event.events = EPOLLIN | EPOLLOUT | EPOLLET | EPOLLRDHUP;
+        epoll_ctl(m_epollfd,EPOLL_CTL_ADD,connfd,&event);
+        serve(m_users + connfd,slot);
+    }
+}
+
+//http_conn的read/process/write和线程池模式相同，只是rearm不调用epoll_ctl，而是记在slot -> wanted中
+//process之后响应已经排好，直接write，通常一次就发完；EAGAIN时才挂起等待可写
+coro_task coro_reactor::serve(http_conn* conn,coro_slot* slot){
+    bool alive = true;
+    while(alive){
+        co_await slot_event{slot,EPOLLIN};
+        if(!conn -> read()){
+            break;
+        }
+        //读满了当前请求允许的字节数时socket中可能还有数据，不会再有边缘事件，解析后要再读一次
+        bool more = conn -> read_full();
+        slot -> wanted = 0;
+        conn -> mark_busy();
+        conn -> process();
+        while(slot -> wanted == EPOLLOUT){
+            slot -> wanted = 0;
+            if(!conn -> write()){
+                alive = false;
+                break;
+            }
+            if(slot -> wanted == EPOLLOUT){        //发送缓冲区满
+                co_await slot_event{slot,EPOLLOUT};
+            }
+            else if(slot -> wanted == 0){          //读缓冲区中还有流水线请求
+                conn -> mark_busy();
+                conn -> process();
+            }
+        }
+        if(more){
+            slot -> ready |= EPOLLIN;
+        }
+    }
+    conn -> close_conn();
+}
+
+void coro_reactor::run(){
+    while(true){
+        int number = epoll_wait(m_epollfd,m_events,MAX_EVENT_NUMBER,m_timers.next_timeout());
+        if((number < 0) && (errno != EINTR)){
+            LOG_ERROR("epoll failure, errno is: %d",errno);
+            break;
+        }
+
+        for(int i = 0;i < number;++i){
+            int sockfd = m_events[i].data.fd;
+            if(sockfd == m_listenfd){
+                accept_all();
+                continue;
+            }
+            //对端关闭和出错都当作可读/可写，由协程中的recv/send发现并关闭连接
+            unsigned events = m_events[i].events;
+            coro_slot* slot = m_slots + sockfd;
+            if(events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)){
+                slot -> ready |= EPOLLIN;
+            }
+            if(events & (EPOLLOUT | EPOLLHUP | EPOLLERR)){
+                slot -> ready |= EPOLLOUT;
+            }
+            if(slot -> handle && (slot -> ready & slot -> waiting)){
+                slot -> handle.resume();
+            }
+        }
+        //到期的连接在挂起状态下被关闭，协程帧在close_conn中销毁
+        m_timers.expire();
+    }
+}
@@ -0,0 +1,92 @@
+#ifndef CORO_REACTOR_H
+#define CORO_REACTOR_H
+
+#include<pthread.h>
+#include<sys/epoll.h>
+#include<coroutine>
+#include<exception>
+#include"http_conn.h"
+#include"timerwheel.h"
+#include"reactor.h"
+
+//协程模式(-m coro)下每个连接的协程状态，以fd为下标，和users数组一样由所有反应堆共享
+//连接注册为EPOLLIN|EPOLLOUT边缘触发，不用EPOLLONESHOT，处理请求时不再调用epoll_ctl
+struct coro_slot{
+    std::coroutine_handle<> handle;  //挂起中的协程，协程运行时为空
+    int waiting;    //挂起的协程等待的事件
+    int ready;      //epoll报告过、还没被消费的事件，边缘触发只报告一次，所以要记下来
+    int wanted;     //http_conn::rearm记录的下一步要等的事件，0表示没有调用rearm
+
+    void reset(){
+        handle = nullptr;
+        waiting = ready = wanted = 0;
+    }
+    //连接在挂起时被关闭(定时器到期)，销毁协程帧；协程运行时由它自己结束
+    void cancel(){
+        if(handle){
+            std::coroutine_handle<> h = handle;
+            handle = nullptr;
+            h.destroy();
+        }
+    }
+};
+
+//连接的协程，创建后立即运行到第一次co_await，结束时协程帧自动释放
+struct coro_task{
+    struct promise_type{
+        coro_task get_return_object(){return coro_task();}
+        std::suspend_never initial_suspend() noexcept{return std::suspend_never();}
+        std::suspend_never final_suspend() noexcept{return std::suspend_never();}
+        void return_void(){}
+        void unhandled_exception(){std::terminate();}
+    };
+};
+
+//co_await slot_event{slot,EPOLLIN}：事件已经就绪时不挂起，否则挂起到反应堆报告该事件
+//恢复时清除就绪标记，之后的读写一直做到EAGAIN，再有数据/空间时边缘触发会重新报告
+struct slot_event{
+    coro_slot* slot;
+    int ev;
+    bool await_ready() const{return slot -> ready & ev;}
+    void await_suspend(std::coroutine_handle<> h){
+        slot -> handle = h;
+        slot -> waiting = ev;
+    }
+    void await_resume(){
+        slot -> handle = nullptr;
+        slot -> ready &= ~ev;
+    }
+};
+
+//协程反应堆：每个连接是一个协程，等待可读/可写时挂起，事件到来时由反应堆线程恢复
+//请求的读、解析、构建响应和发送都在同一个反应堆线程中完成，不经过线程池，也不需要为发送再等一轮epoll
+//多个反应堆(-r)各自运行在一个线程中，用SO_REUSEPORT分配连接，反应堆数一般设置为CPU核数
+class coro_reactor{
+public:
+    coro_reactor();
+    ~coro_reactor();
+    //创建监听socket(SO_REUSEPORT)和epoll，users和slots是所有反应堆共享的、以fd为下标的数组
+    bool init(const char* ip,int port,http_conn* users,coro_slot* slots);
+    //在新线程中运行事件循环
+    bool start();
+    //事件循环，可以直接在主线程中调用
+    void run();
+
+private:
+    static void* worker(void* arg);
+    //边缘触发的监听socket可读：一直accept到EAGAIN，每个新连接启动一个协程
+    void accept_all();
+    //一个连接的整个生命周期：等待请求、解析、发送响应，直到连接关闭
+    static coro_task serve(http_conn* conn,coro_slot* slot);
+
+private:
+    int m_listenfd;
+    int m_epollfd;
+    pthread_t m_thread;
+    timerwheel m_timers;
+    http_conn* m_users;
+    coro_slot* m_slots;
+    epoll_event m_events[MAX_EVENT_NUMBER];
+};
+
+#endif
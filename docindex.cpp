@@ -0,0 +1,515 @@
+#include<sys/stat.h>
+#include<sys/mman.h>
+#include<fcntl.h>
+#include<dirent.h>
+#include<unistd.h>
+#include<string.h>
+#include<stdint.h>
+#include<errno.h>
+#include<atomic>
+#include<algorithm>
+#include<utility>
+#include<unordered_map>
+#include"docindex.h"
+#include"filecache.h"
+#include"respcache.h"
+#include"locker.h"
+#include"stats.h"
+#include"log.h"
+
+//老的头文件中没有；内核不支持(5.14之前)时madvise返回EINVAL，这时退回MADV_WILLNEED
+#ifndef MADV_POPULATE_READ
+#define MADV_POPULATE_READ 22
+#endif
+
+//快照文件：头、count条定长记录、路径字符串表，字段按本机字节序，只给同一台机器上的下一次启动用
+static const char SNAPSHOT_MAGIC[8] = {'T','W','I','D','X','1',0,0};
+static const uint32_t SNAPSHOT_VERSION = 1;
+
+struct snapshot_header{
+    char magic[8];
+    uint32_t version;
+    uint32_t count;           //记录数，记录数组紧跟在头之后
+    uint64_t strings;         //字符串表的偏移
+    uint64_t total;           //文件的总长度，被截断的快照不用
+    char root[256];           //生成快照时的doc_root，不同时不用
+};
+
+struct snapshot_record{
+    uint64_t url_off;         //在字符串表中的偏移
+    uint32_t url_len;
+    uint32_t reserved;
+    int64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t ino;
+    uint64_t hits;
+};
+
+static long elapsed_ms(uint64_t start){
+    return (long)((stats_now_ns() - start) / 1000000);
+}
+
+//在threads个线程中运行fn(arg)，当前线程也算一个，全部结束后返回
+static void run_parallel(void* (*fn)(void*),void* arg,int threads){
+    std::vector<pthread_t> tids;
+    for(int i = 1;i < threads;++i){
+        pthread_t tid;
+        if(pthread_create(&tid,NULL,fn,arg) == 0){
+            tids.push_back(tid);
+        }
+    }
+    fn(arg);
+    for(size_t i = 0;i < tids.size();++i){
+        pthread_join(tids[i],NULL);
+    }
+}
+
+//和filecache加载时的条件一致：其他用户可读的普通文件
+static bool servable(const struct stat& st){
+    return S_ISREG(st.st_mode) && (st.st_mode & S_IROTH);
+}
+
+static void set_stat(docindex::record& r,const struct stat& st){
+    r.size = st.st_size;
+    r.mtime = st.st_mtim;
+    r.ino = st.st_ino;
+}
+
+//读一个目录(相对root)：子目录放进dirs，可以发送的文件放进found
+//符号链接按filecache的stat跟随到目标，指向目录的符号链接不进入，避免成环
+static bool scan_dir(const std::string& root,const std::string& dir,std::vector<std::string>& dirs,std::vector<docindex::record>& found){
+    DIR* d = opendir((root + dir).c_str());
+    if(!d){
+        return false;
+    }
+    int fd = dirfd(d);
+    struct dirent* ent;
+    while((ent = readdir(d)) != NULL){
+        const char* name = ent -> d_name;
+        if(name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))){
+            continue;
+        }
+        struct stat st;
+        if(fstatat(fd,name,&st,AT_SYMLINK_NOFOLLOW) != 0){
+            continue;
+        }
+        if(S_ISDIR(st.st_mode)){
+            dirs.push_back(dir + "/" + name);
+            continue;
+        }
+        if(S_ISLNK(st.st_mode) && fstatat(fd,name,&st,0) != 0){
+            continue;
+        }
+        if(!servable(st)){
+            continue;
+        }
+        docindex::record r;
+        r.url = dir + "/" + name;
+        set_stat(r,st);
+        r.hits = 0;
+        found.push_back(r);
+    }
+    closedir(d);
+    return true;
+}
+
+//并行遍历的共享状态：待读的目录栈，栈为空并且没有线程在读目录时结束
+struct walk_state{
+    const std::string* root;
+    std::vector<std::string> dirs;
+    std::vector<docindex::record> records;
+    int busy;                 //正在读目录的线程数
+    bool root_failed;
+    locker lock;              //保护上面的成员
+    cond idle;                //有新目录或者遍历结束时广播
+};
+
+static void* walk_worker(void* arg){
+    walk_state* w = (walk_state*)arg;
+    std::vector<std::string> subdirs;
+    std::vector<docindex::record> found;
+    w -> lock.lock();
+    while(true){
+        while(w -> dirs.empty() && w -> busy > 0){
+            w -> idle.wait(w -> lock.get());
+        }
+        if(w -> dirs.empty()){
+            break;
+        }
+        std::string dir;
+        dir.swap(w -> dirs.back());
+        w -> dirs.pop_back();
+        ++w -> busy;
+        w -> lock.unlock();
+
+        bool ok = scan_dir(*w -> root,dir,subdirs,found);
+
+        w -> lock.lock();
+        --w -> busy;
+        if(!ok && dir.empty()){
+            w -> root_failed = true;
+        }
+        w -> dirs.insert(w -> dirs.end(),subdirs.begin(),subdirs.end());
+        w -> records.insert(w -> records.end(),found.begin(),found.end());
+        subdirs.clear();
+        found.clear();
+        if(!w -> dirs.empty() || w -> busy == 0){
+            w -> idle.broadcast();
+        }
+    }
+    w -> lock.unlock();
+    return NULL;
+}
+
+//重新stat快照中的记录，每个线程按下标取下一条
+struct revalidate_state{
+    const std::string* root;
+    std::vector<docindex::record>* records;
+    std::vector<char> gone;
+    std::atomic<size_t> next;
+    std::atomic<int> changed;
+};
+
+static void* revalidate_worker(void* arg){
+    revalidate_state* v = (revalidate_state*)arg;
+    std::vector<docindex::record>& records = *v -> records;
+    std::string path;
+    for(size_t i = v -> next++;i < records.size();i = v -> next++){
+        docindex::record& r = records[i];
+        path.assign(*v -> root);
+        path.append(r.url);
+        struct stat st;
+        if(stat(path.c_str(),&st) != 0 || !servable(st)){
+            v -> gone[i] = 1;
+            continue;
+        }
+        if(st.st_size != r.size || st.st_ino != r.ino || st.st_mtim.tv_sec != r.mtime.tv_sec
+            || st.st_mtim.tv_nsec != r.mtime.tv_nsec){
+            set_stat(r,st);
+            ++v -> changed;
+        }
+    }
+    return NULL;
+}
+
+//预取选中的文件，经过filecache加载，加载后的缓存项留在缓存中
+struct prefetch_state{
+    const std::string* root;
+    std::vector<const docindex::record*> files;
+    std::atomic<size_t> next;
+    std::atomic<int> count;
+    std::atomic<size_t> bytes;
+};
+
+static void* prefetch_worker(void* arg){
+    prefetch_state* p = (prefetch_state*)arg;
+    filecache* cache = filecache::instance();
+    std::string path;
+    for(size_t i = p -> next++;i < p -> files.size();i = p -> next++){
+        path.assign(*p -> root);
+        path.append(p -> files[i] -> url);
+        filecache::entry* e = cache -> acquire(path.c_str());
+        if(!e){
+            continue;
+        }
+        size_t size = e -> st.st_size;
+        //映射的文件建立页表(相当于mmap时的MAP_POPULATE，filecache的映射已经建好，只能事后补)，只缓存fd的大文件读进页缓存
+        if(e -> addr){
+            if(madvise(e -> addr,size,MADV_POPULATE_READ) != 0){
+                madvise(e -> addr,size,MADV_WILLNEED);
+            }
+        }
+        else if(e -> fd >= 0){
+            readahead(e -> fd,0,size);
+        }
+        cache -> release(e);
+        ++p -> count;
+        p -> bytes += size;
+    }
+    return NULL;
+}
+
+static bool write_all(int fd,const void* data,size_t len){
+    const char* p = (const char*)data;
+    while(len > 0){
+        ssize_t n = write(fd,p,len);
+        if(n < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+docindex::docindex():
+    m_threads(1),m_interval(0)
+{
+}
+
+docindex::~docindex(){
+}
+
+docindex* docindex::instance(){
+    static docindex index;
+    return &index;
+}
+
+bool docindex::build(const char* root,const char* snapshot,int threads){
+    uint64_t start = stats_now_ns();
+    m_root = root;
+    m_snapshot = snapshot ? snapshot : "";
+    m_threads = threads > 0 ? threads : 1;
+    if(m_root.size() >= sizeof(((snapshot_header*)0) -> root)){
+        LOG_WARN("doc root %s too long for the index snapshot, not saving it",root);
+        m_snapshot.clear();
+    }
+    if(!m_snapshot.empty() && load(m_snapshot.c_str())){
+        long load_ms = elapsed_ms(start);
+        size_t loaded = m_records.size();
+        int changed = 0;
+        int gone = 0;
+        revalidate(m_threads,&changed,&gone);
+        LOG_INFO("doc index: loaded %lu files in %ld ms, revalidated in %ld ms (%d changed, %d gone)",
+            (unsigned long)loaded,load_ms,elapsed_ms(start) - load_ms,changed,gone);
+        if(changed || gone){
+            save();
+        }
+        return true;
+    }
+    if(!walk(m_threads)){
+        LOG_ERROR("doc index: cannot read %s, errno is: %d",root,errno);
+        return false;
+    }
+    LOG_INFO("doc index: walked %lu files in %ld ms with %d threads",(unsigned long)m_records.size(),elapsed_ms(start),m_threads);
+    if(!m_snapshot.empty()){
+        save();
+    }
+    return true;
+}
+
+bool docindex::walk(int threads){
+    walk_state w;
+    w.root = &m_root;
+    w.dirs.push_back("");
+    w.busy = 0;
+    w.root_failed = false;
+    run_parallel(walk_worker,&w,threads);
+    if(w.root_failed){
+        return false;
+    }
+    m_records.swap(w.records);
+    return true;
+}
+
+void docindex::revalidate(int threads,int* changed,int* gone){
+    revalidate_state v;
+    v.root = &m_root;
+    v.records = &m_records;
+    v.gone.assign(m_records.size(),0);
+    v.next = 0;
+    v.changed = 0;
+    run_parallel(revalidate_worker,&v,threads);
+    size_t kept = 0;
+    for(size_t i = 0;i < m_records.size();++i){
+        if(!v.gone[i]){
+            if(kept != i){
+                m_records[kept] = std::move(m_records[i]);
+            }
+            ++kept;
+        }
+    }
+    *gone = (int)(m_records.size() - kept);
+    *changed = v.changed;
+    m_records.resize(kept);
+}
+
+bool docindex::load(const char* path){
+    int fd = open(path,O_RDONLY | O_CLOEXEC);
+    if(fd < 0){
+        return false;
+    }
+    struct stat st;
+    if(fstat(fd,&st) != 0 || (size_t)st.st_size < sizeof(snapshot_header)){
+        close(fd);
+        LOG_WARN("doc index snapshot %s is unusable, walking %s",path,m_root.c_str());
+        return false;
+    }
+    size_t size = st.st_size;
+    void* addr = mmap(NULL,size,PROT_READ,MAP_PRIVATE,fd,0);
+    close(fd);
+    if(addr == MAP_FAILED){
+        return false;
+    }
+    const char* base = (const char*)addr;
+    const snapshot_header* h = (const snapshot_header*)base;
+    bool ok = memcmp(h -> magic,SNAPSHOT_MAGIC,sizeof(SNAPSHOT_MAGIC)) == 0 && h -> version == SNAPSHOT_VERSION
+        && h -> total == size && h -> root[sizeof(h -> root) - 1] == '\0' && m_root == h -> root
+        && h -> strings >= sizeof(snapshot_header) + (uint64_t)h -> count * sizeof(snapshot_record) && h -> strings <= size;
+    if(ok){
+        const snapshot_record* recs = (const snapshot_record*)(base + sizeof(snapshot_header));
+        const char* strings = base + h -> strings;
+        uint64_t strings_len = size - h -> strings;
+        m_records.resize(h -> count);
+        for(uint32_t i = 0;i < h -> count;++i){
+            const snapshot_record& s = recs[i];
+            if(s.url_off > strings_len || s.url_len == 0 || s.url_len > strings_len - s.url_off || strings[s.url_off] != '/'){
+                ok = false;
+                break;
+            }
+            record& r = m_records[i];
+            r.url.assign(strings + s.url_off,s.url_len);
+            r.size = s.size;
+            r.mtime.tv_sec = s.mtime_sec;
+            r.mtime.tv_nsec = s.mtime_nsec;
+            r.ino = s.ino;
+            r.hits = s.hits;
+        }
+    }
+    munmap(addr,size);
+    if(!ok){
+        m_records.clear();
+        LOG_WARN("doc index snapshot %s is unusable, walking %s",path,m_root.c_str());
+    }
+    return ok;
+}
+
+bool docindex::save(){
+    std::vector<snapshot_record> recs(m_records.size());
+    std::string strings;
+    for(size_t i = 0;i < m_records.size();++i){
+        const record& r = m_records[i];
+        snapshot_record& s = recs[i];
+        s.url_off = strings.size();
+        s.url_len = r.url.size();
+        s.reserved = 0;
+        s.size = r.size;
+        s.mtime_sec = r.mtime.tv_sec;
+        s.mtime_nsec = r.mtime.tv_nsec;
+        s.ino = r.ino;
+        s.hits = r.hits;
+        strings.append(r.url);
+    }
+    snapshot_header h;
+    memset(&h,0,sizeof(h));
+    memcpy(h.magic,SNAPSHOT_MAGIC,sizeof(SNAPSHOT_MAGIC));
+    h.version = SNAPSHOT_VERSION;
+    h.count = recs.size();
+    h.strings = sizeof(h) + recs.size() * sizeof(snapshot_record);
+    h.total = h.strings + strings.size();
+    strncpy(h.root,m_root.c_str(),sizeof(h.root) - 1);
+
+    //写完整的临时文件再rename，启动时读到的要么是旧快照要么是新快照
+    //快照只是加速手段，不fsync：掉电后快照损坏或者丢失时下次启动重新遍历
+    std::string tmp = m_snapshot + ".tmp";
+    int fd = open(tmp.c_str(),O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,0644);
+    bool ok = fd >= 0 && write_all(fd,&h,sizeof(h)) && write_all(fd,recs.data(),recs.size() * sizeof(snapshot_record))
+        && write_all(fd,strings.data(),strings.size());
+    if(fd >= 0){
+        close(fd);
+    }
+    if(ok){
+        ok = rename(tmp.c_str(),m_snapshot.c_str()) == 0;
+    }
+    if(!ok){
+        LOG_WARN("cannot write doc index snapshot %s, errno is: %d",m_snapshot.c_str(),errno);
+        unlink(tmp.c_str());
+    }
+    return ok;
+}
+
+void docindex::prefetch(size_t budget,int threads){
+    uint64_t start = stats_now_ns();
+    //访问次数多的优先；次数相同(包括第一次启动都为0)时小文件优先，同样的预算能覆盖更多的请求
+    std::vector<const record*> order(m_records.size());
+    for(size_t i = 0;i < m_records.size();++i){
+        order[i] = &m_records[i];
+    }
+    std::sort(order.begin(),order.end(),[](const record* a,const record* b){
+        return a -> hits != b -> hits ? a -> hits > b -> hits : a -> size < b -> size;
+    });
+    //映射的字节数不超过预算，预取时文件缓存就不会淘汰刚预取的文件；只缓存fd的大文件另外按读进页缓存的字节数计算
+    prefetch_state p;
+    p.root = &m_root;
+    p.next = 0;
+    p.count = 0;
+    p.bytes = 0;
+    size_t threshold = filecache::instance() -> fd_threshold();
+    size_t mapped = 0;
+    size_t cached = 0;
+    for(size_t i = 0;i < order.size();++i){
+        size_t size = order[i] -> size;
+        bool big = size >= threshold;
+        size_t map_cost = big ? 4096 : size;     //和filecache计入预算的方式一致
+        size_t read_cost = big ? size : 0;
+        if(mapped + map_cost > budget || cached + read_cost > budget){
+            continue;
+        }
+        mapped += map_cost;
+        cached += read_cost;
+        p.files.push_back(order[i]);
+    }
+    run_parallel(prefetch_worker,&p,threads);
+    LOG_INFO("doc index: prefetched %d files, %lu KB in %ld ms",(int)p.count,(unsigned long)(p.bytes >> 10),elapsed_ms(start));
+}
+
+void docindex::collect_hits(){
+    std::unordered_map<std::string,unsigned long> hits;
+    filecache::instance() -> collect_hits(hits);
+    respcache::instance() -> collect_hits(hits);
+    //缓存的键是规范化的doc_root加上规范化的URL(main中realpath，http_conn中normalize_path)，和m_root + url逐字节相同
+    std::string path;
+    for(size_t i = 0;i < m_records.size();++i){
+        record& r = m_records[i];
+        path.assign(m_root);
+        path.append(r.url);
+        std::unordered_map<std::string,unsigned long>::iterator it = hits.find(path);
+        //旧的访问次数减半，最近一段时间的访问占主要
+        r.hits = r.hits / 2 + (it != hits.end() ? it -> second : 0);
+    }
+}
+
+bool docindex::start_refresh(int interval){
+    if(interval <= 0 || m_snapshot.empty()){
+        return true;
+    }
+    m_interval = interval;
+    if(pthread_create(&m_thread,NULL,refresh_worker,this) != 0){
+        return false;
+    }
+    return pthread_detach(m_thread) == 0;
+}
+
+//后台单线程重新遍历，不和工作线程抢CPU；新的索引沿用旧索引中同一路径的访问次数
+void* docindex::refresh_worker(void* arg){
+    docindex* index = (docindex*)arg;
+    while(true){
+        sleep(index -> m_interval);
+        std::vector<record> old;
+        old.swap(index -> m_records);
+        if(!index -> walk(1)){
+            index -> m_records.swap(old);
+            continue;
+        }
+        std::unordered_map<std::string,unsigned long> hits;
+        for(size_t i = 0;i < old.size();++i){
+            if(old[i].hits){
+                hits[old[i].url] = old[i].hits;
+            }
+        }
+        for(size_t i = 0;i < index -> m_records.size();++i){
+            record& r = index -> m_records[i];
+            std::unordered_map<std::string,unsigned long>::iterator it = hits.find(r.url);
+            if(it != hits.end()){
+                r.hits = it -> second;
+            }
+        }
+        index -> collect_hits();
+        index -> save();
+    }
+    return NULL;
+}
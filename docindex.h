@@ -0,0 +1,55 @@
+#ifndef DOCINDEX_H
+#define DOCINDEX_H
+
+#include<sys/types.h>
+#include<time.h>
+#include<pthread.h>
+#include<string>
+#include<vector>
+
+//doc_root的路径索引，用于启动预热(-W)：重启之后的第一批请求不再为冷的stat和缺页付出代价
+//启动时载入上次保存的快照，只在多个线程中重新stat比较mtime/大小/inode；没有可用的快照时多个线程并行遍历doc_root
+//之后按访问次数从高到低预取：经过文件缓存的小文件映射后用MADV_POPULATE_READ建立页表，大文件缓存fd并readahead进页缓存
+//快照可以直接mmap：定长的头、定长的记录数组、路径字符串表，载入时不需要解析
+//索引只用于预热，不参与请求处理：不在索引中的文件照常处理，索引中有而已经删除的文件照常404
+class docindex{
+public:
+    struct record{
+        std::string url;        //相对doc_root的路径，以'/'开头
+        off_t size;
+        struct timespec mtime;
+        ino_t ino;
+        unsigned long hits;     //访问次数，每次刷新时减半再加上这段时间的访问
+    };
+
+public:
+    static docindex* instance();
+    //root是网站根目录，snapshot是快照文件(可以不存在)，threads是遍历和重新stat的线程数
+    //root不能打开时返回false
+    bool build(const char* root,const char* snapshot,int threads);
+    //按访问次数(相同时小文件优先)预取，映射的字节数和readahead的字节数各自不超过budget
+    void prefetch(size_t budget,int threads);
+    //把索引连同文件缓存和响应缓存中的访问次数写到快照，先写临时文件再rename
+    bool save();
+    //后台线程每interval秒重新遍历doc_root并保存快照，新增的文件下次启动时也能预热
+    bool start_refresh(int interval);
+
+private:
+    docindex();
+    ~docindex();
+    bool load(const char* path);               //载入快照，格式不对或者根目录不同返回false
+    void revalidate(int threads,int* changed,int* gone);   //重新stat快照中的文件，去掉已经不存在的
+    bool walk(int threads);                    //并行遍历m_root
+    void collect_hits();                       //把缓存中的访问次数合并到记录中
+    static void* refresh_worker(void* arg);
+
+private:
+    std::string m_root;
+    std::string m_snapshot;
+    std::vector<record> m_records;   //启动之后只由刷新线程修改
+    int m_threads;
+    int m_interval;
+    pthread_t m_thread;
+};
+
+#endif
@@ -0,0 +1,325 @@
+#include<sys/inotify.h>
+#include<sys/mman.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<errno.h>
+#include<stdio.h>
+#include"filecache.h"
+#include"respcache.h"
+#include"log.h"
+
+filecache::filecache():
+    m_lru_head(NULL),m_lru_tail(NULL),m_budget(0),m_fd_threshold(0),m_bytes(0),m_inotify_fd(-1)
+{
+}
+
+filecache::~filecache(){
+}
+
+//进程内只有一个缓存，所有工作线程共享
+filecache* filecache::instance(){
+    static filecache cache;
+    return &cache;
+}
+
+bool filecache::init(const char* root,size_t budget,size_t fd_threshold){
+    m_budget = budget;
+    m_fd_threshold = fd_threshold;
+    if(budget == 0){    //预算为0表示关闭缓存
+        return true;
+    }
+    m_inotify_fd = inotify_init1(IN_CLOEXEC);
+    if(m_inotify_fd < 0){
+        return false;
+    }
+    m_locker.lock();
+    watch_dir(root);
+    m_locker.unlock();
+    if(pthread_create(&m_thread,NULL,worker,this) != 0){
+        return false;
+    }
+    return pthread_detach(m_thread) == 0;
+}
+
+filecache::entry* filecache::acquire(const char* path){
+    if(m_budget == 0){
+        return NULL;
+    }
+    m_locker.lock();
+    std::unordered_map<std::string,entry*>::iterator it = m_table.find(path);
+    if(it != m_table.end()){
+        entry* e = it -> second;
+        e -> refs++;
+        //其他线程正在加载同一个文件，等它加载完，不重复加载
+        while(e -> loading){
+            m_loaded.wait(m_locker.get());
+        }
+        if(!e -> linked){    //加载失败，或者加载期间已经失效
+            if(--e -> refs == 0){
+                destroy(e);
+            }
+            m_locker.unlock();
+            return NULL;
+        }
+        //命中，移到LRU表头
+        ++e -> hits;
+        lru_unlink(e);
+        lru_push_front(e);
+        m_locker.unlock();
+        return e;
+    }
+
+    //未命中，先占位，其他线程看到loading后等待
+    entry* e = new entry;
+    e -> path = path;
+    e -> addr = NULL;
+    e -> fd = -1;
+    e -> refs = 1;
+    e -> hits = 0;
+    e -> loading = true;
+    e -> linked = true;
+    e -> prev = e -> next = NULL;
+    m_table[e -> path] = e;
+    //在开始加载之前监听所在的目录，加载期间文件被修改或者被替换时占位的缓存项被摘掉，下面按失效处理
+    watch_dir(e -> path.substr(0,e -> path.rfind('/')));
+    m_locker.unlock();
+
+    //加载过程不持有锁
+    bool ok = false;
+    if(stat(path,&e -> st) == 0 && S_ISREG(e -> st.st_mode) && (e -> st.st_mode & S_IROTH)
+        && cost(e) <= m_budget){
+        if(e -> st.st_size == 0){
+            ok = true;
+        }
+        else if((size_t)e -> st.st_size >= m_fd_threshold){
+            e -> fd = open(path,O_RDONLY | O_CLOEXEC);
+            ok = e -> fd >= 0;
+        }
+        else{
+            int fd = open(path,O_RDONLY);
+            if(fd >= 0){
+                void* addr = mmap(0,e -> st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+                close(fd);
+                if(addr != MAP_FAILED){
+                    e -> addr = (char*)addr;
+                    ok = true;
+                }
+            }
+        }
+    }
+
+    m_locker.lock();
+    if(!ok || !e -> linked){
+        if(e -> linked){
+            remove(e);
+        }
+        e -> loading = false;
+        m_loaded.broadcast();
+        if(--e -> refs == 0){
+            destroy(e);
+        }
+        m_locker.unlock();
+        return NULL;
+    }
+    evict(cost(e));
+    m_bytes += cost(e);
+    lru_push_front(e);
+    e -> loading = false;
+    m_loaded.broadcast();
+    m_locker.unlock();
+    return e;
+}
+
+void filecache::release(entry* e){
+    m_locker.lock();
+    if(--e -> refs == 0 && !e -> linked){
+        destroy(e);
+    }
+    m_locker.unlock();
+}
+
+void filecache::collect_hits(std::unordered_map<std::string,unsigned long>& hits){
+    m_locker.lock();
+    for(std::unordered_map<std::string,entry*>::iterator it = m_table.begin();it != m_table.end();++it){
+        entry* e = it -> second;
+        if(e -> hits){
+            hits[e -> path] += e -> hits;
+            e -> hits = 0;
+        }
+    }
+    m_locker.unlock();
+}
+
+void filecache::lru_unlink(entry* e){
+    if(e -> prev){
+        e -> prev -> next = e -> next;
+    }
+    else{
+        m_lru_head = e -> next;
+    }
+    if(e -> next){
+        e -> next -> prev = e -> prev;
+    }
+    else{
+        m_lru_tail = e -> prev;
+    }
+    e -> prev = e -> next = NULL;
+}
+
+void filecache::lru_push_front(entry* e){
+    e -> prev = NULL;
+    e -> next = m_lru_head;
+    if(m_lru_head){
+        m_lru_head -> prev = e;
+    }
+    m_lru_head = e;
+    if(!m_lru_tail){
+        m_lru_tail = e;
+    }
+}
+
+void filecache::remove(entry* e){
+    m_table.erase(e -> path);
+    e -> linked = false;
+    if(!e -> loading){    //加载中的缓存项还没有进入LRU，也没有计入字节数
+        lru_unlink(e);
+        m_bytes -= cost(e);
+    }
+}
+
+void filecache::destroy(entry* e){
+    if(e -> addr){
+        munmap(e -> addr,e -> st.st_size);
+    }
+    if(e -> fd != -1){
+        close(e -> fd);
+    }
+    delete e;
+}
+
+//映射的文件按文件大小计入预算，只缓存fd的大文件按一个页计入，使它们也能被LRU淘汰
+size_t filecache::cost(const entry* e){
+    if((size_t)e -> st.st_size >= instance() -> m_fd_threshold){
+        return 4096;
+    }
+    return e -> st.st_size;
+}
+
+//从LRU尾部开始淘汰，正在被发送(引用不为0)的缓存项跳过
+void filecache::evict(size_t need){
+    entry* e = m_lru_tail;
+    while(e && m_bytes + need > m_budget){
+        entry* prev = e -> prev;
+        if(e -> refs == 0){
+            remove(e);
+            destroy(e);
+        }
+        e = prev;
+    }
+}
+
+void filecache::watch_dir(const std::string& dir){
+    if(m_watched.count(dir)){
+        return;
+    }
+    int wd = inotify_add_watch(m_inotify_fd,dir.c_str(),
+        IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF);
+    if(wd >= 0){
+        m_watches[wd].insert(dir);
+        m_watched[dir] = wd;
+    }
+}
+
+//使path对应的缓存项失效；path是目录时，使该目录下所有的缓存项失效
+void filecache::invalidate(const std::string& path,bool is_dir){
+    //小文件的完整响应也是由这些文件生成的
+    respcache::instance() -> invalidate(path,is_dir);
+    std::unordered_map<std::string,entry*>::iterator it = m_table.find(path);
+    if(it != m_table.end()){
+        entry* e = it -> second;
+        remove(e);
+        if(e -> refs == 0){
+            destroy(e);
+        }
+    }
+    if(!is_dir){
+        return;
+    }
+    std::string prefix = path + "/";
+    for(it = m_table.begin();it != m_table.end();){
+        entry* e = it -> second;
+        ++it;
+        if(e -> path.compare(0,prefix.size(),prefix) == 0){
+            remove(e);
+            if(e -> refs == 0){
+                destroy(e);
+            }
+        }
+    }
+}
+
+//inotify的事件队列溢出时不知道丢了哪些事件，所有缓存项和完整响应都失效
+void filecache::invalidate_all(){
+    respcache::instance() -> invalidate_all();
+    for(std::unordered_map<std::string,entry*>::iterator it = m_table.begin();it != m_table.end();){
+        entry* e = it -> second;
+        ++it;
+        remove(e);
+        if(e -> refs == 0){
+            destroy(e);
+        }
+    }
+}
+
+void* filecache::worker(void* arg){
+    filecache* cache = (filecache*)arg;
+    cache -> run();
+    return cache;
+}
+
+//inotify线程，阻塞读取文件变化事件
+void filecache::run(){
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while(true){
+        ssize_t len = read(m_inotify_fd,buf,sizeof(buf));
+        if(len <= 0){
+            if(len < 0 && errno == EINTR){
+                continue;
+            }
+            LOG_ERROR("inotify read failure, errno is: %d",errno);
+            return;
+        }
+        m_locker.lock();
+        for(char* p = buf;p < buf + len;p += sizeof(struct inotify_event) + ((struct inotify_event*)p) -> len){
+            struct inotify_event* ev = (struct inotify_event*)p;
+            if(ev -> mask & IN_Q_OVERFLOW){    //溢出事件的wd是-1
+                LOG_WARN("inotify queue overflow, drop all cached files");
+                invalidate_all();
+                continue;
+            }
+            std::map<int,std::set<std::string> >::iterator it = m_watches.find(ev -> wd);
+            if(it == m_watches.end()){
+                continue;
+            }
+            const std::set<std::string>& dirs = it -> second;
+            //目录本身被删除/移走，目录下的缓存项全部失效；移走的目录不再监听，以后按新路径重新加watch
+            if(ev -> mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)){
+                for(std::set<std::string>::const_iterator d = dirs.begin();d != dirs.end();++d){
+                    invalidate(*d,true);
+                    m_watched.erase(*d);
+                }
+                if(ev -> mask & IN_MOVE_SELF){
+                    inotify_rm_watch(m_inotify_fd,ev -> wd);
+                }
+                m_watches.erase(it);
+                continue;
+            }
+            if(ev -> len > 0){
+                for(std::set<std::string>::const_iterator d = dirs.begin();d != dirs.end();++d){
+                    invalidate(*d + "/" + ev -> name,(ev -> mask & IN_ISDIR) != 0);
+                }
+            }
+        }
+        m_locker.unlock();
+    }
+}
@@ -0,0 +1,83 @@
+#ifndef FILECACHE_H
+#define FILECACHE_H
+
+#include<sys/stat.h>
+#include<sys/types.h>
+#include<pthread.h>
+#include<string>
+#include<map>
+#include<set>
+#include<unordered_map>
+#include"locker.h"
+
+//进程内共享的打开文件/内存映射缓存
+//以请求文件的完整路径(doc_root + url)为键，保存stat结果和一份只读的共享映射，命中时do_request无需再stat/open/mmap/munmap
+//缓存项带引用计数，正在发送的响应持有引用，被淘汰或失效的缓存项要等最后一个引用释放后才munmap
+//按字节预算做LRU淘汰，通过inotify监听doc_root下的目录，文件被修改/删除/移动时使缓存项失效
+//不小于fd_threshold的大文件不做映射，只缓存一个打开的只读fd，供sendfile按偏移发送(带偏移的sendfile不改变文件位置，多个连接可以共用)
+//多个线程同时未命中同一个文件时，只有一个线程去加载，其他线程等待加载结果
+//inotify同时使respcache中由这些文件生成的完整响应失效，respcache只缓存经过本缓存加载的文件(所在目录一定被监听)
+class filecache{
+public:
+    struct entry{
+        std::string path;     //键，文件的完整路径
+        struct stat st;       //加载时的文件状态
+        char* addr;           //只读映射的起始地址，空文件和大文件为NULL
+        int fd;               //大文件的只读fd，映射的文件为-1
+        int refs;             //引用计数，由缓存的互斥锁保护
+        unsigned long hits;   //命中次数，由缓存的互斥锁保护，docindex保存快照时取走
+        bool loading;         //正在加载中，其他线程等待
+        bool linked;          //是否还在哈希表中(被淘汰/失效后为false)
+        entry* prev;          //LRU双向链表，表头是最近使用的
+        entry* next;
+    };
+
+public:
+    static filecache* instance();
+    //root是网站根目录，budget是缓存的映射字节数上限，不小于fd_threshold的文件只缓存fd，创建inotify线程
+    bool init(const char* root,size_t budget,size_t fd_threshold);
+    //获取path对应的缓存项并增加引用计数；文件不存在、不可读、不是普通文件或超过预算时返回NULL，由调用者走不缓存的路径
+    entry* acquire(const char* path);
+    //释放acquire得到的引用
+    void release(entry* e);
+    //把每个缓存项的命中次数按路径累加到hits中并清零，docindex据此决定下次启动时预取哪些文件
+    void collect_hits(std::unordered_map<std::string,unsigned long>& hits);
+    //不小于该大小的文件只缓存fd
+    size_t fd_threshold() const{return m_fd_threshold;}
+
+private:
+    filecache();
+    ~filecache();
+    //inotify线程函数
+    static void* worker(void* arg);
+    void run();
+    //以下函数调用时都要持有m_locker
+    void lru_unlink(entry* e);
+    void lru_push_front(entry* e);
+    void remove(entry* e);              //从哈希表和LRU中摘掉，引用为0时释放
+    void destroy(entry* e);             //munmap并释放
+    void evict(size_t need);            //淘汰LRU尾部未被引用的缓存项，直到能放下need字节
+    void watch_dir(const std::string& dir);
+    void invalidate(const std::string& path,bool is_dir);
+    void invalidate_all();
+    static size_t cost(const entry* e);  //缓存项占用的预算字节数
+
+private:
+    std::unordered_map<std::string,entry*> m_table;
+    entry* m_lru_head;
+    entry* m_lru_tail;
+    size_t m_budget;      //字节预算
+    size_t m_fd_threshold;   //不小于该大小的文件不映射，只缓存fd
+    size_t m_bytes;       //当前缓存项(仍在表中)的映射字节数
+    locker m_locker;      //保护上面所有成员
+    cond m_loaded;        //加载完成时广播，唤醒等待同一个文件的线程
+
+    int m_inotify_fd;
+    //inotify watch描述符 -> 目录的所有写法：符号链接指向的目录和目录本身是同一个inode，inotify_add_watch返回同一个wd，
+    //缓存项的路径可能是其中任何一种，事件到来时每种写法下的文件都要失效
+    std::map<int,std::set<std::string> > m_watches;
+    std::unordered_map<std::string,int> m_watched;   //已经加过watch的目录 -> wd
+    pthread_t m_thread;
+};
+
+#endif
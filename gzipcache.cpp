@@ -0,0 +1,215 @@
+#include<stdlib.h>
+#include<string.h>
+#include<zlib.h>
+#include"gzipcache.h"
+#include"log.h"
+
+gzipcache::gzipcache():
+    m_lru_head(NULL),m_lru_tail(NULL),m_budget(0),m_bytes(0),m_level(Z_DEFAULT_COMPRESSION)
+{
+}
+
+gzipcache::~gzipcache(){
+}
+
+//进程内只有一个压缩缓存，所有工作线程共享
+gzipcache* gzipcache::instance(){
+    static gzipcache cache;
+    return &cache;
+}
+
+void gzipcache::init(size_t budget,int level){
+    m_budget = budget;
+    m_level = level;
+}
+
+//缓存项记录的文件版本和st相同
+static bool same_version(const gzipcache::entry* e,const struct stat& st){
+    return e -> mtime.tv_sec == st.st_mtim.tv_sec && e -> mtime.tv_nsec == st.st_mtim.tv_nsec
+        && e -> size == st.st_size && e -> ino == st.st_ino;
+}
+
+gzipcache::entry* gzipcache::find(const char* path,const struct stat& st){
+    std::unordered_map<std::string,entry*>::iterator it = m_table.find(path);
+    if(it == m_table.end()){
+        return NULL;
+    }
+    entry* e = it -> second;
+    if(e -> loading || !same_version(e,st)){
+        return NULL;
+    }
+    e -> refs++;
+    lru_unlink(e);
+    lru_push_front(e);
+    return e;
+}
+
+gzipcache::entry* gzipcache::lookup(const char* path,const struct stat& st){
+    if(m_budget == 0){
+        return NULL;
+    }
+    m_locker.lock();
+    entry* e = find(path,st);
+    m_locker.unlock();
+    return e;
+}
+
+gzipcache::entry* gzipcache::acquire(const char* path,const struct stat& st,const char* data,size_t len){
+    if(m_budget == 0){
+        return NULL;
+    }
+    m_locker.lock();
+    while(true){
+        entry* e = find(path,st);
+        if(e){
+            m_locker.unlock();
+            return e;
+        }
+        std::unordered_map<std::string,entry*>::iterator it = m_table.find(path);
+        if(it == m_table.end()){
+            break;
+        }
+        //其他线程正在压缩这个文件，等它压缩完再查一次
+        if(it -> second -> loading){
+            m_loaded.wait(m_locker.get());
+            continue;
+        }
+        //旧版本的压缩结果，摘掉后重新压缩
+        remove(it -> second);
+    }
+
+    //未命中，先占位，其他线程看到loading后等待
+    entry* e = new entry;
+    e -> path = path;
+    e -> mtime = st.st_mtim;
+    e -> size = st.st_size;
+    e -> ino = st.st_ino;
+    e -> data = NULL;
+    e -> len = 0;
+    e -> refs = 1;
+    e -> loading = true;
+    e -> linked = true;
+    e -> prev = e -> next = NULL;
+    m_table[e -> path] = e;
+    m_locker.unlock();
+
+    //压缩过程不持有锁
+    e -> data = compress(data,len,&e -> len);
+
+    m_locker.lock();
+    //比整个预算还大的结果不进缓存，只给这一次请求用，发送完后释放
+    if(e -> linked && cost(e) > m_budget){
+        remove(e);
+    }
+    e -> loading = false;
+    if(e -> linked){
+        evict(cost(e));
+        m_bytes += cost(e);
+        lru_push_front(e);
+    }
+    m_loaded.broadcast();
+    m_locker.unlock();
+    return e;
+}
+
+void gzipcache::release(entry* e){
+    m_locker.lock();
+    if(--e -> refs == 0 && !e -> linked){
+        destroy(e);
+    }
+    m_locker.unlock();
+}
+
+void gzipcache::lru_unlink(entry* e){
+    if(e -> prev){
+        e -> prev -> next = e -> next;
+    }
+    else{
+        m_lru_head = e -> next;
+    }
+    if(e -> next){
+        e -> next -> prev = e -> prev;
+    }
+    else{
+        m_lru_tail = e -> prev;
+    }
+    e -> prev = e -> next = NULL;
+}
+
+void gzipcache::lru_push_front(entry* e){
+    e -> prev = NULL;
+    e -> next = m_lru_head;
+    if(m_lru_head){
+        m_lru_head -> prev = e;
+    }
+    m_lru_head = e;
+    if(!m_lru_tail){
+        m_lru_tail = e;
+    }
+}
+
+void gzipcache::remove(entry* e){
+    m_table.erase(e -> path);
+    e -> linked = false;
+    if(!e -> loading){    //压缩中的缓存项还没有进入LRU，也没有计入字节数
+        lru_unlink(e);
+        m_bytes -= cost(e);
+        if(e -> refs == 0){
+            destroy(e);
+        }
+    }
+}
+
+void gzipcache::destroy(entry* e){
+    free(e -> data);
+    delete e;
+}
+
+//压缩结果按字节数计入预算，不压缩的记录按一个很小的固定值计入，使它们也能被LRU淘汰
+size_t gzipcache::cost(const entry* e){
+    return e -> data ? e -> len : 64;
+}
+
+//从LRU尾部开始淘汰，正在被发送(引用不为0)的缓存项跳过
+void gzipcache::evict(size_t need){
+    entry* e = m_lru_tail;
+    while(e && m_bytes + need > m_budget){
+        entry* prev = e -> prev;
+        if(e -> refs == 0){
+            remove(e);
+        }
+        e = prev;
+    }
+}
+
+//gzip格式(windowBits 15 + 16)，一次deflate完成，输出缓冲区按deflateBound申请
+char* gzipcache::compress(const char* data,size_t len,size_t* out_len){
+    z_stream zs;
+    memset(&zs,0,sizeof(zs));
+    if(deflateInit2(&zs,m_level,Z_DEFLATED,15 + 16,8,Z_DEFAULT_STRATEGY) != Z_OK){
+        LOG_ERROR("deflateInit2 failure");
+        return NULL;
+    }
+    size_t bound = deflateBound(&zs,len);
+    char* out = (char*)malloc(bound);
+    if(!out){
+        deflateEnd(&zs);
+        return NULL;
+    }
+    zs.next_in = (Bytef*)data;
+    zs.avail_in = len;
+    zs.next_out = (Bytef*)out;
+    zs.avail_out = bound;
+    int ret = deflate(&zs,Z_FINISH);
+    *out_len = zs.total_out;
+    deflateEnd(&zs);
+    //压缩后没有变小(已经压缩过的内容，或者很短的文件)，不如直接发送原文件
+    if(ret != Z_STREAM_END || *out_len >= len){
+        free(out);
+        *out_len = 0;
+        return NULL;
+    }
+    //多申请的空间还给分配器，缓存中按实际长度计算
+    char* shrunk = (char*)realloc(out,*out_len);
+    return shrunk ? shrunk : out;
+}
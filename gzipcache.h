@@ -0,0 +1,68 @@
+#ifndef GZIPCACHE_H
+#define GZIPCACHE_H
+
+#include<sys/stat.h>
+#include<sys/types.h>
+#include<string>
+#include<unordered_map>
+#include"locker.h"
+
+//进程内共享的gzip压缩结果缓存
+//以文件的完整路径为键，记录压缩时文件的mtime/大小/inode，文件变化后旧的压缩结果不再使用，下次请求时重新压缩
+//每个文件只在第一次被请求时压缩一次，多个线程同时请求同一个文件时只有一个线程压缩，其他线程等待结果
+//压缩后没有变小的文件也记录下来(data为NULL)，之后不再尝试压缩
+//缓存项带引用计数，正在发送的响应持有引用；按压缩后的字节数做LRU淘汰
+class gzipcache{
+public:
+    struct entry{
+        std::string path;     //键，文件的完整路径
+        struct timespec mtime;//压缩时文件的状态，和请求时的stat结果比较
+        off_t size;
+        ino_t ino;
+        char* data;           //gzip格式的压缩结果，压缩后没有变小时为NULL
+        size_t len;
+        int refs;             //引用计数，由缓存的互斥锁保护
+        bool loading;         //正在压缩，其他线程等待
+        bool linked;          //是否还在哈希表中(被淘汰/替换后为false)
+        entry* prev;          //LRU双向链表，表头是最近使用的
+        entry* next;
+    };
+
+public:
+    static gzipcache* instance();
+    //budget是压缩结果的字节预算，0表示不做动态压缩；level是zlib的压缩级别
+    void init(size_t budget,int level);
+    bool enabled() const{return m_budget > 0;}
+    //只查找，不压缩：有st对应版本的压缩结果时增加引用计数并返回，否则返回NULL
+    entry* lookup(const char* path,const struct stat& st);
+    //查找，没有时压缩data(文件的全部内容)并放进缓存；压缩失败返回NULL
+    //返回的缓存项data为NULL表示不值得压缩，同样要release
+    entry* acquire(const char* path,const struct stat& st,const char* data,size_t len);
+    void release(entry* e);
+
+private:
+    gzipcache();
+    ~gzipcache();
+    //以下函数调用时都要持有m_locker
+    entry* find(const char* path,const struct stat& st);   //命中时加引用并移到LRU表头
+    void lru_unlink(entry* e);
+    void lru_push_front(entry* e);
+    void remove(entry* e);              //从哈希表和LRU中摘掉，引用为0时释放
+    void evict(size_t need);            //淘汰LRU尾部未被引用的缓存项，直到能放下need字节
+    static void destroy(entry* e);
+    static size_t cost(const entry* e); //缓存项占用的预算字节数
+    //压缩成gzip格式，malloc申请结果；没有变小或者出错返回NULL
+    char* compress(const char* data,size_t len,size_t* out_len);
+
+private:
+    std::unordered_map<std::string,entry*> m_table;
+    entry* m_lru_head;
+    entry* m_lru_tail;
+    size_t m_budget;
+    size_t m_bytes;
+    int m_level;
+    locker m_locker;      //保护上面所有成员
+    cond m_loaded;        //压缩完成时广播，唤醒等待同一个文件的线程
+};
+
+#endif
@@ -1,20 +1,10 @@
 #include"http_conn.h"
+#include<netinet/tcp.h>
+#include"uring_reactor.h"
+#include"coro_reactor.h"
 
-//定义http响应的一些状态信息
-//200 OK
-//400 Bad Request--解析请求报文出现错误，语法错误
-//403 Forbidden--请求的内容没有访问/读权限或者是目录
-//404 Not Found--没有在服务器相关目录找到请求的文件
-//500 Internal Error--解析请求行时出现了一些其他的未知错误
-const char* ok_200_title = "OK";
-const char* error_400_title = "Bad Request";
-const char* error_400_form = "You request has had syntax or is inherently impossible to satisfy.\n";
-const char* error_403_title = "Forbidden";
-const char* error_403_form = "You do not have permission to get file from this server.\n";
-const char* error_404_title = "Not Found";
-const char* error_404_form = "The requested file was not found on this server.\n";
-const char* error_500_title = "Internal Error";
-const char* error_500_form = "There was an unusual problem serving the requested file.\n";
+//访问日志中的方法名，下标是METHOD
+static const char* method_names[] = {"GET","POST","HEAD","PUT","DELETE","TRACE","OPTIONS","CONNECT","PATCH"};
 //网站的根目录，所有请求的文件均存放在当前目录下
 const char* doc_root = "/var/www/html";
 
@@ -38,8 +28,8 @@ void addfd(int epollfd,int fd,bool one_shot){//向epoll例程中注册监视对
     if(one_shot){
         event.events |= EPOLLONESHOT;
     }
+    //fd由创建者设置成非阻塞：监听socket在open_listener中创建，连接由accept4直接得到
     epoll_ctl(epollfd,EPOLL_CTL_ADD,fd,&event);
-    setnonblocking(fd);
 }
 
 //从内核事件表中关闭该fd，同时close(fd)，关闭TCP连接
@@ -56,34 +46,114 @@ void modfd(int epollfd,int fd,int ev){//重置事件，更改文件描述符，
     epoll_ctl(epollfd,EPOLL_CTL_MOD,fd,&event);
 }
 
-int http_conn :: m_user_count = 0;//用户数量
-int http_conn :: m_epollfd = -1;
+std::atomic<int> http_conn :: m_user_count(0);//用户数量
+off_t http_conn :: m_sendfile_threshold = 256 * 1024;
+//请求头20秒、请求体两次读之间60秒、长连接空闲75秒、等待可写60秒
+int http_conn :: m_timeout[4] = {20000,60000,75000,60000};
+//请求头最多32KB，请求体最多1MB
+int http_conn :: m_header_limit = 32 * 1024;
+int http_conn :: m_body_limit = 1024 * 1024;
 
 //关闭连接，移除fd，closefd，user_count--，客户数量一定要-1
 //重置当前的m_sockfd-套接字描述符
+//只在反应堆线程中调用(定时器也在反应堆线程中)
+//socket放在最后关闭：fd一关闭，其他反应堆就可能accept到同一个fd，开始使用users[fd]
 void http_conn :: close_conn(bool real_close){
     if(real_close && (m_sockfd != -1)){
-        removefd(m_epollfd,m_sockfd);
+        int fd = m_sockfd;
+        m_timers -> del(&m_timer);
         m_sockfd = -1;
         m_user_count--;//关闭一个连接时，将客户总量减1
+        unmap();    //发送到一半关闭的连接，也要释放映射/缓存引用
+        free_read_buf();
+        //协程挂起时被关闭(定时器到期)，销毁协程帧
+        if(m_coro){
+            m_coro -> cancel();
+        }
+        //转发中被关闭，后端连接不能再复用
+        if(m_upstream){
+            upstream_pool::abort(m_upstream);
+        }
+        m_proxy_pending = false;
+        free(m_proxy_head);
+        m_proxy_head = NULL;
+        if(m_ring){
+            m_ring -> close_fd(fd);
+        }
+        else{
+            removefd(m_epollfd,fd);
+        }
     }
 }
 
 //http_conn的初始化工作sockfd address，对端的ip地址
-void http_conn :: init(int sockfd,const sockaddr_in& addr){
+void http_conn :: init(int sockfd,const sockaddr_in& addr,int epollfd,timerwheel* timers,uring_reactor* ring,coro_slot* coro){
     m_sockfd = sockfd;
+    m_epollfd = epollfd;
+    m_ring = ring;
+    m_coro = coro;
+    m_timers = timers;
+    m_close_pending = false;
+    m_busy.store(0,std::memory_order_relaxed);
+    m_file_address = 0;
+    m_file_entry = NULL;
+    m_file_fd = -1;
+    m_corked = false;
     m_address = addr;
-    //以下两行为了避免TIME_WAIT状态--设置端口重用
-    int reuse = 1;
-    setsockopt(m_sockfd,SOL_SOCKET,SO_REUSEADDR,&reuse,sizeof(reuse));
-    //添加文件描述符
-    addfd(m_epollfd,sockfd,true);
+    //sockfd已经是非阻塞的(accept4)，端口重用在监听socket上设置；io_uring模式下由反应堆提交recv，不注册到epoll
+    if(!ring && !coro){
+        addfd(m_epollfd,sockfd,true);
+    }
     m_user_count++;
     
     init();
+    //新连接等待第一个请求，按请求头期限计时
+    m_timer.callback = on_timeout;
+    m_timer.data = this;
+    arm_timer(TIMER_HEADER);
+}
+
+void http_conn::rearm(int ev){
+    if(m_ring){
+        m_ring -> rearm(m_sockfd,ev);
+    }
+    else if(m_coro){
+        m_coro -> wanted = ev;
+    }
+    else{
+        modfd(m_epollfd,m_sockfd,ev);
+    }
+}
+
+void http_conn::arm_timer(TIMER_KIND kind){
+    m_timer_kind = kind;
+    m_timers -> add(&m_timer,m_timeout[kind]);
 }
-//初始化读/写缓冲区、主从状态机初始状态--这一定是新来客户连接，或者是处理完一次客户请求，长连接，不关闭，重新初始化操作
+
+//定时器到期：连接还在线程池中处理时推迟一个tick，否则关闭连接
+void http_conn::on_timeout(timer_node* node){
+    http_conn* conn = (http_conn*)node -> data;
+    if(conn -> m_busy.load(std::memory_order_acquire) > 0){
+        conn -> m_timers -> add(node,timerwheel::TICK_MS);
+        return;
+    }
+    //等后端的响应超时，还来得及回答504
+    if(conn -> m_upstream && upstream_pool::expire(conn -> m_upstream)){
+        return;
+    }
+    conn -> close_conn();
+}
+//初始化读/写缓冲区、主从状态机初始状态--新来的客户连接
 void http_conn::init(){
+    free_read_buf();
+    init_request();
+    reset_write();
+    m_need_parse = false;
+    m_proxy_pending = false;
+}
+
+//主从状态机初始状态--开始解析一个新的请求；长连接处理完一个请求后不关闭，由next_request调用
+void http_conn::init_request(){
     //主状态机初始化状态
     m_check_state = CHECK_STATE_REQUESTLINE;
     m_linger = false;    //默认是短连接
@@ -92,31 +162,113 @@ void http_conn::init(){
     m_url = 0;
     m_version = 0;
     m_content_length = 0;
+    m_content_type = NULL;
+    m_body_status = 200;
+    m_accept_gzip = false;
+    m_gzip = false;
+    m_vary = false;
+    m_range = NULL;
+    m_if_range = NULL;
+    m_resp_fill = false;
+    m_if_none_match = NULL;
+    m_if_modified_since = NULL;
+    m_expect_continue = false;
+    m_chunked_body = false;
+    m_backend = NULL;
+    free(m_proxy_head);
+    m_proxy_head = NULL;
+    m_proxy_head_len = 0;
+    m_proxy_body_left = 0;
+    m_etag_len = 0;
+    m_range_count = 0;
+    m_accept_ranges = false;
     m_host = 0;
+    m_parsed_before = 0;
+    m_request_bytes = 0;
+    m_header_bytes = 0;
+    m_read_limit = m_header_limit;
     //接收缓冲区起始行位置
     m_start_line = 0;
     //当前正在分析的字节位置
     m_checked_idx = 0;
-    //buffer中客户数据的尾部的下一字节
-    m_read_idx = 0;
-    m_write_idx = 0;
-    memset(m_read_buf,'\0',READ_BUFFER_SIZE);
-    memset(m_write_buf,'\0',WRITE_BUFFER_SIZE);
     memset(m_real_file,'\0',FILENAME_LEN);
 }
+
+//响应全部发送完后清空队列
+void http_conn::reset_write(){
+    unmap();
+    m_write_idx = 0;
+    m_chunk_count = 0;
+    m_chunk_pos = 0;
+    m_resp_count = 0;
+    m_close_after = false;
+    m_cork = false;
+    //上一批响应设置了TCP_CORK，现在都发完了，取消后内核立即发出剩下的不满一个MSS的数据
+    if(m_corked){
+        int off = 0;
+        setsockopt(m_sockfd,IPPROTO_TCP,TCP_CORK,&off,sizeof(off));
+        m_corked = false;
+    }
+}
+
+//流水线：客户端可以不等响应就连续发送多个请求，一次read可能读入了好几个请求
+//当前请求在读缓冲区中占m_header_bytes + m_content_length字节(请求总是从第一个分段的开头开始)，之后的数据属于下一个请求
+//剩余的数据一般只有几百字节，拷贝到新的分段链表中，保证下一个请求也从分段开头开始、每行都在一个分段内
+bool http_conn::next_request(){
+    long consumed = m_header_bytes + m_content_length;
+    long leftover = m_request_bytes - consumed;
+    buf_segment* old = m_seg_head;
+    m_seg_head = m_seg_cur = m_seg_tail = NULL;
+    m_read_buf = NULL;
+    m_read_idx = 0;
+    init_request();
+    bool ok = true;
+    for(buf_segment* seg = old;seg && leftover > 0;seg = seg -> next){
+        if(consumed >= seg -> len){
+            consumed -= seg -> len;
+            continue;
+        }
+        long n = seg -> len - consumed;
+        if(!append_read_buf(seg -> data + consumed,n)){
+            ok = false;
+            break;
+        }
+        leftover -= n;
+        consumed = 0;
+    }
+    bufpool::free_chain(old);
+    //下一个请求已经在缓冲区中了，从现在开始计时
+    m_request_start_ns = stats_now_ns();
+    return ok;
+}
 //从状态机=>得到行的读取状态，分别表示1.读取一个完整的行LINE_OK，2.行出错LINE_BAD，3.行的数据尚且不完整LINE_OPEN
 //http报文每一行都是以 '\r\n'结尾
 http_conn::LINE_STATUS http_conn::parse_line(){
     char temp;
     /*m_checked_idx指向buffer中当前正在分析的字节，m_read_idx指向buffer中客户数据的尾部的下一字节。
     buffer中[0~m_checked_idx - 1]都已经分析完毕，下面的循环分析[m_checked_idx~m_read_idx- 1]的数据*/
-    //每次分析buffer中一个字节
-    for(;m_checked_idx < m_read_idx;++m_checked_idx){
+    //当前分段中的行都解析完了，后面还有分段，转到下一个分段继续解析
+    //grow_read_buf保证请求头阶段被接上新段的分段以完整的行结束，见函数末尾
+    if(m_seg_cur && m_seg_cur -> next && m_start_line == m_read_idx){
+        m_parsed_before += m_seg_cur -> len;
+        m_seg_cur = m_seg_cur -> next;
+        m_read_buf = m_seg_cur -> data;
+        m_read_idx = m_seg_cur -> len;
+        m_start_line = 0;
+        m_checked_idx = 0;
+    }
+    //用向量化扫描一次跳过一批既不是'\r'也不是'\n'的字节，只在这两个字符上停下来判断
+    //上一次返回LINE_OPEN时m_checked_idx停在末尾的'\r'上，下一次从这个'\r'重新判断，和逐字节扫描的语义相同
+    while(m_checked_idx < m_read_idx){
+        m_checked_idx = scan_crlf(m_read_buf + m_checked_idx,m_read_buf + m_read_idx) - m_read_buf;
+        if(m_checked_idx >= m_read_idx){
+            break;
+        }
         //获取当前要分析的字节
         temp = m_read_buf[m_checked_idx];
-        //如果当前字符是‘\t’则有可能读取一行
+        //如果当前字符是‘\r’则有可能读取一行
         if(temp == '\r'){
-            //如果\t是buffer中最后一个已经被读取的数据，那么当前没有读取一个完整的行，还需要继续读
+            //如果\r是buffer中最后一个已经被读取的数据，那么当前没有读取一个完整的行，还需要继续读
             if(m_checked_idx + 1 == m_read_idx){
                 return LINE_OPEN;   //未读取到一个完整的行，还需要继续读取数据
             }
@@ -130,7 +282,7 @@ http_conn::LINE_STATUS http_conn::parse_line(){
             return LINE_BAD;
         }
         //如果当前的字节是\n，也说明可能读取到一个完整的行
-        else if(temp == '\n'){
+        else{
             if(m_checked_idx > 1 && m_read_buf[m_checked_idx - 1] == '\r'){
                 m_read_buf[m_checked_idx - 1] = '\0';
                 m_read_buf[m_checked_idx++] = '\0';
@@ -141,20 +293,141 @@ http_conn::LINE_STATUS http_conn::parse_line(){
             }
         }
     }
+    //分段以不完整的行结束而后面还有分段，说明这一行超过了请求头的上限(见grow_read_buf)
+    if(m_seg_cur && m_seg_cur -> next && m_start_line < m_read_idx && m_check_state != CHECK_STATE_CONTENT){
+        return LINE_BAD;
+    }
     //如果所有内容分析完毕也没遇到\r字符，则还需要继续读取客户数据
     return LINE_OPEN;
 }
 
-//循环读取客户数据，直到无数据可读或者对方关闭连接
+//在以'\0'结尾的行text中找第一个字符c，和strchr/strpbrk(text,"c")的结果相同
+//行已经由parse_line置好了'\0'，扫描的上界是缓冲区中数据的末尾，一定会先遇到'\0'
+char* http_conn::find_in_line(char* text,char c){
+    char* hit = (char*)scan_any2(text,m_read_buf + m_read_idx,c,'\0');
+    if(hit == m_read_buf + m_read_idx || *hit != c){
+        return NULL;
+    }
+    return hit;
+}
+
+//读缓冲区的最后一段满了(或者还没有分段)，从分段池再取一段接到链表末尾
+bool http_conn::grow_read_buf(){
+    if(!m_seg_tail){
+        buf_segment* seg = bufpool::alloc();
+        m_seg_head = m_seg_cur = m_seg_tail = seg;
+        m_read_buf = seg -> data;
+        m_read_idx = 0;
+        return true;
+    }
+    buf_segment* seg;
+    //请求头还没解析完：把满了的分段末尾不完整的那一行搬到新段，保证每一行都在同一个分段内
+    //只拷贝不完整的一行，已经完整的行留在原分段中，已经解析出的m_url/m_host等指针不受影响
+    //接上的分段容量是请求头的上限，请求头剩下的部分(包括这一行)一定能放进去，一行可以长到请求头的上限，
+    //请求头阶段最多只接一次、只拷贝一次不完整的行
+    //工作线程还没解析到的数据里可能已经有请求体，按行切开也没有关系，请求体只按字节数计算
+    if(m_check_state != CHECK_STATE_CONTENT){
+        buf_segment* tail = m_seg_tail;
+        char* begin = tail -> data + (tail == m_seg_cur ? m_start_line : 0);
+        char* end = tail -> data + tail -> len;
+        char* nl = (char*)memrchr(begin,'\n',end - begin);
+        char* split = nl ? nl + 1 : begin;
+        if(split == tail -> data && tail == m_seg_cur && tail -> cap >= m_header_limit){
+            return false;   //正在解析的行超过了请求头的上限
+        }
+        seg = bufpool::alloc_large(m_header_limit);
+        if(split == tail -> data && tail == m_seg_cur){
+            //正在解析的分段整个是一行，用新段替换掉它，不留下空的分段(请求行总是在第一个分段的开头)
+            memcpy(seg -> data,tail -> data,tail -> len);
+            seg -> len = tail -> len;
+            if(m_seg_head == tail){
+                m_seg_head = seg;
+            }
+            else{
+                buf_segment* prev = m_seg_head;
+                while(prev -> next != tail){
+                    prev = prev -> next;
+                }
+                prev -> next = seg;
+            }
+            m_seg_cur = m_seg_tail = seg;
+            m_read_buf = seg -> data;
+            bufpool::free_chain(tail);
+            return true;
+        }
+        if(split != tail -> data){
+            memcpy(seg -> data,split,end - split);
+            seg -> len = end - split;
+            tail -> len = split - tail -> data;
+            if(tail == m_seg_cur){
+                m_read_idx = tail -> len;
+            }
+        }
+        //整段都没有换行而且不是正在解析的分段，可能是请求体；如果是请求头，parse_line走到段尾时会返回LINE_BAD
+    }
+    else{
+        seg = bufpool::alloc();
+    }
+    m_seg_tail -> next = seg;
+    m_seg_tail = seg;
+    return true;
+}
+
+bool http_conn::append_read_buf(const char* data,long len){
+    while(len > 0){
+        if(!m_seg_tail || m_seg_tail -> len == m_seg_tail -> cap){
+            if(!grow_read_buf()){
+                return false;
+            }
+        }
+        long n = m_seg_tail -> cap - m_seg_tail -> len;
+        if(n > len){
+            n = len;
+        }
+        memcpy(m_seg_tail -> data + m_seg_tail -> len,data,n);
+        m_seg_tail -> len += n;
+        m_request_bytes += n;
+        data += n;
+        len -= n;
+    }
+    if(m_seg_cur){
+        m_read_idx = m_seg_cur -> len;
+    }
+    return true;
+}
+
+void http_conn::free_read_buf(){
+    bufpool::free_chain(m_seg_head);
+    m_seg_head = m_seg_cur = m_seg_tail = NULL;
+    m_read_buf = NULL;
+    m_read_idx = 0;
+}
+
+//循环读取客户数据，直到无数据可读、对方关闭连接或者读满了当前请求允许的字节数
+//读满m_read_limit时先不读了，交给工作线程解析：解析完请求头后放宽上限，再次监听EPOLLIN时内核会重新报告还没读的数据
 bool http_conn::read(){
-    if(m_read_idx >= READ_BUFFER_SIZE){
+    //上次已经读满了上限，工作线程解析后仍然要求继续读，说明请求头超过了m_header_limit
+    if(m_request_bytes >= m_read_limit){
         return false;
     }
     int bytes_read=0;
-    while(true)
+    long total = 0;
+    if(m_request_bytes == 0){   //新请求的第一个字节
+        m_request_start_ns = stats_now_ns();
+    }
+    while(m_request_bytes < m_read_limit)
     {
+        if(!m_seg_tail || m_seg_tail -> len == m_seg_tail -> cap){
+            if(!grow_read_buf()){
+                return false;
+            }
+        }
+        long room = m_seg_tail -> cap - m_seg_tail -> len;
+        if(room > m_read_limit - m_request_bytes){
+            room = m_read_limit - m_request_bytes;
+        }
         //非阻塞读ET
-        bytes_read = recv(m_sockfd,m_read_buf + m_read_idx,READ_BUFFER_SIZE - m_read_idx,0);
+        bytes_read = recv(m_sockfd,m_seg_tail -> data + m_seg_tail -> len,room,0);
         if(bytes_read == -1)
         {
             //缓冲区满，等待再读 / 最后一次读，已经读取完
@@ -168,35 +441,69 @@ bool http_conn::read(){
         else if(bytes_read == 0){
             return false;
         }
-        m_read_idx += bytes_read;
+        m_seg_tail -> len += bytes_read;
+        m_request_bytes += bytes_read;
+        total += bytes_read;
     }
+    m_read_idx = m_seg_cur -> len;
+    after_read(total);
     return true;    
 }
 
+long http_conn::feed(const char* data,long len){
+    if(m_request_bytes >= m_read_limit){
+        return -1;
+    }
+    if(m_request_bytes == 0){
+        m_request_start_ns = stats_now_ns();
+    }
+    if(len > m_read_limit - m_request_bytes){
+        len = m_read_limit - m_request_bytes;
+    }
+    if(!append_read_buf(data,len)){
+        return -1;
+    }
+    after_read(len);
+    return len;
+}
+
+void http_conn::after_read(long bytes){
+    stats_add(STAT_BYTES_IN,bytes);
+    //请求体按两次读之间的间隔计时；请求头从第一个字节开始计时，后续的读不延长期限，防止慢速发送头部的客户端一直占着连接
+    if(m_check_state == CHECK_STATE_CONTENT){
+        arm_timer(TIMER_BODY);
+    }
+    else if(m_timer_kind != TIMER_HEADER){
+        arm_timer(TIMER_HEADER);
+    }
+}
+
 //解析HTTP请求行，获得请求方法,目标URL，以及HTTP版本号   
 // GET http://www.google.com:80/index.html HTTP/1.1
 //主状态机 CHECK_STATE_REQUESTLINE
 http_conn :: HTTP_CODE http_conn::parse_request_line(char* text){
     //在text中找到第一个该字符的位置，前面就是方法
-    m_url = strpbrk(text," ");//A找到第一个等于空格或者制表符的下标位置GET
+    m_url = find_in_line(text,' ');//A找到第一个等于空格或者制表符的下标位置GET
     if(!m_url){        
         return BAD_REQUEST;    //未找到语法错误
     }
     *m_url++ = '\0';//GET\0
 
-    //通过找第一个空格位置，找到了方法GET
+    //通过找第一个空格位置，找到了方法GET；方法表的第一项就是GET
+    //HEAD和GET的首部相同，但是不发送主体，也不打开文件；其他方法只能用在转发给后端的URL上，见下面
     char* method = text;
-    if(strcasecmp(method,"GET") == 0){//忽略大小写比较大小
-        m_method = GET;
-    }
-    else{
-        return BAD_REQUEST;
+    int index = 0;
+    while(strcasecmp(method,method_names[index]) != 0){//忽略大小写比较大小
+        if(++index == (int)(sizeof(method_names) / sizeof(method_names[0]))){
+            return BAD_REQUEST;
+        }
     }
+    m_method = (METHOD)index;
     //现在的m_url是get 后面的内容，strspn是检索字符串1中第一个不在字符串2中出现的字符的下标
     //返回的位置就是url的位置，去掉多余的空格影响
     m_url += strspn(m_url," ");//去掉GET后面多余空格的影响，找到其中最后一个空格位置
     //url 版本，找到空格，下一个位置就是版本
-    m_version = strpbrk(m_url," ");//找到url的结束位置html和HTTP中间的空格位置
+    m_version = find_in_line(m_url,' ');//找到url的结束位置html和HTTP中间的空格位置
     if(!m_version){
         return BAD_REQUEST;
     }
@@ -216,12 +523,37 @@ http_conn :: HTTP_CODE http_conn::parse_request_line(char* text){
     if(!m_url || m_url[0] != '/'){//记住URL后缀是/
         return NO_REQUEST;
     }
+    //转发给后端的URL可以用CONNECT和TRACE以外的方法，其他URL只支持GET和HEAD
+    m_backend = proxy_match(m_url);
+    if(m_backend ? (m_method == CONNECT || m_method == TRACE) : (m_method != GET && m_method != HEAD)){
+        return BAD_REQUEST;
+    }
     //主状态机的状态转移，也就是分析完了请求行字段，下面去分析首部行
     //HTTP请求行处理完毕，状态转移到头部字段的分析
     m_check_state = CHECK_STATE_HEADER;
     return NO_REQUEST;
 }
 
+//Accept-Encoding的值是逗号分隔的编码列表，每一项可以带;q=权重，q=0表示不接受
+//例如"gzip, deflate, br"、"br;q=1.0, gzip;q=0.8"、"*;q=0.5"
+static bool accepts_gzip(const char* value){
+    while(*value){
+        value += strspn(value," \t,");
+        const char* end = value + strcspn(value,",");
+        int len = strcspn(value," \t;,");
+        if((len == 4 && strncasecmp(value,"gzip",4) == 0) || (len == 1 && value[0] == '*')){
+            const char* q = (const char*)memchr(value,';',end - value);
+            if(!q){
+                return true;
+            }
+            q += 1 + strspn(q + 1," \t");
+            return !(q[0] == 'q' && q[1] == '=' && atof(q + 2) == 0);
+        }
+        value = end;
+    }
+    return false;
+}
+
 //分析头部字段
 //HTTP请求的组成是1.一个请求行，2.后面跟随0个或者多个请求头，3.最后跟随一个空的文本行来终止报头列表
 //每次是parse_line读到一行，然后去分析
@@ -231,9 +563,25 @@ http_conn::HTTP_CODE http_conn::parse_headers(char* text)
     //遇到空行，说明头部字段解析完毕
     if(text[0] == '\0')
     {
+        //请求头的字节数，请求体(如果有)紧接在后面
+        m_header_bytes = m_parsed_before + m_checked_idx;
+        //转发的请求不等请求体读完，也不受请求体上限的限制，请求体由代理边读边发给后端
+        if(m_backend){
+            return m_content_length < 0 || m_chunked_body ? BAD_REQUEST : GET_REQUEST;
+        }
+        //本地处理的请求不解码chunked请求体，回答501并关闭连接，否则请求体会被当成下一个流水线请求解析
+        if(m_chunked_body){
+            m_linger = false;
+            return NOT_IMPLEMENTED;
+        }
         //如果HTTP请求有消息体，则还需要读取m_content_length字节的消息体，状态机转移到CHECK_STATE_CONTENT状态
+        if(m_content_length < 0 || m_content_length > m_body_limit){
+            return BAD_REQUEST;
+        }
         if(m_content_length != 0)
         {
+            //请求体接在请求头之后，可能跨越多个分段，之后只按字节数判断是否读完
+            m_read_limit = m_header_bytes + m_content_length;
             m_check_state = CHECK_STATE_CONTENT;   //content-length字段不为0，说明有主体部分，那么状态转移
             return NO_REQUEST;           //返回的是NO_REQUEST，表示当前还未到写响应的时候
         }
@@ -241,8 +589,11 @@ http_conn::HTTP_CODE http_conn::parse_headers(char* text)
         return GET_REQUEST;  //GET_REQUEST表示得到一个完整的HTTP请求
     }
     //下面处理多种请求报头
+    //先用向量化扫描找到首部名后的':'，再按首部名的长度只和可能匹配的那一个首部比较，不再逐个strncasecmp
+    char* colon = find_in_line(text,':');
+    int name_len = colon ? colon - text : -1;
     //处理Connection头部字段--如果keep-alive，那么m_linger为true，表示为长连接
-    else if(strncasecmp(text,"Connection:",11) == 0){
+    if(name_len == 10 && strncasecmp(text,"Connection:",11) == 0){
         text += 11;
         text += strspn(text," ");
         if(strcasecmp(text,"keep-alive") == 0){
@@ -250,29 +601,54 @@ http_conn::HTTP_CODE http_conn::parse_headers(char* text)
         }
     }
     //处理content-length头部字段
-    else if(strcasecmp(text,"Content-Length:") == 0){
+    else if(name_len == 14 && strncasecmp(text,"Content-Length:",15) == 0){
         text += 15;
         text += strspn(text," ");
         m_content_length = atol(text);
     }
     //处理Host头部信息--主机
-    else if(strncasecmp(text,"Host:",5) == 0){
+    else if(name_len == 4 && strncasecmp(text,"Host:",5) == 0){
         text += 5;
         text += strspn(text," ");
         m_host = text;
     }
+    //内容协商：列表中有gzip(或者*)且q不为0
+    else if(name_len == 15 && strncasecmp(text,"Accept-Encoding:",16) == 0){
+        m_accept_gzip = accepts_gzip(text + 16);
+    }
+    //Range和If-Range只记录位置，打开文件知道大小和修改时间之后再解析
+    else if(name_len == 5 && strncasecmp(text,"Range:",6) == 0){
+        m_range = text + 6 + strspn(text + 6," ");
+    }
+    else if(name_len == 8 && strncasecmp(text,"If-Range:",9) == 0){
+        m_if_range = text + 9 + strspn(text + 9," ");
+    }
+    //条件请求，stat之后和验证器比较
+    else if(name_len == 13 && strncasecmp(text,"If-None-Match:",14) == 0){
+        m_if_none_match = text + 14 + strspn(text + 14," ");
+    }
+    else if(name_len == 17 && strncasecmp(text,"If-Modified-Since:",18) == 0){
+        m_if_modified_since = text + 18 + strspn(text + 18," ");
+    }
+    //请求体的编码，只支持Content-Length
+    else if(name_len == 17 && strncasecmp(text,"Transfer-Encoding:",18) == 0){
+        m_chunked_body = true;
+    }
+    else if(name_len == 6 && strncasecmp(text,"Expect:",7) == 0){
+        m_expect_continue = strcasecmp(text + 7 + strspn(text + 7," "),"100-continue") == 0;
+    }
     else{
-        printf("oop!unkonwn header %s\n",text);
+        LOG_DEBUG("oop!unkonwn header %s",text);
     }
 
     return NO_REQUEST;
 }
 
 //我们没有真正的解析HTTP请求的消息体，只是判断它是否被完整的读入了
+//请求体可能分布在多个分段中，按当前请求读入的总字节数判断
 //主状态机状态：CHECK_STATE_CONTENT
-http_conn::HTTP_CODE http_conn::parse_content(char* text){
-    if(m_read_idx >= (m_content_length + m_checked_idx)){
-        text[m_content_length] = '\0';
+http_conn::HTTP_CODE http_conn::parse_content(char*){
+    if(m_request_bytes - m_header_bytes >= m_content_length){
         return GET_REQUEST;
     }
 
@@ -282,18 +658,21 @@ http_conn::HTTP_CODE http_conn::parse_content(char* text){
 //主状态机，用于从buffer中取出所有完整的行
 //process_read，解析读取数据操作操作就是由该函数完成的
 http_conn::HTTP_CODE http_conn::process_read(){
+    m_parse_ns = stats_now_ns();   //解析耗时从这里算起，到调用do_request为止
     LINE_STATUS line_status = LINE_OK;//记录当前行的读取状态
     HTTP_CODE ret = NO_REQUEST;//记录HTTP请求的处理结果--初始为NO_REQUEST，表示没有处理完，要继续处理
     char* text = 0;
     
     //当解析到完整的一行时，去根据主状态机状态解析该行内容，如果状态不是LINE_OK,说明还需要去读，或者有问题
     //如果当前是实体主体内容，那么从状态机的状态就不发生变化了，因为主体并不存在http报文的每一行最后的 '\r\n'格式
-    //实体主体内容，只需要根据Content-Length的长度读就可以了
-    while(((m_check_state == CHECK_STATE_CONTENT) && (line_status == LINE_OPEN))   //??????????
+    //实体主体内容，只需要根据Content-Length的长度读就可以了，不再调用parse_line按行切分(请求体中的\r\n会被改写)
+    while((m_check_state == CHECK_STATE_CONTENT)
         || (line_status = parse_line()) == LINE_OK) {//m_check_state记录主状态机当前的状态
          text = get_line(); //获取刚读到的一行数据
          m_start_line = m_checked_idx;
-         printf("got 1 http line:%s\n",text);
+         if(m_check_state != CHECK_STATE_CONTENT){   //请求体不是以'\0'结尾的行
+             LOG_DEBUG("got 1 http line:%s",text);
+         }
         
         //根据当前主状态机的状态，决定是应该分析什么字段
          switch(m_check_state){
@@ -306,10 +685,11 @@ http_conn::HTTP_CODE http_conn::process_read(){
              }
              case CHECK_STATE_HEADER:{//分析头部字段
                 ret = parse_headers(text);
-                if(ret == BAD_REQUEST){
-                    return BAD_REQUEST;
+                if(ret == BAD_REQUEST || ret == NOT_IMPLEMENTED){
+                    return ret;
                 }
                 else if(ret == GET_REQUEST){     //GET_REQUEST分析完成，这时去写请求，这里意味着首部无content-length字段
+                    stats_record(STAT_PARSE,stats_now_ns() - m_parse_ns);
                     return do_request();
                 }
                 break;
@@ -318,10 +698,10 @@ http_conn::HTTP_CODE http_conn::process_read(){
                  ret = parse_content(text);
                  if(ret == GET_REQUEST)
                  {
-                     return do_request();        //写请求
+                     stats_record(STAT_PARSE,stats_now_ns() - m_parse_ns);
+                    return do_request();        //写请求
                  }
-                 line_status = LINE_OPEN;        //前面还未到写请求，说明，一定是还没有读取完，那么置从状态机为LINE_OPEN,
-                 break;
+                 return NO_REQUEST;              //前面还未到写请求，说明，一定是还没有读取完，继续读
              }
              default:{
                  return INTERNAL_ERROR;
@@ -331,23 +711,456 @@ http_conn::HTTP_CODE http_conn::process_read(){
 
     }
     //解析行状态为LINE_BAD，则BAD_REQUEST
-    //if(line_status==LINE_BAD)
-    //    return BAD_REQUEST;
+    if(line_status==LINE_BAD)
+        return BAD_REQUEST;
 
     return NO_REQUEST;     //不满足while循环的条件，则返回NO_REQUEST表示还不能写，这样去事件集监听写事件
 }
 
+//把URL的路径部分(查询串之前)就地规范化：合并连续的'/'，去掉"."段，".."段回退一级，结果只会变短；回退到根之上返回false
+//文件缓存、响应缓存、gzip缓存和inotify失效都以doc_root加规范化后的路径为键，同一个文件的不同写法(//a、/./a、/b/../a)对应同一个缓存项
+static bool normalize_path(char* url){
+    char* end = url + strcspn(url,"?");
+    char* out = url;
+    char* p = url;
+    while(p < end){
+        while(p < end && *p == '/'){
+            ++p;
+        }
+        char* seg = p;
+        while(p < end && *p != '/'){
+            ++p;
+        }
+        size_t n = p - seg;
+        if(n == 0){     //以'/'结尾，保留一个
+            *out++ = '/';
+            break;
+        }
+        if(n == 1 && seg[0] == '.'){
+            if(p == end){
+                *out++ = '/';
+            }
+            continue;
+        }
+        if(n == 2 && seg[0] == '.' && seg[1] == '.'){
+            if(out == url){
+                return false;
+            }
+            //每一段都以'/'开头，退回到上一段的'/'处
+            while(out > url && *--out != '/'){
+            }
+            if(p == end){
+                *out++ = '/';
+            }
+            continue;
+        }
+        *out++ = '/';
+        memmove(out,seg,n);
+        out += n;
+    }
+    if(out == url){
+        *out++ = '/';
+    }
+    memmove(out,end,strlen(end) + 1);
+    return true;
+}
+
 /*当得到一个完整正确的HTTP请求时，我们就分析目标文件的属性。如果目标文件存在，
 对所有用户可读，且不是目录，则使用mmap将其映射内存地址m_file_address处，并告诉调用者获取文件成功*/
 //分析完用户请求后，do_request响应之--去判断用户请求内容(文件类型、权限内容等)
 http_conn::HTTP_CODE http_conn::do_request(){
+    if(m_backend){
+        return proxy_request();
+    }
+    if(!normalize_path(m_url)){
+        return BAD_REQUEST;
+    }
     strcpy(m_real_file,doc_root);
     int len = strlen(doc_root);
     //m_real_file客户请求的目标文件的完整路径，其内容等于doc_root + m_url,doc_root是网站根目录
     strncpy( m_real_file + len,m_url,FILENAME_LEN - len - 1);
     //m_read_file是用户请求的完整路径和文件名
 
-    if(stat(m_real_file,&m_file_stat)){//获取文件的状态并保存在m_file_stat中
+    //先查路由表，没有匹配的URL才当作文件路径；HEAD没有单独注册时用GET的处理函数
+    const router::route* route = router::instance() -> find(m_method,m_url);
+    if(!route && m_method == HEAD){
+        route = router::instance() -> find(GET,m_url);
+    }
+    if(route){
+        return call_route(route);
+    }
+    //小文件的完整响应缓存，命中时不再stat和打开文件
+    if(lookup_response()){
+        return CACHED_REQUEST;
+    }
+
+    //先只stat(文件缓存命中时什么都不做)，条件请求命中时不打开文件
+    HTTP_CODE ret = stat_file(m_real_file);
+    if(ret != FILE_REQUEST){
+        return ret;
+    }
+    //按扩展名确定Content-Type，可压缩的类型304也要带Vary
+    bool compressible;
+    m_content_type = mime_type(m_real_file,&compressible);
+    m_vary = compressible;
+    set_validators();
+    if(not_modified()){
+        release_file();
+        return NOT_MODIFIED;
+    }
+    //HEAD只需要文件的大小
+    if(m_method != HEAD){
+        ret = map_file(m_real_file);
+        if(ret != FILE_REQUEST){
+            return ret;
+        }
+    }
+    if(m_file_stat.st_size == 0){
+        return FILE_REQUEST;
+    }
+    //416不发送文件内容，文件现在就释放，只留下m_file_stat中的大小；HEAD忽略Range
+    if(m_range && m_method == GET && parse_ranges() == RANGE_NOT_SATISFIABLE){
+        release_file();
+        return RANGE_NOT_SATISFIABLE;
+    }
+    //可压缩的类型再协商gzip，范围是按原文件计算的，Range请求不压缩
+    if(compressible && m_accept_gzip && m_range_count == 0){
+        negotiate_gzip();
+    }
+    //压缩后的内容不支持范围请求，只对原样发送的文件声明Accept-Ranges
+    m_accept_ranges = !m_gzip;
+    return FILE_REQUEST;
+}
+
+//处理函数的主体先写在写缓冲区中m_write_idx开始的地方，首部由process_write接在主体之后，不再拷贝主体
+//留出RESPONSE_RESERVE给首部，放不下时route_reply自己转到malloc申请的缓冲区
+http_conn::HTTP_CODE http_conn::call_route(const router::route* route){
+    route_request req;
+    req.method = m_method;
+    req.path = m_url;
+    req.path_len = strcspn(m_url,"?");
+    req.query = m_url[req.path_len] == '?' ? m_url + req.path_len + 1 : NULL;
+    long room = WRITE_BUFFER_SIZE - 1 - m_write_idx - RESPONSE_RESERVE;
+    route_reply reply(m_write_buf + m_write_idx,room > 0 ? room : 0);
+    if(!route -> handler(req,reply,route -> arg)){
+        return INTERNAL_ERROR;
+    }
+    int len;
+    if(!status_line(reply.status,&len)){
+        LOG_WARN("route %s returned unknown status %d",m_url,reply.status);
+        return INTERNAL_ERROR;
+    }
+    m_body_status = reply.status;
+    m_body_len = reply.size();
+    m_content_type = reply.content_type;
+    if(reply.in_place()){
+        return ROUTE_REQUEST;
+    }
+    m_body_buf = reply.release();
+    return BUFFER_REQUEST;
+}
+
+//只用于没有Range和条件首部的GET/HEAD，这时200响应只取决于文件、Connection和客户端是否接受gzip
+bool http_conn::lookup_response(){
+    respcache* cache = respcache::instance();
+    if(!cache -> enabled() || m_range || m_if_none_match || m_if_modified_since){
+        return false;
+    }
+    m_resp_variant = (m_linger ? respcache::VARIANT_KEEP_ALIVE : 0) | (m_accept_gzip ? respcache::VARIANT_GZIP : 0);
+    m_resp_entry = cache -> acquire(m_real_file,m_resp_variant,&m_resp_generation);
+    if(m_resp_entry){
+        stats_add(STAT_RESPCACHE_HITS,1);
+        return true;
+    }
+    //HEAD不做动态压缩，首部可能和GET的不同，只用GET的响应填充
+    m_resp_fill = m_method == GET;
+    return false;
+}
+
+//逐跳的首部只对客户端到代理这一段有效，不转发给后端；Expect由代理自己回答
+static bool hop_by_hop(const char* line,int len){
+    int name_len = strcspn(line,":");
+    if(name_len == len){
+        return false;
+    }
+    return (name_len == 10 && strncasecmp(line,"Connection",10) == 0) ||
+           (name_len == 10 && strncasecmp(line,"Keep-Alive",10) == 0) ||
+           (name_len == 16 && strncasecmp(line,"Proxy-Connection",16) == 0) ||
+           (name_len == 7 && strncasecmp(line,"Upgrade",7) == 0) ||
+           (name_len == 6 && strncasecmp(line,"Expect",6) == 0);
+}
+
+//发给后端的请求头：请求行和端到端的首部原样转发，加上X-Forwarded-For和Connection: keep-alive(后端连接要复用)
+//解析后每一行都以"\0\0"结尾、完整地落在一个分段内；请求行在parse_request_line中被切开了，首部从版本号之后开始
+//已经读入的请求体接在请求头后面一起发送，剩下的由反应堆从客户端socket直接splice给后端
+http_conn::HTTP_CODE http_conn::proxy_request(){
+    long buffered = m_request_bytes - m_header_bytes;
+    if(buffered > m_content_length){
+        buffered = m_content_length;
+    }
+    size_t cap = m_header_bytes + buffered + 128;
+    char* head = (char*)malloc(cap);
+    if(!head){
+        return INTERNAL_ERROR;
+    }
+    size_t len = snprintf(head,cap,"%s %s HTTP/1.1\r\n",method_names[m_method],m_url);
+    long before = 0;
+    long off = m_version + strlen(m_version) + 2 - m_seg_head -> data;
+    for(buf_segment* seg = m_seg_head;seg && before < m_header_bytes;seg = seg -> next){
+        long end = seg -> len < m_header_bytes - before ? seg -> len : m_header_bytes - before;
+        while(off < end){
+            const char* line = seg -> data + off;
+            int n = strlen(line);
+            if(n == 0){   //空行，请求头结束
+                break;
+            }
+            if(!hop_by_hop(line,n) && len + n + 2 < cap){
+                memcpy(head + len,line,n);
+                memcpy(head + len + n,"\r\n",2);
+                len += n + 2;
+            }
+            off += n + 2;
+        }
+        before += seg -> len;
+        off = 0;
+    }
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET,&m_address.sin_addr,ip,sizeof(ip));
+    len += snprintf(head + len,cap - len,"X-Forwarded-For: %s\r\nConnection: keep-alive\r\n\r\n",ip);
+    if(len + buffered > cap){
+        free(head);
+        return INTERNAL_ERROR;
+    }
+    //请求体可能跨越多个分段
+    long skip = m_header_bytes;
+    long left = buffered;
+    for(buf_segment* seg = m_seg_head;seg && left > 0;seg = seg -> next){
+        if(skip >= seg -> len){
+            skip -= seg -> len;
+            continue;
+        }
+        long n = seg -> len - skip < left ? seg -> len - skip : left;
+        memcpy(head + len,seg -> data + skip,n);
+        len += n;
+        left -= n;
+        skip = 0;
+    }
+    m_proxy_head = head;
+    m_proxy_head_len = len;
+    m_proxy_body_left = m_content_length - buffered;
+    return PROXY_REQUEST;
+}
+
+//转发的请求和本地处理的请求一样计入统计和访问日志，bytes是发给客户端的响应字节数
+void http_conn::log_proxy(int status,long bytes){
+    stats_add(STAT_REQUESTS,1);
+    stats_status(status);
+    stats_record(STAT_LAST_BYTE,stats_now_ns() - m_request_start_ns);
+    if(g_log_level <= LOG_LEVEL_INFO){
+        log_access(m_address.sin_addr.s_addr,m_address.sin_port,method_names[m_method],m_url,status,bytes);
+    }
+}
+
+//在反应堆线程中调用，连接不在线程池中；保持连接时由write决定交给线程池解析下一个请求还是等待新的请求
+void http_conn::end_proxy(int status,long bytes,bool keep){
+    log_proxy(status,bytes);
+    m_proxy_pending = false;
+    if(!keep || !next_request()){
+        close_conn();
+        return;
+    }
+    m_need_parse = m_request_bytes > 0;
+    rearm(EPOLLOUT);
+}
+
+//请求体可能还有一部分没读，回答之后关闭连接
+void http_conn::proxy_error(int status){
+    m_proxy_pending = false;
+    m_linger = false;
+    if(!add_error(status)){
+        close_conn();
+        return;
+    }
+    log_proxy(status,m_write_idx);
+    push_chunk(m_write_buf,m_write_idx);
+    m_close_after = true;
+    rearm(EPOLLOUT);
+}
+
+//解析一个范围"a-b"、"a-"或者"-n"，结果限制在[0,size)内
+//返回1表示范围有效，0表示语法正确但不在文件内，-1表示语法错误；end指向范围之后的字符
+static int parse_range_spec(const char* p,off_t size,off_t* first,off_t* last,const char** end){
+    char* q;
+    unsigned long long a,b;
+    if(*p == '-'){   //后缀范围：最后n个字节，n超过文件大小时是整个文件
+        if(p[1] < '0' || p[1] > '9'){
+            return -1;
+        }
+        b = strtoull(p + 1,&q,10);
+        *end = q;
+        if(b == 0){
+            return 0;
+        }
+        *first = b >= (unsigned long long)size ? 0 : size - b;
+        *last = size - 1;
+        return 1;
+    }
+    if(*p < '0' || *p > '9'){
+        return -1;
+    }
+    a = strtoull(p,&q,10);
+    if(*q != '-'){
+        return -1;
+    }
+    ++q;
+    b = ~0ULL;       //"a-"到文件末尾
+    if(*q >= '0' && *q <= '9'){
+        b = strtoull(q,&q,10);
+        if(b < a){
+            return -1;
+        }
+    }
+    *end = q;
+    if(a >= (unsigned long long)size){
+        return 0;
+    }
+    *first = a;
+    *last = b >= (unsigned long long)size ? size - 1 : b;
+    return 1;
+}
+
+//Range: bytes=0-499, 1000-, -500
+//单位不是bytes、语法错误或者范围太多时忽略整个Range首部，发送整个文件；没有一个范围在文件内时返回416
+//范围按客户端给出的顺序发送，不合并重叠的范围
+http_conn::HTTP_CODE http_conn::parse_ranges(){
+    if(m_if_range && !if_range_matches(m_if_range)){
+        return FILE_REQUEST;
+    }
+    if(strncasecmp(m_range,"bytes=",6) != 0){
+        return FILE_REQUEST;
+    }
+    const char* p = m_range + 6;
+    int specs = 0;
+    while(true){
+        p += strspn(p," \t");
+        off_t first,last;
+        const char* end;
+        int ret = parse_range_spec(p,m_file_stat.st_size,&first,&last,&end);
+        if(ret < 0 || ++specs > MAX_RANGES){
+            m_range_count = 0;
+            return FILE_REQUEST;
+        }
+        if(ret > 0){
+            m_range_start[m_range_count] = first;
+            m_range_end[m_range_count] = last;
+            ++m_range_count;
+        }
+        p = end + strspn(end," \t");
+        if(*p == '\0'){
+            break;
+        }
+        if(*p != ','){
+            m_range_count = 0;
+            return FILE_REQUEST;
+        }
+        ++p;
+    }
+    return m_range_count > 0 ? FILE_REQUEST : RANGE_NOT_SATISFIABLE;
+}
+
+//If-Range是实体标签时要和ETag强比较(弱标签总是不匹配)，是HTTP日期时和文件的修改时间相同才发送范围
+bool http_conn::if_range_matches(const char* value){
+    if(value[0] == '"'){
+        return strcmp(value,m_etag) == 0;
+    }
+    if(strncmp(value,"W/",2) == 0){
+        return false;
+    }
+    return parse_http_date(value) == m_last_modified;
+}
+
+//ETag由inode、大小和修改时间(纳秒)决定，文件被替换或者修改后一定会变
+void http_conn::set_validators(){
+    char* p = m_etag;
+    *p++ = '"';
+    p += format_hex(p,m_file_stat.st_ino);
+    *p++ = '-';
+    p += format_hex(p,m_file_stat.st_size);
+    *p++ = '-';
+    p += format_hex(p,m_file_stat.st_mtim.tv_sec);
+    *p++ = '.';
+    p += format_hex(p,m_file_stat.st_mtim.tv_nsec);
+    *p++ = '"';
+    *p = '\0';
+    m_etag_len = p - m_etag;
+    m_last_modified = m_file_stat.st_mtime;
+}
+
+//If-None-Match: "a", W/"b" 或者 *，用弱比较(忽略W/)，所以gzip响应的弱ETag也能匹配
+static bool etag_list_matches(const char* list,const char* etag,int etag_len){
+    while(true){
+        list += strspn(list," \t,");
+        if(*list == '\0'){
+            return false;
+        }
+        if(*list == '*'){
+            return true;
+        }
+        if(strncmp(list,"W/",2) == 0){
+            list += 2;
+        }
+        if(*list != '"'){
+            return false;
+        }
+        const char* close = strchr(list + 1,'"');
+        if(!close){
+            return false;
+        }
+        if(close + 1 - list == etag_len && memcmp(list,etag,etag_len) == 0){
+            return true;
+        }
+        list = close + 1;
+    }
+}
+
+//有If-None-Match时只看它，If-Modified-Since被忽略；修改时间不晚于If-Modified-Since时客户端的副本有效
+bool http_conn::not_modified(){
+    if(m_if_none_match){
+        return etag_list_matches(m_if_none_match,m_etag,m_etag_len);
+    }
+    if(m_if_modified_since){
+        time_t since = parse_http_date(m_if_modified_since);
+        return since != -1 && m_last_modified <= since;
+    }
+    return false;
+}
+
+void http_conn::release_file(){
+    drop_file(m_file_entry,m_file_address,m_file_stat.st_size,m_file_fd);
+    m_file_entry = NULL;
+    m_file_address = 0;
+    m_file_fd = -1;
+}
+
+http_conn::HTTP_CODE http_conn::open_file(const char* path){
+    HTTP_CODE ret = stat_file(path);
+    if(ret != FILE_REQUEST || m_method == HEAD){
+        return ret;
+    }
+    return map_file(path);
+}
+
+http_conn::HTTP_CODE http_conn::stat_file(const char* path){
+    //先查进程共享的文件缓存，命中则直接使用缓存的stat结果和映射(大文件是fd)，不再stat/open/mmap
+    m_file_entry = filecache::instance() -> acquire(path);
+    if(m_file_entry){
+        m_file_stat = m_file_entry -> st;
+        m_file_address = m_file_entry -> addr;
+        m_file_fd = m_file_entry -> fd;
+        return FILE_REQUEST;
+    }
+    //缓存不了的文件(不存在、不可读、目录、超过缓存预算)，仍然按原来的方式处理
+    if(stat(path,&m_file_stat)){//获取文件的状态并保存在m_file_stat中
         return NO_RESOURCE;   //404，未找到请求的资源信息
     }
     //不可读，403
@@ -358,67 +1171,308 @@ http_conn::HTTP_CODE http_conn::do_request(){
     if(S_ISDIR(m_file_stat.st_mode)){
         return BAD_REQUEST;
     }
+    return FILE_REQUEST;
+}
+
+http_conn::HTTP_CODE http_conn::map_file(const char* path){
+    //缓存项已经有映射或者fd；空文件不需要打开
+    if(m_file_entry || m_file_stat.st_size == 0){
+        return FILE_REQUEST;
+    }
 
     //打开文件，并映射到一块虚拟内存区域
-    int fd = open(m_real_file,O_RDONLY);
+    int fd = open(path,O_RDONLY);
+    if(fd < 0){
+        return INTERNAL_ERROR;
+    }
+    //大文件不映射，保留fd，发送时用sendfile
+    if(m_file_stat.st_size >= m_sendfile_threshold){
+        m_file_fd = fd;
+        return FILE_REQUEST;
+    }
     //创建虚拟内存区域，并将对象映射到这些区域
-    m_file_address = (char*)mmap(0,m_file_stat.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+    void* addr = mmap(0,m_file_stat.st_size,PROT_READ,MAP_PRIVATE,fd,0);
     close(fd);
+    if(addr == MAP_FAILED){
+        return INTERNAL_ERROR;
+    }
     //关闭文件描述符，从内存区域读取文件即可
+    m_file_address = (char*)addr;
     return FILE_REQUEST;
 }
 
-//对内存映射区执行munmap操作
+//1.压缩缓存中有当前版本的压缩结果，直接使用 2.同目录下有foo.gz，发送它
+//3.文件内容在内存中(小于sendfile阈值)时压缩一次放进压缩缓存；sendfile发送的大文件不做动态压缩
+//HEAD请求不读文件内容，压缩缓存和foo.gz都没有时按原文件回答
+void http_conn::negotiate_gzip(){
+    gzipcache* cache = gzipcache::instance();
+    gzipcache::entry* e = cache -> lookup(m_real_file,m_file_stat);
+    if(!e){
+        if(open_gzip_sibling()){
+            m_gzip = true;
+            return;
+        }
+        if(m_method == HEAD || !m_file_address || m_file_stat.st_size < GZIP_MIN_SIZE){
+            return;
+        }
+        e = cache -> acquire(m_real_file,m_file_stat,m_file_address,m_file_stat.st_size);
+        if(!e){
+            return;
+        }
+    }
+    //记录为不值得压缩的文件，直接发送原文件
+    if(!e -> data){
+        cache -> release(e);
+        return;
+    }
+    m_gzip_entry = e;
+    m_gzip = true;
+}
+
+bool http_conn::open_gzip_sibling(){
+    int len = strlen(m_real_file);
+    if(len + 4 > FILENAME_LEN){
+        return false;
+    }
+    //原文件先放到一边，.gz不可用时恢复
+    filecache::entry* entry = m_file_entry;
+    char* addr = m_file_address;
+    int fd = m_file_fd;
+    struct stat st = m_file_stat;
+    m_file_entry = NULL;
+    m_file_address = 0;
+    m_file_fd = -1;
+    memcpy(m_real_file + len,".gz",4);
+    bool ok = open_file(m_real_file) == FILE_REQUEST && m_file_stat.st_size > 0;
+    m_real_file[len] = '\0';
+    if(!ok){
+        drop_file(m_file_entry,m_file_address,m_file_stat.st_size,m_file_fd);
+        m_file_entry = entry;
+        m_file_address = addr;
+        m_file_fd = fd;
+        m_file_stat = st;
+        return false;
+    }
+    drop_file(entry,addr,st.st_size,fd);
+    return true;
+}
+
+void http_conn::drop_file(filecache::entry* entry,char* addr,size_t len,int fd){
+    if(entry){
+        filecache::instance() -> release(entry);
+        return;
+    }
+    if(addr){
+        munmap(addr,len);
+    }
+    if(fd != -1){
+        close(fd);
+    }
+}
+
+//对内存映射区执行munmap操作，如果映射来自文件缓存，则只释放缓存项的引用
+//释放所有排队的响应引用的文件，以及当前请求还没交给响应队列的文件
 void http_conn::unmap(){
-    if(m_file_address){
-        munmap(m_file_address,m_file_stat.st_size);//删除虚拟内存的区域
-        m_file_address = 0;
+    hold_file();
+    for(int i = 0;i < m_file_count;++i){
+        out_file& f = m_files[i];
+        free(f.owned);
+        if(f.gz){
+            gzipcache::instance() -> release(f.gz);
+        }
+        if(f.resp){
+            respcache::instance() -> release(f.resp);
+        }
+        if(f.entry){
+            filecache::instance() -> release(f.entry);
+            continue;
+        }
+        if(f.addr){
+            munmap(f.addr,f.map_len);//删除虚拟内存的区域
+        }
+        if(f.fd != -1){   //不经过缓存的大文件，fd是自己打开的
+            close(f.fd);
+        }
     }
+    m_file_count = 0;
+}
+
+void http_conn::hold_file(){
+    if(!m_file_entry && !m_file_address && m_file_fd == -1 && !m_body_buf && !m_gzip_entry && !m_resp_entry){
+        return;
+    }
+    out_file& f = m_files[m_file_count++];
+    f.entry = m_file_entry;
+    f.addr = m_file_address;
+    f.map_len = m_file_stat.st_size;
+    f.fd = m_file_fd;
+    f.owned = m_body_buf;
+    f.gz = m_gzip_entry;
+    f.resp = m_resp_entry;
+    m_file_entry = NULL;
+    m_file_address = 0;
+    m_file_fd = -1;
+    m_body_buf = NULL;
+    m_gzip_entry = NULL;
+    m_resp_entry = NULL;
+}
+
+void http_conn::push_chunk(const char* base,size_t len,int fd,off_t offset){
+    if(len == 0){
+        return;
+    }
+    //文件块之后还有数据(多范围响应的分隔头、流水线的下一个响应)：sendfile发出的最后一个小段还没确认时，
+    //Nagle会扣住后面的小段，对端又在延迟确认，每次要等几十毫秒，所以这种队列用TCP_CORK合并小段
+    if(m_chunk_count > 0 && m_chunks[m_chunk_count - 1].fd != -1){
+        m_cork = true;
+    }
+    out_chunk& c = m_chunks[m_chunk_count++];
+    c.base = base;
+    c.len = len;
+    c.fd = fd;
+    c.offset = offset;
 }
 
 //写HTTP响应--本系统中是由主线程完成读写
+//按顺序发送队列中的数据块：连续的内存块(可能属于多个流水线响应)集中到一次writev中，文件块用sendfile发送
 bool http_conn::write(){
-    int temp = 0;
-    int bytes_have_send = 0;     //已经发送的字节数
-    int bytes_to_send = m_write_idx;  //待发送的字节数
-    if(bytes_to_send == 0){
-        modfd(m_epollfd,m_sockfd,EPOLLIN);   //写完了，就重置等待读
-        init();
-        return true;
+    ssize_t temp = 0;
+    if(!write_begin()){
+        return false;
     }
-
-    //集中写，就是将状态行、首部行放在一起，主体部分为另一块缓冲区，无需将其拷贝到同一块缓冲区，就可以直接写
-    while(1){
-        temp = writev(m_sockfd,m_iv,m_iv_count);   //m_iv_count，表示集中写的缓冲区的数量
+    while(m_chunk_pos < m_chunk_count){
+        out_chunk* c = m_chunks + m_chunk_pos;
+        if(c -> fd != -1){
+            temp = sendfile(m_sockfd,c -> fd,&c -> offset,c -> len);
+            if(temp == 0){   //文件在发送过程中被截短了，已经发不出Content-Length声明的字节数
+                unmap();
+                return false;
+            }
+        }
+        else{
+            struct iovec iv[CHUNK_CAPACITY];
+            int n = 0;
+            for(int i = m_chunk_pos;i < m_chunk_count && m_chunks[i].fd == -1;++i){
+                iv[n].iov_base = (void*)m_chunks[i].base;
+                iv[n].iov_len = m_chunks[i].len;
+                ++n;
+            }
+            temp = writev(m_sockfd,iv,n);
+        }
         if(temp <= -1){
         //如果TCP写缓存没有空间，则等待下一轮EPOLLOUT事件。虽然在此期间，服务器无法立即接收到同一客户的下一个请求，但是可以保证连接的完整性
         //这里是当前写缓冲区无法写(满)，那么继续监听写事件，设置了EPOLLONESHOT，无法接收该客户的下一个请求
             if(errno == EAGAIN){//当前不可写
-                modfd(m_epollfd,m_sockfd,EPOLLOUT);
+                rearm(EPOLLOUT);
+                arm_timer(TIMER_WRITE);   //每次有进展都重新计时，对端长时间不读则关闭
                 return true;
             }
             unmap();   //出现问题，释放掉区间，return false，关闭TCP连接
             return false;
         }
 
-        bytes_to_send -= temp;
-        bytes_have_send += temp;
-        //将要发送的数量<=已经发送的字节数，也就是说
-        if(bytes_to_send <= bytes_have_send){
-            //发送HTTP响应成功，根据HTTP请求中的Connection字段决定是否立即关闭连接
-            unmap();
-            if(m_linger){   //保持长连接
-                init();     //直接重新初始化当前对象
-                modfd(m_epollfd,m_sockfd,EPOLLIN);   //继续监听可读事件
-                return true;   //return true表示长连接
+        //跳过已经发送完的数据块，部分发送的数据块下一次从没有发送的位置继续，不能从头重发
+        size_t sent = temp;
+        stats_add(STAT_BYTES_OUT,sent);
+        if(c -> fd != -1){   //sendfile已经更新了c -> offset
+            c -> len -= sent;
+            if(c -> len == 0){
+                ++m_chunk_pos;
+            }
+            continue;
+        }
+        while(sent > 0){
+            c = m_chunks + m_chunk_pos;
+            if(sent >= c -> len){
+                sent -= c -> len;
+                ++m_chunk_pos;
             }
             else{
-                modfd(m_epollfd,m_sockfd,EPOLLIN);
-                printf("%s\n",m_write_buf);
-                return false;
+                c -> base += sent;
+                c -> len -= sent;
+                sent = 0;
             }
         }
     }
+
+    return write_end();
+}
+
+bool http_conn::write_begin(){
+    if(m_close_pending){   //工作线程处理失败，在反应堆线程中关闭连接
+        return false;
+    }
+    if(m_cork && !m_corked){
+        int on = 1;
+        setsockopt(m_sockfd,IPPROTO_TCP,TCP_CORK,&on,sizeof(on));
+        m_corked = true;
+    }
+    return true;
+}
+
+void http_conn::write_stalled(){
+    arm_timer(TIMER_WRITE);
+}
+
+int http_conn::out_batch(struct iovec* iv,int max,int* file_fd,off_t* file_off,size_t* file_len){
+    int n = 0;
+    int i = m_chunk_pos;
+    for(;i < m_chunk_count && m_chunks[i].fd == -1 && n < max;++i){
+        iv[n].iov_base = (void*)m_chunks[i].base;
+        iv[n].iov_len = m_chunks[i].len;
+        ++n;
+    }
+    *file_fd = -1;
+    if(i < m_chunk_count && m_chunks[i].fd != -1){
+        *file_fd = m_chunks[i].fd;
+        *file_off = m_chunks[i].offset;
+        *file_len = m_chunks[i].len;
+    }
+    return n;
+}
+
+void http_conn::out_advance(size_t mem_sent,size_t file_sent){
+    while(mem_sent > 0){
+        out_chunk* c = m_chunks + m_chunk_pos;
+        if(mem_sent >= c -> len){
+            mem_sent -= c -> len;
+            ++m_chunk_pos;
+        }
+        else{
+            c -> base += mem_sent;
+            c -> len -= mem_sent;
+            mem_sent = 0;
+        }
+    }
+    if(file_sent > 0){
+        out_chunk* c = m_chunks + m_chunk_pos;
+        c -> offset += file_sent;
+        c -> len -= file_sent;
+        if(c -> len == 0){
+            ++m_chunk_pos;
+        }
+    }
+}
+
+bool http_conn::write_end(){
+    //一批响应的最后一个字节写出，从这一批第一个请求的第一个字节算起
+    if(m_resp_count > 0){
+        stats_record(STAT_LAST_BYTE,stats_now_ns() - m_batch_start_ns);
+    }
+    //发送HTTP响应成功，根据HTTP请求中的Connection字段决定是否立即关闭连接
+    if(m_close_after){
+        reset_write();
+        return false;
+    }
+    reset_write();
+    //读缓冲区中还有请求，由反应堆再交给线程池；或者下一个请求由反应堆转发给后端
+    if(m_need_parse || m_proxy_pending){
+        return true;
+    }
+    //保持长连接，继续监听可读事件；读缓冲区中有半个请求时按请求头期限计时
+    arm_timer(m_request_bytes > 0 ? TIMER_HEADER : TIMER_KEEPALIVE);
+    rearm(EPOLLIN);
+    return true;   //return true表示长连接
 }
 
 //往写缓冲区写入待发送的数据，可变参数
@@ -440,99 +1494,371 @@ bool http_conn::add_response(const char*format,...){
     return true;
 }
 
-//构建状态行、首部行、实体主体行 format  ...(可变参数--对应format中的%s %d这种)
-bool http_conn::add_status_line(int status,const char* title){
-    return add_response("%s %d %s\r\n","HTTP/1.1",status,title);
+//往写缓冲区追加一段固定的内容，预先生成的状态行/首部都通过它写入
+bool http_conn::add_bytes(const char* data,int len){
+    if(len >= WRITE_BUFFER_SIZE - 1 - m_write_idx){   //超过了当前写缓冲区的剩余量
+        return false;
+    }
+    memcpy(m_write_buf + m_write_idx,data,len);
+    m_write_idx += len;
+    m_write_buf[m_write_idx] = '\0';
+    return true;
+}
+
+//构建状态行、首部行、实体主体行，状态行是response_init预先生成的
+bool http_conn::add_status_line(int status){
+    m_status = status;
+    int len;
+    const char* line = status_line(status,&len);
+    return line && add_bytes(line,len);
+}
+//只处理四种首部信息
+bool http_conn::add_headers(long content_len){//头部就四种信息，程序生成的主体再加上Content-Type
+    return add_date() &&                        //日期           //通用首部
+           add_content_type() &&
+           add_encoding() &&
+           add_validators() &&
+           add_range_headers() &&
+           add_content_length(content_len) &&  //内容长度 ---实体首部字段
+           add_linger() &&                      //客户连接信息       //通用首部
+           add_blank_line();                    //空行          //加空行，首部结束后
+}
+//Date字段，每个线程每秒格式化一次
+bool http_conn::add_date(){
+    return add_bytes(date_line(),DATE_LINE_LEN);
+}
+bool http_conn::add_content_type(){
+    if(!m_content_type){
+        return true;
+    }
+    return add_bytes("Content-Type: ",14) && add_bytes(m_content_type,strlen(m_content_type)) && add_bytes("\r\n",2);
+}
+//主体是gzip时加Content-Encoding；可压缩的类型不管这次是否压缩都加Vary，让中间的缓存按Accept-Encoding分别保存
+bool http_conn::add_encoding(){
+    if(m_gzip && !add_bytes("Content-Encoding: gzip\r\n",24)){
+        return false;
+    }
+    return !m_vary || add_bytes("Vary: Accept-Encoding\r\n",23);
+}
+bool http_conn::add_validators(){
+    if(m_etag_len == 0){
+        return true;
+    }
+    char buf[128] = "ETag: ";
+    int len = 6;
+    if(m_gzip){   //压缩后的字节和原文件不同，只能是弱验证器
+        buf[len++] = 'W';
+        buf[len++] = '/';
+    }
+    memcpy(buf + len,m_etag,m_etag_len);
+    len += m_etag_len;
+    memcpy(buf + len,"\r\nLast-Modified: ",17);
+    len += 17;
+    len += format_http_date(buf + len,m_last_modified);
+    buf[len++] = '\r';
+    buf[len++] = '\n';
+    return add_bytes(buf,len);
 }
-//只处理三种首部信息
-bool http_conn::add_headers(int content_len){//头部就三种信息
-    add_content_length(content_len);//内容长度 ---实体首部字段
-    add_linger();//客户连接信息       //通用首部
-    add_blank_line();//空行          //加空行，首部结束后
+//"bytes 0-499/1234"，buf至少64字节
+static int format_range(char* buf,off_t first,off_t last,off_t size){
+    memcpy(buf,"bytes ",6);
+    int len = 6;
+    len += format_decimal(buf + len,first);
+    buf[len++] = '-';
+    len += format_decimal(buf + len,last);
+    buf[len++] = '/';
+    len += format_decimal(buf + len,size);
+    return len;
+}
+//多个范围时每一部分有自己的Content-Range，在multipart的分隔头中
+bool http_conn::add_range_headers(){
+    if(!m_accept_ranges){
+        return true;
+    }
+    if(!add_bytes("Accept-Ranges: bytes\r\n",22)){
+        return false;
+    }
+    if(m_range_count != 1){
+        return true;
+    }
+    char buf[96] = "Content-Range: ";
+    int len = 15;
+    len += format_range(buf + len,m_range_start[0],m_range_end[0],m_file_stat.st_size);
+    buf[len++] = '\r';
+    buf[len++] = '\n';
+    return add_bytes(buf,len);
 }
 //content-len是当前的要发送的文件的大小--字节数
-bool http_conn::add_content_length(int content_len){
-    return add_response("Content-Length: %d\r\n",content_len);
+bool http_conn::add_content_length(long content_len){
+    char buf[48] = "Content-Length: ";
+    int len = 16;
+    len += format_decimal(buf + len,content_len);
+    buf[len++] = '\r';
+    buf[len++] = '\n';
+    return add_bytes(buf,len);
 }
 //Connection字段
 bool http_conn::add_linger(){
-    return add_response("Connection: %s\r\n",(m_linger == true) ? "keep-alive" : "close");
+    if(m_linger){
+        return add_bytes("Connection: keep-alive\r\n",24);
+    }
+    return add_bytes("Connection: close\r\n",19);
 }
 //首部后，主体前，添加一个空行
 bool http_conn::add_blank_line(){
-    return add_response("%s","\r\n");
+    return add_bytes("\r\n",2);
 }
 //添加内容，将所有的content主体部分，添加到响应中去
 bool http_conn::add_content(const char* content){
-    return add_response("%s",content);
+    return add_bytes(content,strlen(content));
+}
+//错误响应：状态行、Date，之后的Content-Length、Connection、空行和主体都是预先生成的
+bool http_conn::add_error(int status){
+    int len;
+    const char* tail = error_tail(status,m_linger,m_method == HEAD,&len);
+    return tail && add_status_line(status) && add_date() && add_bytes(tail,len);
+}
+//416要告诉客户端文件的实际大小
+bool http_conn::add_range_error(){
+    int len;
+    const char* tail = error_tail(416,m_linger,false,&len);
+    char buf[64] = "Content-Range: bytes */";
+    int n = 23;
+    n += format_decimal(buf + n,m_file_stat.st_size);
+    buf[n++] = '\r';
+    buf[n++] = '\n';
+    return tail && add_status_line(416) && add_date() && add_bytes(buf,n) && add_bytes(tail,len);
+}
+
+//304：Date、验证器、Vary和Connection，没有Content-Length也没有主体
+bool http_conn::add_not_modified(){
+    return add_status_line(304) && add_date() && add_validators() &&
+           (!m_vary || add_bytes("Vary: Accept-Encoding\r\n",23)) && add_linger() && add_blank_line();
+}
+
+//206响应，所有数据块在首部都写好之后才入队，失败时队列不受影响
+//单个范围：主体就是文件的一段，内存中的文件从addr + first开始，sendfile从偏移first开始
+//多个范围：multipart/byteranges，每一部分的分隔串和首部、最后的结束分隔串放在m_body_buf中，和文件的各段交替入队
+bool http_conn::add_ranges(int start,const char* addr,int fd){
+    if(m_range_count == 1){
+        off_t first = m_range_start[0];
+        long len = m_range_end[0] - first + 1;
+        if(!add_status_line(206) || !add_headers(len)){
+            return false;
+        }
+        push_chunk(m_write_buf + start,m_write_idx - start);
+        if(fd != -1){
+            push_chunk(NULL,len,fd,first);
+        }
+        else{
+            push_chunk(addr + first,len);
+        }
+        return true;
+    }
+    const char* boundary = byteranges_boundary();
+    const char* part_type = m_content_type;
+    size_t cap = (m_range_count + 1) * (128 + strlen(boundary) + strlen(part_type));
+    char* buf = (char*)malloc(cap);
+    if(!buf){
+        return false;
+    }
+    m_body_buf = buf;   //交给响应队列后由unmap释放
+    int part[MAX_RANGES + 1];
+    int used = 0;
+    long total = 0;
+    for(int i = 0;i < m_range_count;++i){
+        part[i] = used;
+        char range[64];
+        range[format_range(range,m_range_start[i],m_range_end[i],m_file_stat.st_size)] = '\0';
+        used += snprintf(buf + used,cap - used,"%s--%s\r\nContent-Type: %s\r\nContent-Range: %s\r\n\r\n",
+                         i == 0 ? "" : "\r\n",boundary,part_type,range);
+        total += used - part[i] + m_range_end[i] - m_range_start[i] + 1;
+    }
+    part[m_range_count] = used;
+    used += snprintf(buf + used,cap - used,"\r\n--%s--\r\n",boundary);
+    total += used - part[m_range_count];
+
+    m_content_type = byteranges_type();
+    if(!add_status_line(206) || !add_headers(total)){
+        return false;
+    }
+    push_chunk(m_write_buf + start,m_write_idx - start);
+    for(int i = 0;i < m_range_count;++i){
+        push_chunk(buf + part[i],part[i + 1] - part[i]);
+        long len = m_range_end[i] - m_range_start[i] + 1;
+        if(fd != -1){
+            push_chunk(NULL,len,fd,m_range_start[i]);
+        }
+        else{
+            push_chunk(addr + m_range_start[i],len);
+        }
+    }
+    push_chunk(buf + part[m_range_count],used - part[m_range_count]);
+    return true;
 }
 
 //根据服务器处理HTTP请求的结果，决定返回给客户端的内容
 //ret就是状态码，也就是处理的响应结果
+//响应追加到响应队列的末尾，状态行和首部接在写缓冲区中前面的响应之后
 bool http_conn::process_write(HTTP_CODE ret){
+    int start = m_write_idx;   //本响应在写缓冲区中的起始位置
     switch(ret){
         case INTERNAL_ERROR:{   //500内部错误，未知的其他问题
-            add_status_line(500,error_500_title);   //如果缓冲区过小，也就是WRITE_BUFERRSIZE过小，则都不能写，都是返回false，也就是m_write_buf并没有任何数据，不向客户端写，直接在该线程中关闭连接
-            add_headers(strlen(error_500_form));
-            if(!add_content(error_500_form)){
+            if(!add_error(500)){
                 return false;
             }
             break;
         }
         case BAD_REQUEST:{     //400语法错误，请求的是目录
-            add_status_line(400,error_400_title);
-            add_headers(strlen(error_400_form));
-            if(!add_content(error_400_form)){
+            if(!add_error(400)){
+                return false;
+            }
+            break;
+        }
+        case NOT_IMPLEMENTED:{    //501请求体用了不支持的Transfer-Encoding
+            if(!add_error(501)){
                 return false;
             }
             break;
         }
         case NO_RESOURCE:{    //404没有找到资源，stat错误
-            add_status_line(404,error_404_title);
-            add_headers(strlen(error_404_form));
-            if(!add_content(error_404_form)){
+            if(!add_error(404)){
                 return false;
             }
             break;
         }
         case FORBIDDEN_REQUEST:{   //403禁止访问，不可读
-            add_status_line(403,error_403_title);
-            add_headers(strlen(error_403_form));
-            if(!add_content(error_403_form)){
+            if(!add_error(403)){
+                return false;
+            }
+            break;
+        }
+        case RANGE_NOT_SATISFIABLE:{   //416范围不在文件内
+            if(!add_range_error()){
+                return false;
+            }
+            break;
+        }
+        case NOT_MODIFIED:{   //304客户端缓存的副本有效
+            if(!add_not_modified()){
                 return false;
             }
             break;
         }
         case FILE_REQUEST:{      //返回请求的实体主体部分
-            add_status_line(200,ok_200_title);
-            if(m_file_stat.st_size != 0){//st_size表示文件的大小
-                add_headers(m_file_stat.st_size);  //添加首部信息
+            //主体引用的文件交给响应队列，整个队列发送完后再释放
+            //动态压缩时主体是压缩缓存中的压缩结果
+            int fd = m_file_fd;
+            const char* addr = m_file_address;
+            long size = m_file_stat.st_size;
+            if(m_gzip_entry){
+                fd = -1;
+                addr = m_gzip_entry -> data;
+                size = m_gzip_entry -> len;
+            }
+            //Range请求：分隔头的缓冲区在add_ranges中申请，之后和文件一起交给响应队列
+            if(m_range_count > 0){
+                bool ok = add_ranges(start,addr,fd);
+                hold_file();
+                if(!ok){
+                    return false;
+                }
+                ++m_resp_count;
+                m_close_after = !m_linger;
+                return true;
+            }
+            //经过文件缓存的小文件，生成的响应放进小文件响应缓存(文件缓存监听着它所在的目录)
+            bool fill = m_resp_fill && m_file_entry && fd == -1 && size > 0 && (size_t)size <= respcache::MAX_BODY;
+            hold_file();
+            if(size != 0){//st_size表示文件的大小
+                if(!add_status_line(200) || !add_headers(size)){  //添加状态行和首部信息
+                    return false;
+                }
+                //状态行和Date之后的部分，命中时状态行和Date重新生成
+                if(fill){
+                    int skip;
+                    status_line(200,&skip);
+                    skip += DATE_LINE_LEN;
+                    respcache::instance() -> insert(m_real_file,m_resp_variant,m_resp_generation,
+                                                    m_write_buf + start + skip,m_write_idx - start - skip,addr,size);
+                    stats_add(STAT_RESPCACHE_MISSES,1);
+                }
                 //写缓冲区的内容，此前状态行和首部行已经被添加到了写缓冲区  add_status_line/add_headers
-                m_iv[0].iov_base = m_write_buf;
-                m_iv[0].iov_len = m_write_idx;
+                push_chunk(m_write_buf + start,m_write_idx - start);
+                //HEAD只发送首部，文件没有打开
+                if(m_method == HEAD){
+                }
+                //大文件：writev只发首部，主体由sendfile从文件偏移0开始发送
+                else if(fd != -1){
+                    push_chunk(NULL,size,fd,0);
+                }
                 //文件内容和大小--字节数
-                m_iv[1].iov_base = m_file_address;
-                m_iv[1].iov_len = m_file_stat.st_size;
-                m_iv_count = 2;    //写的缓冲区的数量为2
+                else{
+                    push_chunk(addr,size);
+                }
+                ++m_resp_count;
+                m_close_after = !m_linger;
                 return true;
             }
             else{   //请求的文件为空，那么根据html信息返回空的结构体就ok--1.状态行 2.首部行 3.主体行
                 const char* ok_string = "<html><body></body></html>";
-                add_headers(strlen(ok_string));
-                if(!add_content(ok_string)){    
+                if(!add_status_line(200) || !add_headers(strlen(ok_string))){
+                    return false;
+                }
+                if(m_method != HEAD && !add_content(ok_string)){
                     return false;
                 }
             }
-            //没有break，是因为一定就返回了
+            break;
+        }
+        case CACHED_REQUEST:{    //首部和主体都在小文件响应缓存中，写缓冲区中只有状态行和Date，两块在同一次writev中发送
+            const respcache::entry* e = m_resp_entry;
+            hold_file();
+            if(!add_status_line(200) || !add_date()){
+                return false;
+            }
+            push_chunk(m_write_buf + start,m_write_idx - start);
+            push_chunk(respcache::instance() -> data(e),m_method == HEAD ? e -> head_len : e -> len);
+            ++m_resp_count;
+            m_close_after = !m_linger;
+            return true;
+        }
+        case BUFFER_REQUEST:{    //程序生成的主体，发送完后释放
+            const char* body = m_body_buf;
+            hold_file();
+            if(!add_status_line(m_body_status) || !add_headers(m_body_len)){
+                return false;
+            }
+            push_chunk(m_write_buf + start,m_write_idx - start);
+            if(m_method != HEAD){
+                push_chunk(body,m_body_len);
+            }
+            ++m_resp_count;
+            m_close_after = !m_linger;
+            return true;
+        }
+        case ROUTE_REQUEST:{     //主体已经在写缓冲区的start处，首部写在主体之后，按首部、主体的顺序入队
+            m_write_idx += m_body_len;
+            int head = m_write_idx;
+            if(!add_status_line(m_body_status) || !add_headers(m_body_len)){
+                return false;
+            }
+            push_chunk(m_write_buf + head,m_write_idx - head);
+            if(m_method != HEAD){
+                push_chunk(m_write_buf + start,m_body_len);
+            }
+            ++m_resp_count;
+            m_close_after = !m_linger;
+            return true;
         }
         default:{
             return false;
         }
     }
     //除了FILE_REQUEST外的其他几种情况，均是没有文件内容，所以，只需要将状态和首部发送即可
-    m_iv[0].iov_base = m_write_buf;
-    m_iv[0].iov_len = m_write_idx;
-    m_iv_count = 1;
+    push_chunk(m_write_buf + start,m_write_idx - start);
+    ++m_resp_count;
+    m_close_after = !m_linger;
     return true;
 }
 
@@ -541,25 +1867,77 @@ bool http_conn::process_write(HTTP_CODE ret){
  * 写完成后，已经将实体主体内容放到了合适的缓冲区，并且返回HTTP_CODE，知道怎么填充状态行，首部字段已经设置好了private的m_linger字段
  * 并获取到了目标文件的状态，根据m_file_stat.st_size填充content-length，写只需要将这些内容写到响应的缓冲区，此外首部还需要填充空行即可
  * 而状态行已经给出了根据状态码填充的信息
+ * 读缓冲区中可能有多个流水线请求，依次解析，响应按请求的顺序排队，由反应堆线程一起发送
 */
 void http_conn::process(){
-    //处理读事件
-    HTTP_CODE read_ret = process_read();
-    //只有NO_REQUEST是继续监听读事件，读取内容，其他都要处理写事件，这也是do_request的返回结果
-    if(read_ret == NO_REQUEST){    //读事件返回的是NO_REQUEST，表示还应该继续读，继续监听
-        modfd(m_epollfd,m_sockfd,EPOLLIN);  //重新监听可读事件，return，还没到写的时候，这也是重置了EPOLLONESHOT
-        return;
+    stats_record(STAT_QUEUE_WAIT,stats_now_ns() - m_enqueue_ns);
+    m_need_parse = false;
+    while(true){
+        //处理读事件
+        HTTP_CODE read_ret = process_read();
+        //只有NO_REQUEST是继续监听读事件，读取内容，其他都要处理写事件，这也是do_request的返回结果
+        if(read_ret == NO_REQUEST){
+            break;
+        }
+        //转发由反应堆线程和后端完成，前面排好队的响应先发出去，之后的流水线请求等转发结束再处理
+        if(read_ret == PROXY_REQUEST){
+            m_proxy_pending = true;
+            break;
+        }
+        int start = m_write_idx;
+        int first_chunk = m_chunk_count;
+        if(m_resp_count == 0){
+            m_batch_start_ns = m_request_start_ns;
+        }
+        //处理写事件就是将待写的状态行、首部行、主体行写到缓冲区，一旦缓冲区空间大小小于待写的数据字节数，那么就返回false
+        //连接的关闭和定时器都属于反应堆线程，这里只做标记，由反应堆在write中关闭
+        if(!process_write(read_ret)){
+            m_write_idx = start;
+            if(m_resp_count == 0){
+                m_close_pending = true;  //直接关闭连接，不发送数据
+            }
+            else{
+                m_close_after = true;    //先把前面排好队的响应发出去再关闭
+            }
+            break;
+        }
+        stats_add(STAT_REQUESTS,1);
+        stats_status(m_status);
+        //访问日志，字节数是响应的总长度(状态行、首部和主体)
+        if(g_log_level <= LOG_LEVEL_INFO){
+            long bytes = 0;
+            for(int i = first_chunk;i < m_chunk_count;++i){
+                bytes += m_chunks[i].len;
+            }
+            log_access(m_address.sin_addr.s_addr,m_address.sin_port,method_names[m_method],m_url,m_status,bytes);
+        }
+        //不保持连接的响应之后的请求不再处理
+        if(m_close_after){
+            break;
+        }
+        //保留请求之后已经读入的数据，作为下一个请求继续解析
+        if(!next_request()){
+            m_close_after = true;
+            break;
+        }
+        if(m_request_bytes == 0){
+            break;
+        }
+        //队列满了，先发送，发送完后反应堆再把连接交给线程池
+        //数据块的剩余容量要放得下一个多范围的响应
+        if(m_resp_count == MAX_PIPELINE || WRITE_BUFFER_SIZE - m_write_idx < RESPONSE_RESERVE
+           || CHUNK_CAPACITY - m_chunk_count < RESPONSE_CHUNKS){
+            m_need_parse = true;
+            break;
+        }
     }
-    //处理写事件---我觉得这里写的有问题，待会验证一下
-    //验证完毕，就是写的数据大于当前发送缓冲区大小，就不写了，因为没必要写了
-    bool write_ret = process_write(read_ret);
-
-    //处理写事件就是将待写的状态行、首部行、主体行写到缓冲区，一旦缓冲区空间大小小于待写的数据字节数，那么就返回false
-    //表示需要继续监听EPOLLONESHOT事件，等待缓冲区不满，触发可写(ET)，LT是缓冲区有剩余空间就会触发写事件
-    if(!write_ret){     //false应该是因为写的数据大于当前发送缓冲区大小，导致没有写完
-         close_conn();  //直接关闭连接，不发送数据
+    if(m_resp_count == 0 && !m_close_pending && !m_proxy_pending){    //读事件返回的是NO_REQUEST，表示还应该继续读，继续监听
+        rearm(EPOLLIN);  //重新监听可读事件，return，还没到写的时候，这也是重置了EPOLLONESHOT
+        unmark_busy();
+        return;
     }
-    //当前发送缓冲区只用来发送状态行和首部行，文件内容不通过缓冲区发送，除非缓冲区设置太小，不然不会出现这种直接关闭的情况
-    modfd(m_epollfd,m_sockfd,EPOLLOUT);  //因为，process_write仅仅是将该待写数据写到了写缓冲区位置，然后监听可写事件，等待触发，由主线程完成写操作
+    //process_write仅仅是将该待写数据写到了写缓冲区位置，然后监听可写事件，等待触发，由反应堆线程完成写操作
+    rearm(EPOLLOUT);
+    unmark_busy();
 }
 
@@ -18,37 +18,71 @@
 #include<sys/mman.h>
 #include<stdarg.h>//可变参数需要的头文件
 #include<errno.h>
+#include<sys/uio.h>
+#include<sys/sendfile.h>
+#include<atomic>
 #include"locker.h"
+#include"filecache.h"
+#include"gzipcache.h"
+#include"respcache.h"
+#include"timerwheel.h"
+#include"simdscan.h"
+#include"bufpool.h"
+#include"response.h"
+#include"log.h"
+#include"stats.h"
+#include"router.h"
+#include"proxy.h"
+class uring_reactor;
+struct coro_slot;
 //http_conn对象的头文件
 //http_conn是http表示http连接的对象，以及相关的处理
 class http_conn
 {
 public:    
     static const int FILENAME_LEN = 200;//文件名的最大长度
-    static const int READ_BUFFER_SIZE = 2048;//读缓冲区的大小
-    static const int WRITE_BUFFER_SIZE = 1024;//写缓冲区的大小
-    /*HTTP请求方法，但我们仅支持GET*/
+    static const int WRITE_BUFFER_SIZE = 4096;//写缓冲区的大小，流水线的多个响应的状态行和首部依次放在这里
+    static const int MAX_PIPELINE = 16;//一次最多排队发送的响应数
+    static const int RESPONSE_RESERVE = 512;//写缓冲区剩余空间少于这个值时，不再处理下一个流水线请求
+    static const int MAX_RANGES = 8;//一个Range首部最多的范围数，超过时忽略Range，发送整个文件
+    //一个响应最多占用的数据块数：首部、每个范围的分隔头和内容、结束分隔串
+    static const int RESPONSE_CHUNKS = MAX_RANGES * 2 + 2;
+    static const int CHUNK_CAPACITY = MAX_PIPELINE * 2 + RESPONSE_CHUNKS;//响应队列的数据块容量
+    /*HTTP请求方法，但我们仅支持GET和HEAD*/
     enum METHOD{GET = 0,POST,HEAD,PUT,DELETE,TRACE,OPTIONS,CONNECT,PATCH};
     /*解析客户请求时，主状态机所处的状态*/
     //主状态机，是在解析http请求时，处理的状态分别是1.解析请求行 2.头部行 3.主体行
     enum CHECK_STATE{CHECK_STATE_REQUESTLINE = 0,CHECK_STATE_HEADER,CHECK_STATE_CONTENT};
     /*服务器处理HTTP请求的可能结果*/
     //可能的处理结果，处理HTTP请求可能返回的结果
+    //BUFFER_REQUEST表示响应主体是程序生成的，在m_body_buf中(例如统计页面)
+    //ROUTE_REQUEST表示路由处理函数把主体直接写在了写缓冲区的m_write_idx处，长度m_body_len
+    //PROXY_REQUEST表示请求要转发给后端，发给后端的请求头已经在m_proxy_head中
+    //RANGE_NOT_SATISFIABLE表示Range中没有一个范围落在文件内(416)，NOT_MODIFIED表示条件请求的验证器匹配(304)
     enum HTTP_CODE{NO_REQUEST,GET_REQUEST,BAD_REQUEST,NO_RESOURCE,
-                   FORBIDDEN_REQUEST,FILE_REQUEST,INTERNAL_ERROR,CLOSED_CONNECTION};
+                   FORBIDDEN_REQUEST,FILE_REQUEST,INTERNAL_ERROR,CLOSED_CONNECTION,BUFFER_REQUEST,
+                   RANGE_NOT_SATISFIABLE,NOT_MODIFIED,ROUTE_REQUEST,PROXY_REQUEST,CACHED_REQUEST,NOT_IMPLEMENTED};
 
      /*行的读取状态*/   
      //从状态机，在主状态机内实现，用来在解析行时判断当前读取/解析的行的状态
      //分别是1.读取一整行 2.行错误，这时返回BAD_REQUEST(语法错误) 3.未读取完一整行，可能缓冲区满，没有读到所有数据，这时，监听EPOLLIN事件，等待可读，再继续读
      enum LINE_STATUS{LINE_OK = 0,LINE_BAD,LINE_OPEN};
 
+     /*连接定时器的种类，每种对应一个超时时间*/
+     //1.请求头读取期限(从请求的第一个字节开始计时，之后的读不延长) 2.请求体两次读之间的最长间隔
+     //3.长连接两个请求之间的空闲时间 4.发送缓冲区满后等待可写的最长时间
+     enum TIMER_KIND{TIMER_HEADER = 0,TIMER_BODY,TIMER_KEEPALIVE,TIMER_WRITE};
+
 public:
-    http_conn(){}
+    http_conn(){m_timer.prev = m_timer.next = NULL;m_busy = 0;m_seg_head = m_seg_cur = m_seg_tail = NULL;m_file_count = 0;m_body_buf = NULL;m_gzip_entry = NULL;m_resp_entry = NULL;m_proxy_head = NULL;m_upstream = NULL;}
     ~http_conn(){}
 
 public:
     //初始化，包括清空缓冲区、一些值置0等操作
-    void init(int sockfd,const sockaddr_in& addr);//初始化新接受的连接
+    //初始化新接受的连接，epollfd和timers是接受该连接的反应堆的epoll和时间轮
+    //ring不为NULL时连接属于io_uring反应堆，不注册到epoll(epollfd不用)，事件的重新注册和关闭都交给ring
+    //coro不为NULL时连接由协程反应堆驱动，由反应堆注册到epoll，rearm只记录要等的事件
+    void init(int sockfd,const sockaddr_in& addr,int epollfd,timerwheel* timers,uring_reactor* ring = NULL,coro_slot* coro = NULL);
     void close_conn(bool real_close = true);//关闭连接
     //实际工作线程运行的处理客户请求的操作
     void process();//处理客户请求    
@@ -56,9 +90,46 @@ public:
     //读写操作，ET模式，均是非阻塞读写--文件描述法设置成非阻塞的
     bool read();//非阻塞读操作
     bool write();//非阻塞写操作
+    //io_uring反应堆收到的数据交给连接，代替read中的recv；返回接收的字节数，读满当前请求允许的字节数时小于len，已经读满时返回-1
+    long feed(const char* data,long len);
+    //io_uring反应堆用链接的send/splice异步发送响应队列，代替write中的writev/sendfile
+    //write_begin和write_end是write的开头和结尾：前者检查要不要直接关闭、设置TCP_CORK；后者在队列发完后调用，返回值和write相同
+    bool write_begin();
+    bool write_end();
+    //取出队列开头连续的内存块(最多max个)；后面紧跟文件块时由file_fd/file_off/file_len返回，否则file_fd为-1
+    int out_batch(struct iovec* iv,int max,int* file_fd,off_t* file_off,size_t* file_len);
+    //开头的内存块发出了mem_sent字节，之后的文件块有file_sent字节已经交给内核
+    void out_advance(size_t mem_sent,size_t file_sent);
+    bool out_done() const{return m_chunk_pos >= m_chunk_count;}
+    //异步发送还没完成，按等待可写计时，对端长时间不读则关闭
+    void write_stalled();
+
+    //反应堆把连接交给线程池前后调用，处理期间定时器到期不会关闭连接
+    void mark_busy(){m_enqueue_ns = stats_now_ns();m_busy.fetch_add(1,std::memory_order_relaxed);}
+    void unmark_busy(){m_busy.fetch_sub(1,std::memory_order_release);}
+    //交给线程池的时间，线程池据此计算排队时间调整线程数
+    uint64_t enqueue_ns() const{return m_enqueue_ns;}
+    //write返回true后，读缓冲区中还有没解析的流水线请求，反应堆要把连接再交给线程池
+    //队列还没发完(write遇到EAGAIN)时不能交给线程池，等发完的那次write
+    bool pending_request() const{return m_need_parse && m_chunk_count == 0;}
+    //write返回true后，排队的响应都发完了，下一个请求要由反应堆的upstream_pool转发给后端
+    bool proxy_pending() const{return m_proxy_pending && m_chunk_count == 0;}
+    //正在转发，连接上的事件交给upstream_pool
+    upstream* proxying() const{return m_upstream;}
+    //read读满了当前请求允许的字节数而不是读到EAGAIN，socket中可能还有数据
+    bool read_full() const{return m_request_bytes >= m_read_limit;}
+
+    //微基准(bench/microbench.cpp)直接驱动解析和构建响应的私有函数
+    friend class http_conn_test_hook;
+    //反向代理在反应堆线程中直接读写连接的socket和请求状态
+    friend class upstream_pool;
 
 private:
     void init();//初始化连接
+    void init_request();//重置请求的解析状态，不动读缓冲区
+    void reset_write();//清空排队的响应，释放它们引用的文件
+    //一个请求处理完后，把读缓冲区中请求之后的数据(流水线的下一个请求)搬到新的分段链表中，重置解析状态
+    bool next_request();
     //解析HTTP请求--
     HTTP_CODE process_read();//解析HTTP请求
     //根据解析请求的结果，填充HTTP应答，返回的结果是bool型变量，
@@ -72,39 +143,125 @@ private:
     HTTP_CODE parse_content(char* text);       //解析主体行
     //处理相应，返回的均是http响应码
     HTTP_CODE do_request();         
+    //调用匹配的路由处理函数，主体在写缓冲区中返回ROUTE_REQUEST，在m_body_buf中返回BUFFER_REQUEST
+    HTTP_CODE call_route(const router::route* route);
+    //把请求改写成发给后端的请求头，连同已经读入的请求体放进m_proxy_head，返回PROXY_REQUEST
+    HTTP_CODE proxy_request();
+    //转发结束：记录状态码和发给客户端的字节数；keep为true时继续处理读缓冲区中的下一个请求(由write交给线程池)或者等待新的请求
+    void end_proxy(int status,long bytes,bool keep);
+    //转发在发送响应之前失败：回答status并在发送后关闭连接
+    void proxy_error(int status);
+    void log_proxy(int status,long bytes);
+    //查小文件响应缓存，命中时设置m_resp_entry返回true；未命中的GET记下要填充
+    bool lookup_response();
+    //打开path(先查文件缓存)，设置m_file_stat/m_file_entry/m_file_address/m_file_fd，成功返回FILE_REQUEST
+    //HEAD请求只stat不打开
+    HTTP_CODE open_file(const char* path);
+    //open_file的两步：stat_file查文件缓存或者stat，检查权限；map_file打开文件(大文件保留fd，小文件mmap)
+    //中间可以先判断条件请求，304不需要打开文件
+    HTTP_CODE stat_file(const char* path);
+    HTTP_CODE map_file(const char* path);
+    //按m_file_stat生成ETag和Last-Modified
+    void set_validators();
+    //If-None-Match/If-Modified-Since是否说明客户端的副本仍然有效
+    bool not_modified();
+    //释放当前请求打开的文件，304/416不发送主体
+    void release_file();
+    //可压缩的文件按Accept-Encoding协商gzip：压缩缓存、foo.gz、首次请求时压缩
+    void negotiate_gzip();
+    //存在非空的foo.gz时用它代替原文件
+    bool open_gzip_sibling();
+    //解析Range(If-Range不匹配时忽略)，把范围记录到m_range_start/m_range_end
+    //返回FILE_REQUEST(有范围或者忽略Range)或者RANGE_NOT_SATISFIABLE
+    HTTP_CODE parse_ranges();
+    //If-Range是否和当前文件匹配，不匹配时发送整个文件
+    bool if_range_matches(const char* value);
+    //206响应的主体：单个范围直接发送文件的这一段，多个范围组成multipart/byteranges
+    bool add_ranges(int start,const char* addr,int fd);
+    //释放还没交给响应队列的文件
+    static void drop_file(filecache::entry* entry,char* addr,size_t len,int fd);
     //从接收缓冲区中取数据，返回后面的未解析的数据
     char* get_line(){return m_read_buf + m_start_line;}
     //解析行，从状态机
     LINE_STATUS parse_line();
+    //在已经解析出的一行中查找字符
+    char* find_in_line(char* text,char c);
+    //读缓冲区的最后一段满了，再接一段；请求头阶段会把末尾不完整的行搬到新段，行超过一段时返回false
+    bool grow_read_buf();
+    //归还读缓冲区的所有分段
+    void free_read_buf();
+    //读入数据之后：统计字节数，按请求所处的阶段设置定时器
+    void after_read(long bytes);
+    //重新等待事件(EPOLLIN/EPOLLOUT)：epoll模式下重置EPOLLONESHOT，io_uring模式下通知所属的反应堆
+    void rearm(int ev);
+    //把数据追加到读缓冲区，和read中recv的数据一样按行分段
+    bool append_read_buf(const char* data,long len);
 
     //下面这一组函数被process_write调用以填充HTTP应答
-    void unmap();    //将开辟的空间释放掉(已经写到发送缓冲区后)
+    void unmap();    //将开辟的空间释放掉(已经写到发送缓冲区后)，包括所有排队的响应引用的文件
+    void hold_file();//把当前请求的文件(映射/缓存项/fd)交给响应队列，发送完后由unmap释放
+    void push_chunk(const char* base,size_t len,int fd = -1,off_t offset = 0);//待发送数据块入队
     //往响应报文中添加响应
     bool add_response(const char* format,...);//可以允许参数个数的不确定
+    bool add_bytes(const char* data,int len);  //追加固定内容，不格式化
     bool add_content(const char* content);    //添加主体部分
-    bool add_status_line(int status,const char* title);  //添加状态行，要有状态码
-    bool add_headers(int content_length);     //添加首部
-    bool add_content_length(int content_len);
+    bool add_status_line(int status);  //添加状态行，要有状态码
+    bool add_headers(long content_length);     //添加首部
+    bool add_date();       //Date首部字段
+    bool add_content_type();   //Content-Type首部字段，只有m_content_type不为NULL时才添加
+    bool add_encoding();       //Content-Encoding和Vary首部字段
+    bool add_range_headers();  //Accept-Ranges，单个范围时还有Content-Range
+    bool add_validators();     //ETag和Last-Modified，gzip压缩的响应是弱ETag
+    bool add_content_length(long content_len);
     //首部信息只有Connection、Content-Length、
     bool add_linger();     //表示是否是长连接--Connection首部字段
     bool add_blank_line(); //添加空行-表示的是首部后会有一个空行，然后后面才是实体主体部分
+    bool add_error(int status); //整个错误响应(400/403/404/500)，除Date外都是预先生成的
+    bool add_range_error();     //416，在错误响应中加上Content-Range: bytes */文件大小
+    bool add_not_modified();    //304，只有验证器和Vary，没有主体
+
+    //(重新)设置连接的定时器，只在反应堆线程中调用
+    void arm_timer(TIMER_KIND kind);
+    //时间轮的到期回调，在反应堆线程中执行
+    static void on_timeout(timer_node* node);
 
 public:
-    /*所有socket上的事件都被注册到同一个epoll内核事件表中，所以将epoll文件描述符设置为静态的*/
-    static int m_epollfd;
-    static int m_user_count;//统计用户数量
+    //多个反应堆线程同时accept/close，所以用户数量是原子变量
+    static std::atomic<int> m_user_count;//统计用户数量
+    //不小于该大小的文件用sendfile发送主体，小文件仍然mmap+writev
+    static off_t m_sendfile_threshold;
+    //小于这个字节数的文件不做动态压缩，压缩省下的字节抵不过gzip的首尾开销
+    static const int GZIP_MIN_SIZE = 256;
+    //各种定时器的超时时间(毫秒)，下标是TIMER_KIND
+    static int m_timeout[4];
+    //请求头(请求行+首部)和请求体的最大字节数，超过则关闭连接/返回400
+    static int m_header_limit;
+    static int m_body_limit;
 
 private:
+    /*每个反应堆有自己的epoll内核事件表，连接注册在接受它的那个反应堆的epoll中*/
+    int m_epollfd;
+    uring_reactor* m_ring;   //io_uring模式下连接所属的反应堆，epoll模式下为NULL
+    coro_slot* m_coro;       //协程模式下连接的协程状态，其他模式下为NULL
     //该HTTP连接的socket和对方的socket地址
     int m_sockfd;
     sockaddr_in m_address;
 
-    char m_read_buf[READ_BUFFER_SIZE];//读缓冲区
-    int m_read_idx;//标识读缓冲区已经读入的客户数据的最后一个字节的下一个位置
+    //读缓冲区是从分段池中取的分段链表，空闲的长连接不持有分段
+    //请求头阶段每一行都完整地落在一个分段内(见grow_read_buf，请求头阶段接上的分段容量是请求头的上限)，所以解析仍然按行在单个分段中进行，m_url/m_host等指针指向各自的分段
+    buf_segment* m_seg_head;//第一个分段，当前请求的数据从这里开始
+    buf_segment* m_seg_cur; //正在解析的分段
+    buf_segment* m_seg_tail;//正在接收数据的分段
+    char* m_read_buf;//正在解析的分段的数据区
+    int m_read_idx;//标识读缓冲区已经读入的客户数据的最后一个字节的下一个位置(正在解析的分段中)
+    long m_parsed_before;//正在解析的分段之前的分段中的字节数
+    long m_request_bytes;//当前请求已经读入的字节数
+    long m_header_bytes; //请求头的字节数，解析到空行时确定
+    long m_read_limit;   //当前请求最多读入的字节数，请求头阶段是m_header_limit，之后是请求头加请求体
     //标识正在分析的字符在读缓冲区的位置
-    int m_checked_idx;//当前正在分析的字符在读缓冲区中的位置
+    int m_checked_idx;//当前正在分析的字符在正在解析的分段中的位置
     //正在解析的当前行的初始位置
-    int m_start_line;//当前正在解析的行的初始位置
+    int m_start_line;//当前正在解析的行在正在解析的分段中的初始位置
     //写缓冲区的位置-写缓冲区待发送的字节数
     char m_write_buf[WRITE_BUFFER_SIZE];//写缓冲区
     int m_write_idx;//写缓冲区中待发送的字节数
@@ -120,19 +277,100 @@ private:
     //用于解析/读取实体主体内容，我觉得可以避免TCP粘包
     int m_content_length;//HTTP请求的消息体的长度--这个字段很重要
     bool m_linger;//HTTP请求是否要求保持连接--最终写完成后，根据返回的状态，决定是否是长连接
+    bool m_accept_gzip;//Accept-Encoding中接受gzip
+    char* m_range;   //Range首部的值，没有时为NULL
+    char* m_if_range;//If-Range首部的值
+    char* m_if_none_match;     //If-None-Match首部的值
+    char* m_if_modified_since; //If-Modified-Since首部的值
+    bool m_expect_continue;    //Expect: 100-continue，转发时由代理回答100
+    bool m_chunked_body;       //请求带Transfer-Encoding：转发和本地处理都只支持Content-Length的请求体
+
+    //反向代理：URL匹配的后端，发给后端的请求头(malloc申请)，以及还在客户端socket中的请求体字节数
+    const proxy_backend* m_backend;
+    char* m_proxy_head;
+    size_t m_proxy_head_len;
+    long m_proxy_body_left;
+    bool m_proxy_pending;      //排队的响应发完后开始转发
+    upstream* m_upstream;      //正在转发时使用的后端连接
 
     //mmap申请一段内存空间，客户所请求的文件被映射到该内存空间，写到写缓冲区--snprintf
     //写完后，用umap删除这段内存空间
     char* m_file_address;//客户请求的目标文件被mmap到内存中的起始位置
+    filecache::entry* m_file_entry;//命中文件缓存时持有的缓存项，m_file_address指向其中的共享映射，发送完后释放引用而不是munmap
     //获取目标文件的状态，决定返回状态码，如果是目录--400/文件不可读--403/文件不存在--404
     struct stat m_file_stat;//目标文件的状态。通过它我们可以判断文件是否存在/是否为目录/是否可读，并获得文件大小等信息
-    //我们将采用writev来执行写操作，所以定义下面两个成员，其中m_iv_count表示被写内存块的数量
-    
+    //大文件不映射，先用writev发送m_write_buf中的状态行和首部，再用sendfile从m_file_fd零拷贝发送主体
+    int m_file_fd;        //sendfile发送主体时的文件描述符，-1表示主体在内存中
+
     /* 应答：1.1状态行 2.多个首部字段 3.1空行 4.主体(请求文档内容)
-     * do_request中，可以将状态行、首部、空行，写到一块内存中，然后将主体写到另外一块内存中(采用mmap)
-     * 并不需要将这两块内容拼接成一块之后，再一起写到fd，套接字描述符，写给客户端，使用writev可以集中写
+     * 状态行、首部、空行写到写缓冲区，主体是另外一块内存(mmap)或者文件的一段(sendfile)，
+     * 并不需要将这些内容拼接成一块，使用writev可以集中写
+     * 流水线请求的多个响应按请求的顺序排成一个数据块队列，相邻的内存块在一次writev中发送
     */
-    struct iovec m_iv[2];
-    int m_iv_count;   //表示被写的内存块的数量
+    struct out_chunk{
+        const char* base;  //内存块的起始位置，文件块不用
+        size_t len;        //还没有发送的字节数
+        int fd;            //文件块的文件描述符，-1表示内存块
+        off_t offset;      //文件块下一次发送的文件偏移，sendfile会更新它
+    };
+    //排队的响应引用的文件，全部发送完后释放
+    struct out_file{
+        filecache::entry* entry;   //缓存项，不为NULL时只释放引用
+        char* addr;                //自己映射的地址
+        size_t map_len;
+        int fd;                    //自己打开的fd
+        char* owned;               //程序生成的主体，malloc申请的，发送完后free
+        gzipcache::entry* gz;      //主体是压缩缓存中的压缩结果时持有的缓存项
+        respcache::entry* resp;    //从小文件响应缓存发送时持有的记录
+    };
+    out_chunk m_chunks[CHUNK_CAPACITY];
+    int m_chunk_count;  //队列中的数据块数
+    int m_chunk_pos;    //第一个还没发送完的数据块
+    out_file m_files[MAX_PIPELINE];
+    int m_file_count;
+    int m_resp_count;   //队列中的响应数
+    int m_status;       //最近一个响应的状态码，写访问日志用
+    bool m_close_after; //队列中最后一个响应不保持连接，发送完后关闭
+    bool m_cork;        //文件块后面还有数据块，发送期间设置TCP_CORK
+    bool m_corked;      //已经设置了TCP_CORK，队列发完后取消
+    bool m_need_parse;  //队列满了而读缓冲区中还有没解析的请求，发送完后要继续解析
+
+    //程序生成的响应主体(BUFFER_REQUEST)，malloc申请，交给响应队列后由unmap释放
+    char* m_body_buf;
+    size_t m_body_len;    //BUFFER_REQUEST和ROUTE_REQUEST的主体长度
+    int m_body_status;    //路由处理函数设置的状态码
+    const char* m_content_type;   //不为NULL时添加Content-Type首部
+    gzipcache::entry* m_gzip_entry;  //动态压缩的结果，不为NULL时主体是它而不是文件
+    respcache::entry* m_resp_entry;  //命中小文件响应缓存时的记录，首部和主体都在其中(CACHED_REQUEST)
+    bool m_resp_fill;     //没有命中小文件响应缓存，生成的响应符合条件时放进去
+    int m_resp_variant;   //respcache的变体：keep-alive、接受gzip
+    unsigned long m_resp_generation;   //未命中时缓存的失效代数，填充时交回
+    bool m_gzip;          //主体是gzip压缩的(压缩缓存或者foo.gz)，添加Content-Encoding
+    bool m_vary;          //可压缩的类型，不管是否压缩都添加Vary: Accept-Encoding
+    bool m_accept_ranges; //原样发送的文件，添加Accept-Ranges: bytes
+    //Range请求的范围(闭区间，已经限制在文件内)，m_range_count为0表示发送整个文件
+    int m_range_count;
+    off_t m_range_start[MAX_RANGES];
+    off_t m_range_end[MAX_RANGES];
+
+    //文件响应的验证器，按原文件(不是foo.gz)的inode、大小和修改时间生成，m_etag_len为0表示不添加
+    char m_etag[64];      //带引号的强ETag，"inode-大小-修改时间"的十六进制
+    int m_etag_len;
+    time_t m_last_modified;
+
+    //各阶段的时间戳(单调时钟纳秒)，用于延迟统计
+    uint64_t m_enqueue_ns;        //反应堆交给线程池的时间
+    uint64_t m_parse_ns;          //开始解析的时间
+    uint64_t m_request_start_ns;  //当前请求第一个字节读入的时间
+    uint64_t m_batch_start_ns;    //响应队列中第一个请求的开始时间
+
+    //连接的定时器，挂在所属反应堆的时间轮上，只由反应堆线程修改
+    timer_node m_timer;
+    TIMER_KIND m_timer_kind;
+    timerwheel* m_timers;
+    //正在线程池中处理的次数，大于0时定时器到期也不关闭连接(工作线程还在使用它)
+    std::atomic<int> m_busy;
+    //工作线程处理失败要关闭连接时，不在工作线程中直接关闭，而是交给反应堆线程在write中关闭
+    bool m_close_pending;
 };
 #endif
\ No newline at end of file
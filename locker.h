@@ -2,8 +2,13 @@
 #define LOCKER_H
 
 #include<exception>
+#include<atomic>
+#include<climits>
 #include<pthread.h>
 #include<semaphore.h>
+#include<unistd.h>
+#include<sys/syscall.h>
+#include<linux/futex.h>
 
 //信号量封装
 class sem{
@@ -53,6 +58,11 @@ public:
     {
         return pthread_mutex_unlock(&m_mutex)==0;
     }
+    //取出内部的互斥锁，给需要和条件变量配合使用的场景
+    pthread_mutex_t* get()
+    {
+        return &m_mutex;
+    }
 private:
     pthread_mutex_t m_mutex;
 };
@@ -88,14 +98,84 @@ public:
         pthread_mutex_unlock(&m_mutex);
         return ret==0;
     }
+    //调用者已经持有外部的互斥锁mutex(保护的是条件本身)，在这把锁上等待
+    bool wait(pthread_mutex_t* mutex)
+    {
+        return pthread_cond_wait(&m_cond,mutex)==0;
+    }
+    //同上，最多等到绝对时间deadline(CLOCK_REALTIME)
+    bool timewait(pthread_mutex_t* mutex,struct timespec deadline)
+    {
+        return pthread_cond_timedwait(&m_cond,mutex,&deadline)==0;
+    }
     //唤醒一个线程，具体唤醒哪个，要根据内核的调度策略和优先级来决定
     bool signal()
     {
         return pthread_cond_signal(&m_cond)==0;
     }
+    //唤醒所有等待的线程
+    bool broadcast()
+    {
+        return pthread_cond_broadcast(&m_cond)==0;
+    }
 private:
     pthread_mutex_t m_mutex;
     pthread_cond_t m_cond;
 };
 
+//基于futex的事件计数，给无锁队列的消费者在队列空时休眠用
+//消费者：key = prepare_wait()，再检查一次队列，仍然为空才wait(key)，否则cancel_wait()
+//生产者：入队后notify_one()，只有确实有线程在休眠时才进入内核
+class eventcount{
+public:
+    eventcount():m_seq(0),m_waiters(0){}
+    int prepare_wait()
+    {
+        m_waiters.fetch_add(1,std::memory_order_seq_cst);
+        return m_seq.load(std::memory_order_seq_cst);
+    }
+    void cancel_wait()
+    {
+        m_waiters.fetch_sub(1,std::memory_order_relaxed);
+    }
+    //如果prepare_wait之后已经有生产者notify过，序号已经变化，futex直接返回，不会丢失唤醒
+    void wait(int key)
+    {
+        syscall(SYS_futex,(int*)&m_seq,FUTEX_WAIT_PRIVATE,key,NULL,NULL,0);
+        m_waiters.fetch_sub(1,std::memory_order_relaxed);
+    }
+    void notify_one()
+    {
+        notify(1);
+    }
+    //是否有线程正在(或准备)休眠，生产者据此决定唤醒谁
+    bool waiting()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return m_waiters.load(std::memory_order_relaxed) > 0;
+    }
+    void notify_all()
+    {
+        notify(INT_MAX);
+    }
+    //正在(或准备)休眠的线程数，给线程池判断是否有空闲线程用
+    int waiters()
+    {
+        return m_waiters.load(std::memory_order_relaxed);
+    }
+private:
+    void notify(int count)
+    {
+        //和消费者的prepare_wait配对：入队(写)之后再读等待者数量，中间需要全屏障
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(m_waiters.load(std::memory_order_relaxed) > 0){
+            m_seq.fetch_add(1,std::memory_order_seq_cst);
+            syscall(SYS_futex,(int*)&m_seq,FUTEX_WAKE_PRIVATE,count,NULL,NULL,0);
+        }
+    }
+private:
+    std::atomic<int> m_seq;
+    std::atomic<int> m_waiters;
+};
+
 #endif
\ No newline at end of file
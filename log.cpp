@@ -0,0 +1,267 @@
+#include<stdio.h>
+#include<string.h>
+#include<time.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<errno.h>
+#include<pthread.h>
+#include<arpa/inet.h>
+#include<atomic>
+#include"log.h"
+
+int g_log_level = LOG_LEVEL_OFF;
+
+//一条日志记录，定长128字节，生产者只做几次memcpy
+struct log_record{
+    int64_t sec;       //CLOCK_REALTIME
+    int32_t usec;
+    uint8_t level;
+    uint8_t kind;      //KIND_MESSAGE或KIND_ACCESS
+    uint16_t status;   //访问日志的状态码
+    uint32_t ip;       //访问日志的客户端地址，网络字节序
+    uint16_t port;
+    uint16_t len;      //text中的有效字节数
+    int64_t bytes;     //访问日志的主体字节数
+    char text[96];     //普通日志的文本，或者访问日志的"方法 URL"
+};
+
+enum{KIND_MESSAGE = 0,KIND_ACCESS};
+
+static const int CACHE_LINE = 64;
+static const uint32_t RING_SIZE = 1024;   //每个线程的队列容量，必须是2的幂
+static const int MAX_RINGS = 256;         //最多多少个线程写日志
+
+//单生产者单消费者环形队列：生产者(写日志的线程)只写head，消费者(后台线程)只写tail
+struct log_ring{
+    alignas(CACHE_LINE) std::atomic<uint32_t> head;
+    alignas(CACHE_LINE) std::atomic<uint32_t> tail;
+    alignas(CACHE_LINE) std::atomic<uint64_t> dropped;
+    log_record records[RING_SIZE];
+};
+
+static log_ring* g_rings[MAX_RINGS];
+static std::atomic<int> g_ring_count(0);
+static std::atomic<uint64_t> g_unregistered_dropped(0);   //线程数超过MAX_RINGS时丢弃的记录
+static thread_local log_ring* t_ring = NULL;
+static int g_log_fd = 1;
+
+static const char* g_level_names[] = {"DEBUG","INFO","WARN","ERROR"};
+
+int log_level_from_name(const char* name){
+    static const char* names[] = {"debug","info","warn","error","off"};
+    for(int i = 0;i <= LOG_LEVEL_OFF;++i){
+        if(strcmp(name,names[i]) == 0){
+            return i;
+        }
+    }
+    return -1;
+}
+
+//线程第一次写日志时创建自己的队列并登记，后台线程只会看到登记完成的队列
+static log_ring* my_ring(){
+    if(t_ring){
+        return t_ring;
+    }
+    //登记时加锁，每个线程只登记一次；先写入指针再发布计数，后台线程读到计数时指针一定已经写好
+    static pthread_mutex_t reg_lock = PTHREAD_MUTEX_INITIALIZER;
+    pthread_mutex_lock(&reg_lock);
+    int idx = g_ring_count.load(std::memory_order_relaxed);
+    if(idx >= MAX_RINGS){
+        pthread_mutex_unlock(&reg_lock);
+        return NULL;
+    }
+    log_ring* ring = new log_ring;
+    ring -> head.store(0,std::memory_order_relaxed);
+    ring -> tail.store(0,std::memory_order_relaxed);
+    ring -> dropped.store(0,std::memory_order_relaxed);
+    g_rings[idx] = ring;
+    g_ring_count.store(idx + 1,std::memory_order_release);
+    pthread_mutex_unlock(&reg_lock);
+    t_ring = ring;
+    return ring;
+}
+
+//取一个空闲的记录槽，队列满返回NULL并计数
+static log_record* begin_record(int level,int kind){
+    log_ring* ring = my_ring();
+    if(!ring){
+        g_unregistered_dropped.fetch_add(1,std::memory_order_relaxed);
+        return NULL;
+    }
+    uint32_t head = ring -> head.load(std::memory_order_relaxed);
+    if(head - ring -> tail.load(std::memory_order_acquire) >= RING_SIZE){
+        ring -> dropped.fetch_add(1,std::memory_order_relaxed);
+        return NULL;
+    }
+    log_record* rec = &ring -> records[head & (RING_SIZE - 1)];
+    //打印到微秒，不能用粗粒度时钟(精度只有一个调度tick)；CLOCK_REALTIME同样走vdso，不进入内核
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME,&now);
+    rec -> sec = now.tv_sec;
+    rec -> usec = now.tv_nsec / 1000;
+    rec -> level = level;
+    rec -> kind = kind;
+    return rec;
+}
+
+//记录填好后发布给后台线程
+static void commit_record(){
+    t_ring -> head.store(t_ring -> head.load(std::memory_order_relaxed) + 1,std::memory_order_release);
+}
+
+void log_message(int level,const char* format,...){
+    log_record* rec = begin_record(level,KIND_MESSAGE);
+    if(!rec){
+        return;
+    }
+    va_list arg_list;
+    va_start(arg_list,format);
+    int len = vsnprintf(rec -> text,sizeof(rec -> text),format,arg_list);
+    va_end(arg_list);
+    if(len < 0){
+        len = 0;
+    }
+    rec -> len = len < (int)sizeof(rec -> text) ? len : sizeof(rec -> text) - 1;
+    commit_record();
+}
+
+void log_access(uint32_t ip,uint16_t port,const char* method,const char* url,int status,long bytes){
+    log_record* rec = begin_record(LOG_LEVEL_INFO,KIND_ACCESS);
+    if(!rec){
+        return;
+    }
+    rec -> ip = ip;
+    rec -> port = port;
+    rec -> status = status;
+    rec -> bytes = bytes;
+    int len = 0;
+    int mlen = strlen(method);
+    memcpy(rec -> text,method,mlen);
+    len = mlen;
+    rec -> text[len++] = ' ';
+    if(url){
+        int ulen = strnlen(url,sizeof(rec -> text) - len);
+        memcpy(rec -> text + len,url,ulen);
+        len += ulen;
+    }
+    rec -> len = len;
+    commit_record();
+}
+
+uint64_t log_dropped(){
+    uint64_t total = g_unregistered_dropped.load(std::memory_order_relaxed);
+    int n = g_ring_count.load(std::memory_order_acquire);
+    for(int i = 0;i < n;++i){
+        total += g_rings[i] -> dropped.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+static void write_all(const char* buf,size_t len){
+    while(len > 0){
+        ssize_t n = ::write(g_log_fd,buf,len);
+        if(n < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            return;   //日志写不出去也不影响服务
+        }
+        buf += n;
+        len -= n;
+    }
+}
+
+//把一条记录格式化成一行文本，时间前缀每秒只格式化一次
+static int format_record(const log_record* rec,char* out){
+    static int64_t cached_sec = -1;
+    static char cached_prefix[32];
+    if(rec -> sec != cached_sec){
+        time_t t = rec -> sec;
+        struct tm tm;
+        gmtime_r(&t,&tm);
+        strftime(cached_prefix,sizeof(cached_prefix),"%Y-%m-%dT%H:%M:%S",&tm);
+        cached_sec = rec -> sec;
+    }
+    if(rec -> kind == KIND_ACCESS){
+        char ip[INET_ADDRSTRLEN];
+        struct in_addr addr;
+        addr.s_addr = rec -> ip;
+        inet_ntop(AF_INET,&addr,ip,sizeof(ip));
+        return sprintf(out,"%s.%06dZ %s:%d \"%.*s\" %d %ld\n",cached_prefix,rec -> usec,ip,ntohs(rec -> port),
+                       rec -> len,rec -> text,rec -> status,(long)rec -> bytes);
+    }
+    return sprintf(out,"%s.%06dZ [%s] %.*s\n",cached_prefix,rec -> usec,g_level_names[rec -> level],rec -> len,rec -> text);
+}
+
+//后台线程：轮询所有队列，攒满一块缓冲区或者队列都空了再write一次；都空时睡10毫秒
+static void* log_thread(void*){
+    static char buf[64 * 1024];
+    size_t used = 0;
+    uint64_t reported_dropped = 0;
+    while(true){
+        bool got = false;
+        int n = g_ring_count.load(std::memory_order_acquire);
+        for(int i = 0;i < n;++i){
+            log_ring* ring = g_rings[i];
+            uint32_t tail = ring -> tail.load(std::memory_order_relaxed);
+            uint32_t head = ring -> head.load(std::memory_order_acquire);
+            for(;tail != head;++tail){
+                if(sizeof(buf) - used < 256){
+                    write_all(buf,used);
+                    used = 0;
+                }
+                used += format_record(&ring -> records[tail & (RING_SIZE - 1)],buf + used);
+                got = true;
+            }
+            ring -> tail.store(tail,std::memory_order_release);
+        }
+        uint64_t dropped = log_dropped();
+        if(dropped != reported_dropped){
+            //后台线程自己的告警也按记录格式化，和其他行一样带时间前缀
+            log_record rec;
+            struct timespec now;
+            clock_gettime(CLOCK_REALTIME,&now);
+            rec.sec = now.tv_sec;
+            rec.usec = now.tv_nsec / 1000;
+            rec.level = LOG_LEVEL_WARN;
+            rec.kind = KIND_MESSAGE;
+            rec.len = snprintf(rec.text,sizeof(rec.text),"log rings full, %lu records dropped",(unsigned long)(dropped - reported_dropped));
+            if(sizeof(buf) - used < 256){
+                write_all(buf,used);
+                used = 0;
+            }
+            used += format_record(&rec,buf + used);
+            reported_dropped = dropped;
+        }
+        if(used > 0){
+            write_all(buf,used);
+            used = 0;
+        }
+        if(!got){
+            struct timespec ts = {0,10 * 1000 * 1000};
+            nanosleep(&ts,NULL);
+        }
+    }
+    return NULL;
+}
+
+bool log_init(int level,const char* path){
+    g_log_level = level;
+    if(level >= LOG_LEVEL_OFF){
+        return true;
+    }
+    if(path){
+        g_log_fd = open(path,O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,0644);
+        if(g_log_fd < 0){
+            g_log_level = LOG_LEVEL_OFF;
+            return false;
+        }
+    }
+    pthread_t tid;
+    if(pthread_create(&tid,NULL,log_thread,NULL) != 0){
+        g_log_level = LOG_LEVEL_OFF;
+        return false;
+    }
+    pthread_detach(tid);
+    return true;
+}
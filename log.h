@@ -0,0 +1,33 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include<stdint.h>
+#include<stdarg.h>
+
+//异步日志：每个线程把定长的二进制记录写进自己的无锁单生产者单消费者环形队列，
+//后台线程轮询所有队列，格式化成文本后批量write到日志文件，请求处理路径上不做IO、不加锁
+//队列满时丢弃记录并计数，不阻塞写日志的线程；丢弃的条数由后台线程定期写进日志
+
+enum LOG_LEVEL{LOG_LEVEL_DEBUG = 0,LOG_LEVEL_INFO,LOG_LEVEL_WARN,LOG_LEVEL_ERROR,LOG_LEVEL_OFF};
+
+//当前日志级别，低于它的记录在调用处就被过滤掉，不会格式化参数
+extern int g_log_level;
+
+//设置级别并启动后台线程，path为NULL时写到标准输出；level为LOG_LEVEL_OFF时不启动线程
+bool log_init(int level,const char* path);
+//解析级别名字debug/info/warn/error/off，不认识返回-1
+int log_level_from_name(const char* name);
+
+//普通日志，文本超过记录的容量时截断
+void log_message(int level,const char* format,...) __attribute__((format(printf,2,3)));
+//访问日志(INFO级别)：客户端地址(网络字节序)、方法、URL、状态码、主体字节数
+void log_access(uint32_t ip,uint16_t port,const char* method,const char* url,int status,long bytes);
+//因为队列满丢弃的记录总数
+uint64_t log_dropped();
+
+#define LOG_DEBUG(format,...) do{if(g_log_level <= LOG_LEVEL_DEBUG) log_message(LOG_LEVEL_DEBUG,format,##__VA_ARGS__);}while(0)
+#define LOG_INFO(format,...) do{if(g_log_level <= LOG_LEVEL_INFO) log_message(LOG_LEVEL_INFO,format,##__VA_ARGS__);}while(0)
+#define LOG_WARN(format,...) do{if(g_log_level <= LOG_LEVEL_WARN) log_message(LOG_LEVEL_WARN,format,##__VA_ARGS__);}while(0)
+#define LOG_ERROR(format,...) do{if(g_log_level <= LOG_LEVEL_ERROR) log_message(LOG_LEVEL_ERROR,format,##__VA_ARGS__);}while(0)
+
+#endif
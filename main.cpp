@@ -9,18 +9,29 @@
 #include<stdlib.h>
 #include<cassert>
 #include<sys/epoll.h>
+#include<getopt.h>
+#include<libgen.h>
+#include<limits.h>
 
 #include"./locker.h"
 #include"./threadpool.h"
 #include"./http_conn.h"
+#include"./reactor.h"
+#include"./filecache.h"
+#include"./gzipcache.h"
+#include"./respcache.h"
+#include"./docindex.h"
+#include"./simdscan.h"
+#include"./response.h"
+#include"./log.h"
+#include"./stats.h"
+#include"./router.h"
+#include"./proxy.h"
+#include"./uring_reactor.h"
+#include"./coro_reactor.h"
 
-#define MAX_FD 65536
-#define MAX_EVENT_NUMBER 10000
-
-//添加文件描述符到内核事件集
-extern void addfd(int epollfd,int fd,bool one_shot);
-//移除--在TCP连接关闭时，移除后，关闭TCP连接
-extern void removefd(int epollfd,int fd);
+//网站根目录，定义在http_conn.cpp中
+extern const char* doc_root;
 
 //添加信号处理函数，主要是处理SIGPIPE信号
 //1.往关闭管道读端的写端fd[1]写就会触发SIGPIPE
@@ -40,143 +51,392 @@ void addsig(int sig,void(handler)(int),bool restart = true){
     assert(sigaction(sig,&sa,NULL) != -1);    //设置该信号的信号粗粝函数
 }
 
-//向客户端发送错误信息
-void show_error(int connfd,const char* info){
-    send(connfd,info,strlen(info),0);
-    close(connfd);
+void usage(const char* prog){
+    printf("usage: [%s ip port [-r reactor_number] [-c cache_mb] [-s sendfile_kb] [-w fifo|steal] [-t header,body,keepalive,write] [-l header_kb,body_kb] [-L debug|info|warn|error|off] [-o log_file] [-d doc_root] [-e epoll|uring] [-b backlog] [-a defer_accept_sec] [-z gzip_cache_mb] [-m split|coro] [-p prefix=host:port|unix:path] [-A arena_mb] [-W index_snapshot] [-T min_threads,max_threads]]\n",prog);
+}
+
+//统计页面中的仪表，读取时调用
+static long gauge_connections(void*){
+    return http_conn::m_user_count.load(std::memory_order_relaxed);
+}
+static long gauge_queue_depth(void* arg){
+    if(!arg){   //协程模式没有线程池
+        return 0;
+    }
+    return ((threadpool<http_conn>*)arg) -> pending();
+}
+static long gauge_pool_threads(void* arg){
+    if(!arg){
+        return 0;
+    }
+    return ((threadpool<http_conn>*)arg) -> threads();
+}
+static long gauge_log_dropped(void*){
+    return log_dropped();
+}
+static long gauge_respcache_bytes(void*){
+    return respcache::instance() -> bytes();
+}
+
+//统计页面：/__stats是Prometheus文本格式，/__stats.json(arg不为NULL)或者/__stats?format=json是JSON
+static bool route_stats(const route_request& req,route_reply& reply,void* arg){
+    bool json = arg || (req.query && strcmp(req.query,"format=json") == 0);
+    size_t len;
+    char* body = stats_render(json,&len);
+    if(!body){
+        return false;
+    }
+    reply.adopt(body,len);
+    reply.content_type = json ? "application/json" : "text/plain; version=0.0.4";
+    return true;
+}
+//健康检查，主体直接写在连接的写缓冲区中
+static bool route_health(const route_request&,route_reply& reply,void*){
+    return reply.append("ok\n",3);
+}
+
+//反应堆开始接受连接之前，记录从进程启动到现在的时间，压测脚本据此比较有无预热(-W)的启动耗时
+static void log_startup(uint64_t start){
+    LOG_INFO("startup in %lu ms",(unsigned long)((stats_now_ns() - start) / 1000000));
 }
 
 int main(int argc,char* argv[]){
+    uint64_t start = stats_now_ns();
     if(argc <= 2){//argv[0]可执行文件名/main,argv[1]IP地址，argv[2]是端口号
-        printf("usage: [%s ip port]\n",basename(argv[0]));//最后一个/的字符串内容
+        usage(basename(argv[0]));//最后一个/的字符串内容
         return 1;
     }
     const char* ip = argv[1];
     char* port = argv[2];
 
+    //可选参数 -r 反应堆(事件循环)的个数，默认1个，也就是原来的单epoll循环
+    //-c 文件缓存的字节预算(MB)，默认64MB，0表示关闭缓存
+    //-s 不小于该大小(KB)的文件用sendfile发送主体，默认256KB
+    int reactor_number = 1;
+    long cache_mb = 64;
+    long sendfile_kb = 256;
+    //-w 线程池调度方式，fifo是所有工作线程共用一个请求队列，steal是每个线程一个双端队列加工作窃取
+    threadpool<http_conn>::SCHED_MODE sched_mode = threadpool<http_conn>::FIFO;
+    //-t 请求头期限、请求体读间隔、长连接空闲、等待可写的超时时间(秒)，逗号分隔，例如 -t 20,60,75,60
+    //-l 请求头和请求体的最大字节数(KB)，逗号分隔，默认 -l 32,1024
+    //-L 日志级别，默认info(记录访问日志)；-o 日志文件，默认标准输出
+    //-d 网站根目录，默认/var/www/html
+    //-e 事件循环的实现，epoll(默认)或者io_uring
+    //-b 监听socket的全连接队列长度，默认1024；-a TCP_DEFER_ACCEPT的秒数，默认0不设置
+    //-z 动态gzip压缩结果的缓存预算(MB)，默认16MB，0表示只发送已有的.gz文件，不做动态压缩
+    //-m 连接的处理方式，split(默认)是反应堆读写、线程池解析；coro是每个连接一个协程，整个请求在反应堆线程中完成
+    //-A 小文件完整响应缓存的arena大小(MB)，默认8MB，0表示关闭；只缓存经过文件缓存的文件，-c 0时也关闭
+    //-W 启动预热，参数是索引快照文件：载入快照(只重新比较mtime)或者并行遍历doc_root，按访问次数在文件缓存的预算内预取最热的文件，
+    //   之后每5分钟在后台重新遍历并保存快照；默认不预热
+    //-T 线程池的最少和最多工作线程数，默认4和CPU数的两倍(不少于8)，两个数相同时线程数固定；只给一个数时也固定
+    //   持续有任务排队时增加线程，持续空闲时退休线程
+    //-p 反向代理，URL以prefix开头的请求转发给后端，例如 -p /api/=127.0.0.1:8080,/app/=unix:/run/app.sock，可以重复
+    long gzip_cache_mb = 16;
+    long arena_mb = 8;
+    bool use_uring = false;
+    bool use_coro = false;
+    int log_level = LOG_LEVEL_INFO;
+    const char* log_file = NULL;
+    const char* index_snapshot = NULL;
+    int min_threads = 4;
+    int max_threads = 0;
+    int opt;
+    optind = 3;
+    while((opt = getopt(argc,argv,"r:c:s:w:t:l:L:o:d:e:b:a:z:m:p:A:W:T:")) != -1){
+        switch(opt){
+            case 'r':{
+                reactor_number = atoi(optarg);
+                break;
+            }
+            case 'c':{
+                cache_mb = atol(optarg);
+                break;
+            }
+            case 's':{
+                sendfile_kb = atol(optarg);
+                break;
+            }
+            case 't':{
+                int timeout[4];
+                if(sscanf(optarg,"%d,%d,%d,%d",&timeout[0],&timeout[1],&timeout[2],&timeout[3]) != 4){
+                    usage(basename(argv[0]));
+                    return 1;
+                }
+                for(int i = 0;i < 4;++i){
+                    http_conn::m_timeout[i] = timeout[i] * 1000;
+                }
+                break;
+            }
+            case 'l':{
+                int header_kb,body_kb;
+                if(sscanf(optarg,"%d,%d",&header_kb,&body_kb) != 2 || header_kb <= 0 || body_kb < 0){
+                    usage(basename(argv[0]));
+                    return 1;
+                }
+                http_conn::m_header_limit = header_kb << 10;
+                http_conn::m_body_limit = body_kb << 10;
+                break;
+            }
+            case 'L':{
+                log_level = log_level_from_name(optarg);
+                if(log_level < 0){
+                    usage(basename(argv[0]));
+                    return 1;
+                }
+                break;
+            }
+            case 'o':{
+                log_file = optarg;
+                break;
+            }
+            case 'd':{
+                doc_root = optarg;
+                break;
+            }
+            case 'e':{
+                if(strcmp(optarg,"uring") == 0){
+                    use_uring = true;
+                }
+                else if(strcmp(optarg,"epoll") != 0){
+                    usage(basename(argv[0]));
+                    return 1;
+                }
+                break;
+            }
+            case 'b':{
+                reactor::m_backlog = atoi(optarg);
+                if(reactor::m_backlog <= 0){
+                    usage(basename(argv[0]));
+                    return 1;
+                }
+                break;
+            }
+            case 'a':{
+                reactor::m_defer_accept = atoi(optarg);
+                break;
+            }
+            case 'z':{
+                gzip_cache_mb = atol(optarg);
+                break;
+            }
+            case 'm':{
+                if(strcmp(optarg,"coro") == 0){
+                    use_coro = true;
+                }
+                else if(strcmp(optarg,"split") != 0){
+                    usage(basename(argv[0]));
+                    return 1;
+                }
+                break;
+            }
+            case 'A':{
+                arena_mb = atol(optarg);
+                break;
+            }
+            case 'W':{
+                index_snapshot = optarg;
+                break;
+            }
+            case 'T':{
+                int n = sscanf(optarg,"%d,%d",&min_threads,&max_threads);
+                if(n == 1){
+                    max_threads = min_threads;
+                }
+                if(n < 1 || min_threads <= 0 || max_threads < min_threads){
+                    usage(basename(argv[0]));
+                    return 1;
+                }
+                break;
+            }
+            case 'p':{
+                char* save = NULL;
+                for(char* spec = strtok_r(optarg,",",&save);spec;spec = strtok_r(NULL,",",&save)){
+                    if(!proxy_add(spec)){
+                        printf("invalid proxy backend %s\n",spec);
+                        return 1;
+                    }
+                }
+                break;
+            }
+            case 'w':{
+                if(strcmp(optarg,"steal") == 0){
+                    sched_mode = threadpool<http_conn>::WORK_STEALING;
+                }
+                else if(strcmp(optarg,"fifo") != 0){
+                    usage(basename(argv[0]));
+                    return 1;
+                }
+                break;
+            }
+            default:{
+                usage(basename(argv[0]));
+                return 1;
+            }
+        }
+    }
+    if(reactor_number <= 0){
+        reactor_number = 1;
+    }
+    if(max_threads == 0){
+        max_threads = sysconf(_SC_NPROCESSORS_ONLN) * 2;
+        if(max_threads < 8){
+            max_threads = 8;
+        }
+        if(max_threads < min_threads){
+            max_threads = min_threads;
+        }
+    }
+    //io_uring反应堆只支持线程池模式；反向代理的后端连接注册在epoll反应堆上，只支持epoll的线程池模式
+    if((use_coro && use_uring) || (proxy_count() > 0 && (use_uring || use_coro))){
+        usage(basename(argv[0]));
+        return 1;
+    }
+
+    //启动异步日志的后台线程，之后的日志都不会阻塞反应堆和工作线程
+    if(!log_init(log_level,log_file)){
+        printf("log init failure, errno is: %d\n",errno);
+        return 1;
+    }
+
+    //根据CPU选择请求解析用的向量化扫描实现
+    scan_init();
+    //生成状态行和错误响应等固定内容
+    response_init();
+
     //忽略SIGPIPE信号
     addsig(SIGPIPE,SIG_IGN);//SIG_IGN表示忽略SIGPIPE那个注册的信号。
 
-    //创建线程池，线程池内的对象，也就是往工作队列中添加的对象是http_conn
+    //doc_root换成不含符号链接、"."、".."和多余'/'的绝对路径。文件缓存和响应缓存的键、inotify监听的目录、索引快照中的根目录
+    //都是doc_root加上规范化后的URL，网站根目录的不同写法(末尾的'/'、相对路径、符号链接)得到相同的键，快照也能沿用；不存在时保持原样
+    static char real_root[PATH_MAX];
+    if(realpath(doc_root,real_root)){
+        doc_root = real_root;
+    }
+
+    //初始化进程共享的文件缓存，监听doc_root下的文件变化；sendfile发送的大文件在缓存中只保留fd
+    http_conn::m_sendfile_threshold = (off_t)sendfile_kb << 10;
+    if(!filecache::instance() -> init(doc_root,(size_t)cache_mb << 20,(size_t)sendfile_kb << 10)){
+        printf("filecache init failure, errno is: %d\n",errno);
+        return 1;
+    }
+
+    //可压缩类型的文件第一次被请求时压缩一次，压缩结果按字节预算缓存
+    gzipcache::instance() -> init((size_t)gzip_cache_mb << 20,6);
+
+    //小文件的完整响应放在一块大页内存中，失效依靠文件缓存的inotify
+    if(cache_mb > 0 && arena_mb > 0 && !respcache::instance() -> init((size_t)arena_mb << 20)){
+        printf("respcache init failure, errno is: %d\n",errno);
+        return 1;
+    }
+
+    //预热在创建监听socket之前完成，负载均衡的健康检查通过时文件已经在缓存中
+    //stat和缺页主要在等磁盘，线程数不少于4
+    if(index_snapshot){
+        int threads = sysconf(_SC_NPROCESSORS_ONLN);
+        if(threads < 4){
+            threads = 4;
+        }
+        docindex* index = docindex::instance();
+        if(index -> build(doc_root,index_snapshot,threads)){
+            index -> prefetch((size_t)cache_mb << 20,threads);
+            if(!index -> start_refresh(300)){
+                printf("docindex refresh thread failure\n");
+                return 1;
+            }
+        }
+    }
+
+    //创建线程池，线程池内的对象，也就是往工作队列中添加的对象是http_conn；协程模式不需要线程池
     threadpool<http_conn>* pool = NULL;
     try{//这里的语句有任何异常就执行下面的return  并发实现模式--生产者/消费者
-        pool = new threadpool<http_conn>;         //新建线程池，包括-一组线程/工作队列/互斥锁/信号量
+        if(!use_coro){
+            pool = new threadpool<http_conn>(min_threads,1000,sched_mode,max_threads);         //新建线程池，包括-一组线程/工作队列/管理线程
+        }
     }
     catch(...){
         return 1;
     }
 
+    //统计页面(/__stats)中读取时计算的值
+    stats_add_gauge("connections","Open client connections",gauge_connections,NULL);
+    stats_add_gauge("queue_depth","Requests waiting in the threadpool queues",gauge_queue_depth,pool);
+    stats_add_gauge("pool_threads","Worker threads in the threadpool",gauge_pool_threads,pool);
+    stats_add_gauge("log_dropped","Log records dropped because a ring was full",gauge_log_dropped,NULL);
+    stats_add_gauge("respcache_bytes","Bytes of live responses in the small-file response arena",gauge_respcache_bytes,NULL);
+
+    //程序内的URL，在反应堆和工作线程运行之前注册完，没有匹配的URL映射到doc_root下的文件
+    router* routes = router::instance();
+    routes -> add(http_conn::GET,"/__stats",route_stats,NULL);
+    routes -> add(http_conn::GET,"/__stats.json",route_stats,routes);
+    routes -> add(http_conn::GET,"/__health",route_health,NULL);
+
     //预先为每个可能的客户连接分配一个http_conn对象，这样下标就可以当作是文件描述符
+    //所有反应堆共享这一个数组，fd在进程内是唯一的
     http_conn* users = new http_conn[MAX_FD];
     assert(users);
-    //记录当前的用户数量
-    int user_count = 0;  
-
-    int listenfd = socket(PF_INET,SOCK_STREAM,0);
-    assert(listenfd >= 0);
-
-    /* 默认关闭close时，是close调用立即返回，TCP模块负责将该socket对应的TCP发送缓冲区中残留的数据发送给对方 
-     * 1,0--表示的是close调用在关闭TCP连接时，TCP模块将该socket对应的发送缓冲区数据直接丢弃，同时发送给对方一个复位报文段
-     * 给服务器提供了一个异常终止连接的方法(对端会收到复位报文段)
-     * 1,非0--阻塞--等待一段时间再关闭，如果超过时间未收到确认，则返回-1，且errno设置为EWOULDBLOCK
-     *      非阻塞--直接返回，根据errno和返回值判断状态
-    */
-    struct linger tmp = {1,0};//1表示还有数据没发送完毕的时候容许逗留，0表示逗留时间
-    setsockopt(listenfd,SOL_SOCKET,SO_LINGER,&tmp,sizeof(tmp));//即让没发完的数据发送出去后在关闭socket
-
-    //绑定端口号，创建监听套接字--队列--已完成连接队列，未完成连接队列2次握手
-    int ret = 0;
-    struct sockaddr_in address;
-    bzero(&address,sizeof(address));
-    address.sin_family = AF_INET;
-    //address.sin_addr.s_addr = htonl(ip);
-    inet_aton(ip,&address.sin_addr);
-    address.sin_port = htons(atoi(port));
-
-    ret = bind(listenfd,(struct sockaddr*)& address,sizeof(address));
-    assert(ret >= 0);
-
-    ret = listen(listenfd,5);
-    
-    //创建内核事件集
-    epoll_event events[MAX_EVENT_NUMBER];
-    int epollfd = epoll_create(5);
-    assert(epollfd != -1);
-    //添加listenfd到内核事件集中，监听连接事件
-    addfd(epollfd,listenfd,false);
-    http_conn::m_epollfd = epollfd;  //设置
-
-    while(true){
-        int number = epoll_wait(epollfd,events,MAX_EVENT_NUMBER,-1);
-        if((number < 0) && (errno != EINTR)){
-            printf("epoll failure\n");
-            break;
+
+    //创建reactor_number个反应堆，每个反应堆一个监听socket(SO_REUSEPORT)、一个epoll(或io_uring实例)，
+    //第0个反应堆在主线程中运行，其余的各自运行在一个线程中
+    if(use_coro){
+        coro_slot* slots = new coro_slot[MAX_FD];
+        coro_reactor* loops = new coro_reactor[reactor_number];
+        for(int i = 0;i < reactor_number;++i){
+            if(!loops[i].init(ip,atoi(port),users,slots)){
+                printf("coroutine reactor %d init failure, errno is: %d\n",i,errno);
+                return 1;
+            }
         }
-        
-        for(int i = 0;i < number;++i){
-            int sockfd = events[i].data.fd;
-            //如果是监听套接字，则accept取出一个已连接socket
-            if(sockfd == listenfd){
-                struct sockaddr_in client_address;
-                socklen_t client_addrlength = sizeof(client_address);                
-                int connfd = accept(listenfd,(struct sockaddr*)& client_address,&client_addrlength);
-                if(connfd < 0){
-                    printf("error is: %d\n",errno);
-                    continue;
-                }
-                //判断当前的总用户数量，如果用户数量大于MAX_FD，也是内核允许当前进程最大打开文件描述符的数量，那么就不再
-                if(http_conn::m_user_count >= MAX_FD){
-                    show_error(connfd,"Internal server busy");
-                    continue;
-                }
-                //初始化客户连接，user[connfd]表示当前客户连接，connfd就是已连接套接字，就直接是下标
-                users[connfd].init(connfd,client_address);  //已连接套接字、客户端IP设置端口重用，再去初始化其他一些状态
-            }
-            //异常状态，或者对端关闭连接
-            else if(events[i].events & (EPOLLRDHUP | EPOLLHUP |EPOLLERR)){
-                //如果有异常，直接关闭客户连接
-                printf("sock_exception_close\n");
-                users[sockfd].close_conn();   //直接关闭连接close
-            }
-            //可读
-            else if(events[i].events & EPOLLIN){
-                //根据读的结果，决定将任务添加到线程池，还是关闭连接
-                //先读，根据读操作返回的结果，true则将该http_conn对象添加到工作队列中去，由工作线程去处理事件
-                //所以这里是由主线程完成读写，而将http_conn这一对象添加到工作队列中去，工作线程只负责解析接收缓冲区的数据
-                //半同步/半反应堆模式
-                //我认为这里更像是  同步模拟的Proactor模式，因为Reactor模式是主线程仅负责监听事件，读写、处理业务逻辑均是由工作线程完成
-                if(users[sockfd].read()){
-                    pool->append(users + sockfd);
-                }
-                else{
-                    printf("sock_read_close\n");
-                    users[sockfd].close_conn();
-                }
+        for(int i = 1;i < reactor_number;++i){
+            if(!loops[i].start()){
+                printf("coroutine reactor %d start failure\n",i);
+                return 1;
             }
-            else if(events[i].events & EPOLLOUT){
-                //根据写的结果，决定是否关闭连接
-                //写事件触发
-                printf("write_main\n");
-                //由主线程完成写，这个时候逻辑是工作线程处理完读取到的数据，并根据读取的数据情况，决定要写的响应
-                //包括状态行、首部、空行、主体部分
-                //返回结果的false-表示短连接
-                //返回结果的true--表示长连接，这是根据请求和响应报文中首部字段的 Connection决定是长连接或者是短连接
-                if(!users[sockfd].write()){
-                    printf("sock_write_close\n");
-                    users[sockfd].close_conn();
-                }
-                //这里如果是长连接，那么在写完后，就已经重新初始化完了
+        }
+        log_startup(start);
+        loops[0].run();
+        delete [] loops;
+        delete [] slots;
+        delete [] users;
+        return 0;
+    }
+    if(use_uring){
+        uring_reactor* rings = new uring_reactor[reactor_number];
+        for(int i = 0;i < reactor_number;++i){
+            if(!rings[i].init(ip,atoi(port),users,pool)){
+                printf("io_uring reactor %d init failure, errno is: %d\n",i,errno);
+                return 1;
             }
-            else
-            {
-                printf("close\n");
+        }
+        for(int i = 1;i < reactor_number;++i){
+            if(!rings[i].start()){
+                printf("io_uring reactor %d start failure\n",i);
+                return 1;
             }
         }
-
+        log_startup(start);
+        rings[0].run();
+        delete [] rings;
+        delete [] users;
+        delete pool;
+        return 0;
+    }
+    reactor* reactors = new reactor[reactor_number];
+    for(int i = 0;i < reactor_number;++i){
+        if(!reactors[i].init(ip,atoi(port),users,pool)){
+            printf("reactor %d init failure, errno is: %d\n",i,errno);
+            return 1;
+        }
+    }
+    for(int i = 1;i < reactor_number;++i){
+        if(!reactors[i].start()){
+            printf("reactor %d start failure\n",i);
+            return 1;
+        }
     }
+    log_startup(start);
+    reactors[0].run();
 
-    close(epollfd);
-    close(listenfd);
+    delete [] reactors;
     delete [] users;
     delete pool;
     return 0;
@@ -0,0 +1,863 @@
+#include<sys/socket.h>
+#include<sys/un.h>
+#include<sys/uio.h>
+#include<netinet/in.h>
+#include<netinet/tcp.h>
+#include<arpa/inet.h>
+#include<netdb.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<errno.h>
+#include<string.h>
+#include<strings.h>
+#include<stdlib.h>
+#include<vector>
+
+#include"./proxy.h"
+#include"./http_conn.h"
+#include"./reactor.h"
+
+//启动时配置的后端，之后只读
+static std::vector<proxy_backend*> g_backends;
+
+bool proxy_add(const char* spec){
+    const char* eq = strchr(spec,'=');
+    if(!eq || spec[0] != '/' || eq[1] == '\0'){
+        return false;
+    }
+    proxy_backend* b = new proxy_backend;
+    b -> prefix.assign(spec,eq - spec);
+    b -> name = eq + 1;
+    memset(&b -> addr,0,sizeof(b -> addr));
+    const char* target = eq + 1;
+    bool ok = false;
+    if(strncmp(target,"unix:",5) == 0){
+        sockaddr_un* un = (sockaddr_un*)&b -> addr;
+        const char* path = target + 5;
+        if(path[0] != '\0' && strlen(path) < sizeof(un -> sun_path)){
+            un -> sun_family = AF_UNIX;
+            strcpy(un -> sun_path,path);
+            b -> addr_len = sizeof(sockaddr_un);
+            ok = true;
+        }
+    }
+    else{
+        //host:port，host可以是IPv4地址或者主机名，只在启动时解析一次
+        const char* colon = strrchr(target,':');
+        if(colon && colon != target && atoi(colon + 1) > 0){
+            std::string host(target,colon - target);
+            addrinfo hints;
+            memset(&hints,0,sizeof(hints));
+            hints.ai_family = AF_INET;
+            hints.ai_socktype = SOCK_STREAM;
+            addrinfo* res = NULL;
+            if(getaddrinfo(host.c_str(),colon + 1,&hints,&res) == 0 && res){
+                memcpy(&b -> addr,res -> ai_addr,res -> ai_addrlen);
+                b -> addr_len = res -> ai_addrlen;
+                ok = true;
+            }
+            if(res){
+                freeaddrinfo(res);
+            }
+        }
+    }
+    if(!ok){
+        delete b;
+        return false;
+    }
+    b -> index = g_backends.size();
+    g_backends.push_back(b);
+    return true;
+}
+
+const proxy_backend* proxy_match(const char* url){
+    const proxy_backend* best = NULL;
+    for(size_t i = 0;i < g_backends.size();++i){
+        const std::string& prefix = g_backends[i] -> prefix;
+        if(strncmp(url,prefix.data(),prefix.size()) == 0 && (!best || prefix.size() > best -> prefix.size())){
+            best = g_backends[i];
+        }
+    }
+    return best;
+}
+
+int proxy_count(){
+    return g_backends.size();
+}
+
+//转发的阶段
+enum UPSTREAM_STATE{S_SEND_HEAD = 0,S_SEND_BODY,S_RECV_HEAD,S_SEND_RESP,S_RELAY_SPLICE,S_RELAY_CHUNKED};
+//响应主体的边界：没有主体(HEAD/204/304)、Content-Length、chunked、读到后端关闭为止
+enum FRAMING{F_NONE = 0,F_LENGTH,F_CHUNKED,F_CLOSE};
+//chunked主体中的位置：块大小、块扩展到行尾、块数据、块数据后的CRLF、结束块后的尾部首部行首/行中、最后的LF、结束
+enum CHUNK_STATE{C_SIZE = 0,C_EXT,C_DATA,C_DATA_END,C_TRAILER,C_TRAILER_LINE,C_LAST_LF,C_DONE};
+//阶段函数的结果
+enum STEP{STEP_NEXT = 0,STEP_WAIT,STEP_DONE,STEP_RETRY,STEP_FAIL,STEP_DROP};
+
+//响应头的上限，也是转发chunked主体的缓冲区大小
+static const int UPSTREAM_BUF = 16 * 1024;
+
+struct upstream{
+    int fd;
+    int pipe_fd[2];           //splice用的管道，和连接一起复用，转发结束时一定是空的
+    long pipe_cap;
+    const proxy_backend* backend;
+    upstream_pool* pool;
+    upstream* prev;           //空闲链表
+    upstream* next;
+    http_conn* conn;          //正在服务的客户端连接，空闲时为NULL
+    bool dead;                //已经关闭，等这一轮事件处理完再释放
+
+    int state;
+    bool reused;              //这次转发用的是空闲表中的连接
+    bool keep;                //后端没有要求关闭，转发完可以复用
+    bool client_keep;         //响应之后客户端连接保持
+    int client_armed;         //客户端socket已经注册等待的事件，0表示没有
+    size_t sent;              //请求头已经发送的字节数
+    long body_left;           //还在客户端socket中的请求体字节数
+    long piped;               //管道中的字节数
+    int status;
+    int framing;
+    bool eof;                 //F_CLOSE的响应读到了后端关闭
+    long resp_left;           //F_LENGTH的响应还没从后端读出的主体字节数
+    int chunk_state;
+    long chunk_left;
+    long bytes;               //发给客户端的字节数
+    //响应头读进buf，改写后放进out；buf中[pos,len)是还没发给客户端的主体
+    char buf[UPSTREAM_BUF];
+    size_t len;
+    size_t pos;
+    char out[UPSTREAM_BUF + 64];
+    size_t out_len;
+    size_t out_sent;
+};
+
+//以fd为下标，和users数组一样由所有反应堆共享；在reap中fd关闭之前清除，之后其他反应堆才可能拿到同一个fd
+static upstream* g_owner[MAX_FD];
+
+upstream_pool::upstream_pool():
+    m_epollfd(-1),m_idle(NULL),m_idle_count(NULL)
+{
+}
+
+upstream_pool::~upstream_pool(){
+    for(int i = 0;i < proxy_count();++i){
+        while(m_idle[i]){
+            upstream* u = m_idle[i];
+            unlink_idle(u);
+            close_upstream(u);
+        }
+    }
+    reap();
+    delete[] m_idle;
+    delete[] m_idle_count;
+}
+
+void upstream_pool::init(int epollfd){
+    m_epollfd = epollfd;
+    int n = proxy_count();
+    m_idle = new upstream*[n > 0 ? n : 1]();
+    m_idle_count = new int[n > 0 ? n : 1]();
+}
+
+upstream* upstream_pool::owner(int fd){
+    return fd >= 0 && fd < MAX_FD ? g_owner[fd] : NULL;
+}
+
+upstream* upstream_pool::connect_to(const proxy_backend* backend){
+    int family = backend -> addr.ss_family;
+    int fd = socket(family,SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,0);
+    if(fd < 0){
+        return NULL;
+    }
+    if(fd >= MAX_FD){
+        close(fd);
+        return NULL;
+    }
+    if(family == AF_INET){
+        int on = 1;
+        setsockopt(fd,IPPROTO_TCP,TCP_NODELAY,&on,sizeof(on));
+    }
+    //非阻塞connect：TCP返回EINPROGRESS，连上之前send返回EAGAIN，边缘触发的EPOLLOUT报告连上；Unix socket立即完成
+    if(connect(fd,(sockaddr*)&backend -> addr,backend -> addr_len) < 0 && errno != EINPROGRESS){
+        LOG_WARN("connect to upstream %s failure, errno is: %d",backend -> name.c_str(),errno);
+        close(fd);
+        return NULL;
+    }
+    upstream* u = new upstream;
+    if(pipe2(u -> pipe_fd,O_NONBLOCK | O_CLOEXEC) < 0){
+        close(fd);
+        delete u;
+        return NULL;
+    }
+    u -> pipe_cap = fcntl(u -> pipe_fd[1],F_GETPIPE_SZ);
+    u -> fd = fd;
+    u -> backend = backend;
+    u -> pool = this;
+    u -> prev = u -> next = NULL;
+    u -> conn = NULL;
+    u -> piped = 0;
+    u -> dead = false;
+    g_owner[fd] = u;
+    //后端socket一直注册可读和可写，边缘触发，之后不再epoll_ctl
+    epoll_event event;
+    event.data.fd = fd;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLET | EPOLLRDHUP;
+    epoll_ctl(m_epollfd,EPOLL_CTL_ADD,fd,&event);
+    stats_add(STAT_UPSTREAM_CONNECTS,1);
+    return u;
+}
+
+//先从epoll中删除，fd留到这一轮事件处理完再关闭：同一批事件中可能还有这个fd的，
+//fd关闭后可能立即被其他反应堆accept到，那时再按fd找连接就找错了
+void upstream_pool::close_upstream(upstream* u){
+    epoll_ctl(m_epollfd,EPOLL_CTL_DEL,u -> fd,0);
+    u -> dead = true;
+    m_dead.push_back(u);
+}
+
+void upstream_pool::unlink_idle(upstream* u){
+    int i = u -> backend -> index;
+    if(u -> prev){
+        u -> prev -> next = u -> next;
+    }
+    else{
+        m_idle[i] = u -> next;
+    }
+    if(u -> next){
+        u -> next -> prev = u -> prev;
+    }
+    u -> prev = u -> next = NULL;
+    --m_idle_count[i];
+}
+
+void upstream_pool::release(upstream* u,bool reuse){
+    int i = u -> backend -> index;
+    if(!reuse || u -> piped != 0 || m_idle_count[i] >= MAX_IDLE){
+        close_upstream(u);
+        return;
+    }
+    u -> prev = NULL;
+    u -> next = m_idle[i];
+    if(m_idle[i]){
+        m_idle[i] -> prev = u;
+    }
+    m_idle[i] = u;
+    ++m_idle_count[i];
+}
+
+void upstream_pool::attach(upstream* u,http_conn* conn){
+    u -> conn = conn;
+    conn -> m_upstream = u;
+    u -> state = S_SEND_HEAD;
+    u -> keep = false;
+    u -> client_keep = false;
+    u -> client_armed = 0;
+    u -> sent = 0;
+    u -> body_left = conn -> m_proxy_body_left;
+    u -> status = 0;
+    u -> framing = F_NONE;
+    u -> eof = false;
+    u -> resp_left = 0;
+    u -> chunk_state = C_SIZE;
+    u -> chunk_left = 0;
+    u -> bytes = 0;
+    u -> len = u -> pos = 0;
+    u -> out_len = u -> out_sent = 0;
+}
+
+void upstream_pool::start(http_conn* conn){
+    const proxy_backend* b = conn -> m_backend;
+    upstream* u = m_idle[b -> index];
+    bool reused = u != NULL;
+    if(reused){
+        unlink_idle(u);
+        stats_add(STAT_UPSTREAM_REUSES,1);
+    }
+    else{
+        u = connect_to(b);
+        if(!u){
+            conn -> proxy_error(502);
+            return;
+        }
+    }
+    attach(u,conn);
+    u -> reused = reused;
+    //等待后端期间按等待可写的期限计时，每次有进展都重新计时
+    conn -> arm_timer(http_conn::TIMER_WRITE);
+    //客户端要等100 Continue才发送请求体，代理自己回答，不等后端
+    if(conn -> m_expect_continue && u -> body_left > 0){
+        static const char cont[] = "HTTP/1.1 100 Continue\r\n\r\n";
+        send(conn -> m_sockfd,cont,sizeof(cont) - 1,0);
+    }
+    pump(u);
+}
+
+void upstream_pool::wait_client(upstream* u,int ev){
+    if(u -> client_armed != ev){
+        u -> conn -> rearm(ev);
+        u -> client_armed = ev;
+    }
+}
+
+//逗号分隔的列表中是否有token(不区分大小写)，Connection和Transfer-Encoding用
+static bool has_token(const char* value,size_t len,const char* token){
+    size_t tlen = strlen(token);
+    size_t i = 0;
+    while(i < len){
+        while(i < len && (value[i] == ' ' || value[i] == '\t' || value[i] == ',')){
+            ++i;
+        }
+        size_t start = i;
+        while(i < len && value[i] != ',' && value[i] != ' ' && value[i] != '\t' && value[i] != ';'){
+            ++i;
+        }
+        if(i - start == tlen && strncasecmp(value + start,token,tlen) == 0){
+            return true;
+        }
+        while(i < len && value[i] != ','){
+            ++i;
+        }
+    }
+    return false;
+}
+
+//跟踪chunked主体的边界，不解码，数据原样转发；返回属于这个响应的字节数，读到结束块后的空行时chunk_state为C_DONE
+static size_t scan_chunks(upstream* u,const char* p,size_t n){
+    size_t i = 0;
+    while(i < n && u -> chunk_state != C_DONE){
+        char c = p[i];
+        switch(u -> chunk_state){
+            case C_SIZE:{
+                int digit = c >= '0' && c <= '9' ? c - '0' : (c | 0x20) >= 'a' && (c | 0x20) <= 'f' ? (c | 0x20) - 'a' + 10 : -1;
+                if(digit < 0){
+                    u -> chunk_state = C_EXT;   //块大小之后是扩展或者CRLF，由C_EXT处理
+                    break;
+                }
+                u -> chunk_left = u -> chunk_left * 16 + digit;
+                ++i;
+                break;
+            }
+            case C_EXT:{
+                if(c == '\n'){
+                    u -> chunk_state = u -> chunk_left ? C_DATA : C_TRAILER;
+                }
+                ++i;
+                break;
+            }
+            case C_DATA:{
+                size_t take = n - i < (size_t)u -> chunk_left ? n - i : u -> chunk_left;
+                i += take;
+                u -> chunk_left -= take;
+                if(u -> chunk_left == 0){
+                    u -> chunk_state = C_DATA_END;
+                }
+                break;
+            }
+            case C_DATA_END:{
+                if(c == '\n'){
+                    u -> chunk_state = C_SIZE;
+                }
+                ++i;
+                break;
+            }
+            case C_TRAILER:{
+                u -> chunk_state = c == '\r' ? C_LAST_LF : c == '\n' ? C_DONE : C_TRAILER_LINE;
+                ++i;
+                break;
+            }
+            case C_TRAILER_LINE:{
+                if(c == '\n'){
+                    u -> chunk_state = C_TRAILER;
+                }
+                ++i;
+                break;
+            }
+            case C_LAST_LF:{
+                u -> chunk_state = C_DONE;
+                ++i;
+                break;
+            }
+        }
+    }
+    return i;
+}
+
+int upstream_pool::send_head(upstream* u){
+    http_conn* c = u -> conn;
+    while(u -> sent < c -> m_proxy_head_len){
+        ssize_t n = send(u -> fd,c -> m_proxy_head + u -> sent,c -> m_proxy_head_len - u -> sent,0);
+        if(n < 0){
+            //还没连上时send返回EAGAIN，连上后边缘触发的EPOLLOUT再来
+            if(errno == EAGAIN || errno == ENOTCONN){
+                return STEP_WAIT;
+            }
+            return STEP_RETRY;
+        }
+        u -> sent += n;
+    }
+    u -> state = u -> body_left > 0 ? S_SEND_BODY : S_RECV_HEAD;
+    return STEP_NEXT;
+}
+
+//管道的两端分别推进，一边的EAGAIN不影响另一边；有进展就再试一轮，直到两边都要等待
+//管道没满时splice读客户端socket返回EAGAIN，也可能是管道的槽位用完了，这时管道中一定还有数据，排空管道之后会再试
+int upstream_pool::send_body(upstream* u){
+    http_conn* c = u -> conn;
+    while(true){
+        bool progress = false;
+        if(u -> body_left > 0 && u -> piped < u -> pipe_cap){
+            long want = u -> pipe_cap - u -> piped;
+            if(want > u -> body_left){
+                want = u -> body_left;
+            }
+            ssize_t n = splice(c -> m_sockfd,NULL,u -> pipe_fd[1],NULL,want,SPLICE_F_NONBLOCK | SPLICE_F_MOVE);
+            if(n > 0){
+                u -> body_left -= n;
+                u -> piped += n;
+                stats_add(STAT_BYTES_IN,n);
+                progress = true;
+            }
+            else if(n == 0 || errno != EAGAIN){   //客户端没发完请求体就关闭了
+                return STEP_DROP;
+            }
+            else{
+                wait_client(u,EPOLLIN);
+            }
+        }
+        if(u -> piped > 0){
+            ssize_t n = splice(u -> pipe_fd[0],NULL,u -> fd,NULL,u -> piped,SPLICE_F_NONBLOCK | SPLICE_F_MOVE);
+            if(n > 0){
+                u -> piped -= n;
+                progress = true;
+            }
+            else if(n < 0 && errno != EAGAIN){
+                return STEP_FAIL;
+            }
+        }
+        if(u -> body_left == 0 && u -> piped == 0){
+            u -> state = S_RECV_HEAD;
+            return STEP_NEXT;
+        }
+        if(!progress){
+            return STEP_WAIT;
+        }
+    }
+}
+
+//改写响应头：状态行和端到端的首部原样转发，去掉后端的Connection/Keep-Alive，换成代理和客户端之间的Connection
+//确定主体的边界，一起读到的主体字节留在buf的[pos,len)中；1xx的中间响应丢掉，继续读
+int upstream_pool::parse_head(upstream* u,size_t end){
+    char* p = u -> buf;
+    char* head_end = p + end;
+    if(end < 16 || strncmp(p,"HTTP/1.",7) != 0 || p[8] != ' '){
+        return STEP_FAIL;
+    }
+    int status = atoi(p + 9);
+    if(status < 100 || status > 999){
+        return STEP_FAIL;
+    }
+    u -> status = status;
+    if(status < 200){
+        if(status == 101){   //不支持协议升级
+            return STEP_FAIL;
+        }
+        memmove(p,head_end,u -> len - end);
+        u -> len -= end;
+        return STEP_NEXT;
+    }
+    bool keep = p[7] != '0';   //HTTP/1.1默认保持连接，HTTP/1.0要明确keep-alive
+    bool chunked = false;
+    long length = -1;
+    char* line = (char*)memmem(p,end,"\r\n",2) + 2;
+    size_t o = line - p;
+    memcpy(u -> out,p,o);
+    while(line < head_end - 2){
+        char* eol = (char*)memmem(line,head_end - line,"\r\n",2);
+        size_t n = eol - line;
+        char* colon = (char*)memchr(line,':',n);
+        size_t name_len = colon ? colon - line : n;
+        const char* value = colon ? colon + 1 : eol;
+        while(value < eol && (*value == ' ' || *value == '\t')){
+            ++value;
+        }
+        size_t value_len = eol - value;
+        bool copy = true;
+        if(name_len == 10 && strncasecmp(line,"Connection",10) == 0){
+            if(has_token(value,value_len,"close")){
+                keep = false;
+            }
+            else if(has_token(value,value_len,"keep-alive")){
+                keep = true;
+            }
+            copy = false;
+        }
+        else if(name_len == 10 && strncasecmp(line,"Keep-Alive",10) == 0){
+            copy = false;
+        }
+        else if(name_len == 14 && strncasecmp(line,"Content-Length",14) == 0){
+            char* stop;
+            length = strtol(value,&stop,10);
+            if(stop == value || length < 0){
+                return STEP_FAIL;
+            }
+        }
+        else if(name_len == 17 && strncasecmp(line,"Transfer-Encoding",17) == 0){
+            chunked = has_token(value,value_len,"chunked");
+        }
+        if(copy){
+            memcpy(u -> out + o,line,n + 2);
+            o += n + 2;
+        }
+        line = eol + 2;
+    }
+
+    http_conn* c = u -> conn;
+    if(c -> m_method == http_conn::HEAD || status == 204 || status == 304){
+        u -> framing = F_NONE;
+    }
+    else if(chunked){
+        u -> framing = F_CHUNKED;
+    }
+    else if(length >= 0){
+        u -> framing = F_LENGTH;
+        u -> resp_left = length;
+    }
+    else{   //读到后端关闭为止，后端连接不能复用，客户端也只能在发完后关闭
+        u -> framing = F_CLOSE;
+        keep = false;
+    }
+    u -> client_keep = c -> m_linger && u -> framing != F_CLOSE;
+    o += snprintf(u -> out + o,sizeof(u -> out) - o,"Connection: %s\r\n\r\n",u -> client_keep ? "keep-alive" : "close");
+    u -> out_len = o;
+    u -> out_sent = 0;
+
+    //和响应头一起读到的主体；超出这个响应的字节说明后端的数据不可信，连接不再复用
+    u -> pos = end;
+    size_t extra = u -> len - end;
+    if(u -> framing == F_NONE){
+        keep = keep && extra == 0;
+        u -> len = end;
+    }
+    else if(u -> framing == F_LENGTH){
+        if(extra > (size_t)u -> resp_left){
+            keep = false;
+            extra = u -> resp_left;
+            u -> len = end + extra;
+        }
+        u -> resp_left -= extra;
+    }
+    else if(u -> framing == F_CHUNKED){
+        size_t used = scan_chunks(u,p + end,extra);
+        keep = keep && used == extra;
+        u -> len = end + used;
+    }
+    u -> keep = keep;
+    u -> state = S_SEND_RESP;
+    return STEP_NEXT;
+}
+
+int upstream_pool::recv_head(upstream* u){
+    while(true){
+        //先在已经读到的数据中找响应头的结尾，跳过1xx之后后面的响应可能已经在缓冲区中
+        const char* end = u -> len >= 4 ? (const char*)memmem(u -> buf,u -> len,"\r\n\r\n",4) : NULL;
+        if(end){
+            int ret = parse_head(u,end + 4 - u -> buf);
+            if(ret != STEP_NEXT || u -> state != S_RECV_HEAD){
+                return ret;
+            }
+            continue;
+        }
+        if(u -> len == (size_t)UPSTREAM_BUF){   //响应头太长
+            return STEP_FAIL;
+        }
+        ssize_t n = recv(u -> fd,u -> buf + u -> len,UPSTREAM_BUF - u -> len,0);
+        if(n < 0 && errno == EAGAIN){
+            return STEP_WAIT;
+        }
+        if(n <= 0){
+            //什么也没收到就被关闭，多半是复用的空闲连接刚被后端关掉
+            return u -> len == 0 && u -> status == 0 ? STEP_RETRY : STEP_FAIL;
+        }
+        u -> len += n;
+    }
+}
+
+int upstream_pool::send_resp(upstream* u){
+    http_conn* c = u -> conn;
+    while(u -> out_sent < u -> out_len || u -> pos < u -> len){
+        iovec iv[2];
+        int count = 0;
+        if(u -> out_sent < u -> out_len){
+            iv[count].iov_base = u -> out + u -> out_sent;
+            iv[count++].iov_len = u -> out_len - u -> out_sent;
+        }
+        if(u -> pos < u -> len){
+            iv[count].iov_base = u -> buf + u -> pos;
+            iv[count++].iov_len = u -> len - u -> pos;
+        }
+        ssize_t n = writev(c -> m_sockfd,iv,count);
+        if(n < 0){
+            if(errno == EAGAIN){
+                wait_client(u,EPOLLOUT);
+                return STEP_WAIT;
+            }
+            return STEP_DROP;
+        }
+        stats_add(STAT_BYTES_OUT,n);
+        u -> bytes += n;
+        size_t head = u -> out_len - u -> out_sent;
+        if((size_t)n <= head){
+            u -> out_sent += n;
+        }
+        else{
+            u -> out_sent = u -> out_len;
+            u -> pos += n - head;
+        }
+    }
+    if(u -> framing == F_NONE || (u -> framing == F_LENGTH && u -> resp_left == 0) || (u -> framing == F_CHUNKED && u -> chunk_state == C_DONE)){
+        return STEP_DONE;
+    }
+    u -> state = u -> framing == F_CHUNKED ? S_RELAY_CHUNKED : S_RELAY_SPLICE;
+    u -> len = u -> pos = 0;
+    return STEP_NEXT;
+}
+
+//和send_body一样两端分别推进；管道写不进客户端时注册客户端可写，后端的可读由边缘触发的事件报告
+int upstream_pool::relay_splice(upstream* u){
+    http_conn* c = u -> conn;
+    while(true){
+        bool progress = false;
+        bool more = u -> framing == F_CLOSE ? !u -> eof : u -> resp_left > 0;
+        if(more && u -> piped < u -> pipe_cap){
+            long want = u -> pipe_cap - u -> piped;
+            if(u -> framing == F_LENGTH && want > u -> resp_left){
+                want = u -> resp_left;
+            }
+            ssize_t n = splice(u -> fd,NULL,u -> pipe_fd[1],NULL,want,SPLICE_F_NONBLOCK | SPLICE_F_MOVE);
+            if(n > 0){
+                u -> piped += n;
+                if(u -> framing == F_LENGTH){
+                    u -> resp_left -= n;
+                }
+                progress = true;
+            }
+            else if(n == 0 && u -> framing == F_CLOSE){
+                u -> eof = true;
+                progress = true;
+            }
+            else if(n == 0 || errno != EAGAIN){   //定长的主体没发完后端就关闭了，只能关闭客户端连接
+                return STEP_DROP;
+            }
+        }
+        if(u -> piped > 0){
+            ssize_t n = splice(u -> pipe_fd[0],NULL,c -> m_sockfd,NULL,u -> piped,SPLICE_F_NONBLOCK | SPLICE_F_MOVE);
+            if(n > 0){
+                u -> piped -= n;
+                u -> bytes += n;
+                stats_add(STAT_BYTES_OUT,n);
+                progress = true;
+            }
+            else if(n < 0 && errno == EAGAIN){
+                wait_client(u,EPOLLOUT);
+            }
+            else{
+                return STEP_DROP;
+            }
+        }
+        more = u -> framing == F_CLOSE ? !u -> eof : u -> resp_left > 0;
+        if(!more && u -> piped == 0){
+            return STEP_DONE;
+        }
+        if(!progress){
+            return STEP_WAIT;
+        }
+    }
+}
+
+int upstream_pool::relay_chunked(upstream* u){
+    http_conn* c = u -> conn;
+    while(true){
+        if(u -> pos < u -> len){
+            ssize_t n = send(c -> m_sockfd,u -> buf + u -> pos,u -> len - u -> pos,0);
+            if(n < 0){
+                if(errno == EAGAIN){
+                    wait_client(u,EPOLLOUT);
+                    return STEP_WAIT;
+                }
+                return STEP_DROP;
+            }
+            u -> pos += n;
+            u -> bytes += n;
+            stats_add(STAT_BYTES_OUT,n);
+            continue;
+        }
+        if(u -> chunk_state == C_DONE){
+            return STEP_DONE;
+        }
+        u -> pos = u -> len = 0;
+        ssize_t n = recv(u -> fd,u -> buf,UPSTREAM_BUF,0);
+        if(n < 0 && errno == EAGAIN){
+            return STEP_WAIT;
+        }
+        if(n <= 0){
+            return STEP_DROP;
+        }
+        size_t used = scan_chunks(u,u -> buf,n);
+        if(used < (size_t)n){
+            u -> keep = false;
+        }
+        u -> len = used;
+    }
+}
+
+void upstream_pool::pump(upstream* u){
+    //每次被事件唤醒都重新计时，期限针对的是没有进展的时间而不是整个转发
+    u -> conn -> arm_timer(http_conn::TIMER_WRITE);
+    while(true){
+        int ret;
+        switch(u -> state){
+            case S_SEND_HEAD: ret = send_head(u); break;
+            case S_SEND_BODY: ret = send_body(u); break;
+            case S_RECV_HEAD: ret = recv_head(u); break;
+            case S_SEND_RESP: ret = send_resp(u); break;
+            case S_RELAY_SPLICE: ret = relay_splice(u); break;
+            default: ret = relay_chunked(u); break;
+        }
+        switch(ret){
+            case STEP_NEXT:
+                continue;
+            case STEP_WAIT:
+                return;
+            case STEP_DONE:
+                finish(u);
+                return;
+            case STEP_RETRY:
+                u = retry(u);
+                if(!u){
+                    return;
+                }
+                continue;
+            case STEP_FAIL:
+                fail(u,502);
+                return;
+            default:
+                drop(u);
+                return;
+        }
+    }
+}
+
+upstream* upstream_pool::retry(upstream* u){
+    http_conn* c = u -> conn;
+    //只有复用的连接、请求体还没开始从客户端读、后端也还没有回答时才能重发；
+    //POST/PATCH不是幂等的，请求头已经发出去一部分就不重发
+    bool idempotent = c -> m_method != http_conn::POST && c -> m_method != http_conn::PATCH;
+    if(!u -> reused || u -> status != 0 || u -> body_left != c -> m_proxy_body_left || (!idempotent && u -> sent != 0)){
+        fail(u,502);
+        return NULL;
+    }
+    const proxy_backend* b = u -> backend;
+    int armed = u -> client_armed;
+    c -> m_upstream = NULL;
+    u -> conn = NULL;
+    close_upstream(u);
+    upstream* fresh = connect_to(b);
+    if(!fresh){
+        c -> proxy_error(502);
+        return NULL;
+    }
+    attach(fresh,c);
+    fresh -> reused = false;
+    fresh -> client_armed = armed;
+    return fresh;
+}
+
+void upstream_pool::finish(upstream* u){
+    http_conn* c = u -> conn;
+    int status = u -> status;
+    long bytes = u -> bytes;
+    bool client_keep = u -> client_keep;
+    c -> m_upstream = NULL;
+    u -> conn = NULL;
+    release(u,u -> keep);
+    c -> end_proxy(status,bytes,client_keep);
+}
+
+void upstream_pool::fail(upstream* u,int status){
+    http_conn* c = u -> conn;
+    LOG_WARN("upstream %s failed for %s, answer %d",u -> backend -> name.c_str(),c -> m_url,status);
+    c -> m_upstream = NULL;
+    u -> conn = NULL;
+    close_upstream(u);
+    c -> proxy_error(status);
+}
+
+void upstream_pool::drop(upstream* u){
+    http_conn* c = u -> conn;
+    //响应已经开始发送，记下实际发出的部分
+    if(u -> status){
+        c -> log_proxy(u -> status,u -> bytes);
+    }
+    c -> m_upstream = NULL;
+    u -> conn = NULL;
+    close_upstream(u);
+    c -> close_conn();
+}
+
+void upstream_pool::abort(upstream* u){
+    u -> conn -> m_upstream = NULL;
+    u -> conn = NULL;
+    u -> pool -> close_upstream(u);
+}
+
+bool upstream_pool::expire(upstream* u){
+    //请求已经交给后端，一直等不到响应头；等客户端的请求体或者客户端不读响应时直接关闭
+    if(u -> state != S_SEND_HEAD && u -> state != S_RECV_HEAD){
+        return false;
+    }
+    u -> pool -> fail(u,504);
+    return true;
+}
+
+void upstream_pool::on_upstream(upstream* u,unsigned events){
+    if(u -> dead){
+        return;
+    }
+    if(!u -> conn){
+        //空闲连接上有数据或者关闭：后端关闭了连接，或者发来了不属于任何请求的数据，都不能再用
+        //可读事件也可能是上次转发时到达、在这一轮才报告的，这时socket中已经没有数据
+        if(events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)){
+            char byte;
+            if((events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) || recv(u -> fd,&byte,1,MSG_PEEK) >= 0 || errno != EAGAIN){
+                unlink_idle(u);
+                close_upstream(u);
+            }
+        }
+        return;
+    }
+    pump(u);
+}
+
+void upstream_pool::on_client(http_conn* conn,unsigned events){
+    upstream* u = conn -> m_upstream;
+    //EPOLLONESHOT的事件报告之后就不再注册
+    u -> client_armed = 0;
+    if(events & (EPOLLHUP | EPOLLERR)){
+        drop(u);
+        return;
+    }
+    pump(u);
+}
+
+void upstream_pool::reap(){
+    for(size_t i = 0;i < m_dead.size();++i){
+        upstream* u = m_dead[i];
+        g_owner[u -> fd] = NULL;
+        close(u -> fd);
+        close(u -> pipe_fd[0]);
+        close(u -> pipe_fd[1]);
+        delete u;
+    }
+    m_dead.clear();
+}
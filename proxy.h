@@ -0,0 +1,96 @@
+#ifndef PROXY_H
+#define PROXY_H
+
+#include<sys/types.h>
+#include<sys/socket.h>
+#include<string>
+#include<vector>
+
+class http_conn;
+
+//反向代理：URL以配置的前缀开头的请求转发给后端(host:port或者Unix socket)，其他请求照常走路由和文件
+//请求行和首部由工作线程解析、改写成发给后端的请求头，之后连接交回反应堆线程，
+//由反应堆的upstream_pool和后端交换数据，后端连接注册在同一个epoll中，不经过线程池
+
+//一个后端，启动时由-p配置，之后只读
+struct proxy_backend{
+    std::string prefix;     //URL前缀，最长的前缀优先
+    std::string name;       //"host:port"或者"unix:路径"，日志用
+    sockaddr_storage addr;
+    socklen_t addr_len;
+    int index;              //在后端表中的下标，连接池按它分组
+};
+
+//解析"前缀=host:port"或者"前缀=unix:路径"并加入后端表，格式不对返回false；在反应堆运行之前调用
+bool proxy_add(const char* spec);
+//URL(可以带查询串)匹配的后端，没有返回NULL
+const proxy_backend* proxy_match(const char* url);
+//配置的后端个数
+int proxy_count();
+
+//和后端的一条连接，同时也是正在进行的一次转发的状态
+struct upstream;
+
+//每个反应堆一个后端连接池：空闲的长连接按后端分组，挂在反应堆的epoll上(边缘触发，注册一次)，
+//后端关闭空闲连接时收到EPOLLRDHUP就关掉，不等下次使用时才发现
+//转发过程只在反应堆线程中运行：客户端socket仍然用EPOLLONESHOT按需注册可读/可写，后端socket一直注册可读和可写
+//请求体和定长/到关闭为止的响应体用splice经过每条后端连接自己的管道在两个socket之间搬运，管道容量就是缓冲的上限；
+//chunked响应要找到结束的位置，经过一个定长的缓冲区原样转发
+class upstream_pool{
+public:
+    upstream_pool();
+    ~upstream_pool();
+    void init(int epollfd);
+    //工作线程已经准备好发给后端的请求头，连接排队的响应也发完了，开始转发
+    void start(http_conn* conn);
+    //fd是后端连接时返回它，否则返回NULL
+    static upstream* owner(int fd);
+    //epoll报告的后端连接和正在转发的客户端连接上的事件
+    void on_upstream(upstream* u,unsigned events);
+    void on_client(http_conn* conn,unsigned events);
+    //客户端连接被关闭(出错、超时)：放弃转发，后端连接不再复用
+    static void abort(upstream* u);
+    //客户端连接的定时器到期：还没开始发送响应时回答504，返回true；否则返回false，由调用者关闭连接
+    static bool expire(upstream* u);
+    //释放这一轮事件中关闭的后端连接，反应堆每轮事件和定时器处理完之后调用
+    void reap();
+
+    //每个后端最多保留的空闲连接数
+    static const int MAX_IDLE = 32;
+
+private:
+    //转发的各个阶段，返回STEP_*：进入下一阶段、等待事件、完成或者失败
+    static int send_head(upstream* u);      //请求头和已经读入的请求体
+    static int send_body(upstream* u);      //客户端socket -> 管道 -> 后端
+    static int recv_head(upstream* u);      //读后端的响应头
+    static int send_resp(upstream* u);      //改写后的响应头和一起读到的主体
+    static int relay_splice(upstream* u);   //后端 -> 管道 -> 客户端
+    static int relay_chunked(upstream* u);  //经过缓冲区转发chunked主体
+    static int parse_head(upstream* u,size_t end);
+    //客户端socket是EPOLLONESHOT的，要等它的事件时重新注册
+    static void wait_client(upstream* u,int ev);
+
+    upstream* connect_to(const proxy_backend* backend);
+    void attach(upstream* u,http_conn* conn);
+    //空闲连接在复用前已经被后端关闭：换一条新连接重发请求，失败返回NULL
+    upstream* retry(upstream* u);
+    //尽量推进转发，直到两边都要等待事件、转发结束或者出错
+    void pump(upstream* u);
+    //转发结束：后端连接能复用就放回空闲表，客户端连接继续处理下一个请求
+    void finish(upstream* u);
+    //还没有发送响应时失败：关掉后端连接，回答status(502/504)
+    void fail(upstream* u,int status);
+    //已经发出部分响应后失败：两边都关闭
+    void drop(upstream* u);
+    void release(upstream* u,bool reuse);
+    void close_upstream(upstream* u);
+    void unlink_idle(upstream* u);
+
+private:
+    int m_epollfd;
+    upstream** m_idle;    //下标是proxy_backend::index，空闲连接的双向链表
+    int* m_idle_count;
+    std::vector<upstream*> m_dead;
+};
+
+#endif
@@ -0,0 +1,229 @@
+#include<sys/socket.h>
+#include<netinet/in.h>
+#include<netinet/tcp.h>
+#include<arpa/inet.h>
+#include<stdio.h>
+#include<unistd.h>
+#include<errno.h>
+#include<string.h>
+#include<cassert>
+
+#include"./reactor.h"
+
+//添加文件描述符到内核事件集
+extern void addfd(int epollfd,int fd,bool one_shot);
+
+int reactor::m_backlog = 1024;
+int reactor::m_defer_accept = 0;
+
+reactor::reactor():
+    m_listenfd(-1),m_epollfd(-1),m_users(NULL),m_pool(NULL)
+{
+}
+
+reactor::~reactor(){
+    if(m_epollfd != -1){
+        close(m_epollfd);
+    }
+    if(m_listenfd != -1){
+        close(m_listenfd);
+    }
+}
+
+//创建监听socket，设置SO_REUSEPORT后可以多个socket绑定同一个ip:port，epoll和io_uring两种反应堆共用
+//监听socket本身是非阻塞的，边缘触发时accept到EAGAIN为止
+int reactor::open_listener(const char* ip,int port){
+    int listenfd = socket(PF_INET,SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,0);
+    if(listenfd < 0){
+        return -1;
+    }
+    /* 默认关闭close时，是close调用立即返回，TCP模块负责将该socket对应的TCP发送缓冲区中残留的数据发送给对方
+     * 1,0--表示的是close调用在关闭TCP连接时，TCP模块将该socket对应的发送缓冲区数据直接丢弃，同时发送给对方一个复位报文段
+     * 给服务器提供了一个异常终止连接的方法(对端会收到复位报文段)
+     * 1,非0--阻塞--等待一段时间再关闭，如果超过时间未收到确认，则返回-1，且errno设置为EWOULDBLOCK
+     *      非阻塞--直接返回，根据errno和返回值判断状态
+     * 这里不设置SO_LINGER：accept得到的socket会继承监听socket的选项，设置成1,0的话，短连接在write返回后close，
+     * 发送缓冲区中还没发出去的响应(大文件的尾部)会被直接丢弃，客户端收到RST
+    */
+    //SO_REUSEPORT，内核根据四元组哈希把新连接分给绑定在同一端口上的各个监听socket
+    int reuse = 1;
+    setsockopt(listenfd,SOL_SOCKET,SO_REUSEPORT,&reuse,sizeof(reuse));
+    //服务器重启时端口上还有TIME_WAIT的连接也可以bind；accept得到的socket不需要再设置
+    setsockopt(listenfd,SOL_SOCKET,SO_REUSEADDR,&reuse,sizeof(reuse));
+    //客户端发来请求数据后连接才进入全连接队列，只建立连接不发数据的客户端不会唤醒反应堆
+    //超过这个秒数还没有数据，内核仍然会把连接交给accept
+    if(m_defer_accept > 0){
+        setsockopt(listenfd,IPPROTO_TCP,TCP_DEFER_ACCEPT,&m_defer_accept,sizeof(m_defer_accept));
+    }
+
+    //绑定端口号，创建监听套接字--队列--已完成连接队列，未完成连接队列2次握手
+    //全连接队列满时新的SYN/ACK会被丢弃，客户端要等1秒重传，连接突发时队列要足够长
+    struct sockaddr_in address;
+    bzero(&address,sizeof(address));
+    address.sin_family = AF_INET;
+    inet_aton(ip,&address.sin_addr);
+    address.sin_port = htons(port);
+
+    if(bind(listenfd,(struct sockaddr*)& address,sizeof(address)) < 0 || listen(listenfd,m_backlog) < 0){
+        close(listenfd);
+        return -1;
+    }
+    return listenfd;
+}
+
+//每个反应堆各自创建监听socket，由内核把新连接分散到各个反应堆
+bool reactor::init(const char* ip,int port,http_conn* users,threadpool<http_conn>* pool){
+    m_users = users;
+    m_pool = pool;
+
+    m_listenfd = open_listener(ip,port);
+    if(m_listenfd < 0){
+        return false;
+    }
+
+    //创建本反应堆的内核事件集
+    m_epollfd = epoll_create(5);
+    if(m_epollfd == -1){
+        return false;
+    }
+    //添加listenfd到内核事件集中，监听连接事件
+    addfd(m_epollfd,m_listenfd,false);
+    m_upstreams.init(m_epollfd);
+    return true;
+}
+
+bool reactor::start(){
+    if(pthread_create(&m_thread,NULL,worker,this) != 0){
+        return false;
+    }
+    return pthread_detach(m_thread) == 0;
+}
+
+void* reactor::worker(void* arg){
+    reactor* r = (reactor*)arg;
+    r -> run();
+    return r;
+}
+
+void reactor::show_error(int connfd,const char* info){
+    send(connfd,info,strlen(info),0);
+    close(connfd);
+}
+
+//监听socket是边缘触发的，一次事件可能对应多个新连接，不取完的话剩下的要等下一个连接到来才会再被通知
+//accept4直接得到非阻塞的socket，不用再为每个连接调用fcntl
+void reactor::accept_all(){
+    while(true){
+        struct sockaddr_in client_address;
+        socklen_t client_addrlength = sizeof(client_address);
+        int connfd = accept4(m_listenfd,(struct sockaddr*)& client_address,&client_addrlength,SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(connfd < 0){
+            if(errno == EAGAIN || errno == EWOULDBLOCK){
+                break;
+            }
+            //对端在accept之前就断开了，或者被信号打断，继续取下一个
+            if(errno == ECONNABORTED || errno == EINTR){
+                continue;
+            }
+            //fd用完(EMFILE/ENFILE)等：剩下的连接留在队列中，等下一次事件
+            LOG_WARN("accept failure, errno is: %d",errno);
+            break;
+        }
+        stats_add(STAT_ACCEPTS,1);
+        //判断当前的总用户数量，如果用户数量大于MAX_FD，也是内核允许当前进程最大打开文件描述符的数量，那么就不再
+        if(connfd >= MAX_FD || http_conn::m_user_count >= MAX_FD){
+            show_error(connfd,"Internal server busy");
+            continue;
+        }
+        //初始化客户连接，user[connfd]表示当前客户连接，connfd就是已连接套接字，就直接是下标
+        //fd在整个进程内唯一，所以各个反应堆可以共享同一个users数组；连接注册到本反应堆的epoll中
+        m_users[connfd].init(connfd,client_address,m_epollfd,&m_timers);
+    }
+}
+
+void reactor::run(){
+    while(true){
+        //epoll_wait最多等到下一个定时器到期
+        int number = epoll_wait(m_epollfd,m_events,MAX_EVENT_NUMBER,m_timers.next_timeout());
+        if((number < 0) && (errno != EINTR)){
+            LOG_ERROR("epoll failure, errno is: %d",errno);
+            break;
+        }
+
+        for(int i = 0;i < number;++i){
+            int sockfd = m_events[i].data.fd;
+            //如果是监听套接字，则取出全连接队列中的所有连接
+            if(sockfd == m_listenfd){
+                accept_all();
+            }
+            //后端连接，以及正在转发的客户端连接：由连接池推进转发，客户端的半关闭也交给它处理
+            else if(upstream* u = upstream_pool::owner(sockfd)){
+                m_upstreams.on_upstream(u,m_events[i].events);
+            }
+            else if(m_users[sockfd].proxying()){
+                m_upstreams.on_client(m_users + sockfd,m_events[i].events);
+            }
+            //异常状态，或者对端关闭连接
+            else if(m_events[i].events & (EPOLLRDHUP | EPOLLHUP |EPOLLERR)){
+                //如果有异常，直接关闭客户连接
+                LOG_DEBUG("sock_exception_close fd %d",sockfd);
+                m_users[sockfd].close_conn();   //直接关闭连接close
+            }
+            //可读
+            else if(m_events[i].events & EPOLLIN){
+                //根据读的结果，决定将任务添加到线程池，还是关闭连接
+                //先读，根据读操作返回的结果，true则将该http_conn对象添加到工作队列中去，由工作线程去处理事件
+                //所以这里是由主线程完成读写，而将http_conn这一对象添加到工作队列中去，工作线程只负责解析接收缓冲区的数据
+                //半同步/半反应堆模式
+                //我认为这里更像是  同步模拟的Proactor模式，因为Reactor模式是主线程仅负责监听事件，读写、处理业务逻辑均是由工作线程完成
+                //fd作为key，工作窃取模式下同一个连接的请求总是投递给同一个工作线程
+                if(m_users[sockfd].read()){
+                    //交给线程池期间定时器到期不关闭连接，由工作线程处理完后解除
+                    m_users[sockfd].mark_busy();
+                    if(!m_pool->append(m_users + sockfd,sockfd)){
+                        m_users[sockfd].unmark_busy();
+                        m_users[sockfd].close_conn();   //请求队列满，关闭连接
+                    }
+                }
+                else{
+                    LOG_DEBUG("sock_read_close fd %d",sockfd);
+                    m_users[sockfd].close_conn();
+                }
+            }
+            else if(m_events[i].events & EPOLLOUT){
+                //根据写的结果，决定是否关闭连接
+                //写事件触发
+                //由反应堆线程完成写，这个时候逻辑是工作线程处理完读取到的数据，并根据读取的数据情况，决定要写的响应
+                //包括状态行、首部、空行、主体部分
+                //返回结果的false-表示短连接
+                //返回结果的true--表示长连接，这是根据请求和响应报文中首部字段的 Connection决定是长连接或者是短连接
+                if(!m_users[sockfd].write()){
+                    LOG_DEBUG("sock_write_close fd %d",sockfd);
+                    m_users[sockfd].close_conn();
+                }
+                //这里如果是长连接，那么在写完后，就已经重新初始化完了
+                //读缓冲区中还有流水线请求没有解析(上一批响应队列满了)，再交给线程池
+                else if(m_users[sockfd].pending_request()){
+                    m_users[sockfd].mark_busy();
+                    if(!m_pool->append(m_users + sockfd,sockfd)){
+                        m_users[sockfd].unmark_busy();
+                        m_users[sockfd].close_conn();
+                    }
+                }
+                //前面排队的响应发完了，开始把请求转发给后端
+                else if(m_users[sockfd].proxy_pending()){
+                    m_upstreams.start(m_users + sockfd);
+                }
+            }
+            else
+            {
+                LOG_DEBUG("unexpected events %x on fd %d",m_events[i].events,sockfd);
+            }
+        }
+        //处理到期的定时器：超时的连接在这里被关闭
+        m_timers.expire();
+        //这一轮关闭的后端连接在这里才真正关闭fd
+        m_upstreams.reap();
+
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include<pthread.h>
+#include<sys/epoll.h>
+#include"threadpool.h"
+#include"http_conn.h"
+#include"timerwheel.h"
+#include"proxy.h"
+
+#define MAX_FD 65536
+#define MAX_EVENT_NUMBER 10000
+
+//反应堆(事件循环)类，每个反应堆有自己的监听socket和epoll内核事件表
+//多反应堆模式下，每个反应堆的监听socket都设置SO_REUSEPORT绑定到同一端口，由内核把新连接分散到各个反应堆
+//连接由哪个反应堆accept，之后的读写事件就一直由该反应堆处理，连接不会在反应堆之间迁移
+class reactor{
+public:
+    reactor();
+    ~reactor();
+    //创建监听socket(SO_REUSEPORT)和epoll，users是所有反应堆共享的、以fd为下标的http_conn数组
+    bool init(const char* ip,int port,http_conn* users,threadpool<http_conn>* pool);
+    //在新线程中运行事件循环
+    bool start();
+    //事件循环，可以直接在主线程中调用
+    void run();
+    //创建绑定到ip:port的非阻塞监听socket(SO_REUSEPORT)，失败返回-1
+    static int open_listener(const char* ip,int port);
+    //向客户端发送错误信息并关闭连接
+    static void show_error(int connfd,const char* info);
+
+public:
+    //listen的全连接队列长度，内核会截断到net.core.somaxconn
+    static int m_backlog;
+    //TCP_DEFER_ACCEPT的秒数：连接收到第一个数据包后才放进全连接队列，0表示不设置
+    static int m_defer_accept;
+
+private:
+    //线程函数，参数是this
+    static void* worker(void* arg);
+    //边缘触发的监听socket可读：一直accept到EAGAIN
+    void accept_all();
+
+private:
+    int m_listenfd;//本反应堆的监听socket
+    int m_epollfd; //本反应堆的epoll内核事件表
+    pthread_t m_thread;
+    timerwheel m_timers;//本反应堆上所有连接的定时器，由epoll_wait的超时驱动
+    upstream_pool m_upstreams;//本反应堆上转发用的后端连接，注册在同一个epoll中
+    http_conn* m_users;
+    threadpool<http_conn>* m_pool;
+    epoll_event m_events[MAX_EVENT_NUMBER];
+};
+
+#endif
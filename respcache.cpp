@@ -0,0 +1,209 @@
+#include<sys/mman.h>
+#include<string.h>
+#include<errno.h>
+#include"respcache.h"
+#include"log.h"
+
+//MAP_HUGETLB按2MB的大页分配，长度要是大页的整数倍
+static const size_t HUGE_PAGE = 2 << 20;
+
+respcache::respcache():
+    m_oldest(NULL),m_newest(NULL),m_arena(NULL),m_size(0),m_head(0),m_bytes(0),m_huge(false),m_generation(0)
+{
+}
+
+respcache::~respcache(){
+}
+
+//进程内只有一个缓存，所有工作线程共享
+respcache* respcache::instance(){
+    static respcache cache;
+    return &cache;
+}
+
+bool respcache::init(size_t budget){
+    if(budget == 0){    //预算为0表示关闭缓存
+        return true;
+    }
+    size_t size = (budget + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1);
+    void* addr = mmap(NULL,size,PROT_READ | PROT_WRITE,MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,-1,0);
+    m_huge = addr != MAP_FAILED;
+    //没有预留大页(vm.nr_hugepages为0)时用普通页，透明大页打开时内核仍然可能用大页
+    if(!m_huge){
+        addr = mmap(NULL,size,PROT_READ | PROT_WRITE,MAP_PRIVATE | MAP_ANONYMOUS,-1,0);
+        if(addr == MAP_FAILED){
+            return false;
+        }
+        madvise(addr,size,MADV_HUGEPAGE);
+    }
+    m_arena = (char*)addr;
+    m_size = size;
+    LOG_INFO("response arena %lu KB on %s pages",(unsigned long)(size >> 10),m_huge ? "huge" : "normal");
+    return true;
+}
+
+respcache::entry* respcache::acquire(const char* path,int variant,unsigned long* generation){
+    //每个线程复用一个键的缓冲区，命中时不分配内存
+    static thread_local std::string key;
+    key.assign(path);
+    key.push_back('0' + variant);
+    m_locker.lock();
+    std::unordered_map<std::string,entry*>::iterator it = m_table.find(key);
+    entry* e = NULL;
+    if(it != m_table.end()){
+        e = it -> second;
+        ++e -> refs;
+        ++e -> hits;
+    }
+    *generation = m_generation;
+    m_locker.unlock();
+    return e;
+}
+
+void respcache::release(entry* e){
+    m_locker.lock();
+    --e -> refs;
+    m_locker.unlock();
+}
+
+void respcache::collect_hits(std::unordered_map<std::string,unsigned long>& hits){
+    m_locker.lock();
+    for(std::unordered_map<std::string,entry*>::iterator it = m_table.begin();it != m_table.end();++it){
+        entry* e = it -> second;
+        if(e -> hits){
+            hits[e -> key.substr(0,e -> key.size() - 1)] += e -> hits;
+            e -> hits = 0;
+        }
+    }
+    m_locker.unlock();
+}
+
+//队头的记录就在m_head之后：绕回开头时m_head到末尾的记录先被丢掉，然后依次覆盖开头处和新记录重叠的记录
+bool respcache::reserve(size_t len,size_t* offset){
+    size_t pos = m_head;
+    bool wrap = pos + len > m_size;
+    if(wrap){
+        pos = 0;
+    }
+    while(m_oldest){
+        entry* e = m_oldest;
+        bool overlap = (wrap && e -> offset >= m_head) || (e -> offset < pos + len && e -> offset + e -> len > pos);
+        if(!overlap){
+            break;
+        }
+        if(e -> refs > 0){
+            return false;
+        }
+        if(e -> linked){
+            unlink(e);
+        }
+        m_oldest = e -> next;
+        if(!m_oldest){
+            m_newest = NULL;
+        }
+        delete e;
+    }
+    *offset = pos;
+    m_head = pos + len;
+    return true;
+}
+
+void respcache::insert(const char* path,int variant,unsigned long generation,const char* head,size_t head_len,const char* body,size_t body_len){
+    size_t len = head_len + body_len;
+    if(len > m_size){
+        return;
+    }
+    std::string key(path);
+    key.push_back('0' + variant);
+    m_locker.lock();
+    size_t offset;
+    if(generation != m_generation || m_table.count(key) || !reserve(len,&offset)){
+        m_locker.unlock();
+        return;
+    }
+    memcpy(m_arena + offset,head,head_len);
+    memcpy(m_arena + offset + head_len,body,body_len);
+    entry* e = new entry;
+    e -> key.swap(key);
+    e -> offset = offset;
+    e -> len = len;
+    e -> head_len = head_len;
+    e -> refs = 0;
+    e -> hits = 0;
+    e -> linked = true;
+    e -> next = NULL;
+    if(m_newest){
+        m_newest -> next = e;
+    }
+    else{
+        m_oldest = e;
+    }
+    m_newest = e;
+    m_table[e -> key] = e;
+    m_bytes += len;
+    m_locker.unlock();
+}
+
+void respcache::unlink(entry* e){
+    m_table.erase(e -> key);
+    e -> linked = false;
+    m_bytes -= e -> len;
+}
+
+void respcache::invalidate_one(const std::string& path){
+    std::string key(path);
+    key.push_back('0');
+    for(int variant = 0;variant < 4;++variant){
+        key[key.size() - 1] = '0' + variant;
+        std::unordered_map<std::string,entry*>::iterator it = m_table.find(key);
+        if(it != m_table.end()){
+            unlink(it -> second);
+        }
+    }
+}
+
+void respcache::invalidate(const std::string& path,bool is_dir){
+    if(!m_arena){
+        return;
+    }
+    m_locker.lock();
+    //之前未命中、正在生成响应的请求读到的可能是旧的内容，代数变了就不再放进缓存
+    ++m_generation;
+    invalidate_one(path);
+    //压缩过的变体的主体可能来自foo.gz
+    if(path.size() > 3 && path.compare(path.size() - 3,3,".gz") == 0){
+        invalidate_one(path.substr(0,path.size() - 3));
+    }
+    if(is_dir){
+        std::string prefix = path + "/";
+        for(std::unordered_map<std::string,entry*>::iterator it = m_table.begin();it != m_table.end();){
+            entry* e = it -> second;
+            ++it;
+            if(e -> key.compare(0,prefix.size(),prefix) == 0){
+                unlink(e);
+            }
+        }
+    }
+    m_locker.unlock();
+}
+
+void respcache::invalidate_all(){
+    if(!m_arena){
+        return;
+    }
+    m_locker.lock();
+    ++m_generation;
+    for(std::unordered_map<std::string,entry*>::iterator it = m_table.begin();it != m_table.end();){
+        entry* e = it -> second;
+        ++it;
+        unlink(e);
+    }
+    m_locker.unlock();
+}
+
+size_t respcache::bytes(){
+    m_locker.lock();
+    size_t bytes = m_bytes;
+    m_locker.unlock();
+    return bytes;
+}
@@ -0,0 +1,79 @@
+#ifndef RESPCACHE_H
+#define RESPCACHE_H
+
+#include<stddef.h>
+#include<string>
+#include<unordered_map>
+#include"locker.h"
+
+//小文件的完整响应缓存
+//不超过MAX_BODY的文件，把200响应中状态行和Date之后的部分(首部、空行、主体)生成一次，连续存放在一块大页内存(arena)中；
+//命中时不stat、不open、不mmap，也不再格式化首部，写缓冲区中只放状态行和Date(Date每秒都在变，不能预先生成)，
+//和arena中的其余部分在同一次writev中发出，发送完后不需要munmap
+//同一个文件按Connection(keep-alive/close)和客户端是否接受gzip最多有四个变体，各占一条记录
+//arena按日志的方式使用：新记录依次追加在m_head处，写到末尾时绕回开头，覆盖最早的记录(FIFO淘汰)；
+//记录带引用计数，正在发送的记录不能被覆盖，这时放弃这次填充
+//文件缓存的inotify线程在文件被修改/删除/移动时使对应的记录失效，失效的记录等arena绕回时才被覆盖
+class respcache{
+public:
+    struct entry{
+        std::string key;      //文件的完整路径加一个字节的变体
+        size_t offset;        //在arena中的位置
+        size_t len;           //首部 + 空行 + 主体
+        size_t head_len;      //到空行为止，HEAD请求只发送这一部分
+        int refs;             //引用计数，由缓存的互斥锁保护
+        unsigned long hits;   //命中次数，由缓存的互斥锁保护
+        bool linked;          //是否还在哈希表中(失效后为false)
+        entry* next;          //按在arena中的位置(也就是写入的顺序)排成的队列
+    };
+    //变体的各个位
+    enum{VARIANT_KEEP_ALIVE = 1,VARIANT_GZIP = 2};
+    //能放进缓存的最大主体
+    static const size_t MAX_BODY = 8192;
+
+public:
+    static respcache* instance();
+    //budget是arena的字节数，0表示关闭；先申请MAP_HUGETLB的大页，失败时用普通页并建议内核使用透明大页
+    bool init(size_t budget);
+    bool enabled() const{return m_arena != NULL;}
+    //命中时增加引用计数并返回；未命中返回NULL，generation返回当前的失效代数，填充时交回
+    entry* acquire(const char* path,int variant,unsigned long* generation);
+    const char* data(const entry* e) const{return m_arena + e -> offset;}
+    //放进一条记录：head是首部和空行，body是主体；generation和acquire时不同(期间有文件失效)、
+    //已经有同样的记录或者要覆盖的记录还在发送时放弃
+    void insert(const char* path,int variant,unsigned long generation,const char* head,size_t head_len,const char* body,size_t body_len);
+    //释放acquire得到的引用
+    void release(entry* e);
+    //把各个变体的命中次数按文件路径累加到hits中并清零，命中这里的请求不经过文件缓存，docindex要两边都取
+    void collect_hits(std::unordered_map<std::string,unsigned long>& hits);
+    //由文件缓存的inotify线程调用；path是目录时目录下的记录全部失效，foo.gz变化时foo的记录也失效
+    void invalidate(const std::string& path,bool is_dir);
+    //inotify事件队列溢出时由文件缓存的inotify线程调用，所有记录失效
+    void invalidate_all();
+    //有效记录占用的字节数，统计页面的仪表用
+    size_t bytes();
+    //arena是否在MAP_HUGETLB的大页上
+    bool huge() const{return m_huge;}
+
+private:
+    respcache();
+    ~respcache();
+    //以下函数调用时都要持有m_locker
+    bool reserve(size_t len,size_t* offset);   //在m_head处分配len字节，覆盖和它重叠的最早的记录
+    void unlink(entry* e);                     //从哈希表中摘掉，空间等arena绕回时再用
+    void invalidate_one(const std::string& path);
+
+private:
+    std::unordered_map<std::string,entry*> m_table;
+    entry* m_oldest;      //写入顺序的队列，队头是arena中m_head之后最早的记录
+    entry* m_newest;
+    char* m_arena;
+    size_t m_size;
+    size_t m_head;        //下一条记录的写入位置
+    size_t m_bytes;       //仍在哈希表中的记录的字节数
+    bool m_huge;
+    unsigned long m_generation;   //每次失效加一
+    locker m_locker;      //保护上面所有成员
+};
+
+#endif
@@ -0,0 +1,258 @@
+#include<stdio.h>
+#include<string.h>
+#include<time.h>
+#include<strings.h>
+#include<unistd.h>
+#include<sys/random.h>
+#include"response.h"
+
+//定义http响应的一些状态信息
+//200 OK
+//206 Partial Content--Range请求，只发送请求的范围
+//304 Not Modified--条件请求的验证器匹配，客户端用自己缓存的副本
+//400 Bad Request--解析请求报文出现错误，语法错误
+//403 Forbidden--请求的内容没有访问/读权限或者是目录
+//404 Not Found--没有在服务器相关目录找到请求的文件
+//416 Range Not Satisfiable--Range中没有一个范围落在文件内
+//500 Internal Error--解析请求行时出现了一些其他的未知错误
+//501 Not Implemented--请求体用了不支持的Transfer-Encoding(chunked)
+//502 Bad Gateway--反向代理连不上后端或者后端的响应无效
+//504 Gateway Timeout--反向代理等后端的响应超时
+struct status_info{
+    int status;
+    const char* title;
+    const char* form;   //错误响应的主体，NULL表示不是错误响应
+};
+
+static const status_info g_status[] = {
+    {200,"OK",NULL},
+    {206,"Partial Content",NULL},
+    {304,"Not Modified",NULL},
+    {400,"Bad Request","You request has had syntax or is inherently impossible to satisfy.\n"},
+    {403,"Forbidden","You do not have permission to get file from this server.\n"},
+    {404,"Not Found","The requested file was not found on this server.\n"},
+    {416,"Range Not Satisfiable","The requested range is not satisfiable.\n"},
+    {500,"Internal Error","There was an unusual problem serving the requested file.\n"},
+    {501,"Not Implemented","The request body uses a transfer coding this server does not support.\n"},
+    {502,"Bad Gateway","The upstream server is unavailable or sent an invalid response.\n"},
+    {504,"Gateway Timeout","The upstream server did not respond in time.\n"},
+};
+static const int STATUS_COUNT = sizeof(g_status) / sizeof(g_status[0]);
+
+//预先生成的内容，下标和g_status相同
+struct rendered{
+    char line[64];
+    int line_len;
+    char tail[2][256];   //[0]是Connection: close，[1]是keep-alive
+    int tail_len[2];
+    int head_len[2];     //tail中到空行为止的长度，HEAD请求的错误响应不发送主体
+};
+static rendered g_rendered[STATUS_COUNT];
+
+//multipart/byteranges的分隔串，启动时随机生成，文件内容中恰好出现它的概率可以忽略
+static char g_boundary[24];
+static char g_byteranges_type[64];
+
+static int find_status(int status){
+    for(int i = 0;i < STATUS_COUNT;++i){
+        if(g_status[i].status == status){
+            return i;
+        }
+    }
+    return -1;
+}
+
+void response_init(){
+    for(int i = 0;i < STATUS_COUNT;++i){
+        const status_info& s = g_status[i];
+        rendered& r = g_rendered[i];
+        r.line_len = snprintf(r.line,sizeof(r.line),"HTTP/1.1 %d %s\r\n",s.status,s.title);
+        if(!s.form){
+            continue;
+        }
+        for(int linger = 0;linger < 2;++linger){
+            r.tail_len[linger] = snprintf(r.tail[linger],sizeof(r.tail[linger]),
+                                          "Content-Length: %d\r\nConnection: %s\r\n\r\n%s",
+                                          (int)strlen(s.form),linger ? "keep-alive" : "close",s.form);
+            r.head_len[linger] = r.tail_len[linger] - strlen(s.form);
+        }
+    }
+    unsigned char rnd[8];
+    if(getrandom(rnd,sizeof(rnd),0) != (ssize_t)sizeof(rnd)){
+        unsigned long seed = (unsigned long)time(NULL) ^ ((unsigned long)getpid() << 16);
+        memcpy(rnd,&seed,sizeof(rnd));
+    }
+    int len = snprintf(g_boundary,sizeof(g_boundary),"tw");
+    for(int i = 0;i < (int)sizeof(rnd);++i){
+        len += snprintf(g_boundary + len,sizeof(g_boundary) - len,"%02x",rnd[i]);
+    }
+    snprintf(g_byteranges_type,sizeof(g_byteranges_type),"multipart/byteranges; boundary=%s",g_boundary);
+}
+
+const char* byteranges_boundary(){
+    return g_boundary;
+}
+
+const char* byteranges_type(){
+    return g_byteranges_type;
+}
+
+time_t parse_http_date(const char* text){
+    struct tm tm;
+    memset(&tm,0,sizeof(tm));
+    const char* end = strptime(text,"%a, %d %b %Y %H:%M:%S GMT",&tm);
+    if(!end || *end != '\0'){
+        return -1;
+    }
+    return timegm(&tm);
+}
+
+const char* status_line(int status,int* len){
+    int i = find_status(status);
+    if(i < 0){
+        return NULL;
+    }
+    *len = g_rendered[i].line_len;
+    return g_rendered[i].line;
+}
+
+const char* error_tail(int status,bool linger,bool head,int* len){
+    int i = find_status(status);
+    if(i < 0 || !g_status[i].form){
+        return NULL;
+    }
+    *len = head ? g_rendered[i].head_len[linger] : g_rendered[i].tail_len[linger];
+    return g_rendered[i].tail[linger];
+}
+
+static thread_local char t_date_line[DATE_LINE_LEN + 1];
+static thread_local time_t t_date_sec = -1;
+
+const char* date_line(){
+    //粗粒度时钟不进入内核，精度是一个调度tick，对秒级的Date足够
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME_COARSE,&now);
+    if(now.tv_sec != t_date_sec){
+        struct tm tm;
+        gmtime_r(&now.tv_sec,&tm);
+        strftime(t_date_line,sizeof(t_date_line),"Date: %a, %d %b %Y %H:%M:%S GMT\r\n",&tm);
+        t_date_sec = now.tv_sec;
+    }
+    return t_date_line;
+}
+
+//同一个线程连续请求同一批文件时，修改时间往往相同，只缓存最近一次的结果
+static thread_local char t_http_date[HTTP_DATE_LEN + 1];
+static thread_local time_t t_http_date_sec = -1;
+
+int format_http_date(char* buf,time_t t){
+    if(t != t_http_date_sec){
+        struct tm tm;
+        gmtime_r(&t,&tm);
+        strftime(t_http_date,sizeof(t_http_date),"%a, %d %b %Y %H:%M:%S GMT",&tm);
+        t_http_date_sec = t;
+    }
+    memcpy(buf,t_http_date,HTTP_DATE_LEN);
+    return HTTP_DATE_LEN;
+}
+
+//两位两位地转换，查表代替一半的除法
+static const char g_digits[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+int format_decimal(char* buf,unsigned long value){
+    char tmp[20];
+    char* p = tmp + sizeof(tmp);
+    while(value >= 100){
+        unsigned idx = (value % 100) * 2;
+        value /= 100;
+        *--p = g_digits[idx + 1];
+        *--p = g_digits[idx];
+    }
+    if(value >= 10){
+        unsigned idx = value * 2;
+        *--p = g_digits[idx + 1];
+        *--p = g_digits[idx];
+    }
+    else{
+        *--p = '0' + value;
+    }
+    int len = tmp + sizeof(tmp) - p;
+    memcpy(buf,p,len);
+    return len;
+}
+
+int format_hex(char* buf,unsigned long value){
+    static const char hex[] = "0123456789abcdef";
+    char tmp[16];
+    char* p = tmp + sizeof(tmp);
+    do{
+        *--p = hex[value & 15];
+        value >>= 4;
+    }while(value);
+    int len = tmp + sizeof(tmp) - p;
+    memcpy(buf,p,len);
+    return len;
+}
+
+struct mime_info{
+    const char* ext;
+    const char* type;
+    bool compressible;
+};
+//常见的静态资源类型，文本类的压缩率一般在3到5倍
+static const mime_info g_mime[] = {
+    {"html","text/html",true},
+    {"htm","text/html",true},
+    {"css","text/css",true},
+    {"js","application/javascript",true},
+    {"mjs","application/javascript",true},
+    {"json","application/json",true},
+    {"map","application/json",true},
+    {"txt","text/plain",true},
+    {"csv","text/csv",true},
+    {"xml","application/xml",true},
+    {"svg","image/svg+xml",true},
+    {"wasm","application/wasm",true},
+    {"ico","image/x-icon",true},
+    {"png","image/png",false},
+    {"jpg","image/jpeg",false},
+    {"jpeg","image/jpeg",false},
+    {"gif","image/gif",false},
+    {"webp","image/webp",false},
+    {"avif","image/avif",false},
+    {"mp4","video/mp4",false},
+    {"webm","video/webm",false},
+    {"mp3","audio/mpeg",false},
+    {"ogg","audio/ogg",false},
+    {"woff","font/woff",false},
+    {"woff2","font/woff2",false},
+    {"pdf","application/pdf",false},
+    {"zip","application/zip",false},
+    {"gz","application/gzip",false},
+};
+static const int MIME_COUNT = sizeof(g_mime) / sizeof(g_mime[0]);
+
+const char* mime_type(const char* path,bool* compressible){
+    *compressible = false;
+    const char* dot = strrchr(path,'.');
+    if(!dot || strchr(dot,'/')){
+        return "application/octet-stream";
+    }
+    for(int i = 0;i < MIME_COUNT;++i){
+        if(strcasecmp(dot + 1,g_mime[i].ext) == 0){
+            *compressible = g_mime[i].compressible;
+            return g_mime[i].type;
+        }
+    }
+    return "application/octet-stream";
+}
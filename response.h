@@ -0,0 +1,50 @@
+#ifndef RESPONSE_H
+#define RESPONSE_H
+
+//HTTP响应中固定不变的部分：状态行、错误响应(从Content-Length到主体结束)在启动时生成一次，
+//处理请求时只需要memcpy，不再每次用vsnprintf格式化
+
+//"Date: Sun, 06 Nov 1994 08:49:37 GMT\r\n"的长度，IMF-fixdate是定长的
+#define DATE_LINE_LEN 37
+//IMF-fixdate本身("Sun, 06 Nov 1994 08:49:37 GMT")的长度
+#define HTTP_DATE_LEN 29
+
+#include<time.h>
+
+//生成所有状态行和错误响应，程序启动时调用一次
+void response_init();
+
+//状态行"HTTP/1.1 404 Not Found\r\n"，len返回长度；不认识的状态码返回NULL
+const char* status_line(int status,int* len);
+
+//错误响应状态行之后的部分："Content-Length: ...\r\nConnection: ...\r\n\r\n<主体>"，
+//linger决定Connection是keep-alive还是close；head为true时(HEAD请求)只到空行为止，不含主体
+//没有预先生成的状态码返回NULL
+const char* error_tail(int status,bool linger,bool head,int* len);
+
+//当前时间的"Date: ...\r\n"，长度为DATE_LINE_LEN
+//每个线程缓存一份，秒数变了才重新格式化，所以一秒最多格式化一次，不需要加锁
+const char* date_line();
+
+//多个范围的Range响应：multipart/byteranges的分隔串，以及带分隔串的Content-Type
+const char* byteranges_boundary();
+const char* byteranges_type();
+
+//把t格式化成IMF-fixdate写到buf(至少HTTP_DATE_LEN字节)，返回HTTP_DATE_LEN，不写'\0'
+//Last-Modified用，每个线程缓存最近一次的结果
+int format_http_date(char* buf,time_t t);
+
+//解析IMF-fixdate格式的HTTP日期("Sun, 06 Nov 1994 08:49:37 GMT")，格式不对返回-1
+time_t parse_http_date(const char* text);
+
+//按文件扩展名(不区分大小写)得到Content-Type；compressible返回该类型是否值得gzip压缩
+//图片、音视频、字体、压缩包等已经压缩过的类型不压缩；不认识的扩展名返回application/octet-stream，不压缩
+const char* mime_type(const char* path,bool* compressible);
+
+//把非负整数写成十进制到buf(至少20字节)，返回写入的字节数，不写'\0'
+int format_decimal(char* buf,unsigned long value);
+
+//写成小写十六进制到buf(至少16字节)，返回写入的字节数，不写'\0'
+int format_hex(char* buf,unsigned long value);
+
+#endif
@@ -0,0 +1,129 @@
+#ifndef RINGQUEUE_H
+#define RINGQUEUE_H
+
+//有界多生产者多消费者无锁环形队列(Dmitry Vyukov的bounded MPMC queue)
+//每个槽位带一个序号seq，生产者/消费者用CAS抢占入队/出队位置，再通过槽位序号交接数据，整个过程不加锁也不分配内存
+#include<atomic>
+#include<cstddef>
+#include<cstdint>
+#include<exception>
+
+#define CACHE_LINE_SIZE 64
+
+template<typename T>
+class ringqueue{
+public:
+    //容量向上取整为2的幂，这样取槽位下标只需要按位与
+    explicit ringqueue(size_t capacity);
+    ~ringqueue();
+    //队列满返回false
+    bool push(const T& value);
+    //队列空返回false
+    bool pop(T& value);
+    //当前元素个数的近似值，只用于统计
+    size_t size() const;
+    size_t capacity() const {return m_mask + 1;}
+
+private:
+    ringqueue(const ringqueue&);
+    ringqueue& operator=(const ringqueue&);
+
+    struct cell{
+        std::atomic<size_t> seq;  //槽位序号：等于pos表示可写入，等于pos+1表示可读出
+        T data;
+    };
+
+private:
+    //入队位置和出队位置分别由生产者和消费者频繁修改，各占一个缓存行，避免伪共享
+    alignas(CACHE_LINE_SIZE) cell* m_buffer;
+    size_t m_mask;
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> m_enqueue_pos;
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> m_dequeue_pos;
+};
+
+template<typename T>
+ringqueue<T>::ringqueue(size_t capacity):
+    m_buffer(NULL),m_mask(0),m_enqueue_pos(0),m_dequeue_pos(0)
+{
+    if(capacity < 2){
+        capacity = 2;
+    }
+    size_t size = 1;
+    while(size < capacity){
+        size <<= 1;
+    }
+    m_buffer = new cell[size];
+    m_mask = size - 1;
+    for(size_t i = 0;i < size;++i){
+        m_buffer[i].seq.store(i,std::memory_order_relaxed);
+    }
+}
+
+template<typename T>
+ringqueue<T>::~ringqueue(){
+    delete [] m_buffer;
+}
+
+template<typename T>
+bool ringqueue<T>::push(const T& value){
+    cell* c;
+    size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+    while(true){
+        c = &m_buffer[pos & m_mask];
+        size_t seq = c -> seq.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if(diff == 0){
+            //槽位空闲，抢占这个入队位置
+            if(m_enqueue_pos.compare_exchange_weak(pos,pos + 1,std::memory_order_relaxed)){
+                break;
+            }
+        }
+        else if(diff < 0){
+            //槽位还没被消费者取走，队列满
+            return false;
+        }
+        else{
+            //被其他生产者抢先了，重新读入队位置
+            pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+    c -> data = value;
+    c -> seq.store(pos + 1,std::memory_order_release);
+    return true;
+}
+
+template<typename T>
+bool ringqueue<T>::pop(T& value){
+    cell* c;
+    size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+    while(true){
+        c = &m_buffer[pos & m_mask];
+        size_t seq = c -> seq.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if(diff == 0){
+            if(m_dequeue_pos.compare_exchange_weak(pos,pos + 1,std::memory_order_relaxed)){
+                break;
+            }
+        }
+        else if(diff < 0){
+            //槽位还没有被写入，队列空
+            return false;
+        }
+        else{
+            pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        }
+    }
+    value = c -> data;
+    //槽位交还给下一轮的生产者
+    c -> seq.store(pos + m_mask + 1,std::memory_order_release);
+    return true;
+}
+
+template<typename T>
+size_t ringqueue<T>::size() const{
+    size_t enq = m_enqueue_pos.load(std::memory_order_relaxed);
+    size_t deq = m_dequeue_pos.load(std::memory_order_relaxed);
+    return enq > deq ? enq - deq : 0;
+}
+
+#endif
@@ -0,0 +1,193 @@
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<stdarg.h>
+#include"router.h"
+
+route_reply::route_reply(char* buf,size_t cap):
+    status(200),content_type("text/plain"),m_data(buf),m_len(0),m_cap(cap),m_heap(NULL)
+{
+}
+
+route_reply::~route_reply(){
+    free(m_heap);
+}
+
+//写缓冲区放不下：换成malloc申请的缓冲区，把已经写的内容拷过去，之后按两倍增长
+bool route_reply::grow(size_t need){
+    size_t cap = m_cap * 2;
+    if(cap < need){
+        cap = need;
+    }
+    if(cap < 1024){
+        cap = 1024;
+    }
+    char* heap = (char*)realloc(m_heap,cap);
+    if(!heap){
+        return false;
+    }
+    if(!m_heap && m_len){
+        memcpy(heap,m_data,m_len);
+    }
+    m_heap = m_data = heap;
+    m_cap = cap;
+    return true;
+}
+
+bool route_reply::append(const char* data,size_t len){
+    if(m_len + len > m_cap && !grow(m_len + len)){
+        return false;
+    }
+    memcpy(m_data + m_len,data,len);
+    m_len += len;
+    return true;
+}
+
+bool route_reply::appendf(const char* format,...){
+    while(true){
+        size_t room = m_cap - m_len;
+        va_list arg_list;
+        va_start(arg_list,format);
+        int len = vsnprintf(m_data + m_len,room,format,arg_list);
+        va_end(arg_list);
+        if(len < 0){
+            return false;
+        }
+        //vsnprintf要多写一个'\0'，恰好写满时也要增长
+        if((size_t)len < room){
+            m_len += len;
+            return true;
+        }
+        if(!grow(m_len + len + 1)){
+            return false;
+        }
+    }
+}
+
+void route_reply::adopt(char* body,size_t len){
+    free(m_heap);
+    m_heap = m_data = body;
+    m_len = m_cap = len;
+}
+
+char* route_reply::release(){
+    char* heap = m_heap;
+    m_heap = NULL;
+    m_len = m_cap = 0;
+    return heap;
+}
+
+router::router():
+    m_count(0)
+{
+    for(int i = 0;i < METHOD_NUM;++i){
+        m_roots[i] = new node;
+    }
+}
+
+router::~router(){
+    for(int i = 0;i < METHOD_NUM;++i){
+        destroy(m_roots[i]);
+    }
+}
+
+void router::destroy(node* n){
+    for(size_t i = 0;i < n -> children.size();++i){
+        destroy(n -> children[i]);
+    }
+    delete n -> exact;
+    delete n -> prefix;
+    delete n;
+}
+
+router* router::instance(){
+    static router r;
+    return &r;
+}
+
+bool router::add(int method,const char* path,route_handler handler,void* arg){
+    if(method < 0 || method >= METHOD_NUM || !path || path[0] != '/' || strchr(path,'?') || !handler){
+        return false;
+    }
+    size_t rest = strlen(path);
+    bool is_prefix = path[rest - 1] == '*';
+    if(is_prefix){
+        --rest;
+    }
+    //沿着树往下走，和已有的边有公共前缀但不完全相同时，把那条边从公共前缀处分成两段
+    node* n = m_roots[method];
+    const char* p = path;
+    while(rest > 0){
+        size_t i = n -> first.find(*p);
+        if(i == std::string::npos){
+            node* leaf = new node;
+            leaf -> label.assign(p,rest);
+            n -> first.push_back(*p);
+            n -> children.push_back(leaf);
+            n = leaf;
+            break;
+        }
+        node* child = n -> children[i];
+        size_t common = 0;
+        while(common < rest && common < child -> label.size() && child -> label[common] == p[common]){
+            ++common;
+        }
+        if(common < child -> label.size()){
+            node* mid = new node;
+            mid -> label = child -> label.substr(0,common);
+            child -> label.erase(0,common);
+            mid -> first.push_back(child -> label[0]);
+            mid -> children.push_back(child);
+            n -> children[i] = mid;
+            child = mid;
+        }
+        n = child;
+        p += common;
+        rest -= common;
+    }
+    route*& slot = is_prefix ? n -> prefix : n -> exact;
+    if(slot){
+        return false;
+    }
+    slot = new route;
+    slot -> handler = handler;
+    slot -> arg = arg;
+    ++m_count;
+    return true;
+}
+
+const router::route* router::find(int method,const char* url) const{
+    if(method < 0 || method >= METHOD_NUM){
+        return NULL;
+    }
+    const node* n = m_roots[method];
+    //没有注册任何路由时只看一眼根节点，文件请求几乎没有额外开销
+    if(n -> children.empty() && !n -> prefix){
+        return NULL;
+    }
+    //边上的路径不含'?'和'\0'，逐字节比较时碰到URL的结尾或查询串自然就不相等，不需要先求长度
+    const char* p = url;
+    const route* best = NULL;
+    while(true){
+        if(n -> prefix){
+            best = n -> prefix;
+        }
+        if(*p == '\0' || *p == '?'){
+            return n -> exact ? n -> exact : best;
+        }
+        const char* hit = (const char*)memchr(n -> first.data(),*p,n -> first.size());
+        if(!hit){
+            return best;
+        }
+        const node* child = n -> children[hit - n -> first.data()];
+        const char* label = child -> label.data();
+        size_t len = child -> label.size();
+        for(size_t i = 1;i < len;++i){
+            if(label[i] != p[i]){
+                return best;
+            }
+        }
+        n = child;
+        p += len;
+    }
+}
@@ -0,0 +1,95 @@
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include<stddef.h>
+#include<string>
+#include<vector>
+
+//程序内的动态URL(健康检查、统计、小的JSON接口)：按方法+路径注册处理函数，do_request先查路由表，
+//没有匹配的URL才映射到doc_root下的文件，不需要在前面再放一个进程
+
+//交给处理函数的请求信息，指向连接的读缓冲区，只在处理函数执行期间有效
+struct route_request{
+    int method;           //http_conn::METHOD
+    const char* path;     //URL中'?'之前的部分，不以'\0'结尾
+    int path_len;
+    const char* query;    //'?'之后的部分，没有查询串时为NULL
+};
+
+//处理函数的输出：主体直接写在连接的写缓冲区中(首部之后由process_write接在主体后面，分两段writev)，
+//写缓冲区放不下时才转到malloc申请的缓冲区；也可以用adopt接管一块已经生成好的主体
+class route_reply{
+public:
+    route_reply(char* buf,size_t cap);
+    ~route_reply();
+    //追加主体，内存不足返回false
+    bool append(const char* data,size_t len);
+    bool appendf(const char* format,...);
+    //接管malloc申请的主体(例如stats_render的结果)，之前写的内容被丢弃
+    void adopt(char* body,size_t len);
+
+    const char* data() const{return m_data;}
+    size_t size() const{return m_len;}
+    //主体是否还在写缓冲区中
+    bool in_place() const{return m_heap == NULL;}
+    //取走malloc申请的主体，调用者free
+    char* release();
+
+public:
+    int status;                 //状态码，默认200，必须是response.cpp中有状态行的
+    const char* content_type;   //默认text/plain，必须是静态字符串
+
+private:
+    bool grow(size_t need);
+
+private:
+    char* m_data;
+    size_t m_len;
+    size_t m_cap;
+    char* m_heap;     //不为NULL时m_data指向它
+};
+
+//返回false表示处理出错，回答500
+typedef bool (*route_handler)(const route_request& req,route_reply& reply,void* arg);
+
+//路由表：每种方法一棵基数树(压缩前缀树)，边上是路径的一段，查找时逐段比较，不分配内存也不加锁
+//启动时在工作线程运行之前注册完，之后只读
+//路径以'*'结尾表示前缀路由，匹配以'*'之前的部分开头的所有路径；精确路由优先，其次是最长的前缀路由
+class router{
+public:
+    struct route{
+        route_handler handler;
+        void* arg;
+    };
+
+public:
+    static router* instance();
+    //注册路由，method是http_conn::METHOD，path以'/'开头，不含'?'；同一方法同一路径重复注册时返回false
+    bool add(int method,const char* path,route_handler handler,void* arg);
+    //按方法和URL(可以带查询串)查找，没有匹配返回NULL
+    const route* find(int method,const char* url) const;
+    //注册的路由数
+    int size() const{return m_count;}
+
+private:
+    struct node{
+        std::string label;            //从父节点到这里的一段路径
+        std::string first;            //各子节点label的首字符，和children一一对应
+        std::vector<node*> children;
+        route* exact;                 //路径正好到这里结束的路由
+        route* prefix;                //以这里为前缀的路由
+        node():exact(NULL),prefix(NULL){}
+    };
+    static const int METHOD_NUM = 9;
+
+private:
+    router();
+    ~router();
+    static void destroy(node* n);
+
+private:
+    node* m_roots[METHOD_NUM];
+    int m_count;
+};
+
+#endif
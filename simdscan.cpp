@@ -0,0 +1,96 @@
+#include<string.h>
+#include"simdscan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include<immintrin.h>
+#define SIMDSCAN_X86 1
+#endif
+
+//标量实现，也是向量实现处理尾部不足一个向量的字节时使用的实现
+static const char* scan_any2_scalar(const char* p,const char* end,char a,char b){
+    for(;p < end;++p){
+        if(*p == a || *p == b){
+            return p;
+        }
+    }
+    return end;
+}
+
+#ifdef SIMDSCAN_X86
+//SSE4.2：pcmpestri一条指令在16个字节中查找字符集合{a,b}中任意一个字符第一次出现的位置
+__attribute__((target("sse4.2")))
+static const char* scan_any2_sse42(const char* p,const char* end,char a,char b){
+    const char set_bytes[16] = {a,b};
+    const __m128i set = _mm_loadu_si128((const __m128i*)set_bytes);
+    while(end - p >= 16){
+        __m128i chunk = _mm_loadu_si128((const __m128i*)p);
+        int idx = _mm_cmpestri(set,2,chunk,16,_SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_LEAST_SIGNIFICANT);
+        if(idx < 16){
+            return p + idx;
+        }
+        p += 16;
+    }
+    return scan_any2_scalar(p,end,a,b);
+}
+
+//AVX2：一次比较32个字节，两个比较结果按位或之后取掩码，最低的置位就是第一次出现的位置
+__attribute__((target("avx2")))
+static const char* scan_any2_avx2(const char* p,const char* end,char a,char b){
+    const __m256i va = _mm256_set1_epi8(a);
+    const __m256i vb = _mm256_set1_epi8(b);
+    while(end - p >= 32){
+        __m256i chunk = _mm256_loadu_si256((const __m256i*)p);
+        __m256i hit = _mm256_or_si256(_mm256_cmpeq_epi8(chunk,va),_mm256_cmpeq_epi8(chunk,vb));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(hit);
+        if(mask){
+            return p + __builtin_ctz(mask);
+        }
+        p += 32;
+    }
+    //剩余不足32字节的部分用一次16字节的SSE比较
+    if(end - p >= 16){
+        __m128i chunk = _mm_loadu_si128((const __m128i*)p);
+        __m128i hit = _mm_or_si128(_mm_cmpeq_epi8(chunk,_mm_set1_epi8(a)),_mm_cmpeq_epi8(chunk,_mm_set1_epi8(b)));
+        unsigned mask = (unsigned)_mm_movemask_epi8(hit);
+        if(mask){
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+    return scan_any2_scalar(p,end,a,b);
+}
+#endif
+
+typedef const char* (*scan_any2_func)(const char*,const char*,char,char);
+
+static scan_any2_func g_scan_any2 = scan_any2_scalar;
+static const char* g_scan_name = "scalar";
+
+const char* scan_any2(const char* p,const char* end,char a,char b){
+    return g_scan_any2(p,end,a,b);
+}
+
+void scan_init(const char* force){
+    g_scan_any2 = scan_any2_scalar;
+    g_scan_name = "scalar";
+    if(force && strcmp(force,"scalar") == 0){
+        return;
+    }
+#ifdef SIMDSCAN_X86
+    __builtin_cpu_init();
+    bool avx2 = __builtin_cpu_supports("avx2");
+    bool sse42 = __builtin_cpu_supports("sse4.2");
+    if(avx2 && !(force && strcmp(force,"sse4.2") == 0)){
+        g_scan_any2 = scan_any2_avx2;
+        g_scan_name = "avx2";
+    }
+    else if(sse42){
+        g_scan_any2 = scan_any2_sse42;
+        g_scan_name = "sse4.2";
+    }
+#endif
+}
+
+const char* scan_impl_name(){
+    return g_scan_name;
+}
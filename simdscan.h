@@ -0,0 +1,22 @@
+#ifndef SIMDSCAN_H
+#define SIMDSCAN_H
+
+//HTTP报文扫描的向量化实现，解析请求行/首部时用它一次检查16~32个字节，而不是逐字节比较
+//运行时根据CPU选择AVX2、SSE4.2或者标量实现，三种实现的结果完全相同
+//所有函数只读取[p,end)范围内的字节，不会越界读
+
+//在[p,end)中找第一个等于a或b的字节，找不到返回end
+const char* scan_any2(const char* p,const char* end,char a,char b);
+
+//在[p,end)中找第一个'\r'或'\n'，给从状态机parse_line找行的结束位置
+inline const char* scan_crlf(const char* p,const char* end){
+    return scan_any2(p,end,'\r','\n');
+}
+
+//选择实现，程序启动时调用一次；不调用时使用标量实现
+//force为"scalar"/"sse4.2"/"avx2"时强制使用指定实现(CPU不支持则忽略)，给基准测试对比用
+void scan_init(const char* force = 0);
+//当前使用的实现的名字
+const char* scan_impl_name();
+
+#endif
@@ -0,0 +1,308 @@
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<stdarg.h>
+#include<pthread.h>
+#include<atomic>
+#include"stats.h"
+
+static const int SUB_BITS = 4;
+static const int SUB = 1 << SUB_BITS;            //每个2的幂区间的桶数
+static const int MAX_BITS = 40;                  //超过2^40纳秒(约18分钟)的都计入最后一个桶
+static const int HIST_BUCKETS = (MAX_BITS - SUB_BITS + 2) * SUB;
+static const int MAX_BLOCKS = 256;
+
+//状态码和计数下标的对应，最后一个是other
+static const int g_status_codes[] = {200,206,304,400,403,404,413,416,500,501,502,503,504};
+static const int STATUS_NUM = sizeof(g_status_codes) / sizeof(g_status_codes[0]);
+
+//每个线程一块，只有本线程写；读取线程用relaxed读，值可能稍旧但不会撕裂
+struct stats_block{
+    std::atomic<uint64_t> counters[STAT_COUNTER_NUM];
+    std::atomic<uint64_t> status[STATUS_NUM + 1];
+    struct{
+        std::atomic<uint64_t> count;
+        std::atomic<uint64_t> sum;
+        std::atomic<uint64_t> max;
+        std::atomic<uint64_t> buckets[HIST_BUCKETS];
+    } hist[STAT_HISTOGRAM_NUM];
+};
+
+static stats_block* g_blocks[MAX_BLOCKS];
+static std::atomic<int> g_block_count(0);
+static stats_block g_overflow_block;   //线程数超过MAX_BLOCKS时共用，计数可能丢失但不会出错
+static thread_local stats_block* t_block = NULL;
+
+struct gauge{
+    const char* name;
+    const char* help;
+    long (*fn)(void*);
+    void* arg;
+};
+static const int MAX_GAUGES = 16;
+static gauge g_gauges[MAX_GAUGES];
+static int g_gauge_count = 0;
+
+static stats_block* my_block(){
+    if(t_block){
+        return t_block;
+    }
+    static pthread_mutex_t reg_lock = PTHREAD_MUTEX_INITIALIZER;
+    pthread_mutex_lock(&reg_lock);
+    int idx = g_block_count.load(std::memory_order_relaxed);
+    if(idx >= MAX_BLOCKS){
+        t_block = &g_overflow_block;
+    }
+    else{
+        //new出来的atomic数组是值初始化的，全部为0
+        t_block = new stats_block();
+        g_blocks[idx] = t_block;
+        g_block_count.store(idx + 1,std::memory_order_release);
+    }
+    pthread_mutex_unlock(&reg_lock);
+    return t_block;
+}
+
+//单写者的自增：普通的load/store，编译成一条add，没有lock前缀
+static inline void bump(std::atomic<uint64_t>& v,uint64_t n){
+    v.store(v.load(std::memory_order_relaxed) + n,std::memory_order_relaxed);
+}
+
+void stats_add(int counter,uint64_t n){
+    bump(my_block() -> counters[counter],n);
+}
+
+void stats_status(int status){
+    int i = 0;
+    while(i < STATUS_NUM && g_status_codes[i] != status){
+        ++i;
+    }
+    bump(my_block() -> status[i],1);
+}
+
+static inline int bucket_index(uint64_t v){
+    if(v < (uint64_t)SUB){
+        return v;
+    }
+    int msb = 63 - __builtin_clzll(v);
+    if(msb > MAX_BITS){
+        return HIST_BUCKETS - 1;
+    }
+    int shift = msb - SUB_BITS;
+    return (shift + 1) * SUB + ((v >> shift) & (SUB - 1));
+}
+
+//桶的上界，作为分位数的估计值
+static uint64_t bucket_upper(int idx){
+    if(idx < SUB){
+        return idx;
+    }
+    int shift = idx / SUB - 1;
+    uint64_t sub = idx % SUB;
+    return ((SUB + sub + 1) << shift) - 1;
+}
+
+void stats_record(int histogram,uint64_t ns){
+    stats_block* b = my_block();
+    bump(b -> hist[histogram].count,1);
+    bump(b -> hist[histogram].sum,ns);
+    if(ns > b -> hist[histogram].max.load(std::memory_order_relaxed)){
+        b -> hist[histogram].max.store(ns,std::memory_order_relaxed);
+    }
+    bump(b -> hist[histogram].buckets[bucket_index(ns)],1);
+}
+
+void stats_add_gauge(const char* name,const char* help,long (*fn)(void*),void* arg){
+    if(g_gauge_count < MAX_GAUGES){
+        g_gauges[g_gauge_count].name = name;
+        g_gauges[g_gauge_count].help = help;
+        g_gauges[g_gauge_count].fn = fn;
+        g_gauges[g_gauge_count].arg = arg;
+        ++g_gauge_count;
+    }
+}
+
+//合并后的一个直方图
+struct merged_hist{
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[HIST_BUCKETS];
+};
+
+struct merged{
+    uint64_t counters[STAT_COUNTER_NUM];
+    uint64_t status[STATUS_NUM + 1];
+    merged_hist hist[STAT_HISTOGRAM_NUM];
+};
+
+static void merge_block(merged* m,stats_block* b){
+    for(int i = 0;i < STAT_COUNTER_NUM;++i){
+        m -> counters[i] += b -> counters[i].load(std::memory_order_relaxed);
+    }
+    for(int i = 0;i <= STATUS_NUM;++i){
+        m -> status[i] += b -> status[i].load(std::memory_order_relaxed);
+    }
+    for(int h = 0;h < STAT_HISTOGRAM_NUM;++h){
+        m -> hist[h].count += b -> hist[h].count.load(std::memory_order_relaxed);
+        m -> hist[h].sum += b -> hist[h].sum.load(std::memory_order_relaxed);
+        uint64_t mx = b -> hist[h].max.load(std::memory_order_relaxed);
+        if(mx > m -> hist[h].max){
+            m -> hist[h].max = mx;
+        }
+        for(int i = 0;i < HIST_BUCKETS;++i){
+            m -> hist[h].buckets[i] += b -> hist[h].buckets[i].load(std::memory_order_relaxed);
+        }
+    }
+}
+
+//分位数：从小到大累加桶计数，到达q*count的桶的上界(不超过最大值)
+static uint64_t quantile(const merged_hist& h,double q){
+    if(h.count == 0){
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(q * h.count);
+    if(rank >= h.count){
+        rank = h.count - 1;
+    }
+    uint64_t seen = 0;
+    for(int i = 0;i < HIST_BUCKETS;++i){
+        seen += h.buckets[i];
+        if(seen > rank){
+            uint64_t v = bucket_upper(i);
+            return v < h.max ? v : h.max;
+        }
+    }
+    return h.max;
+}
+
+//输出缓冲区，空间不够时倍增
+struct out_buf{
+    char* data;
+    size_t len;
+    size_t cap;
+};
+
+static void append(out_buf* o,const char* format,...) __attribute__((format(printf,2,3)));
+static void append(out_buf* o,const char* format,...){
+    while(true){
+        va_list arg_list;
+        va_start(arg_list,format);
+        int n = vsnprintf(o -> data + o -> len,o -> cap - o -> len,format,arg_list);
+        va_end(arg_list);
+        if(n < 0){
+            return;
+        }
+        if((size_t)n < o -> cap - o -> len){
+            o -> len += n;
+            return;
+        }
+        char* bigger = (char*)realloc(o -> data,o -> cap * 2);
+        if(!bigger){
+            return;
+        }
+        o -> data = bigger;
+        o -> cap *= 2;
+    }
+}
+
+static const char* g_counter_names[STAT_COUNTER_NUM] = {"accepts","bytes_in","bytes_out","requests","upstream_connects","upstream_reuses","respcache_hits","respcache_misses","pool_grows","pool_shrinks"};
+static const char* g_counter_help[STAT_COUNTER_NUM] = {
+    "Accepted connections","Bytes read from client sockets","Bytes written to client sockets","Requests handled",
+    "Upstream connections opened","Proxied requests sent on a pooled upstream connection",
+    "Responses sent from the small-file response arena","Small-file responses built because the response arena had no entry",
+    "Worker threads added by the adaptive threadpool","Worker threads retired by the adaptive threadpool"};
+static const char* g_hist_names[STAT_HISTOGRAM_NUM] = {"queue_wait","parse","last_byte"};
+static const char* g_hist_help[STAT_HISTOGRAM_NUM] = {
+    "Time from threadpool append to process start","Request line and header parse time",
+    "Time from first request byte read to last response byte written"};
+static const double g_quantiles[] = {0.5,0.9,0.99,0.999};
+static const int QUANTILE_NUM = sizeof(g_quantiles) / sizeof(g_quantiles[0]);
+
+static void render_prometheus(out_buf* o,const merged* m){
+    for(int i = 0;i < STAT_COUNTER_NUM;++i){
+        append(o,"# HELP tinyweb_%s_total %s\n# TYPE tinyweb_%s_total counter\ntinyweb_%s_total %lu\n",
+               g_counter_names[i],g_counter_help[i],g_counter_names[i],g_counter_names[i],(unsigned long)m -> counters[i]);
+    }
+    append(o,"# HELP tinyweb_responses_total Responses by status code\n# TYPE tinyweb_responses_total counter\n");
+    for(int i = 0;i <= STATUS_NUM;++i){
+        if(i < STATUS_NUM){
+            append(o,"tinyweb_responses_total{code=\"%d\"} %lu\n",g_status_codes[i],(unsigned long)m -> status[i]);
+        }
+        else{
+            append(o,"tinyweb_responses_total{code=\"other\"} %lu\n",(unsigned long)m -> status[i]);
+        }
+    }
+    for(int i = 0;i < g_gauge_count;++i){
+        append(o,"# HELP tinyweb_%s %s\n# TYPE tinyweb_%s gauge\ntinyweb_%s %ld\n",
+               g_gauges[i].name,g_gauges[i].help,g_gauges[i].name,g_gauges[i].name,g_gauges[i].fn(g_gauges[i].arg));
+    }
+    for(int h = 0;h < STAT_HISTOGRAM_NUM;++h){
+        const char* name = g_hist_names[h];
+        append(o,"# HELP tinyweb_%s_seconds %s\n# TYPE tinyweb_%s_seconds summary\n",name,g_hist_help[h],name);
+        for(int q = 0;q < QUANTILE_NUM;++q){
+            append(o,"tinyweb_%s_seconds{quantile=\"%g\"} %.9f\n",name,g_quantiles[q],quantile(m -> hist[h],g_quantiles[q]) / 1e9);
+        }
+        append(o,"tinyweb_%s_seconds_sum %.9f\ntinyweb_%s_seconds_count %lu\n",
+               name,m -> hist[h].sum / 1e9,name,(unsigned long)m -> hist[h].count);
+    }
+}
+
+static void render_json(out_buf* o,const merged* m){
+    append(o,"{\"counters\":{");
+    for(int i = 0;i < STAT_COUNTER_NUM;++i){
+        append(o,"%s\"%s\":%lu",i ? "," : "",g_counter_names[i],(unsigned long)m -> counters[i]);
+    }
+    append(o,"},\"responses\":{");
+    for(int i = 0;i <= STATUS_NUM;++i){
+        if(i < STATUS_NUM){
+            append(o,"%s\"%d\":%lu",i ? "," : "",g_status_codes[i],(unsigned long)m -> status[i]);
+        }
+        else{
+            append(o,",\"other\":%lu",(unsigned long)m -> status[i]);
+        }
+    }
+    append(o,"},\"gauges\":{");
+    for(int i = 0;i < g_gauge_count;++i){
+        append(o,"%s\"%s\":%ld",i ? "," : "",g_gauges[i].name,g_gauges[i].fn(g_gauges[i].arg));
+    }
+    append(o,"},\"latency_ns\":{");
+    for(int h = 0;h < STAT_HISTOGRAM_NUM;++h){
+        const merged_hist& mh = m -> hist[h];
+        append(o,"%s\"%s\":{\"count\":%lu,\"sum\":%lu,\"max\":%lu",h ? "," : "",g_hist_names[h],
+               (unsigned long)mh.count,(unsigned long)mh.sum,(unsigned long)mh.max);
+        append(o,",\"p50\":%lu,\"p90\":%lu,\"p99\":%lu,\"p999\":%lu}",(unsigned long)quantile(mh,0.5),
+               (unsigned long)quantile(mh,0.9),(unsigned long)quantile(mh,0.99),(unsigned long)quantile(mh,0.999));
+    }
+    append(o,"}}\n");
+}
+
+char* stats_render(bool json,size_t* len){
+    merged* m = (merged*)calloc(1,sizeof(merged));
+    if(!m){
+        return NULL;
+    }
+    int n = g_block_count.load(std::memory_order_acquire);
+    for(int i = 0;i < n;++i){
+        merge_block(m,g_blocks[i]);
+    }
+    merge_block(m,&g_overflow_block);
+
+    out_buf o;
+    o.cap = 4096;
+    o.len = 0;
+    o.data = (char*)malloc(o.cap);
+    if(!o.data){
+        free(m);
+        return NULL;
+    }
+    if(json){
+        render_json(&o,m);
+    }
+    else{
+        render_prometheus(&o,m);
+    }
+    free(m);
+    *len = o.len;
+    return o.data;
+}
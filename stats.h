@@ -0,0 +1,53 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include<stdint.h>
+#include<stddef.h>
+#include<time.h>
+
+//运行统计：每个线程一块计数器和延迟直方图，只由本线程写(普通的读-加-写，不用原子指令，不加锁)，
+//读取时把所有线程的数据加起来；合并后的结果由保留的URL以Prometheus文本或者JSON格式输出
+
+//计数器
+enum STATS_COUNTER{
+    STAT_ACCEPTS = 0,   //accept的连接数
+    STAT_BYTES_IN,      //从socket读入的字节数
+    STAT_BYTES_OUT,     //写到socket的字节数
+    STAT_REQUESTS,      //处理的请求数
+    STAT_UPSTREAM_CONNECTS,   //新建的后端连接数
+    STAT_UPSTREAM_REUSES,     //复用空闲后端连接的转发数
+    STAT_RESPCACHE_HITS,      //从小文件响应缓存发送的响应数
+    STAT_RESPCACHE_MISSES,    //小文件响应缓存中没有、生成后放进去的响应数
+    STAT_POOL_GROWS,          //线程池自适应增加线程的次数
+    STAT_POOL_SHRINKS,        //线程池自适应退休线程的次数
+    STAT_COUNTER_NUM
+};
+
+//延迟直方图，单位纳秒
+enum STATS_HISTOGRAM{
+    STAT_QUEUE_WAIT = 0,   //反应堆append到线程池，到工作线程开始process
+    STAT_PARSE,            //解析一个请求(请求行和首部，不含查找文件)
+    STAT_LAST_BYTE,        //请求的第一个字节读入，到响应的最后一个字节写出
+    STAT_HISTOGRAM_NUM
+};
+
+//记录响应的状态码，表中没有的状态码计入"other"
+void stats_status(int status);
+void stats_add(int counter,uint64_t n);
+//记录一个延迟，HDR风格的对数-线性分桶(每个2的幂区间分16个桶，相对误差不超过1/16)
+void stats_record(int histogram,uint64_t ns);
+
+//读取时调用的仪表(当前连接数、线程池队列长度等)，在启动时登记
+void stats_add_gauge(const char* name,const char* help,long (*fn)(void*),void* arg);
+
+//把合并后的统计输出到malloc申请的缓冲区，len返回长度，调用者free
+char* stats_render(bool json,size_t* len);
+
+//单调时钟的纳秒数，给各个阶段打时间戳
+inline uint64_t stats_now_ns(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+#endif
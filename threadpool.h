@@ -2,129 +2,481 @@
 #define THREADPOOL_H
 
 //生产者消费者模式实现线程池
-#include<list>
 #include<cstdio>
 #include<exception>
+#include<atomic>
+#include<time.h>
 #include<pthread.h>
-#include"locker.h" 
+#include"locker.h"
+#include"ringqueue.h"
+#include"wsdeque.h"
+#include"stats.h"
+#include"log.h"
+#include"bufpool.h"
 
-//线程池类，把它定义为模板类是为了代码复用，模板参数T是任务类　
-//Ｔ表示的是任务，也就是http_conn对象
+//线程池类，把它定义为模板类是为了代码复用，模板参数T是任务类
+//Ｔ表示的是任务，也就是http_conn对象；T要提供process()和enqueue_ns()(交给线程池时的stats_now_ns()，调整线程数时计算排队时间)
+//工作线程数在[min_threads,max_threads]之间自适应：管理线程每100ms采样一次排队的任务数和排队时间，
+//持续拥塞时增加一个线程，持续空闲时退休一个线程；增加快、退休慢，两个方向的条件之间留有余量，避免来回抖动
+//退休的线程不退出，在自己的槽位上停放，再增加线程时优先唤醒停放的线程，只有没用过的槽位才创建新线程：
+//日志的环形队列、统计计数块是按线程注册、不回收的，线程总数因此不超过max_threads，反复伸缩也不会用完
+//所有线程都是可结合的，析构时唤醒并回收全部线程
 template<typename T>
 class threadpool{
 public:
-  /*参数thread_number是线程池中线程的数量，max_requests是请求队列中最多允许的，等待处理的请求的数量*/
-    threadpool(int thread_number = 8,int max_requests = 1000);
+    //调度方式：
+    //FIFO--所有工作线程从同一个请求队列中取任务
+    //WORK_STEALING--每个工作线程有自己的收件箱和Chase-Lev双端队列，任务按key(fd)哈希投递给固定的线程，
+    //              长连接的请求总是落在同一个线程上；空闲的线程从其他线程的队列顶部偷任务
+    enum SCHED_MODE{FIFO = 0,WORK_STEALING};
+
+public:
+  /*参数thread_number是线程池中线程的数量(自适应时是最少的线程数)，max_requests是请求队列中最多允许的，等待处理的请求的数量，
+    max_threads是最多的线程数，不大于thread_number时线程数固定，不创建管理线程*/
+    threadpool(int thread_number = 8,int max_requests = 1000,SCHED_MODE mode = FIFO,int max_threads = 0);
     ~threadpool();
-    //往请求队列中添加任务
-    bool append(T* request);
+    //往请求队列中添加任务，key用来在WORK_STEALING模式下选择工作线程(同一个key总是投递给同一个线程)，小于0则轮流投递
+    bool append(T* request,int key = -1);
+    //排队等待处理的任务数(近似值)，给统计用
+    size_t pending() const;
+    //当前的工作线程数，给统计用
+    int threads() const{return m_active.load(std::memory_order_relaxed);}
 
 private:
-    //工作线程运行的函数，它不断从工作队列中取出任务并执行之
+    //每个工作线程的私有数据，WORK_STEALING模式下才有收件箱和双端队列
+    //按最多的线程数分配，退休的线程停放在自己的槽位上，增加线程时重新使用；每个槽位占独立的缓存行
+    struct alignas(CACHE_LINE_SIZE) worker_slot{
+        threadpool* pool;
+        int index;
+        bool started;           //槽位上已经有线程(运行中或者停放)，只由管理线程和构造/析构函数访问
+        ringqueue<T*>* inbox;   //其他线程(反应堆)投递进来的任务，多生产者
+        wsdeque<T*>* deque;     //属主从底部取，其他工作线程从顶部偷
+        eventcount stat;        //该线程在这上面休眠
+        eventcount park;        //退休后在这上面停放
+        std::atomic<uint64_t> wait_ns;   //累计的排队时间和任务数，只由该线程写，管理线程读
+        std::atomic<uint64_t> done;
+    };
+
+    //工作线程运行的函数，它不断从工作队列中取出任务并执行之；退休后停放，重新启用时继续
     static void* worker(void* arg);
-    void run();
+    //停放到重新启用或者线程池结束，返回false表示线程池结束
+    bool park(worker_slot* self);
+    void run(worker_slot* self);
+    void run_stealing(worker_slot* self);
+    //找一个任务：先取自己的，再偷别人的
+    bool next_stealing(worker_slot* self,T*& request);
+    //执行任务，记录排队时间
+    void execute(worker_slot* self,T* request);
+    //下标不小于线程数的线程退休
+    bool retired(const worker_slot* self) const{return self -> index >= m_active.load(std::memory_order_seq_cst);}
+    //管理线程：定时采样，决定增加或者退休线程
+    static void* manager(void* arg);
+    void adjust();
+    bool grow();
+    void shrink();
+    //正在休眠的工作线程数
+    int sleeping();
 
 private:
-    int m_thread_number;//线程池中的线程数
+    int m_thread_number;//最少的线程数
+    int m_max_threads;  //最多的线程数，也是创建过的线程数的上限
     int m_max_requests; //请求队列中允许的最大请求数
+    SCHED_MODE m_mode;
     //线程池数组大小
-    pthread_t* m_threads;//描述线程池的数组，其大小为m_thread_number
-    //请求队列，任务队列
-    std::list<T*> m_workqueue;//请求队列
-    //互斥锁，用于保护请求队列，请求队列属于共享资源
-    locker m_queuelocker;//保护请求队列的互斥锁
-    //信号量，用于线程阻塞和唤醒，创建线程池，运行worker，阻塞，然后主线程往队列中放任务后，唤醒之
-    sem m_queuestat;//是否有任务需要处理
-    bool m_stop;//是否结束线程
+    pthread_t* m_threads;//描述线程池的数组，其大小为m_max_threads
+    worker_slot* m_slots;//每个工作线程的私有数据
+    //请求队列，任务队列：有界无锁环形队列，入队出队不加锁，也不为每个任务分配链表节点
+    //容量是m_max_requests向上取整的2的幂
+    ringqueue<T*> m_workqueue;//请求队列
+    //队列空时工作线程在futex上休眠，主线程往队列中放任务后，只有确实有线程在休眠时才唤醒之
+    eventcount m_queuestat;//是否有任务需要处理
+    std::atomic<unsigned> m_next;//key小于0时轮流投递的计数
+    std::atomic<int> m_active;//当前的线程数，下标小于它的槽位有线程在运行
+    std::atomic<bool> m_stop;//是否结束线程
+
+    //以下由管理线程使用
+    pthread_t m_manager;
+    bool m_has_manager;
+    locker m_manager_locker;
+    cond m_manager_cond;     //析构时唤醒管理线程
+    uint64_t m_last_wait_ns; //上一次采样时的累计值
+    uint64_t m_last_done;
+    int m_hot_ticks;         //连续拥塞的采样次数
+    int m_cold_ticks;        //连续空闲的采样次数
 };
+
+//采样间隔
+static const long POOL_TICK_MS = 100;
+//连续2次采样(200ms)排队的任务数超过线程数，或者平均排队时间超过1ms，增加一个线程
+static const int POOL_GROW_TICKS = 2;
+static const uint64_t POOL_GROW_WAIT_NS = 1000000;
+//连续50次采样(5s)队列为空、平均排队时间不到100us并且有线程在休眠，退休一个线程
+static const int POOL_SHRINK_TICKS = 50;
+static const uint64_t POOL_SHRINK_WAIT_NS = 100000;
+
 //线程池的构造函数，用于参数初始化等
 template<typename T>
-threadpool<T>::threadpool(int thread_number,int max_requests):
-    m_thread_number(thread_number),m_max_requests(max_requests),
-    m_stop(false),m_threads(NULL)
+threadpool<T>::threadpool(int thread_number,int max_requests,SCHED_MODE mode,int max_threads):
+    m_thread_number(thread_number),m_max_threads(max_threads > thread_number ? max_threads : thread_number),
+    m_max_requests(max_requests),m_mode(mode),
+    m_threads(NULL),m_slots(NULL),m_workqueue(mode == FIFO && max_requests > 0 ? max_requests : 1),
+    m_next(0),m_active(0),m_stop(false),m_has_manager(false),m_last_wait_ns(0),m_last_done(0),m_hot_ticks(0),m_cold_ticks(0)
 
-{    
+{
     if(thread_number <= 0 || max_requests <= 0){
         throw std::exception();
     }
     //新建线程数组，存的是线程tid，每个线程一个
-    m_threads = new pthread_t[m_thread_number];
-    if(!m_threads){
-        throw std::exception();
+    m_threads = new pthread_t[m_max_threads];
+    m_slots = new worker_slot[m_max_threads];
+    for(int i = 0;i < m_max_threads;++i){
+        m_slots[i].pool = this;
+        m_slots[i].index = i;
+        m_slots[i].started = false;
+        m_slots[i].inbox = NULL;
+        m_slots[i].deque = NULL;
+        m_slots[i].wait_ns = 0;
+        m_slots[i].done = 0;
+        if(mode == WORK_STEALING){
+            //m_max_requests平均分给最少的线程数个收件箱
+            int per_worker = max_requests / thread_number;
+            m_slots[i].inbox = new ringqueue<T*>(per_worker > 0 ? per_worker : 1);
+            m_slots[i].deque = new wsdeque<T*>(per_worker > 0 ? per_worker : 1);
+        }
     }
-    //创建thread_number个线程，并设置为分离线程
+    //创建thread_number个线程，线程是可结合的，析构时回收
     for(int i = 0;i < thread_number;++i){
         printf("create the %dth thread\n",i + 1);
-        //worker线程函数参数传递的是this，也就是当前线程池对象
-        if(pthread_create(&m_threads[i],NULL,worker,this) != 0){
-            delete [] m_threads;
+        if(!grow()){
             throw std::exception();
         }
-        //创建线程，并将每个线程均设置为分离线程，所谓分离线程就是在运行结束了系统回收资源，不用其他线程回收该线程资源
-        if(pthread_detach(m_threads[i]) != 0){
-            delete [] m_threads;
+    }
+    if(m_max_threads > m_thread_number){
+        if(pthread_create(&m_manager,NULL,manager,this) != 0){
             throw std::exception();
         }
+        m_has_manager = true;
     }
-    
 }
 
-//线程池的析构函数，避免内存泄露
+//线程池的析构函数：先停下管理线程，线程数就不再变化，再唤醒所有休眠和停放的工作线程并等它们退出
 template<typename T>
 threadpool<T> :: ~threadpool(){
+    m_manager_locker.lock();
+    m_stop = true;
+    m_manager_cond.signal();
+    m_manager_locker.unlock();
+    if(m_has_manager){
+        pthread_join(m_manager,NULL);
+    }
+    m_queuestat.notify_all();
+    for(int i = 0;i < m_max_threads;++i){
+        m_slots[i].stat.notify_all();
+        m_slots[i].park.notify_all();
+    }
+    for(int i = 0;i < m_max_threads;++i){
+        if(m_slots[i].started){
+            pthread_join(m_threads[i],NULL);
+        }
+    }
+    for(int i = 0;i < m_max_threads;++i){
+        delete m_slots[i].inbox;
+        delete m_slots[i].deque;
+    }
+    delete [] m_slots;
     delete [] m_threads;
-    m_stop=true;
 }
 
-//将任务添加到工作队列中去，操作任务队列前，无论是添加元素还是删除元素，均要先加锁－－属于共享资源
+//将任务添加到工作队列中去，无锁入队，队列满(达到m_max_requests)则返回false
 template<typename T>
-bool threadpool<T>::append(T* request){
-    /*操作工作队列前一定要加锁，因为它被所有工作队列共享*/
-    m_queuelocker.lock();
-    if(m_workqueue.size() > m_max_requests){
-        m_queuelocker.unlock();
+bool threadpool<T>::append(T* request,int key){
+    if(m_mode == FIFO){
+        if(!m_workqueue.push(request)){
+            return false;
+        }
+        //入队后，如果有线程在休眠，唤醒一个
+        m_queuestat.notify_one();//保证队列非空
+        return true;
+    }
+
+    //WORK_STEALING：按key选择工作线程，投递到它的收件箱
+    //先按最多的线程数取模，落在退休槽位上时再按当前线程数取模：线程数变化时，仍在运行的线程上的连接不换线程，只有退休槽位的key被重新分配
+    int active = m_active.load(std::memory_order_seq_cst);
+    unsigned index = key >= 0 ? (unsigned)key : m_next.fetch_add(1,std::memory_order_relaxed);
+    unsigned slot = index % m_max_threads;
+    if(slot >= (unsigned)active){
+        slot %= active;
+    }
+    worker_slot* target = &m_slots[slot];
+    if(!target -> inbox -> push(request)){
         return false;
     }
-    m_workqueue.push_back(request);
-    m_queuelocker.unlock();
-    //解锁后，因为确保队列非空，此时可以执行Ｖ操作，信号量值+1,可以唤醒一个线程
-    m_queuestat.post();//保证队列非空
+    //目标线程可能在选择之后退休了(排空自己的队列之后停放)，这时收件箱中的任务要由其他线程偷走
+    bool orphan = retired(target);
+    if(!orphan && target -> stat.waiting()){
+        target -> stat.notify_one();
+        return true;
+    }
+    //目标线程正忙，如果它积压了任务，叫醒一个空闲线程来偷
+    if(orphan || target -> inbox -> size() > 1){
+        active = m_active.load(std::memory_order_seq_cst);
+        for(int i = 1;i <= active;++i){
+            worker_slot* other = &m_slots[(target -> index + i) % active];
+            if(other != target && other -> stat.waiting()){
+                other -> stat.notify_one();
+                break;
+            }
+        }
+    }
     return true;
 }
 
 template<typename T>
-void* threadpool<T> :: worker(void* arg){//传入的是this
-    threadpool* pool = (threadpool*)arg;//将void×指针转化为threadpool*指针
-    //转换为threadpool指针后，运行run函数
-    pool -> run();//就是下面实现的run函数
+size_t threadpool<T>::pending() const{
+    if(m_mode == FIFO){
+        return m_workqueue.size();
+    }
+    size_t total = 0;
+    for(int i = 0;i < m_max_threads;++i){
+        total += m_slots[i].inbox -> size() + m_slots[i].deque -> size();
+    }
+    return total;
+}
+
+template<typename T>
+void* threadpool<T> :: worker(void* arg){//传入的是该线程的worker_slot
+    worker_slot* slot = (worker_slot*)arg;
+    threadpool* pool = slot -> pool;//取出线程池指针
+    //运行run函数，退休时返回，停放到重新启用
+    do{
+        if(pool -> m_mode == WORK_STEALING){
+            pool -> run_stealing(slot);
+        }
+        else{
+            pool -> run(slot);//就是下面实现的run函数
+        }
+    }while(pool -> park(slot));
     return pool;
 }
 
+template<typename T>
+bool threadpool<T>::park(worker_slot* self){
+    //停放期间不处理请求，线程缓存的读缓冲区分段还给全局仓库，给其他线程用
+    bufpool::flush_cache();
+    while(!m_stop && retired(self)){
+        //和run中一样先登记再检查，grow/析构函数改完状态后notify_all，不会错过
+        int key = self -> park.prepare_wait();
+        if(m_stop || !retired(self)){
+            self -> park.cancel_wait();
+            break;
+        }
+        self -> park.wait(key);
+    }
+    return !m_stop;
+}
+
+//执行任务的函数，也就是process
+//T是任务对象，在本项目中就是http_conn对象
+template<typename T>
+void threadpool<T>::execute(worker_slot* self,T* request){
+    uint64_t wait = stats_now_ns() - request -> enqueue_ns();
+    //只有本线程写，普通的读-加-写
+    self -> wait_ns.store(self -> wait_ns.load(std::memory_order_relaxed) + wait,std::memory_order_relaxed);
+    self -> done.store(self -> done.load(std::memory_order_relaxed) + 1,std::memory_order_relaxed);
+    request -> process();//任务中要有process处理函数
+}
+
 //线程实际运行的函数
 template<typename T>
-void threadpool<T>::run(){//消费者
-    //该线程未终止，执行P操作，刚创建线程一定是阻塞之，使得线程睡眠在工作队列中
-    while(!m_stop){
-        m_queuestat.wait();//执行p操作
-        //sleep(5);
-        //唤醒后，从工作队列取元素，要先加锁
-        //操作等待队列(取元素，或添加元素)均一定要先加锁
-        m_queuelocker.lock();//对工作队列操作钱加锁
-        if(m_workqueue.empty()){
-            m_queuelocker.unlock();
+void threadpool<T>::run(worker_slot* self){//消费者
+    T* request = NULL;
+    while(!m_stop && !retired(self)){
+        //先直接出队，队列非空时不进入内核
+        if(!m_workqueue.pop(request)){
+            //队列空：登记为等待者后再检查一次，确实为空才在futex上休眠，避免和append之间丢失唤醒
+            //退休和结束也在登记之后检查，管理线程/析构函数改完状态后notify_all，不会错过
+            int key = m_queuestat.prepare_wait();
+            if(m_workqueue.pop(request)){
+                m_queuestat.cancel_wait();
+            }
+            else{
+                if(!m_stop && !retired(self)){
+                    m_queuestat.wait(key);
+                }
+                else{
+                    m_queuestat.cancel_wait();
+                }
+                continue;
+            }
+        }
+        if(!request){
             continue;
         }
-        //取出来元素，再解锁
-        //T是任务对象，在本项目中就是http_conn对象
-        T* request = m_workqueue.front();
-        m_workqueue.pop_front();
-        m_queuelocker.unlock();
+        execute(self,request);
+    }
+}
+
+template<typename T>
+bool threadpool<T>::next_stealing(worker_slot* self,T*& request){
+    //把收件箱中的任务搬到自己的双端队列，搬不下的留在收件箱
+    T* item = NULL;
+    while(self -> inbox -> pop(item)){
+        if(!self -> deque -> push(item)){
+            request = item;
+            return true;
+        }
+    }
+    if(self -> deque -> pop(request)){
+        return true;
+    }
+    //自己没有任务了，从下一个线程开始依次偷：先偷双端队列顶部，再直接取对方收件箱中还没搬走的任务
+    //退休线程的槽位也要看，退休之后才投递进去的任务留在那里
+    for(int i = 1;i < m_max_threads;++i){
+        worker_slot* victim = &m_slots[(self -> index + i) % m_max_threads];
+        if(victim -> deque -> steal(request) || victim -> inbox -> pop(request)){
+            return true;
+        }
+    }
+    return false;
+}
+
+template<typename T>
+void threadpool<T>::run_stealing(worker_slot* self){
+    T* request = NULL;
+    while(!m_stop){
+        if(retired(self)){
+            //排空自己的收件箱和双端队列后停放，不再偷别人的任务
+            while(self -> deque -> pop(request) || self -> inbox -> pop(request)){
+                execute(self,request);
+            }
+            break;
+        }
+        if(!next_stealing(self,request)){
+            //登记为等待者后再找一次，仍然没有任务才休眠
+            int key = self -> stat.prepare_wait();
+            if(next_stealing(self,request)){
+                self -> stat.cancel_wait();
+            }
+            else{
+                if(!m_stop && !retired(self)){
+                    self -> stat.wait(key);
+                }
+                else{
+                    self -> stat.cancel_wait();
+                }
+                continue;
+            }
+        }
         if(!request){
             continue;
         }
-        //执行任务的函数，也就是process
-        request -> process();//任务中要有process处理函数
-    }    
+        execute(self,request);
+    }
+}
+
+//启用下标为当前线程数的槽位；先增加线程数，append马上就可以投递给它
+//槽位上有停放的线程就唤醒它(它也可能还没来得及停放，看到线程数变了直接继续)，没有才创建新线程
+template<typename T>
+bool threadpool<T>::grow(){
+    int index = m_active.load();
+    if(index >= m_max_threads){
+        return false;
+    }
+    m_active.store(index + 1,std::memory_order_seq_cst);
+    if(m_slots[index].started){
+        m_slots[index].park.notify_all();
+        return true;
+    }
+    if(pthread_create(&m_threads[index],NULL,worker,&m_slots[index]) != 0){
+        m_active.store(index,std::memory_order_seq_cst);
+        return false;
+    }
+    m_slots[index].started = true;
+    return true;
+}
+
+//退休下标最大的线程：减少线程数后唤醒它，它看到自己的下标越界后(WORK_STEALING模式下先处理完自己队列中的任务)停放
+template<typename T>
+void threadpool<T>::shrink(){
+    int index = m_active.load() - 1;
+    m_active.store(index,std::memory_order_seq_cst);
+    if(m_mode == FIFO){
+        m_queuestat.notify_all();
+    }
+    else{
+        m_slots[index].stat.notify_all();
+    }
+}
+
+template<typename T>
+int threadpool<T>::sleeping(){
+    if(m_mode == FIFO){
+        return m_queuestat.waiters();
+    }
+    int total = 0;
+    int active = m_active.load();
+    for(int i = 0;i < active;++i){
+        total += m_slots[i].stat.waiters();
+    }
+    return total;
+}
+
+template<typename T>
+void* threadpool<T>::manager(void* arg){
+    threadpool* pool = (threadpool*)arg;
+    pool -> m_manager_locker.lock();
+    while(!pool -> m_stop){
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME,&deadline);
+        deadline.tv_nsec += POOL_TICK_MS * 1000000;
+        if(deadline.tv_nsec >= 1000000000){
+            deadline.tv_sec += 1;
+            deadline.tv_nsec -= 1000000000;
+        }
+        pool -> m_manager_cond.timewait(pool -> m_manager_locker.get(),deadline);
+        if(pool -> m_stop){
+            break;
+        }
+        pool -> m_manager_locker.unlock();
+        pool -> adjust();
+        pool -> m_manager_locker.lock();
+    }
+    pool -> m_manager_locker.unlock();
+    return NULL;
+}
+
+//一次采样：这段时间内的平均排队时间和当前排队的任务数，连续满足条件才调整
+template<typename T>
+void threadpool<T>::adjust(){
+    uint64_t wait_ns = 0;
+    uint64_t done = 0;
+    for(int i = 0;i < m_max_threads;++i){
+        wait_ns += m_slots[i].wait_ns.load(std::memory_order_relaxed);
+        done += m_slots[i].done.load(std::memory_order_relaxed);
+    }
+    uint64_t avg = done > m_last_done ? (wait_ns - m_last_wait_ns) / (done - m_last_done) : 0;
+    m_last_wait_ns = wait_ns;
+    m_last_done = done;
+    size_t depth = pending();
+    int active = m_active.load();
+
+    bool hot = depth > (size_t)active || avg > POOL_GROW_WAIT_NS;
+    bool cold = depth == 0 && avg < POOL_SHRINK_WAIT_NS && sleeping() > 0;
+    m_hot_ticks = hot ? m_hot_ticks + 1 : 0;
+    m_cold_ticks = cold ? m_cold_ticks + 1 : 0;
+    if(m_hot_ticks >= POOL_GROW_TICKS && active < m_max_threads){
+        m_hot_ticks = 0;
+        if(grow()){
+            stats_add(STAT_POOL_GROWS,1);
+            LOG_INFO("threadpool grew to %d threads (queue %lu, wait %lu us)",active + 1,(unsigned long)depth,(unsigned long)(avg / 1000));
+        }
+    }
+    else if(m_cold_ticks >= POOL_SHRINK_TICKS && active > m_thread_number){
+        m_cold_ticks = 0;
+        shrink();
+        stats_add(STAT_POOL_SHRINKS,1);
+        LOG_INFO("threadpool shrank to %d threads",active - 1);
+    }
 }
 
-#endif
\ No newline at end of file
+#endif
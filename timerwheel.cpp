@@ -0,0 +1,163 @@
+#include<time.h>
+#include"timerwheel.h"
+
+//链表头是循环链表的哨兵，空链表时指向自己
+static void list_init(timer_node* head){
+    head -> prev = head -> next = head;
+}
+
+static bool list_empty(const timer_node* head){
+    return head -> next == head;
+}
+
+timerwheel::timerwheel():
+    m_current(now_tick()),m_count(0)
+{
+    for(int i = 0;i < TVR_SIZE;++i){
+        list_init(&m_tv1[i]);
+    }
+    for(int l = 0;l < LEVELS;++l){
+        for(int i = 0;i < TVN_SIZE;++i){
+            list_init(&m_tvn[l][i]);
+        }
+    }
+}
+
+//单调时钟，粗粒度版本只读vdso中的值，开销很小
+unsigned long timerwheel::now_tick(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE,&ts);
+    return ((unsigned long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000) / TICK_MS;
+}
+
+void timerwheel::list_add_tail(timer_node* head,timer_node* node){
+    node -> next = head;
+    node -> prev = head -> prev;
+    head -> prev -> next = node;
+    head -> prev = node;
+}
+
+//根据到期时间离当前的距离选择层和槽
+void timerwheel::internal_add(timer_node* node){
+    unsigned long expires = node -> expires;
+    unsigned long idx = expires - m_current;
+    timer_node* head;
+    if((long)idx < 0){
+        //已经过期的定时器放到当前槽，下一次expire就会执行
+        head = &m_tv1[m_current & TVR_MASK];
+    }
+    else if(idx < (1UL << TVR_BITS)){
+        head = &m_tv1[expires & TVR_MASK];
+    }
+    else{
+        int level = 0;
+        while(level < LEVELS - 1 && idx >= (1UL << (TVR_BITS + (level + 1) * TVN_BITS))){
+            ++level;
+        }
+        //超出最上层范围的，截断为最上层能表示的最长时间
+        unsigned long max = (1UL << (TVR_BITS + LEVELS * TVN_BITS)) - 1;
+        if(idx > max){
+            expires = m_current + max;
+            node -> expires = expires;
+        }
+        head = &m_tvn[level][(expires >> (TVR_BITS + level * TVN_BITS)) & TVN_MASK];
+    }
+    list_add_tail(head,node);
+}
+
+void timerwheel::add(timer_node* node,int timeout_ms){
+    if(pending(node)){
+        del(node);
+    }
+    //向上取整，保证不会提前到期
+    node -> expires = now_tick() + (timeout_ms + TICK_MS - 1) / TICK_MS;
+    internal_add(node);
+    m_count++;
+}
+
+void timerwheel::del(timer_node* node){
+    if(!pending(node)){
+        return;
+    }
+    node -> prev -> next = node -> next;
+    node -> next -> prev = node -> prev;
+    node -> prev = node -> next = NULL;
+    m_count--;
+}
+
+//把head上的整条链表移到list上，head变为空
+static void list_splice_init(timer_node* head,timer_node* list){
+    list_init(list);
+    if(!list_empty(head)){
+        list -> next = head -> next;
+        list -> prev = head -> prev;
+        list -> next -> prev = list;
+        list -> prev -> next = list;
+        list_init(head);
+    }
+}
+
+int timerwheel::cascade(int level,int index){
+    //先整体摘下来，再逐个重新散列
+    timer_node list;
+    list_splice_init(&m_tvn[level][index],&list);
+    while(!list_empty(&list)){
+        timer_node* node = list.next;
+        list.next = node -> next;
+        node -> next -> prev = &list;
+        internal_add(node);
+    }
+    return index;
+}
+
+void timerwheel::expire(){
+    if(m_count == 0){
+        //没有定时器时直接把时间轮拨到当前时间
+        m_current = now_tick();
+        return;
+    }
+    unsigned long now = now_tick();
+    timer_node list;
+    while(m_current <= now){
+        int index = m_current & TVR_MASK;
+        //第0层转完一圈，从上层拿下一批定时器
+        if(index == 0){
+            int level = 0;
+            while(level < LEVELS &&
+                  cascade(level,(m_current >> (TVR_BITS + level * TVN_BITS)) & TVN_MASK) == 0){
+                ++level;
+            }
+        }
+        //先把这个槽的链表整体摘下来，回调中重新add的定时器即使散列到同一个槽也不会在这一轮被执行
+        list_splice_init(&m_tv1[index],&list);
+        m_current++;
+        while(!list_empty(&list)){
+            timer_node* node = list.next;
+            del(node);
+            //回调中可以重新add这个节点，也可以删除别的节点
+            node -> callback(node);
+        }
+    }
+}
+
+int timerwheel::next_timeout(){
+    if(m_count == 0){
+        return -1;
+    }
+    unsigned long now = now_tick();
+    if(m_current <= now){
+        return 0;
+    }
+    //在第0层中从当前位置向后找第一个非空的槽
+    for(int i = 0;i < TVR_SIZE;++i){
+        unsigned long tick = m_current + i;
+        if((tick & TVR_MASK) == 0){
+            //到了需要cascade的位置，在这里醒来一次
+            return (tick - now) * TICK_MS;
+        }
+        if(!list_empty(&m_tv1[tick & TVR_MASK])){
+            return (tick - now) * TICK_MS;
+        }
+    }
+    return TVR_SIZE * TICK_MS;
+}
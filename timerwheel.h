@@ -0,0 +1,56 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+//分层时间轮定时器(和Linux内核早期的timer wheel一样的结构)
+//第0层256个槽，每个槽一个tick；第1~3层各64个槽，每个槽覆盖下一层转一圈的时间
+//添加/删除定时器都是O(1)的双向链表操作，定时器节点嵌在使用者的对象中，不做任何堆分配
+//第0层转完一圈时，把上一层对应槽里的定时器重新散列到下层(cascade)
+//时间轮不加锁，只能由一个线程(所属的反应堆)使用
+struct timer_node{
+    timer_node* prev;    //prev为NULL表示没有挂在时间轮上
+    timer_node* next;
+    unsigned long expires;             //到期的tick
+    void (*callback)(timer_node* node);//到期回调，回调前节点已经从时间轮上摘下
+    void* data;                        //使用者的数据
+};
+
+class timerwheel{
+public:
+    static const int TICK_MS = 100;   //一个tick的毫秒数
+
+public:
+    timerwheel();
+    ~timerwheel(){}
+    //(重新)设置定时器，timeout_ms毫秒后到期；节点已经在时间轮上时先摘下再挂到新位置
+    void add(timer_node* node,int timeout_ms);
+    //删除定时器，节点不在时间轮上时什么也不做
+    void del(timer_node* node);
+    //距离下一个定时器到期还有多少毫秒，作为epoll_wait的超时时间；没有定时器返回-1
+    int next_timeout();
+    //推进到当前时间，执行所有到期的定时器
+    void expire();
+    static bool pending(const timer_node* node){return node -> prev != NULL;}
+
+private:
+    static const int TVR_BITS = 8;
+    static const int TVN_BITS = 6;
+    static const int TVR_SIZE = 1 << TVR_BITS;
+    static const int TVN_SIZE = 1 << TVN_BITS;
+    static const int TVR_MASK = TVR_SIZE - 1;
+    static const int TVN_MASK = TVN_SIZE - 1;
+    static const int LEVELS = 3;      //第0层之外的层数
+
+    static unsigned long now_tick();
+    void internal_add(timer_node* node);
+    //把第level层index槽的定时器重新散列，返回index，为0表示这一层也转完了一圈
+    int cascade(int level,int index);
+    static void list_add_tail(timer_node* head,timer_node* node);
+
+private:
+    unsigned long m_current;          //时间轮当前指向的tick
+    int m_count;                      //时间轮上定时器的个数
+    timer_node m_tv1[TVR_SIZE];       //第0层，链表头(哨兵)
+    timer_node m_tvn[LEVELS][TVN_SIZE];
+};
+
+#endif
@@ -0,0 +1,785 @@
+#include<sys/socket.h>
+#include<sys/mman.h>
+#include<sys/syscall.h>
+#include<sys/eventfd.h>
+#include<netinet/in.h>
+#include<poll.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<unistd.h>
+#include<errno.h>
+#include<string.h>
+#include<sched.h>
+#include<fcntl.h>
+
+#include"./uring_reactor.h"
+
+//io_uring的三个系统调用，glibc没有封装
+static int sys_io_uring_setup(unsigned entries,io_uring_params* p){
+    return (int)syscall(__NR_io_uring_setup,entries,p);
+}
+
+static int sys_io_uring_enter(int fd,unsigned to_submit,unsigned min_complete,unsigned flags,void* arg,size_t argsz){
+    return (int)syscall(__NR_io_uring_enter,fd,to_submit,min_complete,flags,arg,argsz);
+}
+
+static int sys_io_uring_register(int fd,unsigned opcode,void* arg,unsigned nr_args){
+    return (int)syscall(__NR_io_uring_register,fd,opcode,arg,nr_args);
+}
+
+uring_reactor::uring_reactor():
+    m_listenfd(-1),m_ringfd(-1),m_wakefd(-1),m_wake_value(0),m_users(NULL),m_pool(NULL),m_fds(NULL),
+    m_sq_ptr(MAP_FAILED),m_sq_size(0),m_sqes((io_uring_sqe*)MAP_FAILED),m_sqes_size(0),m_sqe_tail(0),
+    m_cq_ptr(MAP_FAILED),m_cq_size(0),m_bufs(NULL),m_buf_ring((io_uring_buf*)MAP_FAILED),m_buf_ring_size(0),m_buf_tail(0),m_bufs_free(0),
+    m_ready(MAX_FD),m_sleeping(false)
+{
+}
+
+uring_reactor::~uring_reactor(){
+    for(size_t i = 0;i < m_pipes.size();++i){
+        close((int)(m_pipes[i] >> 32));
+        close((int)(uint32_t)m_pipes[i]);
+    }
+    if(m_buf_ring != MAP_FAILED){
+        munmap(m_buf_ring,m_buf_ring_size);
+    }
+    free(m_bufs);
+    if(m_sqes != MAP_FAILED){
+        munmap(m_sqes,m_sqes_size);
+    }
+    if(m_cq_ptr != MAP_FAILED && m_cq_ptr != m_sq_ptr){
+        munmap(m_cq_ptr,m_cq_size);
+    }
+    if(m_sq_ptr != MAP_FAILED){
+        munmap(m_sq_ptr,m_sq_size);
+    }
+    if(m_ringfd != -1){
+        close(m_ringfd);
+    }
+    if(m_wakefd != -1){
+        close(m_wakefd);
+    }
+    if(m_listenfd != -1){
+        close(m_listenfd);
+    }
+    delete [] m_fds;
+}
+
+bool uring_reactor::init(const char* ip,int port,http_conn* users,threadpool<http_conn>* pool){
+    m_users = users;
+    m_pool = pool;
+    m_fds = new fd_state[MAX_FD];
+    memset(m_fds,0,sizeof(fd_state) * MAX_FD);
+    m_listenfd = reactor::open_listener(ip,port);
+    if(m_listenfd < 0){
+        return false;
+    }
+    m_wakefd = eventfd(0,EFD_NONBLOCK | EFD_CLOEXEC);
+    if(m_wakefd < 0){
+        return false;
+    }
+    return setup_ring() && setup_buffers();
+}
+
+//创建io_uring实例并映射提交队列、SQE数组和完成队列
+//SINGLE_ISSUER|DEFER_TASKRUN：只有反应堆线程提交，完成事件的处理推迟到它调用io_uring_enter时进行，减少中断和唤醒
+//实例在主线程中创建，先以R_DISABLED创建，由反应堆线程在run中启用，这样提交者就是反应堆线程；内核不支持这些标志时退回普通模式
+bool uring_reactor::setup_ring(){
+    io_uring_params p;
+    memset(&p,0,sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN | IORING_SETUP_R_DISABLED;
+    p.cq_entries = CQ_ENTRIES;
+    m_ringfd = sys_io_uring_setup(SQ_ENTRIES,&p);
+    if(m_ringfd < 0){
+        memset(&p,0,sizeof(p));
+        p.flags = IORING_SETUP_CQSIZE;
+        p.cq_entries = CQ_ENTRIES;
+        m_ringfd = sys_io_uring_setup(SQ_ENTRIES,&p);
+    }
+    if(m_ringfd < 0){
+        return false;
+    }
+    //带超时的等待需要EXT_ARG
+    if(!(p.features & IORING_FEAT_EXT_ARG)){
+        errno = ENOSYS;
+        return false;
+    }
+
+    m_sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    m_cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = p.features & IORING_FEAT_SINGLE_MMAP;
+    if(single_mmap && m_cq_size > m_sq_size){
+        m_sq_size = m_cq_size;
+    }
+    m_sq_ptr = mmap(NULL,m_sq_size,PROT_READ | PROT_WRITE,MAP_SHARED | MAP_POPULATE,m_ringfd,IORING_OFF_SQ_RING);
+    if(m_sq_ptr == MAP_FAILED){
+        return false;
+    }
+    if(single_mmap){
+        m_cq_ptr = m_sq_ptr;
+    }
+    else{
+        m_cq_ptr = mmap(NULL,m_cq_size,PROT_READ | PROT_WRITE,MAP_SHARED | MAP_POPULATE,m_ringfd,IORING_OFF_CQ_RING);
+        if(m_cq_ptr == MAP_FAILED){
+            return false;
+        }
+    }
+    char* sq = (char*)m_sq_ptr;
+    m_sq_khead = (unsigned*)(sq + p.sq_off.head);
+    m_sq_ktail = (unsigned*)(sq + p.sq_off.tail);
+    m_sq_mask = *(unsigned*)(sq + p.sq_off.ring_mask);
+    m_sq_entries = *(unsigned*)(sq + p.sq_off.ring_entries);
+    //提交队列是SQE下标的数组，这里固定让第i项指向第i个SQE，之后只需要移动tail
+    unsigned* array = (unsigned*)(sq + p.sq_off.array);
+    for(unsigned i = 0;i < m_sq_entries;++i){
+        array[i] = i;
+    }
+    m_sqe_tail = *m_sq_ktail;
+
+    m_sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+    m_sqes = (io_uring_sqe*)mmap(NULL,m_sqes_size,PROT_READ | PROT_WRITE,MAP_SHARED | MAP_POPULATE,m_ringfd,IORING_OFF_SQES);
+    if(m_sqes == MAP_FAILED){
+        return false;
+    }
+
+    char* cq = (char*)m_cq_ptr;
+    m_cq_khead = (unsigned*)(cq + p.cq_off.head);
+    m_cq_ktail = (unsigned*)(cq + p.cq_off.tail);
+    m_cq_mask = *(unsigned*)(cq + p.cq_off.ring_mask);
+    m_cqes = (io_uring_cqe*)(cq + p.cq_off.cqes);
+    return true;
+}
+
+//注册缓冲区环作为缓冲区组0：多发recv从环中取缓冲区，完成事件带回缓冲区的编号，用完后由反应堆放回环中
+//环是和内核共享的一块内存，io_uring_buf数组加一个tail，内核从head往后取，反应堆往tail后面放，放完后store-release发布tail
+//tail和bufs[0].resv是同一个位置，写环中的项只能写addr/len/bid，不能整项赋值，否则写第0项时会把tail清零
+//不用io_uring_buf_ring的bufs成员：头文件用__DECLARE_FLEX_ARRAY声明它，C++中其中的空结构体占1字节，bufs的偏移成了8而不是0，
+//写进去的项整体错开8字节，内核读到的addr/len都不对，recv全部返回ENOBUFS；这里把环直接当作io_uring_buf数组访问
+bool uring_reactor::setup_buffers(){
+    m_bufs = (char*)malloc((size_t)BUF_COUNT * BUF_SIZE);
+    if(!m_bufs){
+        return false;
+    }
+    m_buf_ring_size = BUF_COUNT * sizeof(io_uring_buf);
+    m_buf_ring = (io_uring_buf*)mmap(NULL,m_buf_ring_size,PROT_READ | PROT_WRITE,MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE,-1,0);
+    if(m_buf_ring == MAP_FAILED){
+        return false;
+    }
+    io_uring_buf_reg reg;
+    memset(&reg,0,sizeof(reg));
+    reg.ring_addr = (unsigned long)m_buf_ring;
+    reg.ring_entries = BUF_COUNT;
+    reg.bgid = 0;
+    if(sys_io_uring_register(m_ringfd,IORING_REGISTER_PBUF_RING,&reg,1) < 0){
+        return false;
+    }
+    for(unsigned i = 0;i < BUF_COUNT;++i){
+        m_meta[i].next = -1;
+        return_buf(i);
+    }
+    __atomic_store_n(&m_buf_ring[0].resv,m_buf_tail,__ATOMIC_RELEASE);
+    return true;
+}
+
+//缓冲区放到环的tail处，随下一次submit发布，不需要SQE也不额外进行系统调用
+void uring_reactor::return_buf(unsigned short bid){
+    io_uring_buf* buf = &m_buf_ring[m_buf_tail & (BUF_COUNT - 1)];
+    buf -> addr = (unsigned long)buf_addr(bid);
+    buf -> len = BUF_SIZE;
+    buf -> bid = bid;
+    ++m_buf_tail;
+    ++m_bufs_free;
+}
+
+//取一个空闲的SQE，提交队列满时先提交一次
+io_uring_sqe* uring_reactor::get_sqe(){
+    unsigned head = __atomic_load_n(m_sq_khead,__ATOMIC_ACQUIRE);
+    if(m_sqe_tail - head >= m_sq_entries){
+        submit(false,0);
+        head = __atomic_load_n(m_sq_khead,__ATOMIC_ACQUIRE);
+        if(m_sqe_tail - head >= m_sq_entries){
+            LOG_ERROR("io_uring submission queue full");
+            return NULL;
+        }
+    }
+    io_uring_sqe* sqe = &m_sqes[m_sqe_tail & m_sq_mask];
+    ++m_sqe_tail;
+    memset(sqe,0,sizeof(*sqe));
+    return sqe;
+}
+
+int uring_reactor::submit(bool wait,int timeout_ms){
+    //归还的缓冲区先发布，这一批SQE中的recv就能用到
+    __atomic_store_n(&m_buf_ring[0].resv,m_buf_tail,__ATOMIC_RELEASE);
+    __atomic_store_n(m_sq_ktail,m_sqe_tail,__ATOMIC_RELEASE);
+    unsigned to_submit = m_sqe_tail - __atomic_load_n(m_sq_khead,__ATOMIC_ACQUIRE);
+    //DEFER_TASKRUN模式下完成事件只在带GETEVENTS的io_uring_enter中产生，不等待时也带上
+    unsigned flags = IORING_ENTER_GETEVENTS;
+    io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    void* argp = NULL;
+    size_t argsz = 0;
+    if(wait && timeout_ms >= 0){
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+        memset(&arg,0,sizeof(arg));
+        arg.ts = (unsigned long)&ts;
+        flags |= IORING_ENTER_EXT_ARG;
+        argp = &arg;
+        argsz = sizeof(arg);
+    }
+    return sys_io_uring_enter(m_ringfd,to_submit,wait ? 1 : 0,flags,argp,argsz);
+}
+
+//多发accept，一次提交，每个新连接一个完成事件
+void uring_reactor::arm_accept(){
+    io_uring_sqe* sqe = get_sqe();
+    if(!sqe){
+        return;
+    }
+    sqe -> opcode = IORING_OP_ACCEPT;
+    sqe -> fd = m_listenfd;
+    sqe -> ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe -> accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;   //和accept4一样直接得到非阻塞的socket
+    sqe -> user_data = pack(OP_ACCEPT,0,m_listenfd);
+}
+
+//多发recv，数据放进缓冲区组0中的缓冲区
+void uring_reactor::arm_recv(int fd){
+    io_uring_sqe* sqe = get_sqe();
+    if(!sqe){
+        return;
+    }
+    sqe -> opcode = IORING_OP_RECV;
+    sqe -> fd = fd;
+    sqe -> ioprio = IORING_RECV_MULTISHOT;
+    sqe -> flags = IOSQE_BUFFER_SELECT;
+    sqe -> buf_group = 0;
+    sqe -> user_data = pack(OP_RECV,m_fds[fd].gen,fd);
+    m_fds[fd].recv_armed = true;
+    m_fds[fd].canceling = false;
+}
+
+//一次性的POLLOUT，等待发送缓冲区有空间
+void uring_reactor::arm_pollout(int fd){
+    io_uring_sqe* sqe = get_sqe();
+    if(!sqe){
+        return;
+    }
+    sqe -> opcode = IORING_OP_POLL_ADD;
+    sqe -> fd = fd;
+    sqe -> poll32_events = POLLOUT;
+    sqe -> user_data = pack(OP_POLLOUT,m_fds[fd].gen,fd);
+}
+
+//读eventfd，工作线程写它时唤醒在io_uring_enter中等待的反应堆
+void uring_reactor::arm_wake(){
+    io_uring_sqe* sqe = get_sqe();
+    if(!sqe){
+        return;
+    }
+    sqe -> opcode = IORING_OP_READ;
+    sqe -> fd = m_wakefd;
+    sqe -> addr = (unsigned long)&m_wake_value;
+    sqe -> len = sizeof(m_wake_value);
+    sqe -> user_data = pack(OP_WAKE,0,m_wakefd);
+}
+
+bool uring_reactor::start(){
+    if(pthread_create(&m_thread,NULL,worker,this) != 0){
+        return false;
+    }
+    return pthread_detach(m_thread) == 0;
+}
+
+void* uring_reactor::worker(void* arg){
+    uring_reactor* r = (uring_reactor*)arg;
+    r -> run();
+    return r;
+}
+
+void uring_reactor::rearm(int fd,int ev){
+    if(pthread_equal(pthread_self(),m_thread)){
+        //反应堆线程中：write遇到EAGAIN，等待可写；响应发完则放进就绪队列，本轮循环中处理，不能在write中重入
+        if(ev & EPOLLOUT){
+            arm_pollout(fd);
+            return;
+        }
+        m_ready.push(((uint64_t)m_fds[fd].gen << 32) | ((uint64_t)fd << 1));
+        return;
+    }
+    //工作线程中：连接在处理期间不会被关闭，代数不会变化
+    uint64_t value = ((uint64_t)m_fds[fd].gen << 32) | ((uint64_t)fd << 1) | ((ev & EPOLLOUT) ? 1 : 0);
+    //每个连接最多有一项在队列中，队列的容量是MAX_FD，不会满
+    while(!m_ready.push(value)){
+        sched_yield();
+    }
+    //和run中设置m_sleeping之后检查队列配对，两边都是全屏障，不会丢失唤醒
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(m_sleeping.load(std::memory_order_relaxed)){
+        uint64_t one = 1;
+        if(::write(m_wakefd,&one,sizeof(one)) < 0){
+            LOG_WARN("eventfd write failure, errno is: %d",errno);
+        }
+    }
+}
+
+void uring_reactor::close_fd(int fd){
+    fd_state* st = &m_fds[fd];
+    st -> open = false;
+    ++st -> gen;   //之后到达的旧完成事件都被忽略
+    st -> waiting = false;
+    st -> eof = false;
+    st -> recv_armed = false;
+    while(st -> held_head != -1){
+        int bid = st -> held_head;
+        st -> held_head = m_meta[bid].next;
+        return_buf(bid);
+    }
+    st -> held_tail = -1;
+    st -> held_count = 0;
+    //发送还有SQE没完成，交给最后一个完成事件释放
+    if(st -> send){
+        if(st -> send -> pending > 0){
+            st -> send -> orphan = true;
+        }
+        else{
+            release_send(st -> send);
+        }
+        st -> send = NULL;
+    }
+    //还在进行的多发recv和POLLOUT持有socket的引用，单独close不会结束它们，先shutdown让它们完成
+    shutdown(fd,SHUT_RDWR);
+    close(fd);
+}
+
+void uring_reactor::hold(int fd,unsigned short bid,int len){
+    fd_state* st = &m_fds[fd];
+    m_meta[bid].off = 0;
+    m_meta[bid].len = len;
+    m_meta[bid].next = -1;
+    if(st -> held_tail == -1){
+        st -> held_head = bid;
+    }
+    else{
+        m_meta[st -> held_tail].next = bid;
+    }
+    st -> held_tail = bid;
+    ++st -> held_count;
+}
+
+bool uring_reactor::feed_held(int fd,bool* fed){
+    fd_state* st = &m_fds[fd];
+    while(st -> held_head != -1){
+        int bid = st -> held_head;
+        buf_meta* meta = &m_meta[bid];
+        long n = m_users[fd].feed(buf_addr(bid) + meta -> off,meta -> len);
+        if(n < 0){
+            return false;
+        }
+        *fed = true;
+        meta -> off += n;
+        meta -> len -= n;
+        if(meta -> len > 0){   //读满了当前请求允许的字节数，剩下的等工作线程解析完请求头后再给
+            break;
+        }
+        st -> held_head = meta -> next;
+        if(st -> held_head == -1){
+            st -> held_tail = -1;
+        }
+        --st -> held_count;
+        return_buf(bid);
+    }
+    return true;
+}
+
+void uring_reactor::dispatch(int fd){
+    m_fds[fd].waiting = false;
+    //交给线程池期间定时器到期不关闭连接，由工作线程处理完后解除
+    m_users[fd].mark_busy();
+    if(!m_pool -> append(m_users + fd,fd)){
+        m_users[fd].unmark_busy();
+        m_users[fd].close_conn();   //请求队列满，关闭连接
+    }
+}
+
+void uring_reactor::on_accept(io_uring_cqe* cqe){
+    //多发accept结束了(出错或者资源不足)，重新提交
+    if(!(cqe -> flags & IORING_CQE_F_MORE)){
+        arm_accept();
+    }
+    int connfd = cqe -> res;
+    if(connfd < 0){
+        LOG_WARN("accept failure, errno is: %d",-connfd);
+        return;
+    }
+    stats_add(STAT_ACCEPTS,1);
+    if(connfd >= MAX_FD || http_conn::m_user_count >= MAX_FD){
+        reactor::show_error(connfd,"Internal server busy");
+        return;
+    }
+    //多发accept不返回对端地址，访问日志需要时再取
+    struct sockaddr_in client_address;
+    socklen_t client_addrlength = sizeof(client_address);
+    if(getpeername(connfd,(struct sockaddr*)&client_address,&client_addrlength) < 0){
+        memset(&client_address,0,sizeof(client_address));
+    }
+    fd_state* st = &m_fds[connfd];
+    st -> open = true;
+    st -> waiting = true;
+    st -> eof = false;
+    st -> held_head = st -> held_tail = -1;
+    st -> held_count = 0;
+    st -> send = NULL;
+    m_users[connfd].init(connfd,client_address,-1,&m_timers,this);
+    arm_recv(connfd);
+}
+
+void uring_reactor::on_recv(int fd,io_uring_cqe* cqe){
+    fd_state* st = &m_fds[fd];
+    if(!(cqe -> flags & IORING_CQE_F_MORE)){
+        st -> recv_armed = false;
+        st -> canceling = false;
+    }
+    if(cqe -> res > 0 && (cqe -> flags & IORING_CQE_F_BUFFER)){
+        hold(fd,cqe -> flags >> IORING_CQE_BUFFER_SHIFT,cqe -> res);
+        if(st -> waiting){
+            on_idle(fd);
+        }
+        //连接正在处理而客户端还在发送(流水线太深)，先停止接收，不让一个连接占满缓冲区环
+        else if(st -> held_count >= HELD_CANCEL && st -> recv_armed && !st -> canceling){
+            io_uring_sqe* sqe = get_sqe();
+            if(sqe){
+                sqe -> opcode = IORING_OP_ASYNC_CANCEL;
+                sqe -> addr = pack(OP_RECV,st -> gen,fd);
+                sqe -> user_data = pack(OP_CANCEL,st -> gen,fd);
+                st -> canceling = true;
+            }
+        }
+        return;
+    }
+    if(cqe -> res == -ENOBUFS){   //缓冲区环空了，有缓冲区归还后再提交
+        m_starved.push_back(fd);
+        return;
+    }
+    if(cqe -> res == -ECANCELED){   //暂存太多时主动取消的，连接空闲后再提交
+        return;
+    }
+    //0表示对端关闭，其他是出错；连接正在处理时等它空闲后再关闭
+    LOG_DEBUG("sock_read_close fd %d res %d",fd,cqe -> res);
+    st -> eof = true;
+    if(st -> waiting){
+        on_idle(fd);
+    }
+}
+
+void uring_reactor::on_idle(int fd){
+    fd_state* st = &m_fds[fd];
+    st -> waiting = true;
+    bool fed = false;
+    if(!feed_held(fd,&fed)){
+        m_users[fd].close_conn();
+        return;
+    }
+    if(fed){
+        dispatch(fd);
+        return;
+    }
+    if(st -> eof){
+        m_users[fd].close_conn();
+        return;
+    }
+    if(!st -> recv_armed){
+        if(m_bufs_free > 0){
+            arm_recv(fd);
+        }
+        else{
+            m_starved.push_back(fd);
+        }
+    }
+}
+
+void uring_reactor::on_writable(int fd){
+    if(m_fds[fd].send && m_fds[fd].send -> pending > 0){
+        return;
+    }
+    if(!m_users[fd].write_begin()){
+        m_users[fd].close_conn();
+        return;
+    }
+    send_next(fd);
+}
+
+//一批SQE：开头的内存块一个SENDMSG，后面是文件块时再链接SPLICE文件->管道、SPLICE管道->socket，每批最多搬一个管道的容量
+//SENDMSG带MSG_WAITALL，不全部发出就算失败，链接在它后面的SPLICE被取消，不会把文件数据插到一半的首部后面
+//上一批有数据留在管道中(SPLICE_OUT部分完成或者EAGAIN)，先只把管道中的发完
+void uring_reactor::send_next(int fd){
+    fd_state* st = &m_fds[fd];
+    http_conn* conn = m_users + fd;
+    send_op* op = st -> send;
+    if(!op){
+        op = new send_op;
+        op -> fd = fd;
+        op -> orphan = false;
+        op -> pipe[0] = op -> pipe[1] = -1;
+        op -> in_pipe = 0;
+        memset(&op -> msg,0,sizeof(op -> msg));
+        op -> msg.msg_iov = op -> iov;
+        st -> send = op;
+    }
+    if(op -> in_pipe == 0 && conn -> out_done()){
+        //返回false表示短连接发送完或者出错，关闭连接
+        if(!conn -> write_end()){
+            LOG_DEBUG("sock_write_close fd %d",fd);
+            conn -> close_conn();
+        }
+        //读缓冲区中还有流水线请求没有解析(上一批响应队列满了)，再交给线程池
+        else if(conn -> pending_request()){
+            dispatch(fd);
+        }
+        return;
+    }
+    //一批链接的SQE不能被get_sqe中途的提交拆开
+    if(m_sq_entries - (m_sqe_tail - __atomic_load_n(m_sq_khead,__ATOMIC_ACQUIRE)) < 3){
+        submit(false,0);
+    }
+    op -> pending = 0;
+    op -> used[0] = op -> used[1] = op -> used[2] = false;
+    int file_fd = -1;
+    off_t file_off = 0;
+    size_t len = op -> in_pipe;
+    if(op -> in_pipe == 0){
+        size_t file_len = 0;
+        int n = conn -> out_batch(op -> iov,http_conn::CHUNK_CAPACITY,&file_fd,&file_off,&file_len);
+        if(file_fd != -1){
+            if(op -> pipe[0] == -1){
+                if(!m_pipes.empty()){
+                    op -> pipe[0] = (int)(m_pipes.back() >> 32);
+                    op -> pipe[1] = (int)(uint32_t)m_pipes.back();
+                    m_pipes.pop_back();
+                }
+                else if(pipe2(op -> pipe,O_CLOEXEC) == 0){
+                    fcntl(op -> pipe[1],F_SETPIPE_SZ,PIPE_SIZE);   //失败时用默认容量，SPLICE_IN只搬进能放下的部分
+                }
+                else{
+                    op -> pipe[0] = op -> pipe[1] = -1;
+                    LOG_ERROR("pipe failure, errno is: %d",errno);
+                    conn -> close_conn();
+                    return;
+                }
+            }
+            len = file_len < (size_t)PIPE_SIZE ? file_len : PIPE_SIZE;
+        }
+        if(n > 0){
+            io_uring_sqe* sqe = get_sqe();
+            op -> msg.msg_iovlen = n;
+            sqe -> opcode = IORING_OP_SENDMSG;
+            sqe -> fd = fd;
+            sqe -> addr = (unsigned long)&op -> msg;
+            sqe -> msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+            sqe -> flags = file_fd != -1 ? IOSQE_IO_LINK : 0;
+            sqe -> user_data = pack_send(OP_SEND,op);
+            op -> used[0] = true;
+            ++op -> pending;
+        }
+        if(file_fd != -1){
+            io_uring_sqe* sqe = get_sqe();
+            sqe -> opcode = IORING_OP_SPLICE;
+            sqe -> fd = op -> pipe[1];
+            sqe -> off = (uint64_t)-1;
+            sqe -> splice_fd_in = file_fd;
+            sqe -> splice_off_in = file_off;
+            sqe -> len = len;
+            sqe -> flags = IOSQE_IO_LINK;
+            sqe -> user_data = pack_send(OP_SPLICE_IN,op);
+            op -> used[1] = true;
+            ++op -> pending;
+        }
+    }
+    if(op -> in_pipe > 0 || file_fd != -1){
+        io_uring_sqe* sqe = get_sqe();
+        sqe -> opcode = IORING_OP_SPLICE;
+        sqe -> fd = fd;
+        sqe -> off = (uint64_t)-1;
+        sqe -> splice_fd_in = op -> pipe[0];
+        sqe -> splice_off_in = (uint64_t)-1;
+        sqe -> len = len;
+        sqe -> user_data = pack_send(OP_SPLICE_OUT,op);
+        op -> used[2] = true;
+        ++op -> pending;
+    }
+    //每批都重新计时，对端长时间不读则关闭
+    conn -> write_stalled();
+}
+
+//一批SQE全部完成后按各自的结果推进响应队列：被取消的(前面的失败了)不算，SPLICE_IN读到0说明文件被截短了
+//SPLICE_OUT遇到EAGAIN或者只发出一部分，数据留在管道中，等可写后继续
+void uring_reactor::on_send(int kind,send_op* op,int res){
+    op -> res[kind - OP_SEND] = res;
+    if(--op -> pending > 0){
+        return;
+    }
+    if(op -> orphan){
+        release_send(op);
+        return;
+    }
+    int fd = op -> fd;
+    size_t sent = 0;
+    size_t spliced = 0;
+    size_t out = 0;
+    bool again = false;
+    bool fail = false;
+    if(op -> used[0]){
+        if(op -> res[0] >= 0){
+            sent = op -> res[0];
+        }
+        else{
+            fail = true;
+        }
+    }
+    if(op -> used[1]){
+        if(op -> res[1] > 0){
+            spliced = op -> res[1];
+        }
+        else if(op -> res[1] != -ECANCELED){
+            fail = true;
+        }
+    }
+    if(op -> used[2]){
+        if(op -> res[2] > 0){
+            out = op -> res[2];
+        }
+        else if(op -> res[2] == -EAGAIN){
+            again = true;
+        }
+        else if(op -> res[2] != -ECANCELED){
+            fail = true;
+        }
+    }
+    op -> in_pipe += spliced;
+    op -> in_pipe -= out;
+    stats_add(STAT_BYTES_OUT,sent + out);
+    m_users[fd].out_advance(sent,spliced);
+    if(fail){
+        LOG_DEBUG("sock_write_close fd %d",fd);
+        m_users[fd].close_conn();
+        return;
+    }
+    if(again){
+        arm_pollout(fd);
+        return;
+    }
+    send_next(fd);
+}
+
+//管道中没有剩下数据时放回池中，否则关闭
+void uring_reactor::release_send(send_op* op){
+    if(op -> pipe[0] != -1){
+        if(!op -> orphan && op -> in_pipe == 0 && m_pipes.size() < (size_t)MAX_PIPES){
+            m_pipes.push_back(((uint64_t)op -> pipe[0] << 32) | (uint32_t)op -> pipe[1]);
+        }
+        else{
+            close(op -> pipe[0]);
+            close(op -> pipe[1]);
+        }
+    }
+    delete op;
+}
+
+void uring_reactor::drain_ready(){
+    uint64_t value;
+    while(m_ready.pop(value)){
+        int fd = (int)((value & 0xffffffff) >> 1);
+        uint32_t gen = value >> 32;
+        if(!m_fds[fd].open || m_fds[fd].gen != gen){
+            continue;
+        }
+        if(value & 1){
+            on_writable(fd);
+        }
+        else{
+            on_idle(fd);
+        }
+    }
+}
+
+void uring_reactor::run(){
+    m_thread = pthread_self();
+    //以R_DISABLED创建的实例在这里启用，反应堆线程成为唯一的提交者；不是R_DISABLED创建的会返回错误，忽略
+    sys_io_uring_register(m_ringfd,IORING_REGISTER_ENABLE_RINGS,NULL,0);
+    arm_accept();
+    arm_wake();
+    while(true){
+        drain_ready();
+        //缓冲区用完时停止接收的连接，有缓冲区归还后重新提交recv
+        if(!m_starved.empty() && m_bufs_free > 0){
+            std::vector<int> starved;
+            starved.swap(m_starved);
+            for(size_t i = 0;i < starved.size();++i){
+                fd_state* st = &m_fds[starved[i]];
+                if(st -> open && st -> waiting && !st -> recv_armed){
+                    arm_recv(starved[i]);
+                }
+            }
+        }
+        //就绪队列为空才休眠，最多等到下一个定时器到期
+        m_sleeping.store(true,std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        bool idle = m_ready.size() == 0;
+        int ret = submit(idle,m_timers.next_timeout());
+        m_sleeping.store(false,std::memory_order_relaxed);
+        if(ret < 0 && errno != EINTR && errno != ETIME && errno != EBUSY && errno != EAGAIN){
+            LOG_ERROR("io_uring_enter failure, errno is: %d",errno);
+            break;
+        }
+
+        unsigned head = *m_cq_khead;
+        unsigned tail = __atomic_load_n(m_cq_ktail,__ATOMIC_ACQUIRE);
+        for(;head != tail;++head){
+            io_uring_cqe* cqe = &m_cqes[head & m_cq_mask];
+            int kind = cqe -> user_data >> 56;
+            if(kind >= OP_SEND){
+                on_send(kind,(send_op*)(uintptr_t)(cqe -> user_data & ((1ULL << 56) - 1)),cqe -> res);
+                continue;
+            }
+            uint32_t gen = (cqe -> user_data >> 32) & 0xffffff;
+            int fd = (int)(uint32_t)cqe -> user_data;
+            if(cqe -> flags & IORING_CQE_F_BUFFER){
+                --m_bufs_free;
+            }
+            switch(kind){
+                case OP_ACCEPT:{
+                    on_accept(cqe);
+                    break;
+                }
+                case OP_WAKE:{
+                    arm_wake();
+                    break;
+                }
+                case OP_RECV:{
+                    //已经关闭的连接迟到的数据，只归还缓冲区
+                    if(!m_fds[fd].open || (m_fds[fd].gen & 0xffffff) != gen){
+                        if(cqe -> flags & IORING_CQE_F_BUFFER){
+                            return_buf(cqe -> flags >> IORING_CQE_BUFFER_SHIFT);
+                        }
+                        break;
+                    }
+                    on_recv(fd,cqe);
+                    break;
+                }
+                case OP_POLLOUT:{
+                    if(m_fds[fd].open && (m_fds[fd].gen & 0xffffff) == gen){
+                        on_writable(fd);
+                    }
+                    break;
+                }
+                default:{
+                    break;
+                }
+            }
+        }
+        __atomic_store_n(m_cq_khead,head,__ATOMIC_RELEASE);
+        //处理到期的定时器：超时的连接在这里被关闭
+        m_timers.expire();
+    }
+}
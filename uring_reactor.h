@@ -0,0 +1,164 @@
+#ifndef URING_REACTOR_H
+#define URING_REACTOR_H
+
+#include<pthread.h>
+#include<stdint.h>
+#include<atomic>
+#include<vector>
+#include<linux/io_uring.h>
+#include"threadpool.h"
+#include"http_conn.h"
+#include"timerwheel.h"
+#include"ringqueue.h"
+#include"reactor.h"
+
+//基于io_uring的反应堆，和reactor的用法相同，启动时用-e uring代替epoll反应堆
+//不依赖liburing，直接用io_uring_setup/io_uring_enter/io_uring_register系统调用和共享的提交/完成队列
+//1.监听socket上一个多发(multishot)accept，一次提交持续产生新连接
+//2.每个连接一个多发recv，数据由内核直接放进反应堆注册的缓冲区环(IORING_REGISTER_PBUF_RING)，拷贝进http_conn的分段后立即归还
+//  归还缓冲区只是写共享内存中的环再发布tail，不需要提交SQE
+//3.工作线程处理完后不再调用epoll_ctl，而是把fd放进反应堆的就绪队列，反应堆休眠时才通过eventfd唤醒
+//4.响应队列用SQE异步发送：开头连续的内存块(状态行、首部、mmap的主体)用一个MSG_WAITALL的SENDMSG发出，
+//  后面紧跟的文件块(sendfile发送的大文件)链接一对SPLICE：文件->管道->socket，管道从反应堆的管道池中取
+//一轮io_uring_enter同时完成提交和等待，每个请求的系统调用从epoll_wait+多次recv+多次epoll_ctl+writev减少到只有io_uring_enter
+class uring_reactor{
+public:
+    uring_reactor();
+    ~uring_reactor();
+    //创建监听socket(SO_REUSEPORT)、io_uring实例、缓冲区环和唤醒用的eventfd；内核不支持时返回false
+    bool init(const char* ip,int port,http_conn* users,threadpool<http_conn>* pool);
+    //在新线程中运行事件循环
+    bool start();
+    //事件循环，可以直接在主线程中调用
+    void run();
+
+    //http_conn的回调
+    //连接重新等待事件：EPOLLIN表示响应发完(或请求还不完整)，等待数据；EPOLLOUT表示有响应要发送
+    //工作线程调用时放进就绪队列；反应堆线程中EPOLLOUT是write遇到EAGAIN，提交POLLOUT
+    void rearm(int fd,int ev);
+    //关闭连接的socket，只在反应堆线程中调用
+    void close_fd(int fd);
+
+private:
+    //完成事件的种类，放在user_data的高8位，中间24位是fd的代数，低32位是fd
+    //发送用的三种(OP_SEND开始)低56位是send_op的地址，不带代数和fd
+    enum OP_KIND{OP_ACCEPT = 1,OP_RECV,OP_POLLOUT,OP_WAKE,OP_CANCEL,OP_SEND,OP_SPLICE_IN,OP_SPLICE_OUT};
+    static const unsigned SQ_ENTRIES = 4096;
+    static const unsigned CQ_ENTRIES = 16384;
+    static const unsigned BUF_COUNT = 512;     //缓冲区环中的缓冲区个数，必须是2的幂
+    static const unsigned BUF_SIZE = 8192;
+    static const int HELD_CANCEL = 16;         //连接正在处理时暂存了这么多缓冲区，取消它的recv，空闲后再提交
+    static const int PIPE_SIZE = 256 * 1024;   //splice用的管道的容量，一对SPLICE最多搬这么多字节
+    static const int MAX_PIPES = 64;           //管道池最多保留的空闲管道数
+
+    //一个连接正在进行的异步发送：一次提交的SENDMSG和(或)一对SPLICE，全部完成后一起处理
+    //连接关闭时还有SQE没完成就交给最后一个完成事件释放，SQE引用的msghdr和iovec在那之前一直有效
+    struct send_op{
+        int fd;
+        int pending;           //还没收到完成事件的SQE数
+        bool orphan;           //连接已经关闭
+        int res[3];            //SENDMSG、SPLICE_IN、SPLICE_OUT的结果
+        bool used[3];
+        int pipe[2];           //-1表示还没从池中取管道
+        size_t in_pipe;        //已经进了管道还没发到socket的字节数
+        struct msghdr msg;
+        struct iovec iov[http_conn::CHUNK_CAPACITY];
+    };
+
+    //反应堆为每个fd保存的状态
+    //连接正在处理(在线程池中或者正在发送响应)时收到的数据留在缓冲区中，按收到的顺序串成链表，空闲后再交给http_conn
+    struct fd_state{
+        uint32_t gen;          //代数，关闭时加一，忽略旧连接迟到的完成事件
+        bool open;
+        bool waiting;          //连接空闲，等待请求数据，收到数据就交给线程池
+        bool recv_armed;       //多发recv还在进行
+        bool canceling;        //已经提交了取消recv
+        bool eof;              //对端已经关闭或者出错，连接空闲时关闭
+        int held_head;         //暂存的第一个缓冲区，-1表示没有
+        int held_tail;
+        int held_count;
+        send_op* send;         //异步发送的状态，第一次发送时申请，关闭时释放
+    };
+    //暂存的缓冲区中还没交给http_conn的数据
+    struct buf_meta{
+        int off;
+        int len;
+        int next;
+    };
+
+    static void* worker(void* arg);
+    bool setup_ring();
+    bool setup_buffers();
+    io_uring_sqe* get_sqe();
+    //提交所有准备好的SQE，wait为true时至少等待一个完成事件，最多等timeout_ms毫秒(-1不限)
+    int submit(bool wait,int timeout_ms);
+    static uint64_t pack(int kind,uint32_t gen,int fd){return ((uint64_t)kind << 56) | ((uint64_t)(gen & 0xffffff) << 32) | (uint32_t)fd;}
+    static uint64_t pack_send(int kind,send_op* op){return ((uint64_t)kind << 56) | (uint64_t)(uintptr_t)op;}
+    void arm_accept();
+    void arm_recv(int fd);
+    void arm_pollout(int fd);
+    void arm_wake();
+    void return_buf(unsigned short bid);
+    char* buf_addr(unsigned short bid){return m_bufs + (size_t)bid * BUF_SIZE;}
+
+    void on_accept(io_uring_cqe* cqe);
+    void on_recv(int fd,io_uring_cqe* cqe);
+    //连接空闲：把暂存的数据交给http_conn，有数据就交给线程池
+    void on_idle(int fd);
+    //连接有响应要发送(工作线程处理完或者等到了POLLOUT)
+    void on_writable(int fd);
+    //提交下一批发送；队列发完时结束这一批响应
+    void send_next(int fd);
+    void on_send(int kind,send_op* op,int res);
+    void release_send(send_op* op);
+    //把暂存的数据交给http_conn，返回false表示要关闭连接
+    bool feed_held(int fd,bool* fed);
+    void hold(int fd,unsigned short bid,int len);
+    void dispatch(int fd);
+    void drain_ready();
+
+private:
+    int m_listenfd;
+    int m_ringfd;
+    int m_wakefd;          //eventfd，工作线程往就绪队列放了fd而反应堆在休眠时写它
+    uint64_t m_wake_value;
+    pthread_t m_thread;
+    timerwheel m_timers;
+    http_conn* m_users;
+    threadpool<http_conn>* m_pool;
+    fd_state* m_fds;
+
+    //提交队列
+    void* m_sq_ptr;
+    size_t m_sq_size;
+    unsigned* m_sq_khead;
+    unsigned* m_sq_ktail;
+    unsigned m_sq_mask;
+    unsigned m_sq_entries;
+    io_uring_sqe* m_sqes;
+    size_t m_sqes_size;
+    unsigned m_sqe_tail;   //下一个可用的SQE
+    //完成队列
+    void* m_cq_ptr;
+    size_t m_cq_size;
+    unsigned* m_cq_khead;
+    unsigned* m_cq_ktail;
+    unsigned m_cq_mask;
+    io_uring_cqe* m_cqes;
+
+    //缓冲区环，缓冲区组0
+    char* m_bufs;
+    io_uring_buf* m_buf_ring;    //注册的缓冲区环(io_uring_buf_ring)，tail在第0项的resv处
+    size_t m_buf_ring_size;
+    unsigned short m_buf_tail;   //下一个归还的缓冲区放在环中的位置，submit时发布给内核
+    buf_meta m_meta[BUF_COUNT];
+    int m_bufs_free;       //内核中可用的缓冲区数(近似)
+    std::vector<uint64_t> m_pipes;   //空闲的管道：读端 << 32 | 写端
+    std::vector<int> m_starved;   //因为缓冲区用完(ENOBUFS)停止接收的连接
+
+    //工作线程处理完的连接：代数 << 32 | fd << 1 | 是否是EPOLLOUT
+    ringqueue<uint64_t> m_ready;
+    std::atomic<bool> m_sleeping;
+};
+
+#endif
@@ -0,0 +1,115 @@
+#ifndef WSDEQUE_H
+#define WSDEQUE_H
+
+//Chase-Lev工作窃取双端队列(固定容量，C11内存模型版本，Le等人的实现)
+//只有属主线程在底部push/pop(后进先出，缓存更热)，其他线程从顶部steal(先进先出)
+//属主线程的push/pop在没有竞争时只有普通的读写和一次全屏障，只有和窃取者争最后一个元素时才用CAS
+#include<atomic>
+#include<cstddef>
+#include"ringqueue.h"
+
+template<typename T>
+class wsdeque{
+public:
+    //容量向上取整为2的幂
+    explicit wsdeque(size_t capacity);
+    ~wsdeque();
+    //属主线程调用，队列满返回false
+    bool push(T value);
+    //属主线程调用，从底部取
+    bool pop(T& value);
+    //任意线程调用，从顶部偷，失败(为空或者和别人竞争失败)返回false
+    bool steal(T& value);
+    bool empty() const;
+    //近似的元素个数，任意线程调用，只用于统计
+    size_t size() const;
+
+private:
+    wsdeque(const wsdeque&);
+    wsdeque& operator=(const wsdeque&);
+
+private:
+    alignas(CACHE_LINE_SIZE) std::atomic<long> m_top;      //窃取者修改
+    alignas(CACHE_LINE_SIZE) std::atomic<long> m_bottom;   //属主修改
+    alignas(CACHE_LINE_SIZE) std::atomic<T>* m_buffer;
+    long m_mask;
+};
+
+template<typename T>
+wsdeque<T>::wsdeque(size_t capacity):
+    m_top(0),m_bottom(0),m_buffer(NULL),m_mask(0)
+{
+    size_t size = 2;
+    while(size < capacity){
+        size <<= 1;
+    }
+    m_buffer = new std::atomic<T>[size];
+    m_mask = size - 1;
+}
+
+template<typename T>
+wsdeque<T>::~wsdeque(){
+    delete [] m_buffer;
+}
+
+template<typename T>
+bool wsdeque<T>::push(T value){
+    long b = m_bottom.load(std::memory_order_relaxed);
+    long t = m_top.load(std::memory_order_acquire);
+    if(b - t > m_mask){
+        return false;
+    }
+    m_buffer[b & m_mask].store(value,std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    m_bottom.store(b + 1,std::memory_order_relaxed);
+    return true;
+}
+
+template<typename T>
+bool wsdeque<T>::pop(T& value){
+    long b = m_bottom.load(std::memory_order_relaxed) - 1;
+    m_bottom.store(b,std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    long t = m_top.load(std::memory_order_relaxed);
+    if(t > b){
+        //队列为空，恢复bottom
+        m_bottom.store(b + 1,std::memory_order_relaxed);
+        return false;
+    }
+    value = m_buffer[b & m_mask].load(std::memory_order_relaxed);
+    if(t == b){
+        //只剩最后一个元素，和窃取者用CAS争top
+        bool won = m_top.compare_exchange_strong(t,t + 1,std::memory_order_seq_cst,std::memory_order_relaxed);
+        m_bottom.store(b + 1,std::memory_order_relaxed);
+        return won;
+    }
+    return true;
+}
+
+template<typename T>
+bool wsdeque<T>::steal(T& value){
+    long t = m_top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    long b = m_bottom.load(std::memory_order_acquire);
+    if(t >= b){
+        return false;
+    }
+    value = m_buffer[t & m_mask].load(std::memory_order_relaxed);
+    return m_top.compare_exchange_strong(t,t + 1,std::memory_order_seq_cst,std::memory_order_relaxed);
+}
+
+template<typename T>
+bool wsdeque<T>::empty() const{
+    long t = m_top.load(std::memory_order_relaxed);
+    long b = m_bottom.load(std::memory_order_relaxed);
+    return t >= b;
+}
+
+template<typename T>
+size_t wsdeque<T>::size() const{
+    long t = m_top.load(std::memory_order_relaxed);
+    long b = m_bottom.load(std::memory_order_relaxed);
+    return b > t ? b - t : 0;
+}
+
+#endif